@@ -0,0 +1,175 @@
+// Benchmarks the allocations of loading and saving, which take their scratch buffers from the pooled arena blocks,
+// and the arena itself against mem_alloc for the short lived buffers of an operation
+// Usage: jittey-bench arena [directory [megabytes]], /tmp and 64 MB by default
+// Only the first load or save may allocate a block, the ones after it have to reuse it
+
+#define _POSIX_C_SOURCE 200809L
+#include "bench.h"
+#include "../core/arena.h"
+#include "../core/document.h"
+#include "../core/memory.h"
+#include "../core/save.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// The rounds of every operation, the first one fills the pool
+#define ROUNDS 3
+
+// Prints what an operation took from the heap since 'before', returns the blocks it allocated
+static size_t report_memory(const char* name, const struct mem_stats* before, const struct arena_stats* pool_before, double seconds, size_t bytes) {
+    struct mem_stats after;
+    struct arena_stats pool;
+    mem_get_stats(&after);
+    arena_get_stats(&pool);
+
+    bench_report(name, seconds, bytes);
+    printf("  %-40s %10zu allocations, %zu KB at most, %zu pooled blocks reused\n", "", after.allocations - before->allocations,
+        (after.peak - before->bytes) / 1024, pool.reused - pool_before->reused);
+    return pool.allocated - pool_before->allocated;
+}
+
+// Loads the text a few times, it has LF line breaks, so it goes through the converter
+static int loads(const uint8_t* text, size_t size, struct document** loaded) {
+    const struct format format = { .encoding = ENCODING_UTF8, .linebreak = LINEBREAK_UNIX, .bom = false };
+    int result = 0;
+
+    for (int round = 0; round < ROUNDS; round++) {
+        struct mem_stats before;
+        struct arena_stats pool;
+        mem_reset_peak();
+        mem_get_stats(&before);
+        arena_get_stats(&pool);
+
+        const double start = bench_now();
+        struct document* document = bench_load_document(text, size, format, LINEBREAK_WIN, NULL, 0).snapshot;
+        const double seconds = bench_now() - start;
+
+        char name[64];
+        snprintf(name, sizeof(name), "load %d, LF to CRLF", round + 1);
+        const size_t blocks = report_memory(name, &before, &pool, seconds, size);
+        if (round && blocks) {
+            fprintf(stderr, "  %s allocated %zu arena blocks instead of reusing them\n", name, blocks);
+            result = 1;
+        }
+        if (!document) {
+            fprintf(stderr, "  %s failed\n", name);
+            result = 1;
+        }
+
+        if (round == ROUNDS - 1)
+            *loaded = document;
+        else
+            document_free(document);
+    }
+
+    return result;
+}
+
+// Saves the document a few times, every save has to write the same file
+static int saves(const struct document* document, const char* directory) {
+    const struct format format = { .encoding = ENCODING_UTF8, .linebreak = LINEBREAK_UNIX, .bom = false };
+    char path[512];
+    snprintf(path, sizeof(path), "%s/jittey-bench-arena.txt", directory);
+    int result = 0;
+    size_t first = 0;
+
+    for (int round = 0; round < ROUNDS; round++) {
+        struct mem_stats before;
+        struct arena_stats pool;
+        mem_reset_peak();
+        mem_get_stats(&before);
+        arena_get_stats(&pool);
+
+        const double start = bench_now();
+        const bool saved = save_document(document, path, format);
+        const double seconds = bench_now() - start;
+
+        char name[64];
+        snprintf(name, sizeof(name), "save %d, CRLF to LF", round + 1);
+        const size_t blocks = report_memory(name, &before, &pool, seconds, document_length(document) * sizeof(uint16_t));
+        if (round && blocks) {
+            fprintf(stderr, "  %s allocated %zu arena blocks instead of reusing them\n", name, blocks);
+            result = 1;
+        }
+
+        FILE* f = fopen(path, "rb");
+        size_t size = 0;
+        if (f) {
+            fseek(f, 0, SEEK_END);
+            size = (size_t)ftell(f);
+            fclose(f);
+        }
+        if (!round)
+            first = size;
+        if (!saved || !size || size != first) {
+            fprintf(stderr, "  %s didn't write the same file (%zu bytes instead of %zu)\n", name, size, first);
+            result = 1;
+        }
+    }
+
+    unlink(path);
+    return result;
+}
+
+// The buffers of many small operations: a few of them of different sizes, freed all at once
+static void scratch(bool arena_based, size_t operations) {
+    static const size_t sizes[] = { 64, 4096, 48 * 1024, 256, 16 * 1024 };
+    struct arena arena;
+    arena_init(&arena);
+    uint64_t sum = 0;
+
+    const double start = bench_now();
+    for (size_t i = 0; i < operations; i++) {
+        void* buffers[sizeof(sizes) / sizeof(sizes[0])];
+        for (size_t k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++) {
+            buffers[k] = arena_based ? arena_alloc(&arena, sizes[k]) : mem_alloc(sizes[k]);
+            // Every buffer gets touched, as a real operation would do
+            memset(buffers[k], (int)k, 64);
+            sum += ((uint8_t*)buffers[k])[k];
+        }
+
+        if (arena_based) {
+            arena_reset(&arena);
+        } else {
+            for (size_t k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++)
+                mem_free(buffers[k]);
+        }
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "%zu operations, %s", operations, arena_based ? "arena" : "mem_alloc");
+    bench_report(name, bench_now() - start, 0);
+    // Keeps the compiler from leaving the buffers out
+    if (sum == 1)
+        printf("\n");
+}
+
+int bench_arena(int argc, char** argv) {
+    const char* directory = argc > 0 ? argv[0] : "/tmp";
+    const size_t megabytes = argc > 1 ? strtoull(argv[1], NULL, 10) : 64;
+    const size_t size = megabytes * 1024 * 1024;
+    uint64_t rng = 11;
+    int result = 0;
+
+    uint8_t* text = mem_alloc(size);
+    bench_fill_log((char*)text, size, &rng);
+    printf(" %zu MB of UTF-8 with LF line breaks\n", megabytes);
+
+    struct document* document = NULL;
+    result |= loads(text, size, &document);
+    if (document)
+        result |= saves(document, directory);
+    document_free(document);
+    mem_free(text);
+
+    printf(" scratch buffers of an operation\n");
+    scratch(false, 1000000);
+    scratch(true, 1000000);
+
+    struct arena_stats pool;
+    arena_get_stats(&pool);
+    printf("  %-40s %10zu reused, %zu allocated, %zu pooled\n", "arena blocks", pool.reused, pool.allocated, pool.pooled);
+    return result;
+}
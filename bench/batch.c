@@ -0,0 +1,204 @@
+// Benchmarks converting a directory of many files to UTF-8 with LF line breaks: a serial loop that opens and saves every
+// file the way the editor does, against a batch on one thread, on every processor and on more threads than that,
+// which keeps the processors busy while the threads wait for the disk
+// Usage: jittey-bench batch [directory [files]], /tmp and 2000 files by default
+// The files are made again before every run, every run has to write the same bytes and a second batch over
+// the converted files must find all of them unchanged
+
+#define _POSIX_C_SOURCE 200809L
+#include "bench.h"
+#include "../core/batch.h"
+#include "../core/convert.h"
+#include "../core/detect.h"
+#include "../core/document.h"
+#include "../core/mapping.h"
+#include "../core/memory.h"
+#include "../core/pool.h"
+#include "../core/save.h"
+#include "../core/thread.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static const struct format Target = { ENCODING_UTF8, LINEBREAK_UNIX, false };
+
+// The formats the files are written in, in turn
+static const struct format Formats[] = {
+    { ENCODING_UTF8, LINEBREAK_UNIX, false },
+    { ENCODING_UTF8, LINEBREAK_WIN, false },
+    { ENCODING_UTF8, LINEBREAK_WIN, true },
+    { ENCODING_UTF16, LINEBREAK_WIN, true },
+    { ENCODING_UTF16BE, LINEBREAK_UNIX, true },
+};
+
+#define FORMAT_COUNT (sizeof(Formats) / sizeof(Formats[0]))
+
+static bool write_file(void* ctx, const void* data, size_t size) {
+    return fwrite(data, 1, size, ctx) == size;
+}
+
+static void file_path(char* path, size_t size, const char* directory, size_t index) {
+    snprintf(path, size, "%s/%02zu/file-%05zu.txt", directory, index % 16, index);
+}
+
+// Makes the files, mostly small ones with the odd big one, returns their total size
+static size_t generate(const char* directory, size_t files, const char* text, size_t text_size) {
+    char path[1024];
+    mkdir(directory, 0777);
+    for (size_t i = 0; i < 16; i++) {
+        snprintf(path, sizeof(path), "%s/%02zu", directory, i);
+        mkdir(path, 0777);
+    }
+
+    uint64_t rng = 21;
+    size_t total = 0;
+    for (size_t i = 0; i < files; i++) {
+        const uint64_t r = bench_random(&rng);
+        size_t size = r % 100 == 0 ? text_size : 1024 + (r >> 8) % (64 * 1024);
+        // Whole lines, so that the formats don't cut characters apart
+        while (size > 1 && text[size - 1] != '\n')
+            size--;
+
+        file_path(path, sizeof(path), directory, i);
+        FILE* f = fopen(path, "wb");
+        if (!f) {
+            perror(path);
+            continue;
+        }
+
+        const struct format from = { ENCODING_UTF8, LINEBREAK_UNIX, false };
+        struct converter* converter = mem_alloc(sizeof(*converter));
+        converter_init(converter, from, Formats[i % FORMAT_COUNT], write_file, f);
+        converter_feed(converter, text, size);
+        converter_finish(converter);
+        total += converter_size(converter);
+        mem_free(converter);
+        fclose(f);
+    }
+    return total;
+}
+
+// Converts every file the way opening and saving it in the editor does, one file after the other
+static void serial(const char* directory, size_t files) {
+    char path[1024];
+    for (size_t i = 0; i < files; i++) {
+        file_path(path, sizeof(path), directory, i);
+        struct mapping mapping;
+        if (!mapping_open(&mapping, path))
+            continue;
+
+        const struct detection detection = detect_format(mapping.data, mapping.size, DETECT_SAMPLE);
+        struct document* document = bench_load_document(mapping.data, mapping.size, detection.format, detection.format.linebreak, NULL, 0).snapshot;
+        if (document)
+            save_document(document, path, Target);
+        document_free(document);
+        mapping_close(&mapping);
+    }
+}
+
+// Adds up the sizes of the converted files, so the runs can be compared
+static size_t converted_size(const char* directory, size_t files) {
+    char path[1024];
+    size_t total = 0;
+    for (size_t i = 0; i < files; i++) {
+        struct stat st;
+        file_path(path, sizeof(path), directory, i);
+        if (!stat(path, &st))
+            total += (size_t)st.st_size;
+    }
+    return total;
+}
+
+static int run_batch(const char* name, const char* directory, size_t threads, size_t bytes, size_t expected) {
+    struct pool* pool = pool_create(threads);
+    struct batch* batch = batch_create(Target);
+    int result = 0;
+
+    const double start = bench_now();
+    if (!batch_add(batch, directory)) {
+        perror(directory);
+        result = 1;
+    }
+    const size_t failed = batch_run(batch, pool);
+    bench_report(name, bench_now() - start, bytes);
+
+    size_t converted = 0;
+    for (size_t i = 0; i < batch_count(batch); i++)
+        converted += batch_file(batch, i)->status == BATCH_CONVERTED;
+    if (failed || converted_size(directory, batch_count(batch)) != expected) {
+        fprintf(stderr, "  %s: %zu files failed, %zu bytes instead of %zu\n", name, failed, converted_size(directory, batch_count(batch)), expected);
+        result = 1;
+    }
+    batch_free(batch);
+
+    // Everything is in the format now
+    batch = batch_create(Target);
+    batch_add(batch, directory);
+    const double again = bench_now();
+    batch_run(batch, pool);
+    size_t unchanged = 0;
+    for (size_t i = 0; i < batch_count(batch); i++)
+        unchanged += batch_file(batch, i)->status == BATCH_UNCHANGED;
+    bench_report("  again, nothing to convert", bench_now() - again, bytes);
+    printf("  %-40s %10zu converted, %zu unchanged after\n", "", converted, unchanged);
+    if (unchanged != batch_count(batch)) {
+        fprintf(stderr, "  %s: only %zu of %zu files are unchanged the second time\n", name, unchanged, batch_count(batch));
+        result = 1;
+    }
+
+    batch_free(batch);
+    pool_free(pool);
+    return result;
+}
+
+static void clean_up(const char* directory, size_t files) {
+    char path[1024];
+    for (size_t i = 0; i < files; i++) {
+        file_path(path, sizeof(path), directory, i);
+        unlink(path);
+    }
+    for (size_t i = 0; i < 16; i++) {
+        snprintf(path, sizeof(path), "%s/%02zu", directory, i);
+        rmdir(path);
+    }
+    rmdir(directory);
+}
+
+int bench_batch(int argc, char** argv) {
+    const char* base = argc > 0 ? argv[0] : "/tmp";
+    const size_t files = argc > 1 ? strtoull(argv[1], NULL, 10) : 2000;
+    char directory[512];
+    snprintf(directory, sizeof(directory), "%s/jittey-bench-batch", base);
+    int result = 0;
+
+    // The text the files are cut from, the odd one takes all of it
+    const size_t text_size = 4 * 1024 * 1024;
+    char* text = mem_alloc(text_size);
+    uint64_t rng = 8;
+    bench_fill_log(text, text_size, &rng);
+
+    size_t bytes = generate(directory, files, text, text_size);
+    printf(" %zu files, %.1f MB, %zu threads\n", files, bytes / 1e6, thread_count());
+    serial(directory, files);
+    const size_t expected = converted_size(directory, files);
+
+    bytes = generate(directory, files, text, text_size);
+    double start = bench_now();
+    serial(directory, files);
+    bench_report("serial, open and save", bench_now() - start, bytes);
+
+    generate(directory, files, text, text_size);
+    result |= run_batch("batch, one thread", directory, 1, bytes, expected);
+    generate(directory, files, text, text_size);
+    result |= run_batch("batch, every thread", directory, 0, bytes, expected);
+    generate(directory, files, text, text_size);
+    char name[64];
+    snprintf(name, sizeof(name), "batch, %d threads a processor", BATCH_THREADS);
+    result |= run_batch(name, directory, BATCH_THREADS * thread_count(), bytes, expected);
+
+    clean_up(directory, files);
+    mem_free(text);
+    return result;
+}
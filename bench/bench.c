@@ -0,0 +1,159 @@
+#define _POSIX_C_SOURCE 200809L
+#include "bench.h"
+#include "../core/thread.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Reads a "Name: 123 kB" field from /proc/self/status
+static size_t read_status_field(const char* field) {
+    FILE* f = fopen("/proc/self/status", "r");
+    if (!f)
+        return 0;
+
+    char line[256];
+    size_t value = 0;
+    const size_t field_length = strlen(field);
+    while (fgets(line, sizeof(line), f)) {
+        if (!strncmp(line, field, field_length)) {
+            value = strtoull(line + field_length, NULL, 10) * 1024;
+            break;
+        }
+    }
+
+    fclose(f);
+    return value;
+}
+
+size_t bench_rss(void) {
+    return read_status_field("VmRSS:");
+}
+
+size_t bench_peak_rss(void) {
+    return read_status_field("VmHWM:");
+}
+
+void bench_reset_peak_rss(void) {
+    // Writing 5 to clear_refs resets the peak (since Linux 4.0)
+    FILE* f = fopen("/proc/self/clear_refs", "w");
+    if (f) {
+        fputs("5", f);
+        fclose(f);
+    }
+}
+
+size_t bench_rss_anon(void) {
+    return read_status_field("RssAnon:");
+}
+
+uint64_t bench_random(uint64_t* state) {
+    // splitmix64
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// What bench_load_document waits on, the snapshots before the last one are only freed
+struct waiter {
+    struct mutex* mutex;
+    struct condition* finished;
+    struct loader_progress last;
+    bool done;
+};
+
+static void wait_sink(void* ctx, const struct loader_progress* progress) {
+    struct waiter* waiter = ctx;
+    if (progress->status == LOADER_LOADING) {
+        document_free(progress->snapshot);
+        return;
+    }
+
+    mutex_lock(waiter->mutex);
+    waiter->last = *progress;
+    waiter->done = true;
+    condition_broadcast(waiter->finished);
+    mutex_unlock(waiter->mutex);
+}
+
+struct loader_progress bench_load_document(const void* data, size_t size, struct format from, enum linebreak linebreak,
+    struct document_checkpoint* checkpoints, size_t count) {
+
+    struct waiter waiter = { .mutex = mutex_create(), .finished = condition_create(), .last = { .status = LOADER_CANCELLED } };
+    mutex_lock(waiter.mutex);
+    struct loader* loader = loader_start_indexed(data, size, from, linebreak, checkpoints, count, NULL, NULL, wait_sink, &waiter);
+    while (loader && !waiter.done)
+        condition_wait(waiter.finished, waiter.mutex);
+    mutex_unlock(waiter.mutex);
+    loader_free(loader);
+
+    condition_free(waiter.finished);
+    mutex_free(waiter.mutex);
+    return waiter.last;
+}
+
+void bench_report(const char* name, double seconds, size_t bytes) {
+    if (bytes)
+        printf("  %-40s %10.3f ms %10.1f MB/s\n", name, seconds * 1e3, bytes / seconds / 1e6);
+    else
+        printf("  %-40s %10.3f ms\n", name, seconds * 1e3);
+}
+
+// Fills a buffer with log lines, a few of them with non-ASCII text
+void bench_fill_log(char* text, size_t size, uint64_t* rng) {
+    size_t used = 0;
+    for (size_t line = 0; used < size; line++) {
+        char buffer[256];
+        const int length = snprintf(buffer, sizeof(buffer), line % 50 ?
+            "2021-03-%02u 12:%02u:%02u.%03u [worker-%u] INFO request %llu served in %u ms\n" :
+            "2021-03-%02u 12:%02u:%02u.%03u [worker-%u] WARN requ\xC3\xAAte %llu lente, d\xC3\xA9lai %u ms\n",
+            (unsigned)(line % 28 + 1), (unsigned)(line % 60), (unsigned)(line * 7 % 60), (unsigned)(line % 1000),
+            (unsigned)(bench_random(rng) % 16), (unsigned long long)bench_random(rng) % 1000000, (unsigned)(bench_random(rng) % 500));
+
+        const size_t n = size - used < (size_t)length ? size - used : (size_t)length;
+        memcpy(text + used, buffer, n);
+        used += n;
+    }
+}
+
+int bench_generate_log(const char* path, size_t size) {
+    struct stat st;
+    if (!stat(path, &st) && (size_t)st.st_size == size)
+        return 0;
+
+    FILE* f = fopen(path, "wb");
+    if (!f) {
+        perror(path);
+        return 1;
+    }
+
+    static char block[1 << 20];
+    uint64_t rng = 42;
+    size_t used = 0;
+    for (size_t line = 0; used < sizeof(block) - 256; line++) {
+        used += snprintf(block + used, 256, "2021-03-%02u 12:%02u:%02u.%03u [worker-%u] INFO request %llu served in %u ms\n",
+            (unsigned)(line % 28 + 1), (unsigned)(line % 60), (unsigned)(line * 7 % 60), (unsigned)(line % 1000),
+            (unsigned)(bench_random(&rng) % 16), (unsigned long long)bench_random(&rng) % 1000000, (unsigned)(bench_random(&rng) % 500));
+    }
+
+    for (size_t written = 0; written < size; ) {
+        const size_t chunk = size - written < used ? size - written : used;
+        if (fwrite(block, 1, chunk, f) != chunk) {
+            perror(path);
+            fclose(f);
+            return 1;
+        }
+        written += chunk;
+    }
+
+    fclose(f);
+    return 0;
+}
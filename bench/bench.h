@@ -0,0 +1,64 @@
+#pragma once
+// Shared helpers for the headless benchmarks of the portable core (Linux only)
+
+#include "../core/loader.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Every benchmark gets the arguments following its name on the command line
+typedef int (*benchmark_fn)(int argc, char** argv);
+
+// Returns a monotonic timestamp in seconds
+double bench_now(void);
+
+// Returns the current and the peak resident set size of the process in bytes
+size_t bench_rss(void);
+size_t bench_peak_rss(void);
+// Makes the peak resident set size start over from the current one
+void bench_reset_peak_rss(void);
+// Returns only the anonymous part of the resident set, i.e. without the pages of mapped files
+size_t bench_rss_anon(void);
+
+// A small deterministic random generator, so that every run works with the same data
+uint64_t bench_random(uint64_t* state);
+
+// Writes a log-like UTF-8 file of the specified size, unless it already exists, returns nonzero on failure
+int bench_generate_log(const char* path, size_t size);
+// Fills a buffer with log lines like those, every 50th one has some non-ASCII text
+void bench_fill_log(char* text, size_t size, uint64_t* rng);
+
+// Loads a text the way the editor opens a file (see loader_start_indexed, the checkpoints may be NULL), waiting for
+// the loader the way the UI would
+// Returns what the loader reported last, its snapshot is the final document (or NULL if the load failed), the status
+// is LOADER_CANCELLED if the loader couldn't even be started
+struct loader_progress bench_load_document(const void* data, size_t size, struct format from, enum linebreak linebreak,
+    struct document_checkpoint* checkpoints, size_t count);
+
+// Prints a result line in the common format, 'bytes' may be 0 if the throughput makes no sense
+void bench_report(const char* name, double seconds, size_t bytes);
+
+// The benchmarks themselves, one per module
+int bench_document(int argc, char** argv);
+int bench_open(int argc, char** argv);
+int bench_utf(int argc, char** argv);
+int bench_convert(int argc, char** argv);
+int bench_linebreak(int argc, char** argv);
+int bench_detect(int argc, char** argv);
+int bench_lines(int argc, char** argv);
+int bench_save(int argc, char** argv);
+int bench_load(int argc, char** argv);
+int bench_view(int argc, char** argv);
+int bench_wrap(int argc, char** argv);
+int bench_journal(int argc, char** argv);
+int bench_find(int argc, char** argv);
+int bench_replace(int argc, char** argv);
+int bench_regex(int argc, char** argv);
+int bench_isearch(int argc, char** argv);
+int bench_arena(int argc, char** argv);
+int bench_corpus(int argc, char** argv);
+int bench_trace(int argc, char** argv);
+int bench_batch(int argc, char** argv);
+int bench_decode(int argc, char** argv);
+int bench_reopen(int argc, char** argv);
@@ -0,0 +1,106 @@
+// Benchmarks the conversion pipeline on the common case of opening a UTF-8 file with LF line breaks
+// The staged version does what convert() used to: decode, count the line breaks, rewrite them, every stage in its own buffer
+// Usage: jittey-bench convert [megabytes, 256 by default]
+
+#include "bench.h"
+#include "../core/convert.h"
+#include "../core/utf.h"
+#include "../core/memory.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static uint16_t* staged(const uint8_t* src, size_t size, size_t* length) {
+    const size_t decoded_length = utf8_length_utf16(src, size, NULL);
+    uint16_t* decoded = mem_alloc(decoded_length * sizeof(uint16_t));
+    utf8_to_utf16(src, size, decoded, NULL);
+
+    size_t lines_length = 0;
+    for (size_t i = 0; i < decoded_length; i++)
+        lines_length += (decoded[i] == '\n' && (i == 0 || decoded[i-1] != '\r')) ? 2 : 1;
+
+    uint16_t* lines = mem_alloc(lines_length * sizeof(uint16_t));
+    uint16_t* d = lines;
+    for (size_t i = 0; i < decoded_length; i++) {
+        if (decoded[i] == '\n' && (i == 0 || decoded[i-1] != '\r'))
+            *d++ = '\r';
+        *d++ = decoded[i];
+    }
+
+    mem_free(decoded);
+    *length = lines_length;
+    return lines;
+}
+
+// Only looks at the output, like a writer would
+static bool discard(void* ctx, const void* data, size_t size) {
+    size_t* sum = ctx;
+    *sum += size + ((const uint8_t*)data)[0];
+    return true;
+}
+
+int bench_convert(int argc, char** argv) {
+    const size_t megabytes = argc > 0 ? strtoull(argv[0], NULL, 10) : 256;
+    const size_t size = megabytes * 1024 * 1024;
+    uint64_t rng = 1;
+
+    // Mostly ASCII lines of varying length with an occasional accented character
+    uint8_t* src = mem_alloc(size);
+    for (size_t i = 0; i < size; ) {
+        const uint64_t r = bench_random(&rng);
+        if (r % 50 == 0) {
+            src[i++] = '\n';
+        } else if (r % 97 == 0 && i + 2 <= size) {
+            src[i++] = 0xC3;
+            src[i++] = 0xA9;
+        } else {
+            src[i++] = 'a' + (r >> 8) % 26;
+        }
+    }
+    // Don't end with a cut off character
+    src[size-1] = '\n';
+
+    const struct format from = { ENCODING_UTF8, LINEBREAK_UNIX, false };
+    const struct format to = { ENCODING_UTF16, LINEBREAK_WIN, false };
+
+    size_t expected_length;
+    double start = bench_now();
+    uint16_t* expected = staged(src, size, &expected_length);
+    bench_report("staged (three buffers)", bench_now() - start, size);
+
+    static struct converter converter;
+
+    start = bench_now();
+    const size_t bound = convert_bound(src, size, from, to);
+    uint16_t* out = mem_alloc(bound);
+    converter_init_buffer(&converter, from, to, out);
+    converter_feed(&converter, src, size);
+    converter_finish(&converter);
+    bench_report("fused into one buffer", bench_now() - start, size);
+
+    int result = 0;
+    if (converter_size(&converter) != expected_length * sizeof(uint16_t) || memcmp(out, expected, converter_size(&converter))) {
+        fprintf(stderr, "  the fused output differs from the staged one\n");
+        result = 1;
+    }
+    printf("  %-40s %10.1f %%\n", "bound overhead", 100.0 * bound / converter_size(&converter) - 100);
+
+    // Fed in odd chunks, like a reader thread would
+    size_t sum = 0;
+    start = bench_now();
+    converter_init(&converter, from, to, discard, &sum);
+    for (size_t i = 0; i < size; i += 65537)
+        converter_feed(&converter, src + i, size - i < 65537 ? size - i : 65537);
+    converter_finish(&converter);
+    bench_report("fused into a sink, no allocation", bench_now() - start, size);
+
+    if (converter_size(&converter) != expected_length * sizeof(uint16_t)) {
+        fprintf(stderr, "  the sink got a different amount of output\n");
+        result = 1;
+    }
+
+    mem_free(out);
+    mem_free(expected);
+    mem_free(src);
+    return result;
+}
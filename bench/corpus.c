@@ -0,0 +1,340 @@
+// Benchmarks detecting, converting, loading and saving on a set of generated files of different kinds and sizes
+// Usage: jittey-bench corpus [directory [sizes...]], /tmp and 1K 1M 64M by default, the sizes take K, M and G (e.g. 4G)
+// The files are created in the directory on the first run and kept for the next ones, every saved file has to be
+// the same as the one it was loaded from, the mixed one with both kinds of line breaks too
+
+#define _POSIX_C_SOURCE 200809L
+#include "bench.h"
+#include "../core/convert.h"
+#include "../core/detect.h"
+#include "../core/document.h"
+#include "../core/mapping.h"
+#include "../core/memory.h"
+#include "../core/save.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// The text every file is made of is generated this many bytes of UTF-8 at a time and repeated
+#define CORPUS_PERIOD (1024 * 1024)
+
+enum content {
+    // Log lines, mostly ASCII
+    CONTENT_LOG,
+    // Lines of Chinese and Japanese
+    CONTENT_CJK,
+    // Log lines, every third one ends with CRLF and the rest with LF, only stored as UTF-8
+    CONTENT_MIXED
+};
+
+static const struct {
+    const char* name;
+    enum content content;
+    struct format format;
+} Corpora[] = {
+    { "ascii-lf", CONTENT_LOG, { ENCODING_UTF8, LINEBREAK_UNIX, false } },
+    { "ascii-crlf-bom", CONTENT_LOG, { ENCODING_UTF8, LINEBREAK_WIN, true } },
+    { "cjk-lf", CONTENT_CJK, { ENCODING_UTF8, LINEBREAK_UNIX, false } },
+    { "mixed", CONTENT_MIXED, { ENCODING_UTF8, LINEBREAK_UNIX, false } },
+    { "utf16-crlf-bom", CONTENT_CJK, { ENCODING_UTF16, LINEBREAK_WIN, true } },
+    { "utf16-lf", CONTENT_LOG, { ENCODING_UTF16, LINEBREAK_UNIX, false } },
+    { "utf16be-crlf-bom", CONTENT_CJK, { ENCODING_UTF16BE, LINEBREAK_WIN, true } },
+};
+
+#define CORPUS_COUNT (sizeof(Corpora) / sizeof(Corpora[0]))
+
+// Appends a character to UTF-8 text, only the ones from the BMP are needed
+static size_t put_utf8(char* text, uint32_t c) {
+    if (c < 0x80) {
+        text[0] = (char)c;
+        return 1;
+    }
+    if (c < 0x800) {
+        text[0] = (char)(0xC0 | c >> 6);
+        text[1] = (char)(0x80 | (c & 0x3F));
+        return 2;
+    }
+    text[0] = (char)(0xE0 | c >> 12);
+    text[1] = (char)(0x80 | (c >> 6 & 0x3F));
+    text[2] = (char)(0x80 | (c & 0x3F));
+    return 3;
+}
+
+// Fills the text with lines of CJK ideographs and kana, with the odd punctuation and ASCII number among them
+static void fill_cjk(char* text, size_t size, uint64_t* rng) {
+    size_t used = 0;
+    while (used < size) {
+        char line[256];
+        size_t length = 0;
+        const size_t characters = 10 + bench_random(rng) % 50;
+        for (size_t i = 0; i < characters; i++) {
+            const uint64_t r = bench_random(rng);
+            if (r % 16 == 0)
+                length += put_utf8(line + length, i % 2 ? 0x3002 : 0x3001);
+            else if (r % 16 == 1)
+                length += snprintf(line + length, 8, "%u", (unsigned)(r >> 8) % 1000);
+            else if (r % 4 == 0)
+                length += put_utf8(line + length, 0x3041 + (uint32_t)(r >> 8) % 86);
+            else
+                length += put_utf8(line + length, 0x4E00 + (uint32_t)(r >> 8) % 0x5000);
+        }
+        line[length++] = '\n';
+
+        const size_t n = size - used < length ? size - used : length;
+        memcpy(text + used, line, n);
+        used += n;
+    }
+}
+
+// Makes every third LF of the text a CRLF, the text has to have room for them
+static size_t mix_linebreaks(char* text, size_t size) {
+    size_t breaks = 0;
+    for (size_t i = 0; i < size; i++)
+        breaks += text[i] == '\n';
+
+    size_t added = (breaks + 2) / 3, end = size + added;
+    for (size_t i = size, line = breaks; i-- > 0; ) {
+        text[--end] = text[i];
+        if (text[i] == '\n' && --line % 3 == 0)
+            text[--end] = '\r';
+    }
+    return size + added;
+}
+
+// Returns the size of the text up to the last line break that fits in 'size' bytes (or 0 if there is none)
+static size_t cut(const uint8_t* text, size_t size, enum encoding encoding) {
+    if (encoding == ENCODING_UTF8) {
+        for (size_t i = size; i > 0; i--)
+            if (text[i - 1] == '\n')
+                return i;
+        return 0;
+    }
+
+    // The LF has its low byte first in little endian
+    const size_t low = encoding == ENCODING_UTF16 ? 0 : 1;
+    for (size_t i = size & ~(size_t)1; i >= 2; i -= 2)
+        if (text[i - 2 + low] == '\n' && text[i - 1 - low] == 0)
+            return i;
+    return 0;
+}
+
+static bool write_file(void* ctx, const void* data, size_t size) {
+    return fwrite(data, 1, size, ctx) == size;
+}
+
+// Writes a file of one of the kinds, at most 'size' bytes long and made of whole lines, unless it already exists
+static int generate(const char* path, size_t kind, size_t size) {
+    struct stat st;
+    if (!stat(path, &st) && st.st_size)
+        return 0;
+
+    char part[512];
+    snprintf(part, sizeof(part), "%s.part", path);
+    FILE* f = fopen(part, "wb");
+    if (!f) {
+        perror(part);
+        return 1;
+    }
+
+    // Leaves room for the CRs of the mixed line breaks
+    char* source = mem_alloc(CORPUS_PERIOD + CORPUS_PERIOD / 8);
+    uint64_t rng = 5 + kind;
+    if (Corpora[kind].content == CONTENT_CJK)
+        fill_cjk(source, CORPUS_PERIOD, &rng);
+    else
+        bench_fill_log(source, CORPUS_PERIOD, &rng);
+    size_t source_size = cut((uint8_t*)source, CORPUS_PERIOD, ENCODING_UTF8);
+    if (Corpora[kind].content == CONTENT_MIXED)
+        source_size = mix_linebreaks(source, source_size);
+
+    // A period of the text in the format of the file, without the BOM, which only goes at the start
+    const struct format from = { ENCODING_UTF8, LINEBREAK_UNIX, false };
+    struct format to = Corpora[kind].format;
+    to.bom = false;
+    uint8_t* period = (uint8_t*)source;
+    size_t period_size = source_size;
+    if (Corpora[kind].content != CONTENT_MIXED) {
+        period = mem_alloc(convert_bound(source, source_size, from, to));
+        struct converter* converter = mem_alloc(sizeof(*converter));
+        converter_init_buffer(converter, from, to, period);
+        converter_feed(converter, source, source_size);
+        converter_finish(converter);
+        period_size = converter_size(converter);
+        mem_free(converter);
+    }
+
+    // The converter knows how to write the BOM of every encoding
+    size_t written = 0;
+    if (Corpora[kind].format.bom) {
+        struct converter bom;
+        converter_init(&bom, from, Corpora[kind].format, write_file, f);
+        converter_finish(&bom);
+        written = converter_size(&bom);
+    }
+
+    bool success = true;
+    while (success && written < size) {
+        const size_t n = size - written < period_size ? cut(period, size - written, to.encoding) : period_size;
+        if (!n)
+            break;
+        success = write_file(f, period, n);
+        written += n;
+    }
+
+    success = !fclose(f) && success;
+    if (period != (uint8_t*)source)
+        mem_free(period);
+    mem_free(source);
+    if (!success || rename(part, path)) {
+        perror(path);
+        unlink(part);
+        return 1;
+    }
+    return 0;
+}
+
+// What an operation took, on top of where it started
+struct usage {
+    double start;
+    struct mem_stats heap;
+};
+
+static struct usage begin(void) {
+    struct usage usage;
+    mem_reset_peak();
+    bench_reset_peak_rss();
+    mem_get_stats(&usage.heap);
+    usage.start = bench_now();
+    return usage;
+}
+
+static void report(const char* name, const struct usage* usage, size_t bytes) {
+    const double seconds = bench_now() - usage->start;
+    struct mem_stats heap;
+    mem_get_stats(&heap);
+
+    bench_report(name, seconds, bytes);
+    printf("  %-40s %10zu allocations, %.1f MB peak heap, %.1f MB peak rss\n", "", heap.allocations - usage->heap.allocations,
+        (heap.peak - usage->heap.bytes) / 1e6, bench_peak_rss() / 1e6);
+}
+
+// Loads the file the way the editor does, keeping its line breaks
+static struct document* load(const struct mapping* mapping, struct format format) {
+    return bench_load_document(mapping->data, mapping->size, format, format.linebreak, NULL, 0).snapshot;
+}
+
+// Only looks at the output, like a writer would
+static bool discard(void* ctx, const void* data, size_t size) {
+    size_t* sum = ctx;
+    *sum += size + ((const uint8_t*)data)[0];
+    return true;
+}
+
+// Returns true if the file has the same contents as the mapping
+static bool same_file(const char* path, const struct mapping* mapping) {
+    struct mapping saved;
+    if (!mapping_open(&saved, path))
+        return false;
+
+    const bool same = saved.size == mapping->size && (!saved.size || !memcmp(saved.data, mapping->data, saved.size));
+    mapping_close(&saved);
+    return same;
+}
+
+static int run(const char* directory, size_t kind, size_t size, const char* size_name) {
+    char path[512], saved_path[512];
+    snprintf(path, sizeof(path), "%s/jittey-corpus-%s-%s.txt", directory, Corpora[kind].name, size_name);
+    snprintf(saved_path, sizeof(saved_path), "%s/jittey-corpus-saved.txt", directory);
+    if (generate(path, kind, size))
+        return 1;
+
+    struct mapping mapping;
+    if (!mapping_open(&mapping, path)) {
+        perror(path);
+        return 1;
+    }
+    printf(" %s, %zu bytes\n", Corpora[kind].name, mapping.size);
+    int result = 0;
+
+    struct usage usage = begin();
+    const struct detection detection = detect_format(mapping.data, mapping.size, 0);
+    report("detect", &usage, mapping.size);
+    const struct format expected = Corpora[kind].format;
+    if (detection.format.encoding != expected.encoding || detection.format.bom != expected.bom || detection.format.linebreak != expected.linebreak) {
+        fprintf(stderr, "  %s was detected wrong\n", path);
+        result = 1;
+    }
+
+    // The conversion the loader does, but with nothing kept
+    size_t sum = 0;
+    const struct format document_format = { ENCODING_UTF16, LINEBREAK_WIN, false };
+    struct converter* converter = mem_alloc(sizeof(*converter));
+    usage = begin();
+    converter_init(converter, expected, document_format, discard, &sum);
+    converter_feed(converter, mapping.data, mapping.size);
+    if (converter_finish(converter) != CONVERT_OK) {
+        fprintf(stderr, "  %s didn't convert\n", path);
+        result = 1;
+    }
+    report("convert to utf-16 crlf", &usage, mapping.size);
+    mem_free(converter);
+
+    usage = begin();
+    struct document* document = load(&mapping, expected);
+    report("load", &usage, mapping.size);
+    if (!document) {
+        fprintf(stderr, "  %s didn't load\n", path);
+        mapping_close(&mapping);
+        return 1;
+    }
+
+    usage = begin();
+    // Saved the way the editor does, with the line breaks left the way they are
+    const struct format keep = { expected.encoding, LINEBREAK_KEEP, expected.bom };
+    const bool saved = save_document(document, saved_path, keep);
+    report("save", &usage, mapping.size);
+    if (!saved || !same_file(saved_path, &mapping)) {
+        fprintf(stderr, "  %s didn't save the same\n", path);
+        result = 1;
+    }
+
+    unlink(saved_path);
+    document_free(document);
+    mapping_close(&mapping);
+    return result;
+}
+
+// Reads a size like 64M, returns 0 if it isn't one
+static size_t parse_size(const char* text) {
+    char* end;
+    size_t size = strtoull(text, &end, 10);
+    switch (*end) {
+        case 'K': case 'k': size <<= 10; end++; break;
+        case 'M': case 'm': size <<= 20; end++; break;
+        case 'G': case 'g': size <<= 30; end++; break;
+    }
+    return *end ? 0 : size;
+}
+
+int bench_corpus(int argc, char** argv) {
+    static char* defaults[] = { "1K", "1M", "64M" };
+    const char* directory = argc > 0 ? argv[0] : "/tmp";
+    char** sizes = argc > 1 ? argv + 1 : defaults;
+    const int size_count = argc > 1 ? argc - 1 : (int)(sizeof(defaults) / sizeof(defaults[0]));
+    int result = 0;
+
+    for (int i = 0; i < size_count; i++) {
+        const size_t size = parse_size(sizes[i]);
+        if (!size) {
+            fprintf(stderr, "  '%s' isn't a size\n", sizes[i]);
+            return 1;
+        }
+
+        for (size_t kind = 0; kind < CORPUS_COUNT; kind++)
+            result |= run(directory, kind, size, sizes[i]);
+    }
+
+    return result;
+}
@@ -0,0 +1,132 @@
+// Benchmarks loading text that has to be converted on 1 to 16 threads: UTF-8 with LF line breaks into the CRLF
+// the editor uses, UTF-8 with CRLF line breaks into LF and big endian UTF-16
+// Usage: jittey-bench decode [megabytes [threads]], 256 MB and up to 16 threads by default
+// Every load has to give the same text as the one on a single thread, and text with an invalid byte in it
+// has to fail at the same offset
+
+#include "bench.h"
+#include "../core/convert.h"
+#include "../core/document.h"
+#include "../core/loader.h"
+#include "../core/memory.h"
+#include "../core/thread.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Returns true if both documents have the same text
+static bool same_text(const struct document* a, const struct document* b) {
+    if (document_length(a) != document_length(b) || document_line_count(a) != document_line_count(b))
+        return false;
+
+    static uint16_t x[64 * 1024], y[64 * 1024];
+    for (size_t pos = 0; pos < document_length(a); pos += 64 * 1024) {
+        const size_t length = document_read(a, pos, x, 64 * 1024);
+        if (document_read(b, pos, y, 64 * 1024) != length || memcmp(x, y, length * sizeof(uint16_t)))
+            return false;
+    }
+    return true;
+}
+
+// Loads the text on every number of threads, comparing the documents with the one loaded on a single thread
+static int scale(const char* name, const void* data, size_t size, struct format from, enum linebreak linebreak, size_t most) {
+    printf(" %s\n", name);
+    int result = 0;
+    struct document* reference = NULL;
+    double serial = 0;
+
+    for (size_t threads = 1; threads <= most; threads *= 2) {
+        loader_set_threads(threads);
+        const double start = bench_now();
+        const struct loader_progress loaded = bench_load_document(data, size, from, linebreak, NULL, 0);
+        const double seconds = bench_now() - start;
+
+        char label[64];
+        snprintf(label, sizeof(label), "%zu thread%s", threads, threads > 1 ? "s" : "");
+        bench_report(label, seconds, size);
+        if (threads == 1) {
+            serial = seconds;
+        } else {
+            printf("  %-40s %10.2fx\n", "  speedup", serial / seconds);
+        }
+
+        if (loaded.status != LOADER_DONE || (reference && !same_text(reference, loaded.snapshot))) {
+            fprintf(stderr, "  %s on %zu threads doesn't give the same text as on one\n", name, threads);
+            result = 1;
+        }
+        if (!reference) {
+            reference = loaded.snapshot;
+        } else {
+            document_free(loaded.snapshot);
+        }
+    }
+
+    document_free(reference);
+    return result;
+}
+
+// Loads text with an invalid byte in it on every number of threads, they all have to fail at the byte
+static int invalid(char* text, size_t size, size_t most) {
+    const size_t at = size / 3 * 2 + 1;
+    const char saved = text[at];
+    text[at] = (char)0xFF;
+
+    int result = 0;
+    const struct format from = { ENCODING_UTF8, LINEBREAK_UNIX, false };
+    for (size_t threads = 1; threads <= most; threads *= 2) {
+        loader_set_threads(threads);
+        const struct loader_progress loaded = bench_load_document(text, size, from, LINEBREAK_WIN, NULL, 0);
+        document_free(loaded.snapshot);
+        if (loaded.status != LOADER_INVALID || loaded.error != at) {
+            fprintf(stderr, "  invalid UTF-8 on %zu threads fails at %zu instead of %zu\n", threads, loaded.error, at);
+            result = 1;
+        }
+    }
+
+    text[at] = saved;
+    return result;
+}
+
+// Converts the text into another format, for the inputs that aren't UTF-8 with LF line breaks
+static void* reformat(const char* text, size_t size, struct format to, size_t* converted) {
+    const struct format from = { ENCODING_UTF8, LINEBREAK_UNIX, false };
+    void* out = mem_alloc(convert_bound(text, size, from, to));
+    struct converter* converter = mem_alloc(sizeof(*converter));
+    converter_init_buffer(converter, from, to, out);
+    converter_feed(converter, text, size);
+    converter_finish(converter);
+    *converted = converter_size(converter);
+    mem_free(converter);
+    return out;
+}
+
+int bench_decode(int argc, char** argv) {
+    const size_t megabytes = argc > 0 ? strtoull(argv[0], NULL, 10) : 256;
+    const size_t most = argc > 1 ? strtoull(argv[1], NULL, 10) : 16;
+    const size_t size = megabytes * 1024 * 1024;
+    int result = 0;
+
+    printf(" %zu MB, %zu processors\n", megabytes, thread_count());
+    char* text = mem_alloc(size);
+    uint64_t rng = 22;
+    bench_fill_log(text, size, &rng);
+
+    const struct format utf8_lf = { ENCODING_UTF8, LINEBREAK_UNIX, false };
+    result |= scale("UTF-8 LF into CRLF", text, size, utf8_lf, LINEBREAK_WIN, most);
+
+    size_t converted;
+    const struct format utf8_crlf = { ENCODING_UTF8, LINEBREAK_WIN, false };
+    void* crlf = reformat(text, size, utf8_crlf, &converted);
+    result |= scale("UTF-8 CRLF into LF", crlf, converted, utf8_crlf, LINEBREAK_UNIX, most);
+    mem_free(crlf);
+
+    const struct format utf16be = { ENCODING_UTF16BE, LINEBREAK_WIN, true };
+    void* be = reformat(text, size, utf16be, &converted);
+    result |= scale("UTF-16 BE with BOM, CRLF", be, converted, utf16be, LINEBREAK_WIN, most);
+    mem_free(be);
+
+    result |= invalid(text, size, most);
+    loader_set_threads(0);
+    mem_free(text);
+    return result;
+}
@@ -0,0 +1,94 @@
+// Benchmarks the format detection, looking at the whole text and at a sample of it
+// Usage: jittey-bench detect [megabytes, 512 by default]
+
+#include "bench.h"
+#include "../core/detect.h"
+#include "../core/memory.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Checks the detection of a small handmade text
+static int check(const char* name, const void* text, size_t size, struct format expected, size_t crlf, size_t lf, size_t cr) {
+    const struct detection detection = detect_format(text, size, 0);
+    if (detection.format.encoding != expected.encoding || detection.format.bom != expected.bom || detection.format.linebreak != expected.linebreak
+        || detection.linebreaks.crlf != crlf || detection.linebreaks.lf != lf || detection.linebreaks.cr != cr) {
+        fprintf(stderr, "  %s detected wrong\n", name);
+        return 1;
+    }
+    return 0;
+}
+
+// Reports a detection, the throughput is of the bytes it looked at, which for a sampled one isn't the whole text
+static void report(const char* name, double seconds, const struct detection* detection) {
+    bench_report(name, seconds, detection->scanned);
+    printf("  %-40s %d%%, %zu CRLF, %zu LF, %zu CR, %zu bytes looked at\n", "", detection->confidence,
+        detection->linebreaks.crlf, detection->linebreaks.lf, detection->linebreaks.cr, detection->scanned);
+}
+
+int bench_detect(int argc, char** argv) {
+    const size_t megabytes = argc > 0 ? strtoull(argv[0], NULL, 10) : 512;
+    const size_t size = megabytes * 1024 * 1024;
+    uint64_t rng = 1;
+    int result = 0;
+
+    const uint16_t utf16[] = { 'h', 'i', '\r', '\n', 'y', 'o', '\n' };
+    // Big endian units written on a little endian machine, the BOM is FE FF
+    const uint16_t utf16be[] = { 0xFFFE, 0x6800, 0x6900, 0x0D00, 0x0A00 };
+    // "日本語のテキスト" and a line break, in UTF-16 without any NULs
+    const uint16_t cjk[] = { 0x65E5, 0x672C, 0x8A9E, 0x306E, 0x30C6, 0x30AD, 0x30B9, 0x30C8, 0x2028, 0x65E5, 0x672C };
+    result |= check("ascii", "one\r\ntwo\r\nthree", 15, (struct format){ ENCODING_UTF8, LINEBREAK_WIN, false }, 2, 0, 0);
+    result |= check("utf-8 with a bom", "\xEF\xBB\xBFj\xC3\xA9\n\r\rx\r\n", 12, (struct format){ ENCODING_UTF8, LINEBREAK_UNIX, true }, 1, 1, 2);
+    result |= check("utf-16", utf16, sizeof(utf16), (struct format){ ENCODING_UTF16, LINEBREAK_UNIX, false }, 1, 1, 0);
+    result |= check("utf-16 be", utf16be, sizeof(utf16be), (struct format){ ENCODING_UTF16BE, LINEBREAK_WIN, true }, 1, 0, 0);
+    result |= check("cjk utf-16", cjk, sizeof(cjk), (struct format){ ENCODING_UTF16, LINEBREAK_WIN, false }, 0, 0, 0);
+
+    // A big CRLF log with some UTF-8 in it
+    uint8_t* text = mem_alloc(size);
+    for (size_t i = 0; i < size; ) {
+        const uint64_t r = bench_random(&rng);
+        if (r % 60 == 0 && i + 2 <= size) {
+            text[i++] = '\r';
+            text[i++] = '\n';
+        } else if (r % 200 == 1 && i + 2 <= size) {
+            text[i++] = 0xC3;
+            text[i++] = 0xA9;
+        } else {
+            text[i++] = ' ' + (r >> 8) % 95;
+        }
+    }
+
+    double start = bench_now();
+    struct detection full = detect_format(text, size, 0);
+    report("whole utf-8 text", bench_now() - start, &full);
+
+    start = bench_now();
+    struct detection sampled = detect_format(text, size, DETECT_SAMPLE);
+    report("sampled utf-8 text", bench_now() - start, &sampled);
+
+    if (full.format.encoding != ENCODING_UTF8 || full.format.linebreak != LINEBREAK_WIN || sampled.format.encoding != ENCODING_UTF8 || sampled.format.linebreak != LINEBREAK_WIN) {
+        fprintf(stderr, "  the big utf-8 text was detected wrong\n");
+        result = 1;
+    }
+
+    // The same length of ASCII as UTF-16 with LF line breaks
+    uint16_t* wide = (uint16_t*)text;
+    for (size_t i = 0; i < size / 2; i++)
+        wide[i] = (bench_random(&rng) % 70 == 0) ? '\n' : 'a' + i % 26;
+
+    start = bench_now();
+    full = detect_format(text, size, 0);
+    report("whole utf-16 text", bench_now() - start, &full);
+
+    start = bench_now();
+    sampled = detect_format(text, size, DETECT_SAMPLE);
+    report("sampled utf-16 text", bench_now() - start, &sampled);
+
+    if (full.format.encoding != ENCODING_UTF16 || full.format.linebreak != LINEBREAK_UNIX || sampled.format.encoding != ENCODING_UTF16 || sampled.format.linebreak != LINEBREAK_UNIX) {
+        fprintf(stderr, "  the big utf-16 text was detected wrong\n");
+        result = 1;
+    }
+
+    mem_free(text);
+    return result;
+}
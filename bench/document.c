@@ -0,0 +1,83 @@
+// Benchmarks the piece table: creation, random edits, snapshots and reading
+// Usage: jittey-bench document [megabytes of UTF-16 text, 256 by default]
+
+#include "bench.h"
+#include "../core/document.h"
+#include "../core/memory.h"
+
+#include <stdlib.h>
+
+// Counts the code units seen by document_walk, used to make sure the walk isn't optimised away
+static bool count_span(void* ctx, const uint16_t* text, size_t length) {
+    size_t* sum = ctx;
+    for (size_t i = 0; i < length; i += 4096)
+        *sum += text[i];
+    *sum += length;
+    return true;
+}
+
+int bench_document(int argc, char** argv) {
+    const size_t megabytes = argc > 0 ? strtoull(argv[0], NULL, 10) : 256;
+    const size_t length = megabytes * 1024 * 1024 / sizeof(uint16_t);
+    const size_t edits = 200000;
+    uint64_t rng = 1;
+
+    uint16_t* text = mem_alloc(length * sizeof(uint16_t));
+    for (size_t i = 0; i < length; i++)
+        text[i] = (i % 80 == 79) ? '\n' : 'a' + i % 26;
+
+    double start = bench_now();
+    struct document* document = document_create_from(text, length, NULL, NULL);
+    bench_report("create", bench_now() - start, 0);
+
+    // Typing bursts at random places, every burst starts with a seek and continues with single characters
+    size_t expected = length;
+    start = bench_now();
+    for (size_t i = 0; i < edits; ) {
+        size_t pos = bench_random(&rng) % (expected + 1);
+        for (int j = 0; j < 16 && i < edits; j++, i++, pos++, expected++) {
+            const uint16_t c = 'A' + j;
+            document_insert(document, pos, &c, 1);
+        }
+    }
+    double elapsed = bench_now() - start;
+    printf("  %-40s %10.3f us\n", "insert (per character)", elapsed / edits * 1e6);
+
+    start = bench_now();
+    for (size_t i = 0; i < edits; i++) {
+        const size_t pos = bench_random(&rng) % expected;
+        document_erase(document, pos, 1);
+        expected--;
+    }
+    elapsed = bench_now() - start;
+    printf("  %-40s %10.3f us\n", "erase (per character)", elapsed / edits * 1e6);
+
+    // Taking a snapshot and then editing the original forces the shared path to be copied
+    start = bench_now();
+    struct document* snapshot = NULL;
+    for (size_t i = 0; i < edits; i++) {
+        document_free(snapshot);
+        snapshot = document_snapshot(document);
+        const uint16_t c = 'x';
+        document_insert(document, bench_random(&rng) % (expected + 1), &c, 1);
+        expected++;
+    }
+    elapsed = bench_now() - start;
+    printf("  %-40s %10.3f us\n", "snapshot + insert", elapsed / edits * 1e6);
+
+    size_t sum = 0;
+    start = bench_now();
+    document_walk(document, 0, expected, count_span, &sum);
+    bench_report("walk", bench_now() - start, expected * sizeof(uint16_t));
+
+    printf("  %-40s %10.1f MB\n", "peak rss", bench_peak_rss() / 1e6);
+
+    const int result = (document_length(document) == expected && document_length(snapshot) == expected - 1) ? 0 : 1;
+    if (result)
+        fprintf(stderr, "  document length mismatch\n");
+
+    document_free(snapshot);
+    document_free(document);
+    mem_free(text);
+    return result;
+}
@@ -0,0 +1,208 @@
+// Benchmarks find next through a big document, in UTF-8 as a file is opened and in UTF-16, against wcsstr
+// Usage: jittey-bench find [megabytes, 1024 by default]
+// The pattern is near the very end or not there at all, so every search goes through the whole text
+
+#include "bench.h"
+#include "../core/document.h"
+#include "../core/find.h"
+#include "../core/memory.h"
+#include "../core/simd.h"
+#include "../core/utf.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+static const char* Levels[] = { "scalar", "sse2", "avx2" };
+
+// Converts an ASCII string for a pattern, returns its length
+static size_t pattern_of(const char* s, uint16_t* out) {
+    size_t length = 0;
+    for (; s[length]; length++)
+        out[length] = (uint8_t)s[length];
+    return length;
+}
+
+// Counts the matches by calling find_next over and over, the way find all is going to do it
+static size_t count_matches(const struct finder* finder, const struct document* document) {
+    size_t count = 0, pos = 0, match;
+    while (find_next(finder, document, pos, SIZE_MAX, &match)) {
+        count++;
+        pos = match + 1;
+    }
+    return count;
+}
+
+// Counts the matches in a flat buffer
+static size_t count_in(const struct finder* finder, const uint16_t* text, size_t length) {
+    size_t count = 0;
+    for (size_t pos = find_in(finder, text, length, 0); pos != SIZE_MAX; pos = find_in(finder, text, length, pos + 1))
+        count++;
+    return count;
+}
+
+// Searches a document once for every SIMD level, returns nonzero if the match isn't where it should be
+static int search(const char* name, const struct document* document, const uint16_t* pattern, size_t length, bool ignore_case, size_t expected, size_t bytes) {
+    struct finder* finder = find_create(pattern, length, ignore_case);
+    int result = 0;
+
+    for (int level = SIMD_AVX2; level >= SIMD_NONE; level--) {
+        simd_limit(level);
+
+        size_t match = SIZE_MAX;
+        const double start = bench_now();
+        if (!find_next(finder, document, 0, SIZE_MAX, &match))
+            match = SIZE_MAX;
+
+        char label[64];
+        snprintf(label, sizeof(label), "%s, %s", name, Levels[level]);
+        bench_report(label, bench_now() - start, bytes);
+
+        if (match != expected) {
+            fprintf(stderr, "  %s found the pattern at %zu instead of %zu\n", label, match, expected);
+            result = 1;
+        }
+    }
+
+    simd_limit(SIMD_AVX2);
+    find_free(finder);
+    return result;
+}
+
+// Splits a document into a lot of small pieces without changing its text, every match must still be found
+static int pieces(struct document* document, const uint16_t* text, size_t length) {
+    uint64_t rng = 9;
+    const uint16_t x = 'x';
+    for (size_t i = 0; i < 20000; i++) {
+        const size_t pos = bench_random(&rng) % length;
+        document_insert(document, pos, &x, 1);
+        document_erase(document, pos, 1);
+    }
+
+    const char* patterns[] = { "served in", "INFO REQUEST", "] ", "requ\xC3\xAAte", "2021-03-1" };
+    int result = 0;
+    for (size_t i = 0; i < sizeof(patterns) / sizeof(patterns[0]); i++) {
+        uint16_t pattern[64];
+        const size_t pattern_length = utf8_to_utf16((const uint8_t*)patterns[i], strlen(patterns[i]), pattern, NULL);
+        struct finder* finder = find_create(pattern, pattern_length, i == 1);
+
+        const size_t found = count_matches(finder, document), expected = count_in(finder, text, length);
+        if (found != expected) {
+            fprintf(stderr, "  '%s' found %zu times across the pieces instead of %zu\n", patterns[i], found, expected);
+            result = 1;
+        }
+        find_free(finder);
+    }
+
+    return result;
+}
+
+int bench_find(int argc, char** argv) {
+    const size_t megabytes = argc > 0 ? strtoull(argv[0], NULL, 10) : 1024;
+    const size_t size = megabytes * 1024 * 1024;
+    uint64_t rng = 5;
+    int result = 0;
+
+    // The UTF-8 text gets loaded the same way the editor opens a file, the pattern is put in 1 MB before the end
+    char* text8 = mem_alloc(size);
+    bench_fill_log(text8, size, &rng);
+    static const char needle[] = "connection reset by peer";
+    const size_t needle_at = size - 1024 * 1024;
+    memcpy(text8 + needle_at, needle, sizeof(needle) - 1);
+
+    struct document* utf8 = document_create_lazy(text8, size, ENCODING_UTF8, NULL, NULL);
+    while (document_load_more(utf8, 64 * 1024 * 1024) == DOCUMENT_LOADING);
+
+    // The match is in code units, the text before it has some non-ASCII characters
+    const size_t expected8 = utf8_length_utf16((const uint8_t*)text8, needle_at, NULL);
+
+    uint16_t pattern[64];
+    size_t length;
+    printf(" %zu MB of UTF-8\n", megabytes);
+
+    length = pattern_of(needle, pattern);
+    result |= search("match near the end", utf8, pattern, length, false, expected8, size);
+    length = pattern_of("CONNECTION Reset", pattern);
+    result |= search("match near the end, ignore case", utf8, pattern, length, true, expected8, size);
+    length = pattern_of("segmentation fault", pattern);
+    result |= search("no match", utf8, pattern, length, false, SIZE_MAX, size);
+    length = pattern_of("SEGMENTATION FAULT", pattern);
+    result |= search("no match, ignore case", utf8, pattern, length, true, SIZE_MAX, size);
+
+    // The case of a non-ASCII pattern can only be ignored in UTF-16, so the text gets decoded on the way
+    length = utf8_to_utf16((const uint8_t*)"\xC3\x89" "CHEC", strlen("\xC3\x89" "CHEC"), pattern, NULL);
+    result |= search("no match, non-ASCII, ignore case", utf8, pattern, length, true, SIZE_MAX, size);
+
+    // The same amount of UTF-16 text, the start of the UTF-8 text decoded
+    const size_t length16 = size / sizeof(uint16_t);
+    uint16_t* text16 = mem_alloc(size);
+    const size_t prefix = utf8_complete((const uint8_t*)text8, length16);
+    utf8_to_utf16((const uint8_t*)text8, prefix, text16, NULL);
+    const size_t decoded = utf8_length_utf16((const uint8_t*)text8, prefix, NULL);
+    for (size_t i = decoded; i < length16; i++)
+        text16[i] = 'a' + i % 26;
+    const size_t expected16 = length16 - 1024 * 1024;
+    length = pattern_of(needle, pattern);
+    memcpy(text16 + expected16, pattern, length * sizeof(uint16_t));
+
+    struct document* utf16 = document_create_from(text16, length16, NULL, NULL);
+    printf(" %zu MB of UTF-16\n", megabytes);
+
+    result |= search("match near the end", utf16, pattern, length, false, expected16, size);
+    length = pattern_of("CONNECTION Reset", pattern);
+    result |= search("match near the end, ignore case", utf16, pattern, length, true, expected16, size);
+    length = pattern_of("segmentation fault", pattern);
+    result |= search("no match", utf16, pattern, length, false, SIZE_MAX, size);
+    length = utf8_to_utf16((const uint8_t*)"\xC3\x89" "CHEC", strlen("\xC3\x89" "CHEC"), pattern, NULL);
+    result |= search("no match, non-ASCII, ignore case", utf16, pattern, length, true, SIZE_MAX, size);
+
+    // A pattern that matches almost everywhere but never quite, Two-Way keeps this linear
+    length = pattern_of("2021-03-01 12:00:00.000 [worker-0] INFO request 1 served in 1 ms", pattern);
+    result |= search("almost matching everywhere", utf16, pattern, length, false, SIZE_MAX, size);
+
+    // The naive baseline, wcsstr over wide characters (32 bits on Linux), on an eighth of the text
+    const size_t baseline = length16 / 8;
+    wchar_t* wide = mem_alloc((baseline + 1) * sizeof(wchar_t));
+    for (size_t i = 0; i < baseline; i++)
+        wide[i] = text16[i];
+    wide[baseline] = 0;
+
+    printf(" %zu MB of UTF-16, compared to wcsstr\n", baseline * sizeof(uint16_t) / (1024 * 1024));
+    double start = bench_now();
+    const wchar_t* found = wcsstr(wide, L"segmentation fault");
+    bench_report("wcsstr, no match", bench_now() - start, baseline * sizeof(uint16_t));
+
+    length = pattern_of("segmentation fault", pattern);
+    struct finder* finder = find_create(pattern, length, false);
+    start = bench_now();
+    const size_t match = find_in(finder, text16, baseline, 0);
+    bench_report("find_in, no match", bench_now() - start, baseline * sizeof(uint16_t));
+    find_free(finder);
+
+    if (found || match != SIZE_MAX) {
+        fprintf(stderr, "  the pattern is not in the text, yet it was found\n");
+        result = 1;
+    }
+    mem_free(wide);
+
+    document_free(utf16);
+    document_free(utf8);
+
+    // Matches across the boundaries of pieces, in a few megabytes of both encodings
+    const size_t small = 4 * 1024 * 1024;
+    const size_t small_length = utf8_length_utf16((const uint8_t*)text8, small, NULL);
+    utf8_to_utf16((const uint8_t*)text8, small, text16, NULL);
+
+    struct document* document = document_create_lazy(text8, small, ENCODING_UTF8, NULL, NULL);
+    while (document_load_more(document, 64 * 1024 * 1024) == DOCUMENT_LOADING);
+    result |= pieces(document, text16, small_length);
+    document_free(document);
+
+    document = document_create_from(text16, small_length, NULL, NULL);
+    result |= pieces(document, text16, small_length);
+    document_free(document);
+
+    mem_free(text16);
+    mem_free(text8);
+    return result;
+}
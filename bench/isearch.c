@@ -0,0 +1,125 @@
+// Benchmarks the latency of incremental search while a query is typed a character at a time into a big log
+// Usage: jittey-bench isearch [megabytes, 256 by default]
+// Every keystroke is searched for incrementally, the way the editor does it in steps between the messages, and again
+// from scratch, both have to find the same matches
+
+#include "bench.h"
+#include "../core/document.h"
+#include "../core/isearch.h"
+#include "../core/memory.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// The editor does this much between checking for messages
+#define STEP_BUDGET (1024 * 1024)
+
+// The times of a search, from the keystroke to the first match and to the last one, and the longest step
+struct latency {
+    double first, done, longest;
+    size_t count;
+};
+
+// Searches until all of the matches are found, 'search' already has the query
+static struct latency run(struct isearch* search, const struct document* document) {
+    struct latency latency = { -1, 0, 0, 0 };
+    const double start = bench_now();
+
+    for (bool done = false; !done; ) {
+        const double step = bench_now();
+        done = isearch_step(search, document, STEP_BUDGET);
+        const double now = bench_now();
+
+        if (now - step > latency.longest)
+            latency.longest = now - step;
+        size_t match;
+        if (latency.first < 0 && isearch_next(search, document, 0, &match))
+            latency.first = now - start;
+    }
+
+    latency.done = bench_now() - start;
+    latency.count = isearch_count(search);
+    return latency;
+}
+
+static void report(const char* name, const uint16_t* query, size_t length, const struct latency* latency) {
+    char label[96];
+    int n = snprintf(label, sizeof(label), "%s '", name);
+    for (size_t i = 0; i < length && n < 80; i++)
+        label[n++] = (char)query[i];
+    snprintf(label + n, sizeof(label) - n, "', %zu", latency->count);
+
+    printf("  %-40s %10.3f ms %10.3f ms %10.3f ms\n", label, latency->first < 0 ? 0 : latency->first * 1e3, latency->done * 1e3, latency->longest * 1e3);
+}
+
+// Types the query into the search a character at a time, then deletes the last one, every time checking the matches
+// against a search from scratch, returns nonzero if they differ
+static int type(struct isearch* search, const struct document* document, const char* typed, bool ignore_case) {
+    uint16_t query[64];
+    const size_t length = strlen(typed);
+    for (size_t i = 0; i < length; i++)
+        query[i] = (uint8_t)typed[i];
+
+    struct isearch* fresh = isearch_create();
+    double worst = 0, incremental = 0, scratch = 0;
+    int result = 0;
+
+    // The last step is the backspace
+    for (size_t i = 1; i <= length + 1; i++) {
+        const size_t typed_length = i <= length ? i : length - 1;
+        isearch_query(search, query, typed_length, ignore_case);
+        const struct latency latency = run(search, document);
+        report(i <= length ? "type" : "backspace", query, typed_length, &latency);
+
+        // An empty query forgets the matches, so the next one isn't taken for a longer query
+        isearch_query(fresh, query, 0, ignore_case);
+        isearch_query(fresh, query, typed_length, ignore_case);
+        const struct latency full = run(fresh, document);
+        report("  from scratch", query, typed_length, &full);
+
+        if (latency.count != full.count) {
+            fprintf(stderr, "  %zu matches instead of %zu with the %zu characters of '%s'\n", latency.count, full.count, typed_length, typed);
+            result = 1;
+        }
+        if (latency.longest > worst)
+            worst = latency.longest;
+        incremental += latency.done;
+        scratch += full.done;
+    }
+
+    bench_report("all keystrokes, incremental", incremental, 0);
+    bench_report("all keystrokes, from scratch", scratch, 0);
+    bench_report("the longest step", worst, 0);
+    isearch_free(fresh);
+    return result;
+}
+
+int bench_isearch(int argc, char** argv) {
+    const size_t megabytes = argc > 0 ? strtoull(argv[0], NULL, 10) : 256;
+    const size_t size = megabytes * 1024 * 1024;
+    uint64_t rng = 3;
+    int result = 0;
+
+    char* text8 = mem_alloc(size);
+    bench_fill_log(text8, size, &rng);
+    struct document* document = document_create_lazy(text8, size, ENCODING_UTF8, NULL, NULL);
+    while (document_load_more(document, 64 * 1024 * 1024) == DOCUMENT_LOADING);
+
+    printf(" %zu MB of UTF-8, %u K code units a step\n", megabytes, STEP_BUDGET / 1024);
+    printf("  %-40s %13s %13s %13s\n", "query, matches", "first match", "all matches", "longest step");
+
+    struct isearch* search = isearch_create();
+    result |= type(search, document, "request 4242", false);
+    result |= type(search, document, "WARN REQU", true);
+
+    // An edit makes the matches stale, they have to be found again
+    const uint16_t x = 'x';
+    document_insert(document, document_length(document) / 2, &x, 1);
+    printf(" after an edit\n");
+    result |= type(search, document, "served", false);
+
+    isearch_free(search);
+    document_free(document);
+    mem_free(text8);
+    return result;
+}
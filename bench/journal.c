@@ -0,0 +1,237 @@
+// Benchmarks the undo journal: what typing costs in memory, undoing and redoing, bulk edits and the byte budget
+// Usage: jittey-bench journal [thousands of characters typed, 1000 by default]
+// Undoing must cost as much as the edit, the same in a huge document as in an empty one
+
+#include "bench.h"
+#include "../core/document.h"
+#include "../core/journal.h"
+#include "../core/memory.h"
+#include "../core/view.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static void fake_extents(void* ctx, const uint16_t* text, size_t length, int* extents) {
+    (void)ctx;
+    (void)text;
+    for (size_t i = 0; i < length; i++)
+        extents[i] = (int)(i + 1) * 8;
+}
+
+static const uint16_t Linebreak[] = { '\r', '\n' };
+static const uint16_t Replacement[] = { 'a', 'n' };
+
+// Hashes the whole text of a document
+static bool hash_span(void* ctx, const uint16_t* text, size_t length) {
+    uint64_t* hash = ctx;
+    for (size_t i = 0; i < length; i++)
+        *hash = (*hash ^ text[i]) * 0x100000001B3ull;
+    return true;
+}
+
+static uint64_t hash_of(const struct document* document) {
+    uint64_t hash = 0xCBF29CE484222325ull;
+    document_walk(document, 0, document_length(document), hash_span, &hash);
+    return hash;
+}
+
+// Types text like a person does: words, spaces, a line break every now and then and a typo fixed with backspace
+static void type(struct view* view, size_t count, uint64_t* rng) {
+    for (size_t i = 0; i < count; i++) {
+        const uint64_t r = bench_random(rng) % 100;
+        if (r < 2) {
+            view_insert(view, Linebreak, 2);
+        } else if (r < 4) {
+            view_erase(view, VIEW_LEFT);
+        } else {
+            const uint16_t c = r < 20 ? ' ' : 'a' + (uint16_t)(r % 26);
+            view_insert(view, &c, 1);
+        }
+    }
+}
+
+// Types into a document and undoes and redoes all of it, returns nonzero if the text didn't come back
+static int typing(struct document* document, const char* name, size_t count) {
+    const struct view_metrics metrics = { fake_extents, NULL, 16 };
+    struct view* view = view_create(document, &metrics);
+    struct journal* journal = journal_create(JOURNAL_DEFAULT_BUDGET);
+    view_set_journal(view, journal);
+    view_resize(view, 1600, 1000);
+    view_select(view, document_length(document) / 2, document_length(document) / 2);
+
+    uint64_t rng = 11;
+    const uint64_t before = hash_of(document);
+    const size_t rss = bench_rss_anon();
+    int result = 0;
+
+    double start = bench_now();
+    type(view, count, &rng);
+    const double typed = bench_now() - start;
+
+    const uint64_t after = hash_of(document);
+    const size_t steps = journal_steps(journal);
+    printf(" %s\n", name);
+    printf("  %-40s %10.3f us\n", "type with the journal (per key)", typed / count * 1e6);
+    printf("  %-40s %10.2f bytes\n", "journal memory per key", (double)journal_bytes(journal) / count);
+    printf("  %-40s %10zu (%.1f keys each)\n", "undo steps", steps, (double)count / steps);
+
+    start = bench_now();
+    while (view_undo(view));
+    const double undone = bench_now() - start;
+    printf("  %-40s %10.3f us\n", "undo (per step)", undone / steps * 1e6);
+
+    if (hash_of(document) != before) {
+        fprintf(stderr, "  undoing everything didn't bring the original text back\n");
+        result = 1;
+    }
+
+    start = bench_now();
+    while (view_redo(view));
+    printf("  %-40s %10.3f us\n", "redo (per step)", (bench_now() - start) / steps * 1e6);
+
+    if (hash_of(document) != after) {
+        fprintf(stderr, "  redoing everything didn't bring the typed text back\n");
+        result = 1;
+    }
+
+    // Typing runs end at line breaks, a step every 50 keys or so is about right, a step per key would not be
+    if (steps > count / 10) {
+        fprintf(stderr, "  typing runs are not coalesced, %zu steps for %zu keys\n", steps, count);
+        result = 1;
+    }
+
+    printf("  %-40s %10.1f MB\n", "anonymous memory grown", ((double)bench_rss_anon() - rss) / 1e6);
+
+    journal_free(journal);
+    view_free(view);
+    return result;
+}
+
+// Undoes and redoes straight in a document, without any view
+static void apply_to_document(void* ctx, size_t pos, size_t removed, const uint16_t* text, size_t length) {
+    document_erase(ctx, pos, removed);
+    document_insert(ctx, pos, text, length);
+}
+
+// Replaces every 'a' with "an" as one group, like replacing all of the matches of a search
+static int bulk(size_t length) {
+    uint16_t* text = mem_alloc(length * sizeof(uint16_t));
+    uint64_t rng = 3;
+    for (size_t i = 0; i < length; i++)
+        text[i] = i % 64 == 63 ? '\n' : 'a' + (uint16_t)(bench_random(&rng) % 26);
+
+    struct document* document = document_create_from(text, length, NULL, NULL);
+    struct journal* journal = journal_create(JOURNAL_DEFAULT_BUDGET);
+    const uint64_t before = hash_of(document);
+    int result = 0;
+
+    double start = bench_now();
+    journal_begin_group(journal);
+    size_t edits = 0;
+    for (size_t i = 0, pos = 0; i < length; i++, pos++) {
+        if (text[i] != 'a')
+            continue;
+
+        journal_record(journal, document, pos, 1, Replacement, 2);
+        document_erase(document, pos, 1);
+        document_insert(document, pos, Replacement, 2);
+        pos++;
+        edits++;
+    }
+    journal_end_group(journal);
+    printf(" replace all in %zu KB (%zu matches)\n", length * sizeof(uint16_t) / 1024, edits);
+    printf("  %-40s %10.3f ms\n", "replace all, recorded", (bench_now() - start) * 1e3);
+    printf("  %-40s %10zu\n", "undo steps", journal_steps(journal));
+
+    if (journal_steps(journal) != 1) {
+        fprintf(stderr, "  a group must be a single step\n");
+        result = 1;
+    }
+
+    const uint64_t after = hash_of(document);
+    start = bench_now();
+    journal_undo(journal, apply_to_document, document);
+    printf("  %-40s %10.3f ms\n", "undo replace all", (bench_now() - start) * 1e3);
+
+    if (hash_of(document) != before) {
+        fprintf(stderr, "  undoing the group didn't bring the original text back\n");
+        result = 1;
+    }
+
+    start = bench_now();
+    journal_redo(journal, apply_to_document, document);
+    printf("  %-40s %10.3f ms\n", "redo replace all", (bench_now() - start) * 1e3);
+
+    if (hash_of(document) != after) {
+        fprintf(stderr, "  redoing the group didn't bring the replaced text back\n");
+        result = 1;
+    }
+
+    journal_free(journal);
+    document_free(document);
+    mem_free(text);
+    return result;
+}
+
+// Types a lot more than a small budget allows, the journal must stay within it and still undo what it kept
+static int budget(size_t count) {
+    const size_t budget = 1024 * 1024;
+    struct document* document = document_create();
+    const struct view_metrics metrics = { fake_extents, NULL, 16 };
+    struct view* view = view_create(document, &metrics);
+    struct journal* journal = journal_create(budget);
+    view_set_journal(view, journal);
+    view_resize(view, 1600, 1000);
+
+    uint64_t rng = 5;
+    size_t most = 0;
+    int result = 0;
+    for (size_t i = 0; i < 100; i++) {
+        type(view, count / 10, &rng);
+        const size_t bytes = journal_bytes(journal);
+        most = bytes > most ? bytes : most;
+    }
+
+    printf(" %zu KB typed with a budget of %zu KB\n", count * 10 * sizeof(uint16_t) / 1024, budget / 1024);
+    printf("  %-40s %10zu KB\n", "most memory used by the journal", most / 1024);
+    printf("  %-40s %10zu\n", "undo steps kept", journal_steps(journal));
+
+    if (most > budget) {
+        fprintf(stderr, "  the journal went over its budget\n");
+        result = 1;
+    }
+
+    // Whatever was kept can be undone, down to some earlier state of the text
+    while (view_undo(view));
+    if (!journal_can_redo(journal) || journal_can_undo(journal)) {
+        fprintf(stderr, "  the kept steps can't be undone\n");
+        result = 1;
+    }
+
+    journal_free(journal);
+    view_free(view);
+    document_free(document);
+    return result;
+}
+
+int bench_journal(int argc, char** argv) {
+    const size_t count = (argc > 0 ? strtoull(argv[0], NULL, 10) : 1000) * 1000;
+
+    // Typing into an empty document and into the middle of a big one must cost the same
+    struct document* empty = document_create();
+    int result = typing(empty, "empty document", count);
+    document_free(empty);
+
+    const size_t length = 256 * 1024 * 1024;
+    uint16_t* text = mem_alloc(length * sizeof(uint16_t));
+    for (size_t i = 0; i < length; i++)
+        text[i] = i % 80 == 79 ? '\n' : 'a' + (uint16_t)(i % 26);
+    struct document* big = document_create_from(text, length, NULL, NULL);
+    result |= typing(big, "512 MB document", count);
+    document_free(big);
+    mem_free(text);
+
+    result |= bulk(16 * 1024 * 1024);
+    result |= budget(count);
+    return result;
+}
@@ -0,0 +1,209 @@
+// Benchmarks the line break translation against the loops convert() used to have (a counting pass and a copying pass)
+// Usage: jittey-bench linebreak [megabytes per corpus, 64 by default]
+
+#include "bench.h"
+#include "../core/linebreak.h"
+#include "../core/simd.h"
+#include "../core/memory.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// The old loops, on UTF-16 and on bytes
+static size_t old_to_win_utf16(const uint16_t* src, size_t length, uint16_t* dst) {
+    size_t new_length = 0;
+    for (size_t i = 0; i < length; i++)
+        new_length += (src[i] == '\n' && (i == 0 || src[i-1] != '\r')) ? 2 : 1;
+
+    uint16_t* d = dst;
+    for (size_t i = 0; i < length; i++, d++) {
+        if (src[i] == '\n' && (i == 0 || src[i-1] != '\r'))
+            *(d++) = '\r';
+        *d = src[i];
+    }
+    return new_length;
+}
+
+static size_t old_to_unix_utf16(const uint16_t* src, size_t length, uint16_t* dst) {
+    size_t new_length = 0;
+    for (size_t i = 0; i < length; i++)
+        new_length += !(src[i] == '\r' && i+1 < length && src[i+1] == '\n');
+
+    uint16_t* d = dst;
+    for (size_t i = 0; i < length; i++) {
+        if (src[i] == '\r' && i+1 < length && src[i+1] == '\n')
+            continue;
+        *(d++) = src[i];
+    }
+    return new_length;
+}
+
+static size_t old_to_win_utf8(const uint8_t* src, size_t size, uint8_t* dst) {
+    size_t new_size = 0;
+    for (size_t i = 0; i < size; i++)
+        new_size += (src[i] == '\n' && (i == 0 || src[i-1] != '\r')) ? 2 : 1;
+
+    uint8_t* d = dst;
+    for (size_t i = 0; i < size; i++, d++) {
+        if (src[i] == '\n' && (i == 0 || src[i-1] != '\r'))
+            *(d++) = '\r';
+        *d = src[i];
+    }
+    return new_size;
+}
+
+static size_t old_to_unix_utf8(const uint8_t* src, size_t size, uint8_t* dst) {
+    size_t new_size = 0;
+    for (size_t i = 0; i < size; i++)
+        new_size += !(src[i] == '\r' && i+1 < size && src[i+1] == '\n');
+
+    uint8_t* d = dst;
+    for (size_t i = 0; i < size; i++) {
+        if (src[i] == '\r' && i+1 < size && src[i+1] == '\n')
+            continue;
+        *(d++) = src[i];
+    }
+    return new_size;
+}
+
+// Fills 'length' characters of lines around 'line' characters long ('spread' is the random variation)
+static void generate(uint16_t* text16, uint8_t* text8, size_t length, size_t line, size_t spread, bool crlf, uint64_t* rng) {
+    size_t i = 0;
+    while (i < length) {
+        size_t n = line - spread / 2 + bench_random(rng) % (spread + 1);
+        for (; n && i < length; n--, i++)
+            text16[i] = 'a' + i % 26;
+        if (crlf && i < length)
+            text16[i++] = '\r';
+        if (i < length)
+            text16[i++] = '\n';
+    }
+    for (i = 0; i < length; i++)
+        text8[i] = (uint8_t)text16[i];
+}
+
+static int run(const char* name, const uint16_t* text16, const uint8_t* text8, size_t length, bool win,
+    uint16_t* out16, uint16_t* expected16, uint8_t* out8, uint8_t* expected8) {
+
+    const int rounds = 5;
+    int result = 0;
+    char label[64];
+
+    double start = bench_now();
+    size_t expected_length = 0;
+    for (int r = 0; r < rounds; r++)
+        expected_length = win ? old_to_win_utf16(text16, length, expected16) : old_to_unix_utf16(text16, length, expected16);
+    snprintf(label, sizeof(label), "%s, utf-16, old loops", name);
+    bench_report(label, (bench_now() - start) / rounds, length * sizeof(uint16_t));
+
+    for (int level = SIMD_NONE; level <= SIMD_SSE2; level++) {
+        simd_limit(level);
+        size_t written = 0;
+        start = bench_now();
+        for (int r = 0; r < rounds; r++) {
+            // Translating to LF may hold back a CR at the very end
+            bool cr = false;
+            written = win ? linebreak_to_win_utf16(text16, length, out16, &cr) : linebreak_to_unix_utf16(text16, length, out16, &cr);
+            if (!win && cr)
+                out16[written++] = '\r';
+        }
+        snprintf(label, sizeof(label), "%s, utf-16, %s", name, level ? "sse2" : "scalar");
+        bench_report(label, (bench_now() - start) / rounds, length * sizeof(uint16_t));
+
+        if (written != expected_length || memcmp(out16, expected16, written * sizeof(uint16_t))) {
+            fprintf(stderr, "  %s differs from the old loops\n", label);
+            result = 1;
+        }
+    }
+
+    start = bench_now();
+    for (int r = 0; r < rounds; r++)
+        expected_length = win ? old_to_win_utf8(text8, length, expected8) : old_to_unix_utf8(text8, length, expected8);
+    snprintf(label, sizeof(label), "%s, utf-8, old loops", name);
+    bench_report(label, (bench_now() - start) / rounds, length);
+
+    for (int level = SIMD_NONE; level <= SIMD_SSE2; level++) {
+        simd_limit(level);
+        size_t written = 0;
+        start = bench_now();
+        for (int r = 0; r < rounds; r++) {
+            bool cr = false;
+            written = win ? linebreak_to_win_utf8(text8, length, out8, &cr) : linebreak_to_unix_utf8(text8, length, out8, &cr);
+            if (!win && cr)
+                out8[written++] = '\r';
+        }
+        snprintf(label, sizeof(label), "%s, utf-8, %s", name, level ? "sse2" : "scalar");
+        bench_report(label, (bench_now() - start) / rounds, length);
+
+        if (written != expected_length || memcmp(out8, expected8, written)) {
+            fprintf(stderr, "  %s differs from the old loops\n", label);
+            result = 1;
+        }
+    }
+
+    simd_limit(SIMD_AVX2);
+    return result;
+}
+
+int bench_linebreak(int argc, char** argv) {
+    const size_t megabytes = argc > 0 ? strtoull(argv[0], NULL, 10) : 64;
+    const size_t length = megabytes * 1024 * 1024 / sizeof(uint16_t);
+    uint64_t rng = 1;
+
+    uint16_t* text16 = mem_alloc(length * sizeof(uint16_t));
+    uint8_t* text8 = mem_alloc(length);
+    uint16_t* out16 = mem_alloc(2 * length * sizeof(uint16_t));
+    uint16_t* expected16 = mem_alloc(2 * length * sizeof(uint16_t));
+    uint8_t* out8 = mem_alloc(2 * length);
+    uint8_t* expected8 = mem_alloc(2 * length);
+
+    // The memory bandwidth, as the reference for the cases where nothing changes
+    generate(text16, text8, length, 80, 0, false, &rng);
+    memset(out16, 1, 2 * length * sizeof(uint16_t));
+    memset(out8, 1, 2 * length);
+    memset(expected16, 1, 2 * length * sizeof(uint16_t));
+    memset(expected8, 1, 2 * length);
+    const double start = bench_now();
+    memcpy(out16, text16, length * sizeof(uint16_t));
+    bench_report("memcpy, utf-16 sized", bench_now() - start, length * sizeof(uint16_t));
+
+    const struct {
+        const char* name;
+        size_t line, spread;
+    } shapes[] = {
+        { "short lines", 12, 8 },
+        { "80 columns", 80, 0 },
+        { "varied lines", 100, 200 },
+        { "long lines", 2000, 1000 },
+    };
+
+    int result = 0;
+    for (size_t i = 0; i < sizeof(shapes) / sizeof(shapes[0]); i++) {
+        printf(" %s\n", shapes[i].name);
+
+        generate(text16, text8, length, shapes[i].line, shapes[i].spread, false, &rng);
+        result |= run("LF to CRLF", text16, text8, length, true, out16, expected16, out8, expected8);
+        result |= run("LF to LF (unchanged)", text16, text8, length, false, out16, expected16, out8, expected8);
+
+        generate(text16, text8, length, shapes[i].line, shapes[i].spread, true, &rng);
+        result |= run("CRLF to LF", text16, text8, length, false, out16, expected16, out8, expected8);
+        result |= run("CRLF to CRLF (unchanged)", text16, text8, length, true, out16, expected16, out8, expected8);
+
+        // Every LF is a part of a CRLF here, so there are as many of them as CRLF to LF removes
+        const double count_start = bench_now();
+        const size_t count = linebreak_count_utf8(text8, length);
+        bench_report("count LFs, utf-8", bench_now() - count_start, length);
+        if (count != length - old_to_unix_utf8(text8, length, out8)) {
+            fprintf(stderr, "  the LF count is off\n");
+            result = 1;
+        }
+    }
+
+    mem_free(expected8);
+    mem_free(out8);
+    mem_free(expected16);
+    mem_free(out16);
+    mem_free(text8);
+    mem_free(text16);
+    return result;
+}
@@ -0,0 +1,106 @@
+// Benchmarks the line index: the caret row and column queries the status bar makes after every key press
+// Usage: jittey-bench lines [millions of lines, 10 by default]
+
+#include "bench.h"
+#include "../core/document.h"
+#include "../core/memory.h"
+
+#include <stdlib.h>
+
+// The old way of finding the line of a position, counting the LFs in front of it, what the edit control did
+static bool count_lfs(void* ctx, const uint16_t* text, size_t length) {
+    size_t* lines = ctx;
+    for (size_t i = 0; i < length; i++)
+        *lines += text[i] == '\n';
+    return true;
+}
+
+int bench_lines(int argc, char** argv) {
+    const size_t millions = argc > 0 ? strtoull(argv[0], NULL, 10) : 10;
+    const size_t count = millions * 1000 * 1000;
+    const size_t queries = 1000000;
+    uint64_t rng = 1;
+
+    // CRLF lines of 0 to 78 characters, the starts are remembered to check the answers
+    size_t* starts = mem_alloc(count * sizeof(*starts));
+    size_t length = 0;
+    for (size_t i = 0; i < count; i++) {
+        starts[i] = length;
+        length += bench_random(&rng) % 79 + 2;
+    }
+
+    uint16_t* text = mem_alloc(length * sizeof(uint16_t));
+    for (size_t i = 0; i < count; i++) {
+        const size_t end = i + 1 < count ? starts[i+1] : length;
+        for (size_t j = starts[i]; j < end - 2; j++)
+            text[j] = 'a' + j % 26;
+        text[end-2] = '\r';
+        text[end-1] = '\n';
+    }
+
+    double start = bench_now();
+    struct document* document = document_create_from(text, length, NULL, NULL);
+    bench_report("create (counting the lines)", bench_now() - start, length * sizeof(uint16_t));
+
+    int result = 0;
+    if (document_line_count(document) != count + 1) {
+        fprintf(stderr, "  line count mismatch\n");
+        result = 1;
+    }
+
+    // Every line starts right after the previous line's LF, the last (empty) one at the very end
+    size_t* positions = mem_alloc(queries * sizeof(*positions));
+    for (size_t i = 0; i < queries; i++)
+        positions[i] = bench_random(&rng) % (length + 1);
+
+    size_t mismatches = 0;
+    start = bench_now();
+    for (size_t i = 0; i < queries; i++) {
+        const size_t row = document_line_of(document, positions[i]);
+        const size_t line_start = document_line_start(document, row);
+        const size_t expected = row < count ? starts[row] : length;
+        mismatches += line_start != expected || positions[i] < line_start || (row + 1 < count && positions[i] >= starts[row+1]);
+    }
+    double elapsed = bench_now() - start;
+    printf("  %-40s %10.3f us\n", "row + column (per query)", elapsed / queries * 1e6);
+
+    // The old way is linear, a few queries are enough to see that
+    const size_t slow_queries = 20;
+    start = bench_now();
+    for (size_t i = 0; i < slow_queries; i++) {
+        size_t row = 0;
+        document_walk(document, 0, positions[i], count_lfs, &row);
+        mismatches += row != document_line_of(document, positions[i]);
+    }
+    elapsed = bench_now() - start;
+    printf("  %-40s %10.3f us\n", "counting the LFs (per query)", elapsed / slow_queries * 1e6);
+
+    // Typing at the start of a line with a status bar update after every key press, every tenth key is Enter
+    const size_t keys = 200000;
+    size_t pos = starts[count / 2], lines = count;
+    start = bench_now();
+    for (size_t i = 0; i < keys; i++, pos++) {
+        const uint16_t c = i % 10 == 9 ? '\n' : 'x';
+        document_insert(document, pos, &c, 1);
+        lines += c == '\n';
+
+        const size_t row = document_line_of(document, pos + 1);
+        mismatches += pos + 1 - document_line_start(document, row) != (c == '\n' ? 0 : i % 10 + 1);
+    }
+    elapsed = bench_now() - start;
+    printf("  %-40s %10.3f us\n", "insert + row + column (per key)", elapsed / keys * 1e6);
+
+    if (document_line_count(document) != lines + 1)
+        mismatches++;
+
+    if (mismatches) {
+        fprintf(stderr, "  %zu wrong answers\n", mismatches);
+        result = 1;
+    }
+
+    document_free(document);
+    mem_free(positions);
+    mem_free(text);
+    mem_free(starts);
+    return result;
+}
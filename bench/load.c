@@ -0,0 +1,134 @@
+// Benchmarks loading on the worker thread with a fake UI: the time to the first chunk, to the whole file and to cancel
+// Usage: jittey-bench load [megabytes, 256 by default]
+
+#include "bench.h"
+#include "../core/document.h"
+#include "../core/loader.h"
+#include "../core/memory.h"
+#include "../core/thread.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// What the UI thread would get through its messages
+struct fake_ui {
+    struct mutex* mutex;
+    struct condition* finished;
+
+    struct loader* loader;
+    bool cancel;
+
+    double start, first, end, cancelled_at;
+    size_t chunks;
+    size_t length, error;
+    enum loader_status status;
+    bool done;
+};
+
+static void fake_sink(void* ctx, const struct loader_progress* progress) {
+    struct fake_ui* ui = ctx;
+    const double now = bench_now();
+
+    if (!ui->chunks++)
+        ui->first = now;
+    if (progress->snapshot) {
+        // The first screen, the way the UI would read it
+        uint16_t screen[4096];
+        document_read(progress->snapshot, 0, screen, 4096);
+        ui->length = document_length(progress->snapshot);
+        document_free(progress->snapshot);
+    }
+
+    // The callback can run before loader_start has returned, 'run' sets the loader while holding the mutex
+    if (ui->cancel && progress->status == LOADER_LOADING && !ui->cancelled_at) {
+        mutex_lock(ui->mutex);
+        if (ui->loader) {
+            ui->cancelled_at = now;
+            loader_cancel(ui->loader);
+        }
+        mutex_unlock(ui->mutex);
+    }
+
+    if (progress->status != LOADER_LOADING) {
+        mutex_lock(ui->mutex);
+        ui->end = now;
+        ui->status = progress->status;
+        ui->error = progress->error;
+        ui->done = true;
+        condition_broadcast(ui->finished);
+        mutex_unlock(ui->mutex);
+    }
+}
+
+// Loads the text and waits for the loader to finish, returns false if it didn't end the expected way:
+// with the document of the expected 'length', or with the first invalid byte at 'length'
+static bool run(const char* name, const uint8_t* text, size_t size, struct format format, bool cancel, enum loader_status expected, size_t length) {
+    struct fake_ui ui = { .mutex = mutex_create(), .finished = condition_create(), .cancel = cancel };
+
+    ui.start = bench_now();
+    mutex_lock(ui.mutex);
+    ui.loader = loader_start(text, size, format, LINEBREAK_WIN, NULL, NULL, fake_sink, &ui);
+    while (!ui.done)
+        condition_wait(ui.finished, ui.mutex);
+    mutex_unlock(ui.mutex);
+    loader_free(ui.loader);
+
+    printf("  %s\n", name);
+    bench_report("  first chunk", ui.first - ui.start, 0);
+    if (cancel)
+        bench_report("  cancelled after the first chunk", ui.end - ui.cancelled_at, 0);
+    else
+        bench_report("  whole file", ui.end - ui.start, size);
+    printf("  %-40s %10zu\n", "  chunks", ui.chunks);
+
+    condition_free(ui.finished);
+    mutex_free(ui.mutex);
+
+    bool success = ui.status == expected;
+    if (expected == LOADER_DONE)
+        success &= ui.length == length;
+    if (expected == LOADER_INVALID)
+        success &= ui.error == length;
+    if (!success)
+        fprintf(stderr, "  %s didn't load correctly\n", name);
+    return success;
+}
+
+int bench_load(int argc, char** argv) {
+    const size_t megabytes = argc > 0 ? strtoull(argv[0], NULL, 10) : 256;
+    const size_t size = megabytes * 1024 * 1024;
+    uint64_t rng = 5;
+
+    // The same text with both kinds of line breaks, CRLF is only indexed and LF has to be converted
+    uint8_t* crlf = mem_alloc(size);
+    uint8_t* lf = mem_alloc(size);
+    for (size_t i = 0; i < size; i++) {
+        const uint64_t r = bench_random(&rng) % 48;
+        lf[i] = r == 0 ? '\n' : 'a' + r % 26;
+        crlf[i] = lf[i];
+        if (lf[i] == '\n' && i > 0 && crlf[i-1] != '\n')
+            crlf[i-1] = '\r';
+    }
+
+    // Every LF of the text that gets converted gains a CR
+    size_t lf_count = 0;
+    for (size_t i = 0; i < size; i++)
+        lf_count += lf[i] == '\n';
+
+    const struct format crlf_format = { .encoding = ENCODING_UTF8, .linebreak = LINEBREAK_WIN, .bom = false };
+    const struct format lf_format = { .encoding = ENCODING_UTF8, .linebreak = LINEBREAK_UNIX, .bom = false };
+
+    int result = 0;
+    result |= !run("crlf (indexed)", crlf, size, crlf_format, false, LOADER_DONE, size);
+    result |= !run("lf (converted)", lf, size, lf_format, false, LOADER_DONE, size + lf_count);
+    result |= !run("crlf, cancelled", crlf, size, crlf_format, true, LOADER_CANCELLED, 0);
+    result |= !run("lf, cancelled", lf, size, lf_format, true, LOADER_CANCELLED, 0);
+
+    // Broken text must be reported with the offset of the first bad byte
+    crlf[size / 2] = 0xFF;
+    result |= !run("invalid", crlf, size, crlf_format, false, LOADER_INVALID, size / 2);
+
+    mem_free(crlf);
+    mem_free(lf);
+    return result;
+}
@@ -0,0 +1,60 @@
+// The headless benchmark driver for the portable core
+// Usage: jittey-bench [benchmark [arguments...]], runs all of the benchmarks if none is specified
+
+#include "bench.h"
+
+#include <string.h>
+
+static const struct {
+    const char* name;
+    benchmark_fn fn;
+} Benchmarks[] = {
+    { "document", bench_document },
+    { "open", bench_open },
+    { "utf", bench_utf },
+    { "convert", bench_convert },
+    { "linebreak", bench_linebreak },
+    { "detect", bench_detect },
+    { "lines", bench_lines },
+    { "save", bench_save },
+    { "load", bench_load },
+    { "view", bench_view },
+    { "wrap", bench_wrap },
+    { "journal", bench_journal },
+    { "find", bench_find },
+    { "replace", bench_replace },
+    { "regex", bench_regex },
+    { "isearch", bench_isearch },
+    { "arena", bench_arena },
+    { "corpus", bench_corpus },
+    { "trace", bench_trace },
+    { "batch", bench_batch },
+    { "decode", bench_decode },
+    { "reopen", bench_reopen },
+};
+
+#define BENCHMARK_COUNT (sizeof(Benchmarks) / sizeof(Benchmarks[0]))
+
+int main(int argc, char** argv) {
+
+    if (argc > 1) {
+        for (size_t i = 0; i < BENCHMARK_COUNT; i++)
+            if (!strcmp(argv[1], Benchmarks[i].name)) {
+                printf("%s\n", Benchmarks[i].name);
+                return Benchmarks[i].fn(argc - 2, argv + 2);
+            }
+
+        fprintf(stderr, "Unknown benchmark '%s', the available ones are:\n", argv[1]);
+        for (size_t i = 0; i < BENCHMARK_COUNT; i++)
+            fprintf(stderr, "  %s\n", Benchmarks[i].name);
+        return 1;
+    }
+
+    int result = 0;
+    for (size_t i = 0; i < BENCHMARK_COUNT; i++) {
+        printf("%s\n", Benchmarks[i].name);
+        result |= Benchmarks[i].fn(0, NULL);
+    }
+
+    return result;
+}
@@ -0,0 +1,73 @@
+// Benchmarks opening huge files through a memory mapping and a lazily loaded document
+// Usage: jittey-bench open [directory [megabytes...]], the files are 1 GB and 4 GB by default
+// The synthetic files are created in the directory (/tmp by default) on the first run and kept for the next ones
+
+#define _POSIX_C_SOURCE 200809L
+#include "bench.h"
+#include "../core/detect.h"
+#include "../core/document.h"
+#include "../core/mapping.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// What the editor needs to show the first screen, generously
+#define FIRST_SCREEN_BYTES (64 * 1024)
+#define FIRST_SCREEN_UNITS (200 * 120)
+
+static int open_file(const char* path) {
+    static uint16_t screen[FIRST_SCREEN_UNITS];
+
+    // Time to first screen: map the file, index the beginning and decode what would be visible
+    double start = bench_now();
+
+    struct mapping mapping;
+    if (!mapping_open(&mapping, path)) {
+        perror(path);
+        return 1;
+    }
+
+    // The editor only samples big files, so this must not depend on the size
+    const struct detection detection = detect_format(mapping.data, mapping.size, DETECT_SAMPLE);
+    struct document* document = document_create_lazy(mapping.data, mapping.size, detection.format.encoding, NULL, NULL);
+    document_load_more(document, FIRST_SCREEN_BYTES);
+    const size_t shown = document_read(document, 0, screen, FIRST_SCREEN_UNITS);
+
+    bench_report("time to first screen", bench_now() - start, 0);
+    printf("  %-40s %10.1f MB (%.1f MB anonymous)\n", "rss after first screen", bench_rss() / 1e6, bench_rss_anon() / 1e6);
+
+    // The rest of the file only has to be validated and measured
+    start = bench_now();
+    while (document_load_more(document, 64 * 1024 * 1024) == DOCUMENT_LOADING);
+    bench_report("index the whole file", bench_now() - start, mapping.size);
+    printf("  %-40s %10.1f MB (%.1f MB anonymous)\n", "rss after indexing", bench_rss() / 1e6, bench_rss_anon() / 1e6);
+
+    const int result = (document_state(document) == DOCUMENT_LOADED && shown == FIRST_SCREEN_UNITS && detection.format.encoding == ENCODING_UTF8) ? 0 : 1;
+    if (result)
+        fprintf(stderr, "  the file didn't load correctly\n");
+
+    document_free(document);
+    mapping_close(&mapping);
+    return result;
+}
+
+int bench_open(int argc, char** argv) {
+    const char* directory = argc > 0 ? argv[0] : "/tmp";
+    static const size_t default_sizes[] = { 1024, 4096 };
+
+    int result = 0;
+    const int count = argc > 1 ? argc - 1 : 2;
+    for (int i = 0; i < count; i++) {
+        const size_t megabytes = argc > 1 ? strtoull(argv[i + 1], NULL, 10) : default_sizes[i];
+
+        char path[512];
+        snprintf(path, sizeof(path), "%s/jittey-bench-%zuM.log", directory, megabytes);
+        printf(" %zu MB\n", megabytes);
+
+        if (bench_generate_log(path, megabytes * 1024 * 1024))
+            return 1;
+        result |= open_file(path);
+    }
+
+    return result;
+}
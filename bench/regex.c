@@ -0,0 +1,173 @@
+// Benchmarks finding all of the matches of regular expressions in a big log, against glibc's regexec
+// Usage: jittey-bench regex [megabytes, 1024 by default]
+// The counts get checked against the literal search of find.h, and a pattern that backtracking takes exponential
+// time for has to take linear time here
+
+#include "bench.h"
+#include "../core/document.h"
+#include "../core/find.h"
+#include "../core/memory.h"
+#include "../core/pool.h"
+#include "../core/regex.h"
+#include "../core/utf.h"
+
+#include <regex.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Converts a UTF-8 string for a pattern, returns its length
+static size_t pattern_of(const char* s, uint16_t* out) {
+    return utf8_to_utf16((const uint8_t*)s, strlen(s), out, NULL);
+}
+
+// Counts the occurrences of a literal with find all
+static size_t literal_count(const struct document* document, struct pool* pool, const char* literal) {
+    uint16_t pattern[64];
+    struct finder* finder = find_create(pattern, pattern_of(literal, pattern), false);
+    size_t* matches;
+    const size_t count = find_all(finder, document, pool, &matches);
+    mem_free(matches);
+    find_free(finder);
+    return count;
+}
+
+// Finds all of the matches of a pattern and reports the throughput, returns SIZE_MAX if the pattern doesn't compile
+static size_t count_all(const char* name, const struct document* document, const char* pattern, bool ignore_case, size_t bytes) {
+    uint16_t units[256];
+    size_t error_at;
+    struct regex* regex = regex_create(units, pattern_of(pattern, units), ignore_case, &error_at);
+    if (!regex) {
+        fprintf(stderr, "  '%s' doesn't compile, the problem is at %zu\n", pattern, error_at);
+        return SIZE_MAX;
+    }
+
+    struct regex_match* matches;
+    const double start = bench_now();
+    const size_t count = regex_all(regex, document, &matches);
+    const double seconds = bench_now() - start;
+
+    char label[128];
+    snprintf(label, sizeof(label), "%s, %zu matches", name, count);
+    bench_report(label, seconds, bytes);
+
+    // The matches are in order and don't overlap
+    bool ordered = !count || matches[count - 1].end <= document_length(document);
+    for (size_t i = 1; i < count && ordered; i++)
+        ordered = matches[i].start >= matches[i - 1].end && matches[i].start > matches[i - 1].start;
+
+    mem_free(matches);
+    regex_free(regex);
+    if (!ordered) {
+        fprintf(stderr, "  '%s' has matches out of order or overlapping\n", pattern);
+        return SIZE_MAX;
+    }
+    return count;
+}
+
+static int expect(const char* pattern, size_t count, size_t lo, size_t hi) {
+    if (count >= lo && count <= hi)
+        return 0;
+    fprintf(stderr, "  '%s' matched %zu times instead of %zu to %zu\n", pattern, count, lo, hi);
+    return 1;
+}
+
+// Counts the matches of an extended POSIX pattern with regexec, the range to search is passed with REG_STARTEND,
+// otherwise every call would go through the rest of the text to find its end
+static size_t regexec_count(const char* pattern, const char* text, size_t size) {
+    regex_t compiled;
+    if (regcomp(&compiled, pattern, REG_EXTENDED | REG_NEWLINE))
+        return SIZE_MAX;
+
+    size_t count = 0;
+    regmatch_t match = { 0, (regoff_t)size };
+    for (; !regexec(&compiled, text, 1, &match, REG_STARTEND); count++) {
+        match.rm_so = match.rm_eo > match.rm_so ? match.rm_eo : match.rm_eo + 1;
+        match.rm_eo = (regoff_t)size;
+    }
+
+    regfree(&compiled);
+    return count;
+}
+
+// Times '(x+x+)+y' on a run of x's without a y, which takes exponential time to backtrack through
+static int pathological(void) {
+    static const char pattern[] = "(x+x+)+y";
+    double seconds[2];
+    int result = 0;
+
+    for (size_t i = 0; i < 2; i++) {
+        const size_t length = (i + 1) * 8 * 1024 * 1024;
+        uint16_t* text = mem_alloc(length * sizeof(uint16_t));
+        for (size_t k = 0; k < length; k++)
+            text[k] = 'x';
+        struct document* document = document_create_from(text, length, NULL, NULL);
+
+        char name[64];
+        snprintf(name, sizeof(name), "'%s' on %zu MB of x", pattern, length * sizeof(uint16_t) / (1024 * 1024));
+        const double start = bench_now();
+        result |= expect(pattern, count_all(name, document, pattern, false, length * sizeof(uint16_t)), 0, 0);
+        seconds[i] = bench_now() - start;
+        document_free(document);
+        mem_free(text);
+    }
+
+    // Twice the text may take about twice the time, nowhere near the square of it
+    if (seconds[1] > seconds[0] * 4 + 0.05) {
+        fprintf(stderr, "  '%s' took %.2f s on twice the text instead of %.2f s, it isn't linear\n", pattern, seconds[1], seconds[0]);
+        result = 1;
+    }
+    return result;
+}
+
+int bench_regex(int argc, char** argv) {
+    const size_t megabytes = argc > 0 ? strtoull(argv[0], NULL, 10) : 1024;
+    const size_t size = megabytes * 1024 * 1024;
+    uint64_t rng = 5;
+    int result = 0;
+
+    char* text8 = mem_alloc(size);
+    bench_fill_log(text8, size, &rng);
+
+    struct document* document = document_create_lazy(text8, size, ENCODING_UTF8, NULL, NULL);
+    while (document_load_more(document, 64 * 1024 * 1024) == DOCUMENT_LOADING);
+
+    // The counts the patterns should have, the last line may be cut short
+    struct pool* pool = pool_create(0);
+    const size_t lines = literal_count(document, pool, "\n");
+    const size_t served = literal_count(document, pool, "served in");
+    const size_t warnings = literal_count(document, pool, "WARN");
+    pool_free(pool);
+    printf(" %zu MB of UTF-8, %zu lines\n", megabytes, lines);
+
+    // A literal with the prefilter, then the literals with what's around them
+    result |= expect("served in", count_all("literal", document, "served in", false, size), served, served);
+    result |= expect("served in \\d+ ms", count_all("literal and digits", document, "served in \\d+ ms", false, size), served - 1, served);
+    result |= expect("INFO REQUEST \\d+", count_all("literal and digits, ignore case", document, "INFO REQUEST \\d+", true, size), served - 1, served);
+    result |= expect("\\[worker-(1[0-5]|\\d)\\] (WARN|ERROR) requ\\S+",
+        count_all("literal, alternatives", document, "\\[worker-(1[0-5]|\\d)\\] (WARN|ERROR) requ\\S+", false, size), warnings - 1, warnings);
+
+    // Nothing for the prefilter, only the DFA
+    result |= expect("^\\d{4}-\\d\\d-\\d\\d \\d\\d:\\d\\d:\\d\\d",
+        count_all("timestamp at every line", document, "^\\d{4}-\\d\\d-\\d\\d \\d\\d:\\d\\d:\\d\\d", false, size), lines, lines + 1);
+    result |= expect("\\d+ ms$", count_all("digits at the end of every line", document, "\\d+ ms$", false, size), lines - 1, lines + 1);
+    result |= expect("[A-Z]{5,}\\d", count_all("no match, DFA only", document, "[A-Z]{5,}\\d", false, size), 0, 0);
+    document_free(document);
+
+    // glibc's regexec on a part of the same text
+    const size_t part = size < 64 * 1024 * 1024 ? size : 64 * 1024 * 1024;
+    document = document_create_lazy(text8, part, ENCODING_UTF8, NULL, NULL);
+    while (document_load_more(document, 64 * 1024 * 1024) == DOCUMENT_LOADING);
+
+    printf(" %zu MB of UTF-8, compared to regexec\n", part / (1024 * 1024));
+    const size_t ours = count_all("served in \\d+ ms", document, "served in \\d+ ms", false, part);
+    const double start = bench_now();
+    const size_t theirs = regexec_count("served in [0-9]+ ms", text8, part);
+    bench_report("regexec, served in [0-9]+ ms", bench_now() - start, part);
+    result |= expect("served in \\d+ ms", ours, theirs, theirs);
+
+    document_free(document);
+    mem_free(text8);
+
+    result |= pathological();
+    return result;
+}
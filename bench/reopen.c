@@ -0,0 +1,196 @@
+// Benchmarks opening a huge file the first time, when all of it has to be indexed, against opening it again with the
+// checkpoints kept the first time, both with the file evicted from the system's cache (unless it's on a tmpfs, where
+// evicting does nothing) and with it cached, then going to random lines in the opened document
+// Usage: jittey-bench reopen [directory [megabytes]], /tmp and 1024 MB by default
+// The file is created in the directory on the first run and kept for the next ones, the checkpoints are kept in a
+// directory next to it, which starts empty. The document built out of the checkpoints has to have the same text and
+// lines as the indexed one, and they must not be used anymore once the file has been written to
+#define _POSIX_C_SOURCE 200809L
+#include "bench.h"
+#include "../core/checkpoint.h"
+#include "../core/detect.h"
+#include "../core/document.h"
+#include "../core/loader.h"
+#include "../core/mapping.h"
+#include "../core/memory.h"
+#include "../core/thread.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// The lines gone to and the code units read at each of them, about a screen
+#define JUMPS 10000
+#define SCREEN_UNITS (50 * 120)
+
+// Drops the file's pages from the system's cache, so that opening it has to read them from the disk again
+static void evict(const char* path) {
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return;
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+// Opens the file the way the editor does, with the checkpoints kept for it if there are any and 'reopen' is true
+static struct loader_progress open_file(const char* path, struct mapping* mapping, bool reopen) {
+    if (!mapping_open(mapping, path)) {
+        perror(path);
+        return (struct loader_progress){ .status = LOADER_CANCELLED };
+    }
+
+    const struct format format = detect_format(mapping->data, mapping->size, DETECT_SAMPLE).format;
+    size_t count = 0;
+    struct document_checkpoint* checkpoints = reopen ? checkpoint_load(path, mapping, format, &count) : NULL;
+    return bench_load_document(mapping->data, mapping->size, format, format.linebreak, checkpoints, count);
+}
+
+// Goes to random lines, reading a screen at each, returns the seconds per jump and a sum of what was read
+static double jump(const struct document* document, uint64_t* sum) {
+    static uint16_t screen[SCREEN_UNITS];
+    uint64_t rng = 25;
+    *sum = 0;
+
+    const double start = bench_now();
+    for (int i = 0; i < JUMPS; i++) {
+        const size_t line = bench_random(&rng) % document_line_count(document);
+        const size_t pos = document_line_start(document, line);
+        const size_t read = document_read(document, pos, screen, SCREEN_UNITS);
+        *sum += pos * 31 + read + (read ? screen[0] + screen[read - 1] : 0);
+    }
+    return (bench_now() - start) / JUMPS;
+}
+
+// Returns true if both documents have the same text
+static bool same_text(const struct document* a, const struct document* b) {
+    if (document_length(a) != document_length(b) || document_line_count(a) != document_line_count(b))
+        return false;
+
+    static uint16_t x[64 * 1024], y[64 * 1024];
+    for (size_t pos = 0; pos < document_length(a); pos += 64 * 1024) {
+        const size_t length = document_read(a, pos, x, 64 * 1024);
+        if (document_read(b, pos, y, 64 * 1024) != length || memcmp(x, y, length * sizeof(uint16_t)))
+            return false;
+    }
+    return true;
+}
+
+// Opens the file and goes to the lines, once without the checkpoints and once with them, every time the lines
+// have to have the same text as the time before
+static int run(const char* path, const char* label, bool cold, uint64_t* sum) {
+    int result = 0;
+    for (int reopen = 0; reopen < 2; reopen++) {
+        // The mapping of the last open is closed by now, the pages of a mapped file wouldn't be dropped
+        if (cold)
+            evict(path);
+
+        struct mapping mapping;
+        const double start = bench_now();
+        struct loader_progress opened = open_file(path, &mapping, reopen);
+        const double seconds = bench_now() - start;
+        if (!opened.snapshot) {
+            fprintf(stderr, "  %s didn't load\n", path);
+            return 1;
+        }
+
+        char name[64];
+        snprintf(name, sizeof(name), "%s, %s", reopen ? "reopen" : "open", label);
+        bench_report(name, seconds, mapping.size);
+        if (opened.indexed != reopen) {
+            fprintf(stderr, "  %s: the checkpoints %s\n", name, reopen ? "weren't used" : "were used");
+            result = 1;
+        }
+
+        uint64_t jumped;
+        const double per_jump = jump(opened.snapshot, &jumped);
+        printf("  %-40s %10.3f us\n", "  go to a line and read a screen", per_jump * 1e6);
+        if (*sum && jumped != *sum) {
+            fprintf(stderr, "  %s: the lines have different text\n", name);
+            result = 1;
+        }
+        *sum = jumped;
+
+        document_free(opened.snapshot);
+        mapping_close(&mapping);
+    }
+    return result;
+}
+
+// Deletes the checkpoints from an earlier run, so the first open has none
+static void clean_up(const char* directory) {
+    DIR* dir = opendir(directory);
+    if (!dir)
+        return;
+
+    char path[1024];
+    for (struct dirent* entry; (entry = readdir(dir));) {
+        if (entry->d_name[0] == '.')
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+        unlink(path);
+    }
+    closedir(dir);
+}
+
+int bench_reopen(int argc, char** argv) {
+    const char* directory = argc > 0 ? argv[0] : "/tmp";
+    const size_t megabytes = argc > 1 ? strtoull(argv[1], NULL, 10) : 1024;
+    int result = 0;
+
+    char path[512], checkpoints[512];
+    snprintf(path, sizeof(path), "%s/jittey-bench-%zuM.log", directory, megabytes);
+    snprintf(checkpoints, sizeof(checkpoints), "%s/jittey-bench-checkpoints", directory);
+    if (bench_generate_log(path, megabytes * 1024 * 1024))
+        return 1;
+    checkpoint_set_directory(checkpoints);
+    clean_up(checkpoints);
+    printf(" %zu MB, %zu processors\n", megabytes, thread_count());
+
+    // The first open indexes the file, then keeps its checkpoints the way the editor does once it's loaded
+    struct mapping mapping;
+    struct loader_progress first = open_file(path, &mapping, false);
+    if (!first.snapshot) {
+        fprintf(stderr, "  %s didn't load\n", path);
+        return 1;
+    }
+    const struct format format = detect_format(mapping.data, mapping.size, DETECT_SAMPLE).format;
+    double start = bench_now();
+    if (!checkpoint_save(path, &mapping, format, first.snapshot)) {
+        perror("  keeping the checkpoints");
+        result = 1;
+    }
+    bench_report("keep the checkpoints", bench_now() - start, 0);
+
+    // Built out of the checkpoints, the document has to be the same
+    struct mapping again;
+    struct loader_progress second = open_file(path, &again, true);
+    if (!second.indexed || !same_text(first.snapshot, second.snapshot)) {
+        fprintf(stderr, "  the document built out of the checkpoints isn't the same\n");
+        result = 1;
+    }
+    document_free(second.snapshot);
+    mapping_close(&again);
+    document_free(first.snapshot);
+    mapping_close(&mapping);
+
+    uint64_t sum = 0;
+    result |= run(path, "not cached", true, &sum);
+    result |= run(path, "cached", false, &sum);
+
+    // Writing to the file (or only touching it) makes the checkpoints out of date
+    utimensat(AT_FDCWD, path, NULL, 0);
+    struct loader_progress touched = open_file(path, &mapping, true);
+    if (touched.indexed) {
+        fprintf(stderr, "  the checkpoints were used for a changed file\n");
+        result = 1;
+    }
+    document_free(touched.snapshot);
+    mapping_close(&mapping);
+
+    checkpoint_set_directory(NULL);
+    return result;
+}
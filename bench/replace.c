@@ -0,0 +1,209 @@
+// Benchmarks finding all of the matches on more and more threads, and replacing all of them at once
+// Usage: jittey-bench replace [megabytes, 1024 by default]
+// Finding all should scale with the number of cores, replacing all should cost about as much as reading the text once
+
+#include "bench.h"
+#include "../core/document.h"
+#include "../core/find.h"
+#include "../core/journal.h"
+#include "../core/memory.h"
+#include "../core/pool.h"
+#include "../core/thread.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static const uint16_t Took[] = { 't', 'o', 'o', 'k' };
+
+// Hashes the whole text of a document
+static bool hash_span(void* ctx, const uint16_t* text, size_t length) {
+    uint64_t* hash = ctx;
+    for (size_t i = 0; i < length; i++)
+        *hash = (*hash ^ text[i]) * 0x100000001B3ull;
+    return true;
+}
+
+static uint64_t hash_of(const struct document* document) {
+    uint64_t hash = 0xCBF29CE484222325ull;
+    document_walk(document, 0, document_length(document), hash_span, &hash);
+    return hash;
+}
+
+static struct finder* finder_of(const char* pattern) {
+    uint16_t units[64];
+    size_t length = 0;
+    for (; pattern[length]; length++)
+        units[length] = (uint8_t)pattern[length];
+    return find_create(units, length, false);
+}
+
+// Finds all of the matches on 1, 2, 4, ... threads, all of them must find the same ones
+static int find_all_scaling(const char* name, const struct document* document, const char* pattern, size_t bytes) {
+    struct finder* finder = finder_of(pattern);
+    size_t* expected = NULL;
+    size_t expected_count = 0;
+    double single = 0;
+    int result = 0;
+
+    // More threads than cores only shows what the overhead is
+    const size_t cores = thread_count();
+    const size_t most = cores > 8 ? cores : 8;
+    printf(" %s (%zu cores)\n", name, cores);
+
+    for (size_t threads = 1; threads <= most; threads *= 2) {
+        struct pool* pool = pool_create(threads);
+        size_t* matches;
+
+        const double start = bench_now();
+        const size_t count = find_all(finder, document, pool, &matches);
+        const double seconds = bench_now() - start;
+
+        char label[64];
+        snprintf(label, sizeof(label), "%zu thread%s, %zu matches", threads, threads > 1 ? "s" : "", count);
+        if (threads == 1)
+            single = seconds;
+        printf("  %-40s %10.3f ms %10.1f MB/s %6.2fx\n", label, seconds * 1e3, bytes / seconds / 1e6, single / seconds);
+
+        if (threads == 1) {
+            expected = matches;
+            expected_count = count;
+        } else {
+            if (count != expected_count || (count && memcmp(matches, expected, count * sizeof(size_t)))) {
+                fprintf(stderr, "  %zu threads found other matches than one\n", threads);
+                result = 1;
+            }
+            mem_free(matches);
+        }
+        pool_free(pool);
+    }
+
+    // Every match is the pattern and the next one starts after it
+    for (size_t i = 1; i < expected_count; i++) {
+        if (expected[i] < expected[i - 1] + find_length(finder)) {
+            fprintf(stderr, "  the matches overlap or are out of order\n");
+            result = 1;
+            break;
+        }
+    }
+
+    mem_free(expected);
+    find_free(finder);
+    return result;
+}
+
+// Undoes and redoes straight in a document
+static void apply_to_document(void* ctx, size_t pos, size_t removed, const uint16_t* text, size_t length) {
+    document_erase(ctx, pos, removed);
+    document_insert(ctx, pos, text, length);
+}
+
+// Replaces every match one edit at a time and then all at once, both must give the same text
+static int replace_all(const struct document* original, size_t bytes, bool one_by_one) {
+    struct pool* pool = pool_create(0);
+    struct finder* finder = finder_of("served in");
+    const size_t removed = find_length(finder);
+    int result = 0;
+
+    size_t* matches;
+    double start = bench_now();
+    const size_t count = find_all(finder, original, pool, &matches);
+    printf(" replace %zu matches in %zu MB\n", count, bytes / (1024 * 1024));
+    bench_report("find all", bench_now() - start, bytes);
+
+    uint64_t expected = 0;
+    if (one_by_one) {
+        struct document* document = document_snapshot(original);
+        start = bench_now();
+        for (size_t i = count; i--;) {
+            document_erase(document, matches[i], removed);
+            document_insert(document, matches[i], Took, 4);
+        }
+        bench_report("one edit per match", bench_now() - start, bytes);
+        expected = hash_of(document);
+        document_free(document);
+    }
+
+    // What the editor does, recorded as one undo step, which needs more than the default budget for the small file
+    struct document* document = document_snapshot(original);
+    struct journal* journal = journal_create(one_by_one ? 4 * JOURNAL_DEFAULT_BUDGET : JOURNAL_DEFAULT_BUDGET);
+    start = bench_now();
+    journal_record_all(journal, document, matches, NULL, count, removed, Took, 4);
+    bench_report("record in the journal", bench_now() - start, 0);
+    start = bench_now();
+    document_replace_all(document, matches, NULL, count, removed, Took, 4);
+    bench_report("replace all in a single pass", bench_now() - start, bytes);
+    printf("  %-40s %10zu (%zu KB)\n", "undo steps", journal_steps(journal), journal_bytes(journal) / 1024);
+
+    if (document_length(document) != document_length(original) - count * (removed - 4)) {
+        fprintf(stderr, "  the replaced document has the wrong length\n");
+        result = 1;
+    }
+    if (one_by_one && hash_of(document) != expected) {
+        fprintf(stderr, "  replacing all at once differs from replacing one at a time\n");
+        result = 1;
+    }
+
+    // Nothing may be left to find
+    size_t* left;
+    const size_t remaining = find_all(finder, document, pool, &left);
+    mem_free(left);
+    if (remaining) {
+        fprintf(stderr, "  %zu matches are left after replacing all of them\n", remaining);
+        result = 1;
+    }
+
+    // The whole replacement is a single step to undo and to redo
+    if (one_by_one) {
+        start = bench_now();
+        journal_undo(journal, apply_to_document, document);
+        bench_report("undo", bench_now() - start, 0);
+        if (hash_of(document) != hash_of(original)) {
+            fprintf(stderr, "  undoing the replacement didn't give back the original text\n");
+            result = 1;
+        }
+
+        start = bench_now();
+        journal_redo(journal, apply_to_document, document);
+        bench_report("redo", bench_now() - start, 0);
+        if (hash_of(document) != expected) {
+            fprintf(stderr, "  redoing the replacement didn't give the replaced text\n");
+            result = 1;
+        }
+    }
+
+    journal_free(journal);
+    document_free(document);
+    mem_free(matches);
+    find_free(finder);
+    pool_free(pool);
+    return result;
+}
+
+int bench_replace(int argc, char** argv) {
+    const size_t megabytes = argc > 0 ? strtoull(argv[0], NULL, 10) : 1024;
+    const size_t size = megabytes * 1024 * 1024;
+    uint64_t rng = 5;
+    int result = 0;
+
+    // Loaded the same way the editor opens a file
+    char* text = mem_alloc(size);
+    bench_fill_log(text, size, &rng);
+    struct document* document = document_create_lazy(text, size, ENCODING_UTF8, NULL, NULL);
+    while (document_load_more(document, 64 * 1024 * 1024) == DOCUMENT_LOADING);
+
+    result |= find_all_scaling("find all, a match on every line", document, "served in", size);
+    result |= find_all_scaling("find all, a match every 50 lines", document, "WARN", size);
+
+    // Replacing one match at a time is only bearable in a smaller file
+    const size_t small = size < 64 * 1024 * 1024 ? size : 64 * 1024 * 1024;
+    struct document* part = document_create_lazy(text, small, ENCODING_UTF8, NULL, NULL);
+    while (document_load_more(part, 64 * 1024 * 1024) == DOCUMENT_LOADING);
+    result |= replace_all(part, small, true);
+    document_free(part);
+
+    result |= replace_all(document, size, false);
+
+    document_free(document);
+    mem_free(text);
+    return result;
+}
@@ -0,0 +1,126 @@
+// Benchmarks saving: the streaming writer against converting the whole text first and writing it at once
+// Usage: jittey-bench save [directory [megabytes of UTF-16 text]], /tmp and 256 MB by default
+
+#define _POSIX_C_SOURCE 200809L
+#include "bench.h"
+#include "../core/convert.h"
+#include "../core/document.h"
+#include "../core/mapping.h"
+#include "../core/memory.h"
+#include "../core/save.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// The format most files are saved in
+static const struct format Target = { .encoding = ENCODING_UTF8, .linebreak = LINEBREAK_UNIX, .bom = false };
+
+// What saving used to do: convert everything into one buffer and write it in one go
+static bool save_whole(const struct document* document, const char* path, uint8_t** out, size_t* out_size) {
+    const size_t length = document_length(document);
+    uint16_t* text = mem_alloc(length * sizeof(uint16_t));
+    document_read(document, 0, text, length);
+
+    const struct format from = { .encoding = ENCODING_UTF16, .linebreak = LINEBREAK_WIN, .bom = false };
+    uint8_t* converted = mem_alloc(convert_bound(text, length * sizeof(uint16_t), from, Target));
+    struct converter* converter = mem_alloc(sizeof(*converter));
+    converter_init_buffer(converter, from, Target, converted);
+    converter_feed(converter, text, length * sizeof(uint16_t));
+    converter_finish(converter);
+    *out_size = converter_size(converter);
+    mem_free(converter);
+    mem_free(text);
+
+    FILE* f = fopen(path, "wb");
+    const bool success = f && fwrite(converted, 1, *out_size, f) == *out_size;
+    if (f)
+        fclose(f);
+
+    *out = converted;
+    return success;
+}
+
+int bench_save(int argc, char** argv) {
+    const char* directory = argc > 0 ? argv[0] : "/tmp";
+    const size_t megabytes = argc > 1 ? strtoull(argv[1], NULL, 10) : 256;
+    const size_t length = megabytes * 1024 * 1024 / sizeof(uint16_t);
+    uint64_t rng = 3;
+
+    // CRLF lines with a bit of non-ASCII text in them
+    uint16_t* text = mem_alloc(length * sizeof(uint16_t));
+    for (size_t i = 0; i < length; i++) {
+        const uint64_t r = bench_random(&rng) % 64;
+        text[i] = r == 0 ? '\r' : r == 1 ? 0x00E9 : r == 2 ? 0x4E2D : 'a' + r % 26;
+        if (text[i] == '\r' && i + 1 < length)
+            text[++i] = '\n';
+    }
+
+    // Edited a bit, so that it isn't one piece after another
+    struct document* document = document_create_from(text, length, NULL, NULL);
+    for (int i = 0; i < 1000; i++) {
+        const uint16_t inserted[] = { 'e', 'd', 'i', 't', '\r', '\n' };
+        document_insert(document, bench_random(&rng) % document_length(document), inserted, 6);
+    }
+
+    char path[512], whole_path[512];
+    snprintf(path, sizeof(path), "%s/jittey-bench-save.txt", directory);
+    snprintf(whole_path, sizeof(whole_path), "%s/jittey-bench-save-whole.txt", directory);
+    int result = 0;
+
+    // The target exists already, the way it usually does
+    FILE* f = fopen(path, "wb");
+    if (!f) {
+        perror(path);
+        return 1;
+    }
+    fputs("the old contents", f);
+    fclose(f);
+
+    const size_t bytes = document_length(document) * sizeof(uint16_t);
+    bench_reset_peak_rss();
+    size_t base = bench_rss();
+    double start = bench_now();
+    if (!save_document(document, path, Target)) {
+        perror("save_document");
+        result = 1;
+    }
+    bench_report("streaming save", bench_now() - start, bytes);
+    printf("  %-40s %10.1f MB\n", "peak memory on top of the document", (bench_peak_rss() - base) / 1e6);
+
+    uint8_t* whole;
+    size_t whole_size;
+    bench_reset_peak_rss();
+    base = bench_rss();
+    start = bench_now();
+    if (!save_whole(document, whole_path, &whole, &whole_size)) {
+        perror(whole_path);
+        result = 1;
+    }
+    bench_report("convert everything, then write", bench_now() - start, bytes);
+    printf("  %-40s %10.1f MB\n", "peak memory on top of the document", (bench_peak_rss() - base) / 1e6);
+
+    // Both ways must have written the same thing
+    struct mapping saved;
+    if (!mapping_open(&saved, path) || saved.size != whole_size || memcmp(saved.data, whole, whole_size)) {
+        fprintf(stderr, "  the saved file is wrong\n");
+        result = 1;
+    }
+    mapping_close(&saved);
+
+    // A save that fails must leave no trace
+    char bad_path[600];
+    snprintf(bad_path, sizeof(bad_path), "%s/jittey-no-such-directory/file.txt", directory);
+    if (save_document(document, bad_path, Target) || errno != ENOENT) {
+        fprintf(stderr, "  saving into a missing directory didn't fail the right way\n");
+        result = 1;
+    }
+
+    unlink(path);
+    unlink(whole_path);
+    mem_free(whole);
+    document_free(document);
+    mem_free(text);
+    return result;
+}
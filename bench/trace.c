@@ -0,0 +1,122 @@
+// Benchmarks what a tracing span costs with tracing off and on, and traces a load and a save of a log into a file
+// Usage: jittey-bench trace [directory [megabytes]], /tmp and 64 MB by default
+// The exported trace has to have the spans of the loader and of both of the saving threads in it
+
+#define _POSIX_C_SOURCE 200809L
+#include "bench.h"
+#include "../core/document.h"
+#include "../core/memory.h"
+#include "../core/save.h"
+#include "../core/trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SPANS 10000000
+
+// Records spans back to back, returns the nanoseconds one takes
+static double spans(const char* name) {
+    const double start = bench_now();
+    uint64_t sum = 0;
+    for (size_t i = 0; i < SPANS; i++)
+        sum += trace_end(trace_begin(), "span");
+
+    const double seconds = bench_now() - start;
+    bench_report(name, seconds, 0);
+    // Keeps the compiler from leaving the spans out
+    if (sum == 1)
+        printf("\n");
+    return seconds / SPANS * 1e9;
+}
+
+// Counts the times a span name is in the exported text
+static size_t count_spans(const char* text, const char* name) {
+    char quoted[64];
+    snprintf(quoted, sizeof(quoted), "\"name\":\"%s\"", name);
+
+    size_t count = 0;
+    for (const char* at = text; (at = strstr(at, quoted)); at++)
+        count++;
+    return count;
+}
+
+// Loads the text as the editor would and saves it again, both with their spans recorded
+static int trace_load_save(const char* directory, size_t size) {
+    char* text = mem_alloc(size);
+    uint64_t rng = 17;
+    bench_fill_log(text, size, &rng);
+
+    char path[512], trace_path[512];
+    snprintf(path, sizeof(path), "%s/jittey-bench-trace.txt", directory);
+    snprintf(trace_path, sizeof(trace_path), "%s/jittey-bench-trace.json", directory);
+
+    const uint64_t open = trace_begin();
+    const struct format format = { .encoding = ENCODING_UTF8, .linebreak = LINEBREAK_UNIX, .bom = false };
+    struct document* document = bench_load_document(text, size, format, LINEBREAK_WIN, NULL, 0).snapshot;
+    bench_report("traced load", trace_end(open, "open") / 1e9, size);
+
+    int result = !document;
+    const uint64_t save = trace_begin();
+    result |= document && !save_document(document, path, format);
+    bench_report("traced save", trace_end(save, "save") / 1e9, size);
+    if (result)
+        fprintf(stderr, "  the traced load or save failed\n");
+
+    double start = bench_now();
+    if (!trace_export(trace_path)) {
+        perror(trace_path);
+        result = 1;
+    }
+    bench_report("export", bench_now() - start, 0);
+
+    // The whole trace fits in memory easily, the rings are bounded
+    FILE* f = fopen(trace_path, "rb");
+    if (f) {
+        fseek(f, 0, SEEK_END);
+        const size_t trace_size = (size_t)ftell(f);
+        fseek(f, 0, SEEK_SET);
+        char* trace = mem_alloc(trace_size + 1);
+        trace[fread(trace, 1, trace_size, f)] = '\0';
+        fclose(f);
+
+        static const char* names[] = { "open", "load: convert", "load: report", "save", "save: convert", "save: write", "save: replace" };
+        printf("  %-40s %10zu KB\n", "trace", trace_size / 1024);
+        for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+            const size_t count = count_spans(trace, names[i]);
+            printf("  %-40s %10zu\n", names[i], count);
+            if (!count) {
+                fprintf(stderr, "  the trace has no '%s' spans\n", names[i]);
+                result = 1;
+            }
+        }
+        if (strncmp(trace, "{\"traceEvents\":[", 16) || !strstr(trace, "\n],\"displayTimeUnit\"")) {
+            fprintf(stderr, "  the trace isn't in the trace event format\n");
+            result = 1;
+        }
+        mem_free(trace);
+    }
+
+    document_free(document);
+    mem_free(text);
+    unlink(path);
+    unlink(trace_path);
+    return result;
+}
+
+int bench_trace(int argc, char** argv) {
+    const char* directory = argc > 0 ? argv[0] : "/tmp";
+    const size_t megabytes = argc > 1 ? strtoull(argv[1], NULL, 10) : 64;
+    int result = 0;
+
+    printf(" %u spans\n", SPANS);
+    const double off = spans("tracing off");
+    trace_enable(true);
+    const double on = spans("tracing on, the ring wraps around");
+    printf("  %-40s %10.1f ns off, %.1f ns on\n", "a span", off, on);
+
+    printf(" %zu MB of UTF-8 with LF line breaks\n", megabytes);
+    result |= trace_load_save(directory, megabytes * 1024 * 1024);
+    trace_enable(false);
+    return result;
+}
@@ -0,0 +1,136 @@
+// Benchmarks the UTF-8 decoder and encoder: the old way (measure, then convert) against a single pass at every instruction set
+// Usage: jittey-bench utf [megabytes per corpus, 64 by default]
+
+#include "bench.h"
+#include "../core/utf.h"
+#include "../core/simd.h"
+#include "../core/memory.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Generates 'size' bytes of UTF-8 text, 'exotic' is the percentage of characters that are not ASCII
+// 'wide' picks three byte (CJK) characters over two byte ones, every 64th of the exotic ones is an emoji
+static size_t generate(uint8_t* out, size_t size, int exotic, bool wide, uint64_t* rng) {
+    size_t i = 0;
+    while (i + 4 <= size) {
+        const uint64_t r = bench_random(rng);
+        if ((int)(r % 100) >= exotic) {
+            out[i++] = (r >> 8) % 61 == 0 ? '\n' : ' ' + (r >> 16) % 95;
+        } else if ((r >> 8) % 64 == 0) {
+            const uint32_t cp = 0x1F600 + (r >> 16) % 64;
+            out[i++] = 0xF0 | (cp >> 18);
+            out[i++] = 0x80 | ((cp >> 12) & 0x3F);
+            out[i++] = 0x80 | ((cp >> 6) & 0x3F);
+            out[i++] = 0x80 | (cp & 0x3F);
+        } else if (wide) {
+            const uint32_t cp = 0x4E00 + (r >> 16) % 0x5000;
+            out[i++] = 0xE0 | (cp >> 12);
+            out[i++] = 0x80 | ((cp >> 6) & 0x3F);
+            out[i++] = 0x80 | (cp & 0x3F);
+        } else {
+            const uint32_t cp = 0xC0 + (r >> 16) % 0x180;
+            out[i++] = 0xC0 | (cp >> 6);
+            out[i++] = 0x80 | (cp & 0x3F);
+        }
+    }
+    while (i < size)
+        out[i++] = '\n';
+    return size;
+}
+
+static const char* const Level_names[] = { "scalar", "sse2", "avx2" };
+
+int bench_utf(int argc, char** argv) {
+    const size_t megabytes = argc > 0 ? strtoull(argv[0], NULL, 10) : 64;
+    const size_t size = megabytes * 1024 * 1024;
+    const int rounds = 5;
+    uint64_t rng = 1;
+
+    const struct {
+        const char* name;
+        int exotic;
+        bool wide;
+    } corpora[] = {
+        { "ascii", 0, false },
+        { "latin (5% non-ASCII)", 5, false },
+        { "cyrillic-like (60%)", 60, false },
+        { "cjk (90%)", 90, true },
+    };
+
+    uint8_t* src = mem_alloc(size);
+    uint16_t* expected = mem_alloc(size * sizeof(uint16_t));
+    uint16_t* dst = mem_alloc(size * sizeof(uint16_t));
+    uint8_t* encoded = mem_alloc(size * 3);
+    const enum simd_level best = simd_level();
+    int result = 0;
+
+    for (size_t c = 0; c < sizeof(corpora) / sizeof(corpora[0]); c++) {
+        generate(src, size, corpora[c].exotic, corpora[c].wide, &rng);
+        printf(" %s\n", corpora[c].name);
+
+        // The baseline mirrors what MultiByteToWideChar is used for: one pass to size the buffer, another to fill it
+        simd_limit(SIMD_NONE);
+        size_t length = 0;
+        double start = bench_now();
+        for (int r = 0; r < rounds; r++) {
+            length = utf8_length_utf16(src, size, NULL);
+            utf8_to_utf16(src, size, expected, NULL);
+        }
+        bench_report("decode, two passes, scalar", (bench_now() - start) / rounds, size);
+
+        for (int level = SIMD_NONE; level <= (int)best; level++) {
+            simd_limit(level);
+            size_t written = 0;
+            start = bench_now();
+            for (int r = 0; r < rounds; r++)
+                written = utf8_to_utf16(src, size, dst, NULL);
+
+            char name[64];
+            snprintf(name, sizeof(name), "decode, one pass, %s", Level_names[level]);
+            bench_report(name, (bench_now() - start) / rounds, size);
+
+            if (written != length || memcmp(dst, expected, length * sizeof(uint16_t))) {
+                fprintf(stderr, "  %s output differs from the scalar one\n", Level_names[level]);
+                result = 1;
+            }
+            if (utf8_length_utf16(src, size, NULL) != length) {
+                fprintf(stderr, "  %s length differs from the scalar one\n", Level_names[level]);
+                result = 1;
+            }
+        }
+
+        // Encoding the decoded text again has to give back the exact same bytes
+        simd_limit(SIMD_NONE);
+        start = bench_now();
+        for (int r = 0; r < rounds; r++) {
+            utf16_length_utf8(expected, length);
+            utf16_to_utf8(expected, length, encoded);
+        }
+        bench_report("encode, two passes, scalar", (bench_now() - start) / rounds, size);
+
+        for (int level = SIMD_NONE; level <= (int)best; level++) {
+            simd_limit(level);
+            size_t written = 0;
+            start = bench_now();
+            for (int r = 0; r < rounds; r++)
+                written = utf16_to_utf8(expected, length, encoded);
+
+            char name[64];
+            snprintf(name, sizeof(name), "encode, one pass, %s", Level_names[level]);
+            bench_report(name, (bench_now() - start) / rounds, size);
+
+            if (written != size || memcmp(encoded, src, size)) {
+                fprintf(stderr, "  %s encoder doesn't give back the original text\n", Level_names[level]);
+                result = 1;
+            }
+        }
+    }
+
+    simd_limit(best);
+    mem_free(encoded);
+    mem_free(dst);
+    mem_free(expected);
+    mem_free(src);
+    return result;
+}
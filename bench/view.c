@@ -0,0 +1,167 @@
+// Benchmarks the text view: painting and scrolling a tiny and a huge file with fake font metrics
+// Usage: jittey-bench view [directory [megabytes]], the huge file is 2 GB by default
+// The cost of a screen must not depend on the size of the file, both files are measured the same way
+
+#define _POSIX_C_SOURCE 200809L
+#include "bench.h"
+#include "../core/document.h"
+#include "../core/mapping.h"
+#include "../core/view.h"
+
+#include <stdlib.h>
+
+// A screen of a 1600x1000 window with an 8x16 monospace font
+#define CHAR_WIDTH 8
+#define LINE_HEIGHT 16
+#define VIEW_WIDTH 1600
+#define VIEW_HEIGHT 1000
+
+static void fake_extents(void* ctx, const uint16_t* text, size_t length, int* extents) {
+    (void)ctx;
+    (void)text;
+    for (size_t i = 0; i < length; i++)
+        extents[i] = (int)(i + 1) * CHAR_WIDTH;
+}
+
+// Counts what would be drawn and remembers the first run
+struct canvas {
+    size_t runs, units;
+    int first_x, first_y;
+    uint16_t first;
+};
+
+static void fake_draw(void* ctx, int x, int y, int width, const uint16_t* text, size_t length, bool selected) {
+    (void)width;
+    (void)selected;
+    struct canvas* canvas = ctx;
+    if (!canvas->runs++) {
+        canvas->first_x = x;
+        canvas->first_y = y;
+        canvas->first = length ? text[0] : 0;
+    }
+    canvas->units += length;
+}
+
+// Paints the same screen a number of times, returns the time per paint
+static double paint(struct view* view, struct canvas* canvas, size_t times) {
+    const double start = bench_now();
+    for (size_t i = 0; i < times; i++) {
+        *canvas = (struct canvas){ 0 };
+        view_paint(view, fake_draw, canvas);
+    }
+    return (bench_now() - start) / times;
+}
+
+static int view_file(const char* path) {
+    struct mapping mapping;
+    if (!mapping_open(&mapping, path)) {
+        perror(path);
+        return 1;
+    }
+
+    struct document* document = document_create_lazy(mapping.data, mapping.size, ENCODING_UTF8, NULL, NULL);
+    while (document_load_more(document, 64 * 1024 * 1024) == DOCUMENT_LOADING);
+
+    const size_t rss = bench_rss_anon();
+
+    const struct view_metrics metrics = { fake_extents, NULL, LINE_HEIGHT };
+    struct view* view = view_create(document, &metrics);
+    view_resize(view, VIEW_WIDTH, VIEW_HEIGHT);
+
+    const size_t lines = document_line_count(document);
+    const size_t page = view_page_lines(view);
+    struct canvas canvas;
+    int result = 0;
+
+    // The top, the middle and the end of the file
+    const size_t tops[] = { 0, lines / 2, lines > page ? lines - page : 0 };
+    const char* names[] = { "paint at the top (per screen)", "paint in the middle (per screen)", "paint at the end (per screen)" };
+    for (size_t i = 0; i < 3; i++) {
+        view_scroll_to(view, tops[i]);
+        printf("  %-40s %10.3f us\n", names[i], paint(view, &canvas, 100) * 1e6);
+
+        // The first run is the start of the top line (every line of the log starts with a digit)
+        uint16_t expected = 0;
+        document_read(document, document_line_start(document, tops[i]), &expected, 1);
+        if (canvas.first_x || canvas.first_y || canvas.first != expected || !canvas.units) {
+            fprintf(stderr, "  the screen at line %zu is wrong\n", tops[i]);
+            result = 1;
+        }
+    }
+
+    // Scrolling with the wheel, three lines at a time, repainting after every step
+    view_scroll_to(view, lines / 3);
+    const size_t steps = 10000;
+    double start = bench_now();
+    for (size_t i = 0; i < steps; i++) {
+        view_scroll_lines(view, 3);
+        canvas = (struct canvas){ 0 };
+        view_paint(view, fake_draw, &canvas);
+    }
+    printf("  %-40s %10.3f us\n", "scroll 3 lines + paint (per step)", (bench_now() - start) / steps * 1e6);
+
+    // Holding the down arrow and page down
+    view_select(view, document_line_start(document, lines / 4), document_line_start(document, lines / 4));
+    start = bench_now();
+    for (size_t i = 0; i < steps; i++) {
+        view_move(view, VIEW_DOWN, false);
+        canvas = (struct canvas){ 0 };
+        view_paint(view, fake_draw, &canvas);
+    }
+    printf("  %-40s %10.3f us\n", "arrow down + paint (per key)", (bench_now() - start) / steps * 1e6);
+
+    const size_t line = document_line_of(document, view_caret(view));
+    if (line != (lines / 4 + steps < lines ? lines / 4 + steps : lines - 1)) {
+        fprintf(stderr, "  the caret ended up on line %zu\n", line);
+        result = 1;
+    }
+
+    start = bench_now();
+    for (size_t i = 0; i < steps / 10; i++) {
+        view_move(view, VIEW_PAGE_DOWN, true);
+        canvas = (struct canvas){ 0 };
+        view_paint(view, fake_draw, &canvas);
+    }
+    printf("  %-40s %10.3f us\n", "shift + page down + paint (per key)", (bench_now() - start) / (steps / 10) * 1e6);
+
+    // Ctrl+End and back
+    start = bench_now();
+    view_move(view, VIEW_DOCUMENT_END, false);
+    view_paint(view, fake_draw, &canvas);
+    view_move(view, VIEW_DOCUMENT_START, false);
+    view_paint(view, fake_draw, &canvas);
+    printf("  %-40s %10.3f us\n", "ctrl + end, ctrl + home, paint both", (bench_now() - start) * 1e6);
+
+    if (view_caret(view) || view_top_line(view)) {
+        fprintf(stderr, "  ctrl + home didn't go to the start\n");
+        result = 1;
+    }
+
+    // The view itself must not need memory that grows with the file
+    printf("  %-40s %10.1f MB\n", "anonymous memory grown by the view", ((double)bench_rss_anon() - rss) / 1e6);
+
+    view_free(view);
+    document_free(document);
+    mapping_close(&mapping);
+    return result;
+}
+
+int bench_view(int argc, char** argv) {
+    const char* directory = argc > 0 ? argv[0] : "/tmp";
+    const size_t megabytes = argc > 1 ? strtoull(argv[1], NULL, 10) : 2048;
+
+    char path[512];
+    snprintf(path, sizeof(path), "%s/jittey-bench-2K.log", directory);
+    printf(" 2 KB\n");
+    if (bench_generate_log(path, 2048))
+        return 1;
+    int result = view_file(path);
+
+    snprintf(path, sizeof(path), "%s/jittey-bench-%zuM.log", directory, megabytes);
+    printf(" %zu MB\n", megabytes);
+    if (bench_generate_log(path, megabytes * 1024 * 1024))
+        return 1;
+    result |= view_file(path);
+
+    return result;
+}
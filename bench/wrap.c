@@ -0,0 +1,159 @@
+// Benchmarks word wrapping: resize storms (dragging the edge of the window) over a file with a million lines
+// Usage: jittey-bench wrap [thousands of lines, 1000 by default]
+// Only the visible lines should get wrapped, so a resize must cost as much as a screen, not as much as the file
+
+#include "bench.h"
+#include "../core/document.h"
+#include "../core/memory.h"
+#include "../core/view.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A 1600x1000 window with an 8x16 monospace font
+#define CHAR_WIDTH 8
+#define LINE_HEIGHT 16
+#define VIEW_WIDTH 1600
+#define VIEW_HEIGHT 1000
+
+static void fake_extents(void* ctx, const uint16_t* text, size_t length, int* extents) {
+    (void)ctx;
+    (void)text;
+    for (size_t i = 0; i < length; i++)
+        extents[i] = (int)(i + 1) * CHAR_WIDTH;
+}
+
+// Hashes everything that was drawn, to compare two views
+struct canvas {
+    size_t length;
+    uint64_t hash;
+};
+
+static void fake_draw(void* ctx, int x, int y, int width, const uint16_t* text, size_t length, bool selected) {
+    (void)selected;
+    struct canvas* canvas = ctx;
+    canvas->hash = (canvas->hash ^ (uint64_t)(x * 31 + y * 17 + width)) * 0x100000001B3ull;
+    for (size_t i = 0; i < length; i++)
+        canvas->hash = (canvas->hash ^ text[i]) * 0x100000001B3ull;
+    canvas->length += length;
+}
+
+static uint64_t paint(struct view* view) {
+    struct canvas canvas = { .hash = 0xCBF29CE484222325ull };
+    view_paint(view, fake_draw, &canvas);
+    return canvas.hash;
+}
+
+int bench_wrap(int argc, char** argv) {
+    const size_t count = (argc > 0 ? strtoull(argv[0], NULL, 10) : 1000) * 1000;
+    uint64_t rng = 7;
+
+    // Lines of words, most of them short, every tenth one long enough to wrap a few times
+    // The text gets loaded the same way the editor opens a file, in pieces over a UTF-8 buffer
+    size_t capacity = count * 64, size = 0;
+    char* text = mem_alloc(capacity);
+    for (size_t i = 0; i < count; i++) {
+        const size_t line = i % 10 ? bench_random(&rng) % 80 : bench_random(&rng) % 600;
+        if (size + line + 2 > capacity) {
+            capacity *= 2;
+            text = mem_realloc(text, capacity);
+        }
+
+        for (size_t j = 0; j < line; j++)
+            text[size++] = bench_random(&rng) % 6 ? 'a' + (char)(bench_random(&rng) % 26) : ' ';
+        text[size++] = '\r';
+        text[size++] = '\n';
+    }
+
+    struct document* document = document_create_lazy(text, size, ENCODING_UTF8, NULL, NULL);
+    while (document_load_more(document, 64 * 1024 * 1024) == DOCUMENT_LOADING);
+
+    const struct view_metrics metrics = { fake_extents, NULL, LINE_HEIGHT };
+    struct view* view = view_create(document, &metrics);
+    view_resize(view, VIEW_WIDTH, VIEW_HEIGHT);
+    view_scroll_to(view, count / 2);
+    paint(view);
+
+    const size_t rss = bench_rss_anon();
+    int result = 0;
+
+    // Turning wrapping on and off, what the menu does
+    const size_t toggles = 1000;
+    double start = bench_now();
+    for (size_t i = 0; i < toggles; i++) {
+        view_set_wrap(view, !view_wrap(view));
+        paint(view);
+    }
+    printf("  %-40s %10.3f us\n", "toggle wrap + paint", (bench_now() - start) / toggles * 1e6);
+    view_set_wrap(view, true);
+
+    // Dragging the edge of the window back and forth, every step is a new width and a repaint
+    const size_t steps = 5000;
+    const size_t top = view_top_line(view);
+    start = bench_now();
+    for (size_t i = 0; i < steps; i++) {
+        const int width = 400 + (int)(i % 300) * 4;
+        view_resize(view, width, VIEW_HEIGHT);
+        paint(view);
+    }
+    const double storm = (bench_now() - start) / steps;
+    printf("  %-40s %10.3f us\n", "resize + paint (per step)", storm * 1e6);
+
+    if (view_top_line(view) != top) {
+        fprintf(stderr, "  the view moved from line %zu to %zu while resizing\n", top, view_top_line(view));
+        result = 1;
+    }
+
+    // The same storm all over the file, so that nothing is cached
+    start = bench_now();
+    for (size_t i = 0; i < steps; i++) {
+        view_scroll_to(view, bench_random(&rng) % count);
+        view_resize(view, 400 + (int)(bench_random(&rng) % 1200), VIEW_HEIGHT);
+        paint(view);
+    }
+    printf("  %-40s %10.3f us\n", "jump + resize + paint (per step)", (bench_now() - start) / steps * 1e6);
+
+    // Typing into a long wrapped line, every key goes through the cache
+    view_resize(view, VIEW_WIDTH, VIEW_HEIGHT);
+    view_select(view, document_line_start(document, count / 2 + 10) + 5, document_line_start(document, count / 2 + 10) + 5);
+    const size_t keys = 20000;
+    start = bench_now();
+    for (size_t i = 0; i < keys; i++) {
+        const uint16_t c = i % 7 ? 'x' : ' ';
+        view_insert(view, &c, 1);
+        paint(view);
+    }
+    printf("  %-40s %10.3f us\n", "type into a wrapped line + paint", (bench_now() - start) / keys * 1e6);
+
+    // After all of that, the view must show exactly what a new one does
+    struct view* fresh = view_create(document, &metrics);
+    view_resize(fresh, VIEW_WIDTH, VIEW_HEIGHT);
+    view_set_wrap(fresh, true);
+    view_scroll_to(view, count / 2);
+    view_scroll_to(fresh, count / 2);
+    view_select(view, 0, 0);
+    view_scroll_to(view, count / 2);
+    if (paint(view) != paint(fresh)) {
+        fprintf(stderr, "  the cached rows differ from the fresh ones\n");
+        result = 1;
+    }
+    view_free(fresh);
+
+    printf("  %-40s %10.1f MB\n", "anonymous memory grown by wrapping", ((double)bench_rss_anon() - rss) / 1e6);
+
+    // What rewrapping the whole file would cost on every resize, the way the edit control did it
+    struct view* whole = view_create(document, &metrics);
+    view_resize(whole, VIEW_WIDTH, INT_MAX);
+    view_set_wrap(whole, true);
+    start = bench_now();
+    paint(whole);
+    const double full = bench_now() - start;
+    printf("  %-40s %10.3f ms (%.0fx a resize)\n", "wrap the whole file once", full * 1e3, full / storm);
+    view_free(whole);
+
+    view_free(view);
+    document_free(document);
+    mem_free(text);
+    return result;
+}
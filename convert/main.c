@@ -0,0 +1,74 @@
+// The headless batch converter for everything but Windows, jittey --convert does the same on Windows
+// Usage: jittey-convert format paths..., see batch_parse_format for the format, e.g. "utf-8,lf"
+// Every path is a file or a directory converted with all of its subdirectories, see batch_add
+
+#define _POSIX_C_SOURCE 200809L
+#include "../core/batch.h"
+#include "../core/pool.h"
+#include "../core/thread.h"
+#include "../core/trace.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static const char* Encodings[] = {
+    [ENCODING_UTF8   ] = "UTF-8",
+    [ENCODING_UTF16  ] = "UTF-16",
+    [ENCODING_UTF16BE] = "UTF-16 BE"
+};
+
+static const char* Statuses[] = {
+    [BATCH_PENDING  ] = "pending",
+    [BATCH_CONVERTED] = "converted",
+    [BATCH_UNCHANGED] = "unchanged",
+    [BATCH_SKIPPED  ] = "skipped",
+    [BATCH_INVALID  ] = "invalid",
+    [BATCH_FAILED   ] = "failed"
+};
+
+int main(int argc, char** argv) {
+    struct format format;
+    if (argc < 3 || !batch_parse_format(argv[1], &format)) {
+        fprintf(stderr, "Usage: %s format paths...\n", argv[0]);
+        fprintf(stderr, "  format: utf-8, utf-16 or utf-16be, then optionally bom and lf, crlf or keep, e.g. utf-16,bom,crlf\n");
+        return 2;
+    }
+
+    const uint64_t start = trace_now();
+    struct batch* batch = batch_create(format);
+    int result = 0;
+    for (int i = 2; i < argc; i++)
+        if (!batch_add(batch, argv[i])) {
+            perror(argv[i]);
+            result = 1;
+        }
+
+    struct pool* pool = pool_create(BATCH_THREADS * thread_count());
+    if (batch_run(batch, pool))
+        result = 1;
+    pool_free(pool);
+    const double seconds = (trace_now() - start) / 1e9;
+
+    size_t counts[sizeof(Statuses) / sizeof(Statuses[0])] = {0};
+    size_t bytes = 0;
+    for (size_t i = 0; i < batch_count(batch); i++) {
+        const struct batch_file* file = batch_file(batch, i);
+        counts[file->status]++;
+        bytes += file->size;
+
+        // The format it was detected in, so what it was converted from
+        printf("%-9s  %-9s %-3s %10.1f MB/s  %s", Statuses[file->status], Encodings[file->from.encoding],
+            file->from.bom ? "BOM" : "", file->time ? file->size / (file->time / 1e9) / 1e6 : 0.0, file->path);
+        if (file->status == BATCH_FAILED)
+            printf(": %s", strerror((int)file->error));
+        printf("\n");
+    }
+
+    printf("%zu files, %.1f MB in %.0f ms, %.1f MB/s on %zu threads:", batch_count(batch), bytes / 1e6, seconds * 1e3,
+        seconds > 0 ? bytes / seconds / 1e6 : 0.0, BATCH_THREADS * thread_count());
+    for (size_t i = BATCH_CONVERTED; i < sizeof(Statuses) / sizeof(Statuses[0]); i++)
+        printf(" %zu %s%s", counts[i], Statuses[i], i + 1 < sizeof(Statuses) / sizeof(Statuses[0]) ? "," : "\n");
+
+    batch_free(batch);
+    return result;
+}
@@ -0,0 +1,120 @@
+#include "arena.h"
+#include "memory.h"
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Every allocation is aligned like malloc aligns its memory
+#define ARENA_ALIGN alignof(max_align_t)
+
+struct arena_block {
+    struct arena_block* next;
+    size_t size;
+    alignas(max_align_t) uint8_t data[];
+};
+
+// The pool is shared by every thread (a load runs on its own one), the lock is only ever held for a few instructions
+static atomic_flag Lock = ATOMIC_FLAG_INIT;
+static struct arena_block* Pool[ARENA_POOL];
+static size_t Pooled = 0;
+static size_t Reused = 0, Allocated = 0;
+
+static void lock(void) {
+    while (atomic_flag_test_and_set_explicit(&Lock, memory_order_acquire));
+}
+
+static void unlock(void) {
+    atomic_flag_clear_explicit(&Lock, memory_order_release);
+}
+
+// Takes a block of at least 'size' bytes, from the pool if it's a regular one
+static struct arena_block* block_take(size_t size) {
+    struct arena_block* block = NULL;
+
+    lock();
+    if (size <= ARENA_BLOCK && Pooled) {
+        block = Pool[--Pooled];
+        Reused++;
+    } else {
+        Allocated++;
+    }
+    unlock();
+
+    if (!block) {
+        if (size < ARENA_BLOCK)
+            size = ARENA_BLOCK;
+        block = mem_alloc(sizeof(*block) + size);
+        block->size = size;
+    }
+    block->next = NULL;
+    return block;
+}
+
+// Gives a block back, to the pool if it's a regular one and there is room
+static void block_give(struct arena_block* block) {
+    bool kept = false;
+
+    lock();
+    if (block->size == ARENA_BLOCK && Pooled < ARENA_POOL) {
+        Pool[Pooled++] = block;
+        kept = true;
+    }
+    unlock();
+
+    if (!kept)
+        mem_free(block);
+}
+
+void arena_init(struct arena* arena) {
+    arena->blocks = NULL;
+    arena->used = 0;
+}
+
+void* arena_alloc(struct arena* arena, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    struct arena_block* block = arena->blocks;
+    if (!block || block->size - arena->used < size) {
+        // The new block goes in front, the rest of the old one is wasted, which is fine for the few buffers of an operation
+        struct arena_block* fresh = block_take(size);
+        fresh->next = block;
+        arena->blocks = block = fresh;
+        arena->used = 0;
+    }
+
+    void* memory = block->data + arena->used;
+    arena->used += size;
+    return memory;
+}
+
+void arena_reset(struct arena* arena) {
+    while (arena->blocks) {
+        struct arena_block* next = arena->blocks->next;
+        block_give(arena->blocks);
+        arena->blocks = next;
+    }
+    arena->used = 0;
+}
+
+void arena_trim(void) {
+    lock();
+    const size_t count = Pooled;
+    struct arena_block* blocks[ARENA_POOL];
+    for (size_t i = 0; i < count; i++)
+        blocks[i] = Pool[i];
+    Pooled = 0;
+    unlock();
+
+    for (size_t i = 0; i < count; i++)
+        mem_free(blocks[i]);
+}
+
+void arena_get_stats(struct arena_stats* stats) {
+    lock();
+    stats->reused = Reused;
+    stats->allocated = Allocated;
+    stats->pooled = Pooled;
+    unlock();
+}
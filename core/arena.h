@@ -0,0 +1,45 @@
+#pragma once
+// Scratch memory for an operation that needs big buffers once in a while, like the buffers of a save or the converter
+// of a load
+//
+// An arena hands out memory by moving a pointer through a block and gives all of it back at once when the operation
+// is over, so an operation takes a block or two however many buffers it needs. The blocks given back are kept in
+// a small pool, so the next load or save reuses them instead of allocating (and faulting in) new memory, and big
+// buffers that come and go don't fragment the heap over a long session.
+
+#include <stddef.h>
+
+// The size of a pooled block, anything that doesn't fit gets a block of its own, which isn't kept
+#define ARENA_BLOCK (4 * 1024 * 1024)
+// The number of blocks the pool keeps
+#define ARENA_POOL 4
+
+struct arena_block;
+
+// An arena can be placed anywhere (the stack of the operation is fine), it has to be set up with arena_init
+struct arena {
+    // The block memory is taken from, the ones before it are full
+    struct arena_block* blocks;
+    size_t used;
+};
+
+void arena_init(struct arena* arena);
+
+// Returns 'size' bytes aligned for anything, which are valid until the arena is reset, never returns NULL
+void* arena_alloc(struct arena* arena, size_t size);
+
+// Gives all of the memory of the arena back, to the pool as long as there is room in it
+void arena_reset(struct arena* arena);
+
+// Frees the blocks kept in the pool, e.g. before the application goes idle for a long time
+void arena_trim(void);
+
+// The counters of the pool, since the start
+struct arena_stats {
+    // The blocks taken from the pool and the ones that had to be allocated (the big ones of their own included)
+    size_t reused, allocated;
+    // The blocks in the pool right now
+    size_t pooled;
+};
+
+void arena_get_stats(struct arena_stats* stats);
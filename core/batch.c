@@ -0,0 +1,338 @@
+#ifndef _WIN32
+    #define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "batch.h"
+#include "detect.h"
+#include "mapping.h"
+#include "memory.h"
+#include "save.h"
+#include "trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+    #include <windows.h>
+    #define TEMP_SUFFIX L".jittey~"
+    #define SEPARATOR L'\\'
+    #define INVALID_INPUT ERROR_NO_UNICODE_TRANSLATION
+#else
+    #include <dirent.h>
+    #include <errno.h>
+    #include <sys/stat.h>
+    #define TEMP_SUFFIX ".jittey~"
+    #define SEPARATOR '/'
+    #define INVALID_INPUT EILSEQ
+#endif
+
+struct batch {
+    struct format format;
+    struct batch_file* files;
+    size_t count, capacity;
+};
+
+struct batch* batch_create(struct format format) {
+    struct batch* batch = mem_alloc(sizeof(*batch));
+    *batch = (struct batch){ .format = format };
+    return batch;
+}
+
+void batch_free(struct batch* batch) {
+    if (!batch)
+        return;
+
+    for (size_t i = 0; i < batch->count; i++)
+        mem_free(batch->files[i].path);
+    mem_free(batch->files);
+    mem_free(batch);
+}
+
+// Compares the part of a name up to the next comma with a word of ASCII letters, ignoring the case
+static bool is_word(const path_char* name, size_t length, const char* word) {
+    for (size_t i = 0; i < length; i++, word++) {
+        const path_char c = name[i] >= 'A' && name[i] <= 'Z' ? name[i] - 'A' + 'a' : name[i];
+        if (!*word || c != (path_char)*word)
+            return false;
+    }
+    return !*word;
+}
+
+bool batch_parse_format(const path_char* name, struct format* format) {
+    static const char* encodings[] = {
+        [ENCODING_UTF8   ] = "utf-8",
+        [ENCODING_UTF16  ] = "utf-16",
+        [ENCODING_UTF16BE] = "utf-16be"
+    };
+
+    *format = (struct format){ .encoding = ENCODING_UTF8, .linebreak = LINEBREAK_UNIX, .bom = false };
+    for (size_t part = 0; ; part++) {
+        size_t length = 0;
+        while (name[length] && name[length] != ',')
+            length++;
+
+        bool known = false;
+        if (part == 0) {
+            for (size_t i = 0; i < sizeof(encodings) / sizeof(encodings[0]) && !known; i++)
+                if ((known = is_word(name, length, encodings[i])))
+                    format->encoding = (enum encoding)i;
+        } else if (is_word(name, length, "bom")) {
+            known = !format->bom;
+            format->bom = true;
+        } else if (is_word(name, length, "lf") || is_word(name, length, "crlf")) {
+            known = true;
+            format->linebreak = length == 2 ? LINEBREAK_UNIX : LINEBREAK_WIN;
+        } else if (is_word(name, length, "keep")) {
+            known = true;
+            format->linebreak = LINEBREAK_KEEP;
+        }
+        if (!known)
+            return false;
+
+        if (!name[length])
+            return true;
+        name += length + 1;
+    }
+}
+
+static size_t path_length(const path_char* path) {
+#ifdef _WIN32
+    return wcslen(path);
+#else
+    return strlen(path);
+#endif
+}
+
+// Returns a new path made of the two, with a separator between them unless 'a' already ends with one
+static path_char* join(const path_char* a, const path_char* b) {
+    const size_t a_length = path_length(a), b_length = path_length(b);
+    const bool separator = a_length && a[a_length - 1] != '/' && a[a_length - 1] != '\\';
+
+    path_char* path = mem_alloc((a_length + separator + b_length + 1) * sizeof(path_char));
+    memcpy(path, a, a_length * sizeof(path_char));
+    if (separator)
+        path[a_length] = SEPARATOR;
+    memcpy(path + a_length + separator, b, (b_length + 1) * sizeof(path_char));
+    return path;
+}
+
+static path_char* copy_path(const path_char* path) {
+    const size_t length = path_length(path);
+    path_char* copy = mem_alloc((length + 1) * sizeof(path_char));
+    memcpy(copy, path, (length + 1) * sizeof(path_char));
+    return copy;
+}
+
+static void add_file(struct batch* batch, path_char* path, size_t size) {
+    if (batch->count == batch->capacity) {
+        batch->capacity = batch->capacity ? batch->capacity * 2 : 64;
+        batch->files = mem_realloc(batch->files, batch->capacity * sizeof(*batch->files));
+    }
+    batch->files[batch->count++] = (struct batch_file){ .path = path, .size = size, .status = BATCH_PENDING };
+}
+
+// The entries of a directory that aren't added: ".", "..", the hidden ones and the temporary files of saving
+static bool ignored(const path_char* name) {
+    const size_t length = path_length(name), suffix = path_length(TEMP_SUFFIX);
+    return name[0] == '.' || (length >= suffix && !memcmp(name + length - suffix, TEMP_SUFFIX, suffix * sizeof(path_char)));
+}
+
+#ifdef _WIN32
+
+static bool add_directory(struct batch* batch, const path_char* directory) {
+    path_char* pattern = join(directory, L"*");
+    WIN32_FIND_DATAW data;
+    HANDLE find = FindFirstFileW(pattern, &data);
+    mem_free(pattern);
+    if (find == INVALID_HANDLE_VALUE)
+        return false;
+
+    bool success = true;
+    do {
+        if (ignored(data.cFileName) || (data.dwFileAttributes & (FILE_ATTRIBUTE_HIDDEN | FILE_ATTRIBUTE_REPARSE_POINT)))
+            continue;
+
+        path_char* path = join(directory, data.cFileName);
+        if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            success = add_directory(batch, path);
+            mem_free(path);
+        } else {
+            add_file(batch, path, (size_t)((ULONGLONG)data.nFileSizeHigh << 32 | data.nFileSizeLow));
+        }
+    } while (success && FindNextFileW(find, &data));
+
+    const DWORD error = success ? GetLastError() : 0;
+    FindClose(find);
+    if (success && error != ERROR_NO_MORE_FILES) {
+        SetLastError(error);
+        return false;
+    }
+    return success;
+}
+
+bool batch_add(struct batch* batch, const path_char* path) {
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesExW(path, GetFileExInfoStandard, &data))
+        return false;
+
+    if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+        return add_directory(batch, path);
+
+    add_file(batch, copy_path(path), (size_t)((ULONGLONG)data.nFileSizeHigh << 32 | data.nFileSizeLow));
+    return true;
+}
+
+static unsigned long last_error(void) {
+    return GetLastError();
+}
+
+#else
+
+static bool add_directory(struct batch* batch, const path_char* directory) {
+    DIR* dir = opendir(directory);
+    if (!dir)
+        return false;
+
+    bool success = true;
+    struct dirent* entry;
+    while (success && (errno = 0, entry = readdir(dir))) {
+        if (ignored(entry->d_name))
+            continue;
+
+        // Symbolic links aren't followed, so that nothing gets converted twice (or forever)
+        path_char* path = join(directory, entry->d_name);
+        struct stat st;
+        if (lstat(path, &st)) {
+            success = false;
+        } else if (S_ISDIR(st.st_mode)) {
+            success = add_directory(batch, path);
+        } else if (S_ISREG(st.st_mode)) {
+            add_file(batch, path, (size_t)st.st_size);
+            continue;
+        }
+        mem_free(path);
+    }
+
+    const int error = success ? errno : 0;
+    closedir(dir);
+    if (error) {
+        errno = error;
+        return false;
+    }
+    return success;
+}
+
+bool batch_add(struct batch* batch, const path_char* path) {
+    struct stat st;
+    if (stat(path, &st))
+        return false;
+
+    if (S_ISDIR(st.st_mode))
+        return add_directory(batch, path);
+
+    add_file(batch, copy_path(path), (size_t)st.st_size);
+    return true;
+}
+
+static unsigned long last_error(void) {
+    return (unsigned long)errno;
+}
+
+#endif
+
+// Returns true if the text already is in the format, all of its line breaks included
+static bool in_format(const struct detection* detection, struct format format) {
+    if (detection->format.encoding != format.encoding || detection->format.bom != format.bom)
+        return false;
+    if (format.linebreak == LINEBREAK_KEEP)
+        return true;
+    return format.linebreak == LINEBREAK_WIN ? !detection->linebreaks.lf : !detection->linebreaks.crlf;
+}
+
+// Lets go of the mapping before the converted file replaces the original, as Windows doesn't let a mapped file go
+static void close_mapping(void* ctx, const void* data, size_t size) {
+    (void)data;
+    (void)size;
+    mapping_close(ctx);
+}
+
+static void convert_file(struct batch_file* file, struct format format) {
+    struct mapping mapping;
+    if (!mapping_open(&mapping, file->path)) {
+        file->status = BATCH_FAILED;
+        file->error = last_error();
+        return;
+    }
+    file->size = mapping.size;
+
+    // The whole file is looked at, as a single line break of the wrong type means it has to be converted
+    const void* data = mapping.data ? mapping.data : "";
+    const struct detection detection = detect_format(data, mapping.size, 0);
+    file->from = detection.format;
+
+    if (mapping.size && detection.confidence < BATCH_CONFIDENCE) {
+        file->status = BATCH_SKIPPED;
+    } else if (in_format(&detection, format) || (!mapping.size && !format.bom)) {
+        file->status = BATCH_UNCHANGED;
+    } else if (save_converted(data, mapping.size, detection.format, file->path, format, close_mapping, &mapping)) {
+        file->status = BATCH_CONVERTED;
+        return;
+    } else {
+        file->error = last_error();
+        file->status = file->error == INVALID_INPUT ? BATCH_INVALID : BATCH_FAILED;
+        return;
+    }
+
+    mapping_close(&mapping);
+}
+
+// A file in the order the files are converted in
+struct order {
+    size_t size, index;
+};
+
+// What the tasks of a run share
+struct run {
+    struct batch* batch;
+    // The biggest file first
+    struct order* order;
+};
+
+static void convert_task(void* ctx, size_t index) {
+    struct run* run = ctx;
+    struct batch_file* file = &run->batch->files[run->order[index].index];
+
+    const uint64_t start = trace_now(), span = trace_begin();
+    convert_file(file, run->batch->format);
+    trace_end(span, "batch: file");
+    file->time = trace_now() - start;
+}
+
+static int compare_sizes(const void* a, const void* b) {
+    const struct order* x = a;
+    const struct order* y = b;
+    return x->size < y->size ? 1 : x->size > y->size ? -1 : (x->index > y->index) - (x->index < y->index);
+}
+
+size_t batch_run(struct batch* batch, struct pool* pool) {
+    struct run run = { batch, mem_alloc((batch->count ? batch->count : 1) * sizeof(struct order)) };
+    for (size_t i = 0; i < batch->count; i++)
+        run.order[i] = (struct order){ batch->files[i].size, i };
+    qsort(run.order, batch->count, sizeof(struct order), compare_sizes);
+
+    pool_run(pool, convert_task, &run, batch->count);
+    mem_free(run.order);
+
+    size_t failed = 0;
+    for (size_t i = 0; i < batch->count; i++)
+        failed += batch->files[i].status == BATCH_INVALID || batch->files[i].status == BATCH_FAILED;
+    return failed;
+}
+
+size_t batch_count(const struct batch* batch) {
+    return batch->count;
+}
+
+const struct batch_file* batch_file(const struct batch* batch, size_t index) {
+    return &batch->files[index];
+}
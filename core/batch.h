@@ -0,0 +1,73 @@
+#pragma once
+// Converting many files to one format at once, e.g. to normalize the encoding and the line breaks before shipping them
+//
+// Every file is mapped, its format is detected and it's converted straight out of the mapping into a temporary file,
+// which then replaces it (see save_converted). So no file is ever in memory as a whole, and as every thread of the pool
+// converts one file at a time, a batch has at most a few buffers per thread in flight. The threads take the files one
+// at a time, the biggest ones first, so that a huge file doesn't come last and keep one thread busy on its own.
+// Files that don't look like text (detected with less than BATCH_CONFIDENCE) are skipped, so are the ones that are
+// in the format already, neither is touched.
+
+#include "format.h"
+#include "platform.h"
+#include "pool.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// The threads per processor worth converting on, as they spend much of their time waiting for the disk
+#define BATCH_THREADS 4
+
+// The least confidence of the detection (see struct detection) a file gets converted with
+#define BATCH_CONFIDENCE 50
+
+enum batch_status {
+    BATCH_PENDING,
+    BATCH_CONVERTED,
+    // The file is in the format already
+    BATCH_UNCHANGED,
+    // The file doesn't look like text
+    BATCH_SKIPPED,
+    // The file isn't valid in the encoding it was detected in
+    BATCH_INVALID,
+    // Reading or writing the file failed, 'error' says why
+    BATCH_FAILED
+};
+
+struct batch_file {
+    path_char* path;
+    // The size of the file when it was added and its format
+    size_t size;
+    struct format from;
+    enum batch_status status;
+    // GetLastError (or errno) after BATCH_FAILED
+    unsigned long error;
+    // How long detecting and converting took, in nanoseconds
+    uint64_t time;
+};
+
+struct batch;
+
+// Reads a format from its name, e.g. from the command line: an encoding (utf-8, utf-16 or utf-16be), then
+// optionally "bom" and the line breaks (lf, crlf or keep to leave them alone, lf by default), separated by commas,
+// like "utf-16,bom,crlf"
+// Returns false if the name isn't one
+bool batch_parse_format(const path_char* name, struct format* format);
+
+// Creates an empty batch that converts the files into 'format'
+struct batch* batch_create(struct format format);
+void batch_free(struct batch* batch);
+
+// Adds a file, or every file in a directory and its subdirectories, except for the hidden ones (whose names
+// start with a dot, or that are hidden on Windows), the symbolic links and the temporary files of saving
+// Returns false if the path (or a directory in it) couldn't be read, GetLastError (or errno) says why, the files
+// found until then stay in the batch
+bool batch_add(struct batch* batch, const path_char* path);
+
+// Converts all of the files on the threads of the pool, returns the number of them that are BATCH_INVALID or BATCH_FAILED
+size_t batch_run(struct batch* batch, struct pool* pool);
+
+// The files in the order they were added
+size_t batch_count(const struct batch* batch);
+const struct batch_file* batch_file(const struct batch* batch, size_t index);
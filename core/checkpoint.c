@@ -0,0 +1,207 @@
+#ifndef _WIN32
+    #define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "checkpoint.h"
+#include "memory.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+    #include <windows.h>
+    #define SEPARATOR L'\\'
+    #define SUFFIX(s) L##s
+#else
+    #include <errno.h>
+    #include <sys/stat.h>
+    #define SEPARATOR '/'
+    #define SUFFIX(s) s
+#endif
+
+// The longest path of a checkpoint file, longer ones aren't kept
+#define PATH_CAPACITY 1024
+
+// The bytes at the start and at the end of the text that have to be the same, on top of the size and the time
+#define FINGERPRINT 4096
+
+// What a checkpoint file starts with, followed by the path of the file it's for (without a terminator)
+// and the checkpoints, all in the byte order of the machine, as the cache is never shared with another one
+struct header {
+    char magic[8];
+    uint64_t size, modified, fingerprint;
+    uint32_t encoding, bom;
+    uint64_t path_length, count;
+};
+
+static const char Magic[8] = "jittey\1\n";
+
+static path_char Directory[PATH_CAPACITY];
+
+void checkpoint_set_directory(const path_char* directory) {
+    Directory[0] = 0;
+    for (size_t i = 0; directory && directory[i] && i + 1 < PATH_CAPACITY; i++) {
+        Directory[i] = directory[i];
+        Directory[i + 1] = 0;
+    }
+}
+
+// Appends a string to a path, returns false if it doesn't fit
+static bool append(path_char* path, size_t* length, const path_char* text) {
+    for (; *text; text++) {
+        if (*length + 1 >= PATH_CAPACITY)
+            return false;
+        path[(*length)++] = *text;
+    }
+    path[*length] = 0;
+    return true;
+}
+
+static bool make_directory(const path_char* path) {
+#ifdef _WIN32
+    return CreateDirectoryW(path, NULL) || GetLastError() == ERROR_ALREADY_EXISTS;
+#else
+    return !mkdir(path, 0700) || errno == EEXIST;
+#endif
+}
+
+// FNV-1a, both over the bytes of a path and of the text
+static uint64_t hash(uint64_t h, const void* data, size_t size) {
+    const uint8_t* bytes = data;
+    for (size_t i = 0; i < size; i++)
+        h = (h ^ bytes[i]) * 0x100000001B3u;
+    return h;
+}
+
+static uint64_t fingerprint(const struct mapping* mapping) {
+    const size_t size = mapping->size < FINGERPRINT ? mapping->size : FINGERPRINT;
+    const uint64_t h = hash(0xCBF29CE484222325u, mapping->data, size);
+    return hash(h, (const uint8_t*)mapping->data + mapping->size - size, size);
+}
+
+static size_t path_length(const path_char* path) {
+    size_t length = 0;
+    while (path[length])
+        length++;
+    return length;
+}
+
+// Makes the path of the checkpoint file for 'path' (with 'suffix'), creating the directory on the way if 'create' is true
+static bool checkpoint_path(const path_char* path, const path_char* suffix, bool create, path_char* out) {
+    size_t length = 0;
+    out[0] = 0;
+
+    if (Directory[0]) {
+        if (!append(out, &length, Directory) || (create && !make_directory(out)))
+            return false;
+    } else {
+#ifdef _WIN32
+        const path_char* base = _wgetenv(L"LOCALAPPDATA");
+        if (!base || !append(out, &length, base))
+            return false;
+#else
+        const path_char* base = getenv("XDG_CACHE_HOME");
+        if (base && base[0]) {
+            if (!append(out, &length, base))
+                return false;
+        } else if (!(base = getenv("HOME")) || !append(out, &length, base) || !append(out, &length, "/.cache") || (create && !make_directory(out))) {
+            return false;
+        }
+#endif
+        const path_char name[] = { SEPARATOR, 'j', 'i', 't', 't', 'e', 'y', 0 };
+        if (!append(out, &length, name) || (create && !make_directory(out)))
+            return false;
+    }
+
+    // The name is the hash of the path in hexadecimal
+    path_char name[18] = { SEPARATOR };
+    const uint64_t h = hash(0xCBF29CE484222325u, path, path_length(path) * sizeof(path_char));
+    for (int i = 0; i < 16; i++)
+        name[1 + i] = "0123456789abcdef"[h >> (60 - 4 * i) & 15];
+    return append(out, &length, name) && append(out, &length, suffix);
+}
+
+static struct header make_header(const path_char* path, const struct mapping* mapping, struct format format, size_t count) {
+    struct header header = {
+        .size = mapping->size,
+        .modified = mapping->modified,
+        .fingerprint = fingerprint(mapping),
+        .encoding = format.encoding,
+        .bom = format.bom,
+        .path_length = path_length(path),
+        .count = count
+    };
+    memcpy(header.magic, Magic, sizeof(Magic));
+    return header;
+}
+
+bool checkpoint_save(const path_char* path, const struct mapping* mapping, struct format format, const struct document* document) {
+    size_t count;
+    struct document_checkpoint* checkpoints = document_checkpoints(document, &count);
+    path_char target[PATH_CAPACITY], temp[PATH_CAPACITY];
+    if (!checkpoints || !mapping->data || !checkpoint_path(path, SUFFIX(".idx"), true, target) || !checkpoint_path(path, SUFFIX(".idx~"), false, temp)) {
+        mem_free(checkpoints);
+        return false;
+    }
+
+    // Written next to it first, so that a crash never leaves a half written file behind for the next time
+#ifdef _WIN32
+    FILE* f = _wfopen(temp, L"wb");
+#else
+    FILE* f = fopen(temp, "wb");
+#endif
+    if (!f) {
+        mem_free(checkpoints);
+        return false;
+    }
+
+    const struct header header = make_header(path, mapping, format, count);
+    fwrite(&header, sizeof(header), 1, f);
+    fwrite(path, sizeof(path_char), header.path_length, f);
+    fwrite(checkpoints, sizeof(*checkpoints), count, f);
+    mem_free(checkpoints);
+
+    bool success = !ferror(f);
+    success &= !fclose(f);
+#ifdef _WIN32
+    success = success && MoveFileExW(temp, target, MOVEFILE_REPLACE_EXISTING);
+    if (!success)
+        DeleteFileW(temp);
+#else
+    success = success && !rename(temp, target);
+    if (!success)
+        remove(temp);
+#endif
+    return success;
+}
+
+struct document_checkpoint* checkpoint_load(const path_char* path, const struct mapping* mapping, struct format format, size_t* count) {
+    path_char source[PATH_CAPACITY];
+    struct mapping file;
+    if (!mapping->data || !checkpoint_path(path, SUFFIX(".idx"), false, source) || !mapping_open(&file, source))
+        return NULL;
+
+    // The header (but the count) and the path have to be the same, and the checkpoints have to be all there is after them
+    struct header header;
+    const struct header expected = make_header(path, mapping, format, 0);
+    const size_t start = sizeof(header) + expected.path_length * sizeof(path_char);
+    struct document_checkpoint* checkpoints = NULL;
+
+    if (file.size >= start) {
+        memcpy(&header, file.data, sizeof(header));
+        const size_t rest = file.size - start;
+        const uint64_t stored = header.count;
+        header.count = 0;
+
+        if (!memcmp(&header, &expected, sizeof(header)) && !memcmp((const uint8_t*)file.data + sizeof(header), path, start - sizeof(header))
+            && stored && rest % sizeof(*checkpoints) == 0 && rest / sizeof(*checkpoints) == stored) {
+            checkpoints = mem_alloc(rest);
+            memcpy(checkpoints, (const uint8_t*)file.data + start, rest);
+            *count = (size_t)stored;
+        }
+    }
+
+    mapping_close(&file);
+    return checkpoints;
+}
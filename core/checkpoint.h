@@ -0,0 +1,35 @@
+#pragma once
+// Keeping the checkpoints of big files (see document_checkpoints) in a cache, so that opening one again doesn't read it
+//
+// Indexing a file reads all of it, which for a file of a few GB takes seconds when it isn't in the system's cache.
+// Once a big file is loaded, the byte offset, the code unit position and the line of every piece (every DOCUMENT_CHUNK
+// or so) are written to a small file in the cache directory, named after a hash of the path. Opening the file again
+// builds the document out of them without reading the text (see loader_start_indexed), so any line is O(log n) away
+// right from the start. There's no decoder state to keep, as the pieces are cut between whole characters.
+// The checkpoints are only used for the same path with the same size, time of the last write, format and first and
+// last page of text, anything else means the file has changed since and it's indexed again.
+
+#include "document.h"
+#include "format.h"
+#include "mapping.h"
+#include "platform.h"
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// The smallest file whose checkpoints are worth keeping, in bytes, anything smaller is indexed in a few milliseconds
+#define CHECKPOINT_SMALLEST (32 * 1024 * 1024)
+
+// Sets the directory the checkpoints are kept in, or NULL for the default: jittey in %LOCALAPPDATA% on Windows,
+// in $XDG_CACHE_HOME (or ~/.cache) elsewhere
+// Mainly for benchmarks, it must not be called while checkpoints are being saved or loaded
+void checkpoint_set_directory(const path_char* directory);
+
+// Keeps the checkpoints of a document loaded from the mapping of the file at 'path' (in 'format', which says where
+// the text starts after the BOM), the directory is created if needed
+// Returns false if the document has no checkpoints (see document_checkpoints) or they couldn't be written
+bool checkpoint_save(const path_char* path, const struct mapping* mapping, struct format format, const struct document* document);
+
+// Returns the checkpoints kept for the file at 'path' with the mapping, to be freed with mem_free (loader_start_indexed
+// takes them over), or NULL if there are none or the file has changed since
+struct document_checkpoint* checkpoint_load(const path_char* path, const struct mapping* mapping, struct format format, size_t* count);
@@ -0,0 +1,350 @@
+#include "convert.h"
+#include "utf.h"
+#include "linebreak.h"
+
+#include <string.h>
+
+static const uint8_t Bom_utf8[] = { 0xEF, 0xBB, 0xBF };
+static const uint8_t Bom_utf16[] = { 0xFF, 0xFE };
+static const uint8_t Bom_utf16be[] = { 0xFE, 0xFF };
+
+static const uint8_t* bom_of(enum encoding encoding, size_t* size) {
+    if (encoding == ENCODING_UTF16) {
+        *size = sizeof(Bom_utf16);
+        return Bom_utf16;
+    }
+
+    if (encoding == ENCODING_UTF16BE) {
+        *size = sizeof(Bom_utf16be);
+        return Bom_utf16be;
+    }
+
+    *size = sizeof(Bom_utf8);
+    return Bom_utf8;
+}
+
+size_t convert_bound(const void* src, size_t size, struct format from, struct format to) {
+    size_t from_bom = 0, to_bom = 0;
+    if (from.bom) bom_of(from.encoding, &from_bom);
+    if (to.bom) bom_of(to.encoding, &to_bom);
+
+    const uint8_t* text = (const uint8_t*)src + (size > from_bom ? from_bom : size);
+    const size_t text_size = size > from_bom ? size - from_bom : 0;
+
+    // Decoding never gives more code units than there are UTF-8 bytes
+    size_t units = from.encoding != ENCODING_UTF8 ? text_size / 2 : text_size;
+
+    // A UTF-16 code unit takes up at most three bytes in UTF-8, which is more than enough even for a CRLF
+    if (from.encoding != ENCODING_UTF8 && to.encoding == ENCODING_UTF8)
+        return to_bom + units * 3;
+
+    // Every LF may gain a CR, it's worth counting them, it's far cheaper than doubling the whole estimate
+    if (to.linebreak == LINEBREAK_WIN) {
+        if (from.encoding == ENCODING_UTF16) {
+            // The text may not be aligned after a BOM of an odd size, but a UTF-16 BOM has an even size
+            units += linebreak_count_utf16((const uint16_t*)text, units);
+        } else if (from.encoding == ENCODING_UTF16BE) {
+            // Every big endian LF has a 0x0A byte in it, counting the bytes can only overestimate
+            units += linebreak_count_utf8(text, text_size);
+        } else {
+            units += linebreak_count_utf8(text, text_size);
+        }
+    }
+
+    // Valid UTF-8 is encoded back into exactly the same bytes, so UTF-8 to UTF-8 only grows by the CRs
+    return to_bom + units * (to.encoding != ENCODING_UTF8 ? 2 : 1);
+}
+
+static void init(struct converter* converter, struct format from, struct format to) {
+    converter->from = from;
+    converter->to = to;
+    converter->sink = NULL;
+    converter->sink_ctx = NULL;
+    converter->out = NULL;
+    converter->size = 0;
+    converter->offset = 0;
+    converter->error = 0;
+    converter->status = CONVERT_OK;
+    converter->skip = 0;
+    if (from.bom) bom_of(from.encoding, &converter->skip);
+    converter->write_bom = to.bom;
+    converter->valid = false;
+    converter->carry_size = 0;
+    converter->carry_offset = 0;
+    converter->cr = false;
+    converter->high = 0;
+}
+
+void converter_init(struct converter* converter, struct format from, struct format to, convert_sink_fn sink, void* sink_ctx) {
+    init(converter, from, to);
+    converter->sink = sink;
+    converter->sink_ctx = sink_ctx;
+}
+
+void converter_init_buffer(struct converter* converter, struct format from, struct format to, void* out) {
+    init(converter, from, to);
+    converter->out = out;
+}
+
+// Returns where the output of the next block should be written
+static uint8_t* target(struct converter* converter) {
+    return converter->sink ? (uint8_t*)converter->staging : converter->out + converter->size;
+}
+
+// Finishes the output of a block written to target()
+static enum convert_status emit(struct converter* converter, size_t size) {
+    if (converter->sink && size && !converter->sink(converter->sink_ctx, converter->staging, size))
+        converter->status = CONVERT_STOPPED;
+
+    converter->size += size;
+    return converter->status;
+}
+
+static enum convert_status emit_bom(struct converter* converter) {
+    converter->write_bom = false;
+
+    size_t size;
+    const uint8_t* bom = bom_of(converter->to.encoding, &size);
+    memcpy(target(converter), bom, size);
+    return emit(converter, size);
+}
+
+// Passes output that is ready somewhere else already, a sink gets it straight from there
+static enum convert_status emit_from(struct converter* converter, const void* data, size_t size) {
+    if (!converter->sink) {
+        memcpy(converter->out + converter->size, data, size);
+    } else if (size && !converter->sink(converter->sink_ctx, data, size)) {
+        converter->status = CONVERT_STOPPED;
+    }
+
+    converter->size += size;
+    return converter->status;
+}
+
+// Translates the line breaks of 'length' units into 'dst', returns the number of units written
+static size_t translate(struct converter* converter, const uint16_t* src, size_t length, uint16_t* dst) {
+    if (converter->to.linebreak == LINEBREAK_WIN)
+        return linebreak_to_win_utf16(src, length, dst, &converter->cr);
+    if (converter->to.linebreak == LINEBREAK_UNIX)
+        return linebreak_to_unix_utf16(src, length, dst, &converter->cr);
+
+    memcpy(dst, src, length * sizeof(uint16_t));
+    return length;
+}
+
+// Swaps the bytes of UTF-16 code units in place, for big endian text
+static void swap_bytes(uint16_t* units, size_t length) {
+    for (size_t i = 0; i < length; i++)
+        units[i] = (uint16_t)(units[i] << 8 | units[i] >> 8);
+}
+
+// Passes a block of decoded units through the rest of the stages
+static enum convert_status process(struct converter* converter, const uint16_t* units, size_t length) {
+    if (converter->to.encoding != ENCODING_UTF8) {
+        uint16_t* out = (uint16_t*)target(converter);
+        const size_t count = translate(converter, units, length, out);
+        if (converter->to.encoding == ENCODING_UTF16BE)
+            swap_bytes(out, count);
+        return emit(converter, count * 2);
+    }
+
+    // The surrogate held back from the last block goes right in front of the translated text
+    uint16_t* lines = converter->lines + 1;
+    size_t count = translate(converter, units, length, lines);
+    if (converter->high) {
+        *--lines = converter->high;
+        count++;
+        converter->high = 0;
+    }
+
+    if (count && lines[count-1] >= 0xD800 && lines[count-1] <= 0xDBFF)
+        converter->high = lines[--count];
+
+    return emit(converter, utf16_to_utf8(lines, count, target(converter)));
+}
+
+// Passes a block of complete UTF-8 characters through all of the stages, 'offset' is where the block starts in the input
+static enum convert_status process_utf8(struct converter* converter, const uint8_t* src, size_t size, size_t offset) {
+    size_t error;
+
+    // UTF-8 to UTF-8 doesn't need to go through UTF-16 at all, the text only has to be validated
+    if (converter->to.encoding == ENCODING_UTF8) {
+        if (!converter->valid && utf8_length_utf16(src, size, &error) == UTF_INVALID) {
+            converter->status = CONVERT_INVALID;
+            converter->error = offset + error;
+            return converter->status;
+        }
+
+        uint8_t* out = target(converter);
+        if (converter->to.linebreak == LINEBREAK_WIN)
+            return emit(converter, linebreak_to_win_utf8(src, size, out, &converter->cr));
+        if (converter->to.linebreak == LINEBREAK_UNIX)
+            return emit(converter, linebreak_to_unix_utf8(src, size, out, &converter->cr));
+        return emit_from(converter, src, size);
+    }
+
+    const size_t length = utf8_to_utf16(src, size, converter->units, &error);
+    if (length == UTF_INVALID) {
+        converter->status = CONVERT_INVALID;
+        converter->error = offset + error;
+        return converter->status;
+    }
+
+    return process(converter, converter->units, length);
+}
+
+// Converts a block from the beginning of UTF-16 input, returns the number of bytes consumed
+static size_t feed_utf16(struct converter* converter, const uint8_t* src, size_t size) {
+    uint16_t* units = converter->units;
+    size_t count = 0, used = 0;
+
+    const bool big_endian = converter->from.encoding == ENCODING_UTF16BE;
+
+    // Finish the code unit split between the chunks
+    if (converter->carry_size) {
+        units[count++] = big_endian ? (uint16_t)converter->carry[0] << 8 | src[0] : converter->carry[0] | (uint16_t)src[0] << 8;
+        converter->carry_size = 0;
+        used = 1;
+    }
+
+    // The machines the editor runs on are little endian, only big endian text needs its bytes swapped
+    size_t length = (size - used) / 2;
+    if (length > CONVERT_BLOCK) length = CONVERT_BLOCK;
+    memcpy(units + count, src + used, length * 2);
+    if (big_endian)
+        swap_bytes(units + count, length);
+    count += length;
+    used += length * 2;
+
+    if (size - used == 1) {
+        converter->carry[0] = src[used];
+        converter->carry_size = 1;
+        used = size;
+    }
+
+    process(converter, units, count);
+    return used;
+}
+
+// Converts a block from the beginning of UTF-8 input, returns the number of bytes consumed
+static size_t feed_utf8(struct converter* converter, const uint8_t* src, size_t size) {
+
+    // Finish the character split between the chunks, it goes through the stages on its own
+    if (converter->carry_size) {
+        const uint8_t lead = converter->carry[0];
+        const size_t length = lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : 2;
+        size_t used = 0;
+        while (converter->carry_size < length && used < size)
+            converter->carry[converter->carry_size++] = src[used++];
+
+        if (converter->carry_size == length) {
+            converter->carry_size = 0;
+            process_utf8(converter, converter->carry, length, converter->carry_offset);
+        }
+
+        return used;
+    }
+
+    const size_t chunk = size < CONVERT_BLOCK ? size : CONVERT_BLOCK;
+
+    // A character cut off by the end of the block is left for the next one, unless this is the end of the chunk
+    const size_t complete = utf8_complete(src, chunk);
+    if (complete < chunk && chunk == size) {
+        converter->carry_size = chunk - complete;
+        converter->carry_offset = converter->offset + complete;
+        memcpy(converter->carry, src + complete, converter->carry_size);
+    }
+
+    process_utf8(converter, src, complete, converter->offset);
+    return chunk == size ? chunk : complete;
+}
+
+enum convert_status converter_feed(struct converter* converter, const void* data, size_t size) {
+    const uint8_t* src = data;
+
+    if (converter->status != CONVERT_OK)
+        return converter->status;
+
+    if (converter->write_bom && emit_bom(converter) != CONVERT_OK)
+        return converter->status;
+
+    while (converter->skip && size) {
+        converter->skip--;
+        converter->offset++;
+        src++;
+        size--;
+    }
+
+    while (size) {
+        const size_t used = converter->from.encoding != ENCODING_UTF8 ? feed_utf16(converter, src, size) : feed_utf8(converter, src, size);
+        if (converter->status != CONVERT_OK)
+            return converter->status;
+
+        converter->offset += used;
+        src += used;
+        size -= used;
+    }
+
+    return converter->status;
+}
+
+void converter_set_source(struct converter* converter, enum encoding encoding, bool valid) {
+    converter->valid = valid;
+    if (converter->status != CONVERT_OK || converter->from.encoding == encoding)
+        return;
+
+    // UTF-8 into UTF-8 skips the stage that pairs the surrogates, so a high one left over becomes U+FFFD right away
+    if (converter->high && encoding == ENCODING_UTF8 && converter->to.encoding == ENCODING_UTF8) {
+        emit(converter, utf16_to_utf8(&converter->high, 1, target(converter)));
+        converter->high = 0;
+    }
+    converter->from.encoding = encoding;
+}
+
+enum convert_status converter_finish(struct converter* converter) {
+    if (converter->status != CONVERT_OK)
+        return converter->status;
+
+    if (converter->write_bom && emit_bom(converter) != CONVERT_OK)
+        return converter->status;
+
+    // A cut off character at the very end is invalid, half of a UTF-16 code unit is just dropped
+    if (converter->carry_size && converter->from.encoding == ENCODING_UTF8) {
+        converter->status = CONVERT_INVALID;
+        converter->error = converter->carry_offset;
+        return converter->status;
+    }
+    converter->carry_size = 0;
+
+    // Flush the held back CR and the unpaired surrogate, which becomes U+FFFD
+    uint16_t rest[1];
+    size_t length = 0;
+    if (converter->cr && converter->to.linebreak == LINEBREAK_UNIX) {
+        converter->cr = false;
+        rest[length++] = '\r';
+    }
+
+    if (converter->to.encoding != ENCODING_UTF8) {
+        if (converter->to.encoding == ENCODING_UTF16BE)
+            swap_bytes(rest, length);
+        memcpy(target(converter), rest, length * 2);
+        return emit(converter, length * 2);
+    }
+
+    uint8_t* out = target(converter);
+    size_t written = 0;
+    if (converter->high) {
+        written = utf16_to_utf8(&converter->high, 1, out);
+        converter->high = 0;
+    }
+
+    return emit(converter, written + utf16_to_utf8(rest, length, out + written));
+}
+
+size_t converter_size(const struct converter* converter) {
+    return converter->size;
+}
+
+size_t converter_error(const struct converter* converter) {
+    return converter->error;
+}
@@ -0,0 +1,100 @@
+#pragma once
+// Streaming conversion between formats (encoding, line breaks and the BOM) in a single pass
+//
+// The input is fed in chunks of any size and goes through all of the stages (decoding, translating the line breaks,
+// encoding) a small block at a time, so nothing but the final output is ever as big as the text. The output either
+// goes straight into a buffer supplied by the caller, or to a sink function, in which case the converter doesn't
+// allocate anything at all. Characters, surrogate pairs and CRLF pairs may be split between the chunks in any way.
+//
+// The source line breaks don't matter: converting to LINEBREAK_WIN turns every lone LF into CRLF
+// and converting to LINEBREAK_UNIX turns every CRLF into LF, lone CRs are always kept.
+// LINEBREAK_KEEP leaves all of them alone, UTF-8 into UTF-8 then goes to the sink as it is, without a copy.
+
+#include "format.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// The number of code units that go through the stages at once
+#define CONVERT_BLOCK 4096
+
+enum convert_status {
+    CONVERT_OK,
+    // The input is not valid in its encoding (only UTF-8 is validated)
+    CONVERT_INVALID,
+    // The sink has returned false
+    CONVERT_STOPPED
+};
+
+// Receives the converted output, returning false stops the conversion
+typedef bool (*convert_sink_fn)(void* ctx, const void* data, size_t size);
+
+// The state of a conversion, it is quite big because of the block buffers, but it doesn't point to itself
+// so it can be placed anywhere (the stack of the caller is fine), none of the fields are meant to be touched
+struct converter {
+    struct format from, to;
+
+    convert_sink_fn sink;
+    void* sink_ctx;
+    // The output buffer if there is no sink
+    uint8_t* out;
+
+    // The number of output bytes produced so far
+    size_t size;
+    // The number of input bytes fed so far and the offset of the first invalid byte
+    size_t offset;
+    size_t error;
+    enum convert_status status;
+
+    // The number of BOM bytes still to be skipped in the input and whether the BOM is yet to be written
+    size_t skip;
+    bool write_bom;
+    // The input doesn't need to be validated, see converter_set_source
+    bool valid;
+
+    // An incomplete UTF-8 character (or a half of a UTF-16 code unit) from the end of the last chunk
+    uint8_t carry[4];
+    size_t carry_size;
+    size_t carry_offset;
+
+    // The last code unit was a CR, LINEBREAK_WIN needs it to recognize CRLF, LINEBREAK_UNIX holds the CR back
+    bool cr;
+    // A high surrogate from the end of the last block, waiting for its pair (only when encoding UTF-8)
+    uint16_t high;
+
+    uint16_t units[CONVERT_BLOCK + 4];
+    uint16_t lines[2 * CONVERT_BLOCK + 8];
+    // Only used with a sink, aligned for UTF-16 output
+    uint16_t staging[(3 * (2 * CONVERT_BLOCK + 8) + 4) / 2];
+};
+
+// Returns the number of bytes the conversion of the whole 'src' (including the BOM if 'from' has one) can produce at most
+// This takes a quick look at the text, so that the estimate isn't wildly off
+size_t convert_bound(const void* src, size_t size, struct format from, struct format to);
+
+// Starts a conversion which passes the output to 'sink'
+void converter_init(struct converter* converter, struct format from, struct format to, convert_sink_fn sink, void* sink_ctx);
+
+// Starts a conversion which writes the output to 'out', which has to be big enough for all of it (see convert_bound)
+// If the output is UTF-16, 'out' has to be aligned to two bytes
+void converter_init_buffer(struct converter* converter, struct format from, struct format to, void* out);
+
+// Converts the next chunk of the input, the first chunk starts with the BOM if 'from' has one
+// Once the conversion fails, every other call fails the same way
+enum convert_status converter_feed(struct converter* converter, const void* data, size_t size);
+
+// Changes the encoding of the input from the next chunk on, e.g. for the pieces of a document, which are either
+// UTF-8 or UTF-16, the chunks fed so far have to end with a whole character (a CR held back for a CRLF is fine)
+// If 'valid' is true, the input is known to be valid (the document has validated it), so UTF-8 into UTF-8 is only
+// copied and has its line breaks translated, without being validated again
+void converter_set_source(struct converter* converter, enum encoding encoding, bool valid);
+
+// Flushes whatever the converter has held back waiting for more input, must be called after the last chunk
+enum convert_status converter_finish(struct converter* converter);
+
+// Returns the number of output bytes produced so far
+size_t converter_size(const struct converter* converter);
+
+// Returns the offset of the first invalid input byte (including the BOM), valid only after CONVERT_INVALID
+size_t converter_error(const struct converter* converter);
@@ -0,0 +1,174 @@
+#include "detect.h"
+#include "utf.h"
+#include "simd.h"
+
+// The number of spans a sample is made of
+#define SPANS 16
+
+// The NULs at the even and the odd offsets, and the bytes above 0x7F
+struct byte_counts {
+    size_t zeros_even, zeros_odd, high;
+};
+
+#ifdef SIMD_X86
+// Adds up the two 64-bit halves of the result of _mm_sad_epu8
+static inline size_t sum_halves(__m128i sums) {
+    return (size_t)_mm_cvtsi128_si32(sums) + (size_t)_mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+}
+#endif
+
+// 'src' has to start at an even offset
+static void count_bytes(const uint8_t* src, size_t size, struct byte_counts* counts) {
+    size_t i = 0;
+
+#ifdef SIMD_X86
+    if (simd_level() != SIMD_NONE) {
+        // Every match subtracts -1 from a byte counter, the counters are summed up before they can overflow
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i low = _mm_set1_epi16(0x00FF);
+        while (size - i >= 16) {
+            __m128i zeros = zero, high = zero;
+            for (int round = 0; round < 255 && size - i >= 16; round++, i += 16) {
+                const __m128i bytes = _mm_loadu_si128((const __m128i*)(src + i));
+                zeros = _mm_sub_epi8(zeros, _mm_cmpeq_epi8(bytes, zero));
+                high = _mm_sub_epi8(high, _mm_cmplt_epi8(bytes, zero));
+            }
+
+            // The even bytes are the low halves of the 16-bit lanes
+            counts->zeros_even += sum_halves(_mm_sad_epu8(_mm_and_si128(zeros, low), zero));
+            counts->zeros_odd += sum_halves(_mm_sad_epu8(_mm_srli_epi16(zeros, 8), zero));
+            counts->high += sum_halves(_mm_sad_epu8(high, zero));
+        }
+    }
+#endif
+
+    for (; i < size; i++) {
+        if (!src[i])
+            *((i & 1) ? &counts->zeros_odd : &counts->zeros_even) += 1;
+        counts->high += src[i] >= 0x80;
+    }
+}
+
+// Checks if the span is valid UTF-8, the characters cut off at its edges don't count
+static bool valid_utf8(const uint8_t* src, size_t size, bool cut_start, bool cut_end) {
+    if (cut_start)
+        for (int i = 0; i < 3 && size && (*src & 0xC0) == 0x80; i++, src++, size--);
+    if (cut_end)
+        size = utf8_complete(src, size);
+
+    return utf8_length_utf16(src, size, NULL) != UTF_INVALID;
+}
+
+// Guesses the byte order of UTF-16 text without any NULs, e.g. CJK:
+// the high bytes of the code units take far fewer values than the low ones
+static bool looks_big_endian(const uint8_t* src, size_t size) {
+    uint8_t seen[2][32] = {0};
+    size_t distinct[2] = {0};
+
+    for (size_t i = 0; i < size; i++) {
+        uint8_t* set = seen[i & 1];
+        const uint8_t bit = 1 << (src[i] & 7);
+        if (!(set[src[i] >> 3] & bit)) {
+            set[src[i] >> 3] |= bit;
+            distinct[i & 1]++;
+        }
+    }
+
+    return distinct[0] < distinct[1];
+}
+
+// Returns where the i-th span starts, the spans are spread evenly over the text
+static size_t span_offset(size_t i, size_t spans, size_t span_size, size_t size) {
+    return spans > 1 ? ((size - span_size) / (spans - 1) * i) & ~(size_t)1 : 0;
+}
+
+struct detection detect_format(const void* data, size_t size, size_t sample) {
+    const uint8_t* src = data;
+    struct detection detection = {0};
+
+    // A BOM settles the encoding
+    size_t bom = 0;
+    if (size >= 3 && src[0] == 0xEF && src[1] == 0xBB && src[2] == 0xBF) {
+        detection.format.encoding = ENCODING_UTF8;
+        bom = 3;
+    } else if (size >= 2 && src[0] == 0xFF && src[1] == 0xFE) {
+        detection.format.encoding = ENCODING_UTF16;
+        bom = 2;
+    } else if (size >= 2 && src[0] == 0xFE && src[1] == 0xFF) {
+        detection.format.encoding = ENCODING_UTF16BE;
+        bom = 2;
+    }
+
+    const uint8_t* text = src + bom;
+    const size_t text_size = size - bom;
+
+    // The spans start at even offsets, so that they all agree on which byte of a UTF-16 code unit is which
+    size_t spans = 1, span_size = text_size;
+    if (sample && text_size > sample) {
+        spans = SPANS;
+        span_size = (sample / SPANS) & ~(size_t)1;
+        detection.sampled = true;
+    }
+
+    detection.scanned = bom + spans * span_size;
+
+    if (bom) {
+        detection.format.bom = true;
+        detection.confidence = 100;
+    } else {
+        // The NULs are only counted in whole code units, a text of an odd size (only ever looked at as a whole)
+        // has a byte left over, which counts for UTF-8 only
+        const size_t whole = span_size & ~(size_t)1;
+        struct byte_counts counts = {0};
+        for (size_t i = 0; i < spans; i++)
+            count_bytes(text + span_offset(i, spans, span_size, text_size), whole, &counts);
+        const bool stray_zero = whole < span_size && !text[whole];
+        if (whole < span_size)
+            counts.high += text[whole] >= 0x80;
+
+        // Any Latin text in UTF-16 is full of NULs (the high bytes of ASCII characters), UTF-8 text never has any
+        const size_t units = spans * whole / 2;
+        if (units && counts.zeros_odd > counts.zeros_even * 4 && counts.zeros_odd >= units / 16) {
+            detection.format.encoding = ENCODING_UTF16;
+            detection.confidence = 50 + (int)(45 * counts.zeros_odd / units);
+        } else if (units && counts.zeros_even > counts.zeros_odd * 4 && counts.zeros_even >= units / 16) {
+            detection.format.encoding = ENCODING_UTF16BE;
+            detection.confidence = 50 + (int)(45 * counts.zeros_even / units);
+        } else {
+            bool utf8 = true;
+            for (size_t i = 0; i < spans && utf8; i++) {
+                const size_t offset = span_offset(i, spans, span_size, text_size);
+                utf8 = valid_utf8(text + offset, span_size, offset > 0, offset + span_size < text_size);
+            }
+
+            if (utf8) {
+                // Random bytes are very unlikely to be valid UTF-8, but NULs don't belong in text
+                detection.format.encoding = ENCODING_UTF8;
+                detection.confidence = (counts.zeros_even + counts.zeros_odd || stray_zero) ? 20 : counts.high ? 95 : 90;
+            } else if (units && text_size % 2 == 0) {
+                // It may still be UTF-16 without any NULs at all (e.g. CJK)
+                detection.format.encoding = looks_big_endian(text, span_size) ? ENCODING_UTF16BE : ENCODING_UTF16;
+                detection.confidence = 30;
+            } else {
+                // Nothing fits, UTF-8 at least reports where the text goes wrong
+                detection.format.encoding = ENCODING_UTF8;
+                detection.confidence = 0;
+            }
+        }
+    }
+
+    // The NULs can't be more than the code units, but the confidence is a percentage either way
+    if (detection.confidence > 100)
+        detection.confidence = 100;
+
+    for (size_t i = 0; i < spans; i++) {
+        const size_t offset = span_offset(i, spans, span_size, text_size);
+        if (detection.format.encoding == ENCODING_UTF8)
+            linebreak_stats_utf8(text + offset, span_size, &detection.linebreaks);
+        else
+            linebreak_stats_utf16((const uint16_t*)(text + offset), span_size / 2, detection.format.encoding == ENCODING_UTF16BE, &detection.linebreaks);
+    }
+
+    detection.format.linebreak = detection.linebreaks.lf ? LINEBREAK_UNIX : LINEBREAK_WIN;
+    return detection;
+}
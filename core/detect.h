@@ -0,0 +1,32 @@
+#pragma once
+// Guessing the format of a text file from its contents
+//
+// The detector counts NULs (separately at the even and odd offsets), high bytes and line breaks with vector
+// instructions, so looking at the whole file runs at the speed of the memory. Huge files don't have to be looked at
+// as a whole though, a sample made of spans spread over the whole file gives the same answer for any sane file.
+
+#include "format.h"
+#include "linebreak.h"
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// The sample size the editor uses, files up to this size are always looked at as a whole
+#define DETECT_SAMPLE (1024 * 1024)
+
+struct detection {
+    // The best guess, the line break type is LINEBREAK_UNIX if there is any LF which isn't a part of a CRLF
+    struct format format;
+    // How sure the guess of the encoding is, from 0 (a wild guess) to 100 (there is a BOM)
+    int confidence;
+    // The line breaks in the text that has been looked at
+    struct linebreak_stats linebreaks;
+    // The number of bytes looked at, which is less than the size if the text has been sampled
+    size_t scanned;
+    bool sampled;
+};
+
+// Guesses the format of 'size' bytes of text, a NUL terminator is neither needed nor treated specially
+// If 'sample' isn't 0 and the text is bigger than it, only about 'sample' bytes spread over the text are looked at
+// The data has to be aligned to two bytes, as UTF-16 text is read in code units
+struct detection detect_format(const void* data, size_t size, size_t sample);
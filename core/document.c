@@ -0,0 +1,1203 @@
+#include "document.h"
+#include "memory.h"
+#include "utf.h"
+#include "linebreak.h"
+
+#include <stdatomic.h>
+#include <string.h>
+
+// A buffer that pieces point into, either an original one or an append block
+// Original buffers can be UTF-8, those are decoded only when somebody reads them,
+// all of the sizes are in elements of the encoding (bytes for UTF-8, code units for UTF-16)
+struct buffer {
+    atomic_size_t refs;
+    const void* data;
+    enum encoding encoding;
+    // 'size' is the number of elements that are in use, only append blocks ever grow it
+    size_t size, capacity;
+
+    buffer_release_fn release;
+    void* release_ctx;
+};
+
+// A range of text inside of a buffer, 'start' and 'size' are in elements of the buffer,
+// 'length' is the number of UTF-16 code units the range decodes to and 'lines' the number of LFs in it
+struct piece {
+    struct buffer* buffer;
+    size_t start, size, length;
+    size_t lines;
+};
+
+// A node of the piece tree, 'length' and 'lines' are the totals of the whole subtree
+// Nodes with more than one reference are shared between documents and must not be modified
+struct node {
+    struct node *left, *right;
+    atomic_size_t refs;
+    uint32_t priority;
+
+    struct piece piece;
+    size_t length, lines;
+};
+
+struct document {
+    struct node* root;
+    // The block that newly inserted text gets appended to, NULL if there is none yet
+    struct buffer* append;
+    // The state of the random generator used for node priorities
+    uint32_t seed;
+
+    // The buffer of a lazily loaded document and the offset (in its elements) up to which it has been indexed
+    struct buffer* lazy;
+    size_t lazy_offset;
+    enum document_state state;
+
+    // Changes with every edit, see document_revision
+    uint64_t revision;
+};
+
+// The number of code units decoded at once when walking through UTF-8 text
+#define WALK_SCRATCH 2048
+
+// The seed for the next document, it doesn't matter much but it must not be zero
+static atomic_uint Seed = 2463534242u;
+
+// The next revision, shared by all of the documents so that no two versions of any of them get the same one
+static atomic_uint_least64_t Revision = 1;
+
+static void touch(struct document* document) {
+    document->revision = atomic_fetch_add_explicit(&Revision, 1, memory_order_relaxed);
+}
+
+static uint32_t next_priority(struct document* document) {
+    // xorshift32
+    uint32_t x = document->seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return document->seed = x;
+}
+
+static struct buffer* buffer_create(const void* data, enum encoding encoding, size_t size, size_t capacity, buffer_release_fn release, void* release_ctx) {
+    struct buffer* buffer = mem_alloc(sizeof(*buffer));
+    atomic_init(&buffer->refs, 1);
+    buffer->data = data;
+    buffer->encoding = encoding;
+    buffer->size = size;
+    buffer->capacity = capacity;
+    buffer->release = release;
+    buffer->release_ctx = release_ctx;
+    return buffer;
+}
+
+// Releases the buffer's memory
+static void free_owned(void* ctx, const void* data, size_t size) {
+    (void)ctx; (void)size;
+    mem_free((void*)data);
+}
+
+// Creates a buffer that owns its memory
+static struct buffer* buffer_alloc(size_t capacity) {
+    return buffer_create(mem_alloc(capacity * sizeof(uint16_t)), ENCODING_UTF16, 0, capacity, free_owned, NULL);
+}
+
+static struct buffer* buffer_retain(struct buffer* buffer) {
+    atomic_fetch_add_explicit(&buffer->refs, 1, memory_order_relaxed);
+    return buffer;
+}
+
+static void buffer_release(struct buffer* buffer) {
+    if (!buffer || atomic_fetch_sub_explicit(&buffer->refs, 1, memory_order_acq_rel) != 1)
+        return;
+
+    if (buffer->release)
+        buffer->release(buffer->release_ctx, buffer->data, buffer->capacity * (buffer->encoding == ENCODING_UTF8 ? 1 : sizeof(uint16_t)));
+    mem_free(buffer);
+}
+
+static size_t length_of(const struct node* node) {
+    return node ? node->length : 0;
+}
+
+static size_t lines_of(const struct node* node) {
+    return node ? node->lines : 0;
+}
+
+// Returns the byte offset of a code unit in a UTF-8 piece
+// A piece with as many bytes as code units is all ASCII, which is the common case and needs no decoding
+static size_t piece_offset_of(const struct piece* piece, size_t units, bool* inside_pair) {
+    *inside_pair = false;
+    if (piece->size == piece->length)
+        return units < piece->size ? units : piece->size;
+    return utf8_offset_of((const uint8_t*)piece->buffer->data + piece->start, piece->size, units, inside_pair);
+}
+
+// Recalculates the subtree totals after the children have changed
+static void update(struct node* node) {
+    node->length = length_of(node->left) + node->piece.length + length_of(node->right);
+    node->lines = lines_of(node->left) + node->piece.lines + lines_of(node->right);
+}
+
+// Counts the LFs in a range of a buffer, in UTF-8 a 0x0A byte is never a part of another character
+static size_t count_lines(const struct buffer* buffer, size_t start, size_t size) {
+    if (buffer->encoding == ENCODING_UTF8)
+        return linebreak_count_utf8((const uint8_t*)buffer->data + start, size);
+    return linebreak_count_utf16((const uint16_t*)buffer->data + start, size);
+}
+
+static struct node* node_create(struct document* document, const struct piece piece) {
+    struct node* node = mem_alloc(sizeof(*node));
+    node->left = node->right = NULL;
+    atomic_init(&node->refs, 1);
+    node->priority = next_priority(document);
+    node->piece = piece;
+    node->piece.buffer = buffer_retain(piece.buffer);
+    node->length = piece.length;
+    node->lines = piece.lines;
+    return node;
+}
+
+static struct node* node_retain(struct node* node) {
+    if (node)
+        atomic_fetch_add_explicit(&node->refs, 1, memory_order_relaxed);
+    return node;
+}
+
+static void node_release(struct node* node) {
+    if (!node || atomic_fetch_sub_explicit(&node->refs, 1, memory_order_acq_rel) != 1)
+        return;
+
+    node_release(node->left);
+    node_release(node->right);
+    buffer_release(node->piece.buffer);
+    mem_free(node);
+}
+
+// Makes sure we are the only owner of the node, copying it if it is shared
+// Consumes the reference to 'node' and returns a reference to a node that can be modified
+static struct node* own(struct node* node) {
+    if (atomic_load_explicit(&node->refs, memory_order_acquire) == 1)
+        return node;
+
+    struct node* copy = mem_alloc(sizeof(*copy));
+    copy->left = node_retain(node->left);
+    copy->right = node_retain(node->right);
+    atomic_init(&copy->refs, 1);
+    copy->priority = node->priority;
+    copy->piece = node->piece;
+    buffer_retain(copy->piece.buffer);
+    copy->length = node->length;
+    copy->lines = node->lines;
+
+    node_release(node);
+    return copy;
+}
+
+// Joins two trees, all of 'left' comes before 'right', consumes both references
+static struct node* merge(struct node* left, struct node* right) {
+    if (!left) return right;
+    if (!right) return left;
+
+    if (left->priority >= right->priority) {
+        left = own(left);
+        left->right = merge(left->right, right);
+        update(left);
+        return left;
+    } else {
+        right = own(right);
+        right->left = merge(left, right->left);
+        update(right);
+        return right;
+    }
+}
+
+// Decodes the UTF-8 of a piece into exactly 'length' code units, 'dst' needs room for 'size' of them if that's more
+// The pieces of a document built out of checkpoints may not be what the checkpoints say, if the file has changed
+// in a way they couldn't tell (see checkpoint.h), so the text is never trusted: invalid bytes become U+FFFD,
+// and so does anything the bytes are short of
+static void decode_units(const uint8_t* src, size_t size, uint16_t* dst, size_t length) {
+    for (size_t i = utf8_to_utf16_lossy(src, size, dst); i < length; i++)
+        dst[i] = 0xFFFD;
+}
+
+// Replaces a UTF-8 piece with a UTF-16 copy of its text
+static void decode_piece(struct piece* piece) {
+    struct buffer* buffer = buffer_alloc(piece->size > piece->length ? piece->size : piece->length);
+    decode_units((const uint8_t*)piece->buffer->data + piece->start, piece->size, (uint16_t*)buffer->data, piece->length);
+    buffer->size = piece->length;
+
+    buffer_release(piece->buffer);
+    *piece = (struct piece){ .buffer = buffer, .start = 0, .size = piece->length, .length = piece->length, .lines = piece->lines };
+}
+
+// Splits a tree into the text before 'pos' and the rest, consumes the reference to 'node'
+// If 'pos' lands inside of a piece, the piece gets split in two
+static void split(struct document* document, struct node* node, size_t pos, struct node** left, struct node** right) {
+    if (!node) {
+        *left = *right = NULL;
+        return;
+    }
+
+    node = own(node);
+    const size_t left_length = length_of(node->left);
+
+    if (pos <= left_length) {
+        split(document, node->left, pos, left, &node->left);
+        update(node);
+        *right = node;
+    } else if (pos >= left_length + node->piece.length) {
+        split(document, node->right, pos - left_length - node->piece.length, &node->right, right);
+        update(node);
+        *left = node;
+    } else {
+        // The position is inside of this node's piece, cut off the tail into a new node
+        const size_t offset = pos - left_length;
+        size_t elements = offset;
+
+        if (node->piece.buffer->encoding == ENCODING_UTF8) {
+            bool inside_pair;
+            elements = piece_offset_of(&node->piece, offset, &inside_pair);
+
+            // A UTF-8 piece can't end in the middle of a character, so convert this one to UTF-16
+            if (inside_pair) {
+                decode_piece(&node->piece);
+                elements = offset;
+            }
+        }
+
+        // Only the shorter part gets its LFs counted, the other one has the rest of them
+        size_t head_lines;
+        if (elements <= node->piece.size / 2)
+            head_lines = count_lines(node->piece.buffer, node->piece.start, elements);
+        else
+            head_lines = node->piece.lines - count_lines(node->piece.buffer, node->piece.start + elements, node->piece.size - elements);
+
+        struct node* tail = node_create(document, (struct piece){
+            .buffer = node->piece.buffer,
+            .start = node->piece.start + elements,
+            .size = node->piece.size - elements,
+            .length = node->piece.length - offset,
+            .lines = node->piece.lines - head_lines
+        });
+
+        node->piece.size = elements;
+        node->piece.length = offset;
+        node->piece.lines = head_lines;
+        *right = merge(tail, node->right);
+        node->right = NULL;
+        update(node);
+        *left = node;
+    }
+}
+
+// Adds a node to the right end of a cartesian tree that is being built in O(n), the stack holds the right spine of the tree
+static void push_node(struct node** stack, size_t* top, struct node* node) {
+    struct node* last = NULL;
+    while (*top && stack[*top - 1]->priority < node->priority) {
+        last = stack[--*top];
+        update(last);
+    }
+
+    node->left = last;
+    if (*top)
+        stack[*top - 1]->right = node;
+    stack[(*top)++] = node;
+}
+
+// Finishes a tree built with push_node and returns its root
+static struct node* finish_tree(struct node** stack, size_t top) {
+    if (!top)
+        return NULL;
+
+    // The nodes that are still on the stack are the ones whose right subtrees could have changed
+    while (top > 1)
+        update(stack[--top]);
+    update(stack[0]);
+
+    // The bottom of the stack is the root
+    return stack[0];
+}
+
+// Builds a tree out of consecutive pieces of a UTF-16 buffer, none of them longer than DOCUMENT_CHUNK
+static struct node* build(struct document* document, struct buffer* buffer, size_t start, size_t length) {
+    if (!length)
+        return NULL;
+
+    const size_t count = (length + DOCUMENT_CHUNK - 1) / DOCUMENT_CHUNK;
+    struct node** stack = mem_alloc(count * sizeof(*stack));
+    size_t top = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        const size_t offset = i * DOCUMENT_CHUNK;
+        const size_t piece_length = (length - offset < DOCUMENT_CHUNK) ? length - offset : DOCUMENT_CHUNK;
+        push_node(stack, &top, node_create(document, (struct piece){
+            .buffer = buffer,
+            .start = start + offset,
+            .size = piece_length,
+            .length = piece_length,
+            .lines = count_lines(buffer, start + offset, piece_length)
+        }));
+    }
+
+    struct node* root = finish_tree(stack, top);
+    mem_free(stack);
+    return root;
+}
+
+// Copies the text into the append block and returns the tree of pieces referencing it
+static struct node* append_text(struct document* document, const uint16_t* text, size_t length) {
+
+    // Big insertions (pasting a whole file) get their own buffer, so that they don't waste the append block
+    if (length > DOCUMENT_CHUNK / 2) {
+        struct buffer* buffer = buffer_alloc(length);
+        memcpy((uint16_t*)buffer->data, text, length * sizeof(uint16_t));
+        buffer->size = length;
+
+        struct node* tree = build(document, buffer, 0, length);
+        buffer_release(buffer);
+        return tree;
+    }
+
+    if (!document->append || document->append->capacity - document->append->size < length) {
+        buffer_release(document->append);
+        document->append = buffer_alloc(DOCUMENT_CHUNK);
+    }
+
+    struct buffer* block = document->append;
+    memcpy((uint16_t*)block->data + block->size, text, length * sizeof(uint16_t));
+    struct node* node = node_create(document, (struct piece){
+        .buffer = block,
+        .start = block->size,
+        .size = length,
+        .length = length,
+        .lines = linebreak_count_utf16(text, length)
+    });
+    block->size += length;
+
+    return node;
+}
+
+// Finds the piece that ends exactly at 'pos', NULL if 'pos' isn't at the end of a piece
+static const struct piece* piece_ending_at(const struct node* node, size_t pos) {
+    while (node) {
+        const size_t left_length = length_of(node->left);
+
+        if (pos <= left_length) {
+            node = node->left;
+        } else if (pos > left_length + node->piece.length) {
+            pos -= left_length + node->piece.length;
+            node = node->right;
+        } else {
+            return pos == left_length + node->piece.length ? &node->piece : NULL;
+        }
+    }
+
+    return NULL;
+}
+
+// Lengthens the piece that ends at 'pos' by 'length' units with 'lines' LFs, along with all of the subtree totals on the way
+static struct node* extend(struct node* node, size_t pos, size_t length, size_t lines) {
+    node = own(node);
+    const size_t left_length = length_of(node->left);
+
+    if (pos <= left_length)
+        node->left = extend(node->left, pos, length, lines);
+    else if (pos > left_length + node->piece.length)
+        node->right = extend(node->right, pos - left_length - node->piece.length, length, lines);
+    else {
+        node->piece.size += length;
+        node->piece.length += length;
+        node->piece.lines += lines;
+    }
+
+    node->length += length;
+    node->lines += lines;
+    return node;
+}
+
+struct document* document_create(void) {
+    struct document* document = mem_alloc(sizeof(*document));
+    document->root = NULL;
+    document->append = NULL;
+    document->seed = atomic_fetch_add_explicit(&Seed, 0x9E3779B9u, memory_order_relaxed) | 1;
+    document->lazy = NULL;
+    document->lazy_offset = 0;
+    document->state = DOCUMENT_LOADED;
+    touch(document);
+    return document;
+}
+
+struct document* document_create_from(const uint16_t* text, size_t length, buffer_release_fn release, void* release_ctx) {
+    struct document* document = document_create();
+
+    struct buffer* buffer = buffer_create(text, ENCODING_UTF16, length, length, release, release_ctx);
+    document->root = build(document, buffer, 0, length);
+    buffer_release(buffer);
+
+    return document;
+}
+
+void document_append_from(struct document* document, const uint16_t* text, size_t length, buffer_release_fn release, void* release_ctx) {
+    touch(document);
+
+    struct buffer* buffer = buffer_create(text, ENCODING_UTF16, length, length, release, release_ctx);
+    document->root = merge(document->root, build(document, buffer, 0, length));
+    buffer_release(buffer);
+}
+
+struct document* document_create_lazy(const void* data, size_t size, enum encoding encoding, buffer_release_fn release, void* release_ctx) {
+    struct document* document = document_create();
+
+    // The buffer sizes are in elements, a stray odd byte at the end of UTF-16 text is ignored
+    const size_t elements = encoding == ENCODING_UTF16 ? size / sizeof(uint16_t) : size;
+    document->lazy = buffer_create(data, encoding, elements, elements, release, release_ctx);
+    document->state = elements ? DOCUMENT_LOADING : DOCUMENT_LOADED;
+    return document;
+}
+
+enum document_state document_load_more(struct document* document, size_t bytes) {
+    struct buffer* lazy = document->lazy;
+    if (document->state != DOCUMENT_LOADING)
+        return document->state;
+
+    touch(document);
+    if (lazy->encoding == ENCODING_UTF16) {
+        const size_t elements = bytes / sizeof(uint16_t) ? bytes / sizeof(uint16_t) : 1;
+        const size_t target = (lazy->size - document->lazy_offset > elements) ? document->lazy_offset + elements : lazy->size;
+
+        // UTF-16 needs no decoding or validation, the pieces only get their LFs counted
+        document->root = merge(document->root, build(document, lazy, document->lazy_offset, target - document->lazy_offset));
+        document->lazy_offset = target;
+    }
+
+    const uint8_t* data = lazy->data;
+    const size_t target = (lazy->size - document->lazy_offset > bytes) ? document->lazy_offset + bytes : lazy->size;
+
+    // Every chunk becomes one piece, it is validated and measured, but not decoded
+    while (lazy->encoding == ENCODING_UTF8 && document->lazy_offset < target) {
+        const size_t offset = document->lazy_offset;
+        size_t size = lazy->size - offset;
+
+        if (size > DOCUMENT_CHUNK) {
+            size = utf8_complete(data + offset, DOCUMENT_CHUNK);
+            // Nothing complete in a whole chunk means that the text is broken
+            if (!size)
+                size = DOCUMENT_CHUNK;
+        }
+
+        const size_t length = utf8_length_utf16(data + offset, size, &document->lazy_offset);
+        if (length == UTF_INVALID) {
+            // Remember where exactly the text is invalid
+            document->lazy_offset += offset;
+            return document->state = DOCUMENT_INVALID;
+        }
+
+        struct node* node = node_create(document, (struct piece){
+            .buffer = lazy,
+            .start = offset,
+            .size = size,
+            .length = length,
+            .lines = linebreak_count_utf8(data + offset, size)
+        });
+        document->root = merge(document->root, node);
+        document->lazy_offset = offset + size;
+    }
+
+    if (document->lazy_offset == lazy->size) {
+        document->state = DOCUMENT_LOADED;
+        buffer_release(document->lazy);
+        document->lazy = NULL;
+    }
+
+    return document->state;
+}
+
+enum document_state document_state(const struct document* document) {
+    return document->state;
+}
+
+size_t document_pending_bytes(const struct document* document) {
+    if (!document->lazy)
+        return 0;
+
+    const size_t pending = document->lazy->size - document->lazy_offset;
+    return document->lazy->encoding == ENCODING_UTF16 ? pending * sizeof(uint16_t) : pending;
+}
+
+struct document* document_snapshot(const struct document* document) {
+    struct document* snapshot = document_create();
+    snapshot->root = node_retain(document->root);
+    snapshot->revision = document->revision;
+    return snapshot;
+}
+
+// The state of document_copy, the pieces are copied into one buffer for each encoding
+struct copy {
+    struct document* document;
+    struct buffer* buffers[2];
+    size_t sizes[2];
+    struct node** stack;
+    size_t top, count;
+};
+
+// Calls 'fn' for every piece of the tree, in order
+static void each_piece(const struct node* node, void (*fn)(void* ctx, const struct piece* piece), void* ctx) {
+    while (node) {
+        each_piece(node->left, fn, ctx);
+        fn(ctx, &node->piece);
+        node = node->right;
+    }
+}
+
+static void measure_piece(void* ctx, const struct piece* piece) {
+    struct copy* copy = ctx;
+    copy->sizes[piece->buffer->encoding == ENCODING_UTF8] += piece->size;
+    copy->count++;
+}
+
+static void copy_piece(void* ctx, const struct piece* piece) {
+    struct copy* copy = ctx;
+    const bool utf8 = piece->buffer->encoding == ENCODING_UTF8;
+    const size_t element = utf8 ? 1 : sizeof(uint16_t);
+    struct buffer* buffer = copy->buffers[utf8];
+
+    memcpy((uint8_t*)buffer->data + buffer->size * element, (const uint8_t*)piece->buffer->data + piece->start * element, piece->size * element);
+    push_node(copy->stack, &copy->top, node_create(copy->document, (struct piece){
+        .buffer = buffer,
+        .start = buffer->size,
+        .size = piece->size,
+        .length = piece->length,
+        .lines = piece->lines
+    }));
+    buffer->size += piece->size;
+}
+
+struct document* document_copy(const struct document* document) {
+    struct copy copy = { .document = document_create() };
+    each_piece(document->root, measure_piece, &copy);
+    if (!copy.count)
+        return copy.document;
+
+    copy.buffers[0] = buffer_alloc(copy.sizes[0]);
+    copy.buffers[1] = buffer_create(mem_alloc(copy.sizes[1]), ENCODING_UTF8, 0, copy.sizes[1], free_owned, NULL);
+    copy.stack = mem_alloc(copy.count * sizeof(*copy.stack));
+    each_piece(document->root, copy_piece, &copy);
+
+    copy.document->root = finish_tree(copy.stack, copy.top);
+    mem_free(copy.stack);
+    buffer_release(copy.buffers[0]);
+    buffer_release(copy.buffers[1]);
+    return copy.document;
+}
+
+// The state of document_checkpoints, the pieces have to follow each other through all of one original buffer
+struct checkpoints {
+    const struct buffer* buffer;
+    struct document_checkpoint* checkpoints;
+    size_t count;
+    bool broken;
+};
+
+static void count_piece(void* ctx, const struct piece* piece) {
+    struct checkpoints* list = ctx;
+    list->broken |= piece->buffer != list->buffer;
+    list->count++;
+}
+
+static void checkpoint_piece(void* ctx, const struct piece* piece) {
+    struct checkpoints* list = ctx;
+    const struct document_checkpoint* last = &list->checkpoints[list->count];
+    const size_t element = piece->buffer->encoding == ENCODING_UTF8 ? 1 : sizeof(uint16_t);
+
+    list->broken |= piece->start * element != last->offset;
+    list->checkpoints[++list->count] = (struct document_checkpoint){
+        .offset = last->offset + piece->size * element,
+        .position = last->position + piece->length,
+        .line = last->line + piece->lines
+    };
+}
+
+struct document_checkpoint* document_checkpoints(const struct document* document, size_t* count) {
+    const struct node* first = document->root;
+    while (first && first->left)
+        first = first->left;
+
+    // The buffers the document owns are the append blocks and decoded copies, which only edits make
+    if (document->state != DOCUMENT_LOADED || !first || first->piece.buffer->release == free_owned)
+        return NULL;
+
+    struct checkpoints list = { .buffer = first->piece.buffer };
+    each_piece(document->root, count_piece, &list);
+    if (list.broken)
+        return NULL;
+
+    list.checkpoints = mem_alloc((list.count + 1) * sizeof(*list.checkpoints));
+    list.checkpoints[0] = (struct document_checkpoint){ 0 };
+    list.count = 0;
+    each_piece(document->root, checkpoint_piece, &list);
+
+    const size_t element = list.buffer->encoding == ENCODING_UTF8 ? 1 : sizeof(uint16_t);
+    if (list.broken || list.checkpoints[list.count].offset != list.buffer->size * element) {
+        mem_free(list.checkpoints);
+        return NULL;
+    }
+
+    *count = list.count + 1;
+    return list.checkpoints;
+}
+
+struct document* document_create_indexed(const void* data, size_t size, enum encoding encoding,
+    const struct document_checkpoint* checkpoints, size_t count, buffer_release_fn release, void* release_ctx) {
+
+    const size_t element = encoding == ENCODING_UTF8 ? 1 : sizeof(uint16_t);
+    const size_t elements = size / element;
+    if (!count || checkpoints[0].offset || checkpoints[0].position || checkpoints[0].line || checkpoints[count - 1].offset != elements * element)
+        return NULL;
+
+    // Every piece has to be one document_load_more could have made: not empty, not bigger than a chunk, with as many
+    // code units as UTF-8 (at most 3 bytes a unit) or UTF-16 can have and with no more LFs than that
+    for (size_t i = 1; i < count; i++) {
+        const struct document_checkpoint* a = &checkpoints[i - 1];
+        const struct document_checkpoint* b = &checkpoints[i];
+        if (b->offset <= a->offset || b->position < a->position || b->line < a->line)
+            return NULL;
+
+        const uint64_t piece_size = b->offset - a->offset, length = b->position - a->position, lines = b->line - a->line;
+        if (piece_size % element || piece_size / element > DOCUMENT_CHUNK || lines > length)
+            return NULL;
+        if (encoding == ENCODING_UTF8 ? length > piece_size || length * 3 < piece_size : length != piece_size / element)
+            return NULL;
+    }
+
+    struct document* document = document_create();
+    struct buffer* buffer = buffer_create(data, encoding, elements, elements, release, release_ctx);
+    struct node** stack = mem_alloc(count * sizeof(*stack));
+    size_t top = 0;
+
+    for (size_t i = 1; i < count; i++)
+        push_node(stack, &top, node_create(document, (struct piece){
+            .buffer = buffer,
+            .start = checkpoints[i - 1].offset / element,
+            .size = (checkpoints[i].offset - checkpoints[i - 1].offset) / element,
+            .length = checkpoints[i].position - checkpoints[i - 1].position,
+            .lines = checkpoints[i].line - checkpoints[i - 1].line
+        }));
+
+    document->root = finish_tree(stack, top);
+    mem_free(stack);
+    buffer_release(buffer);
+    return document;
+}
+
+void document_free(struct document* document) {
+    if (!document)
+        return;
+
+    node_release(document->root);
+    buffer_release(document->append);
+    buffer_release(document->lazy);
+    mem_free(document);
+}
+
+size_t document_length(const struct document* document) {
+    return length_of(document->root);
+}
+
+uint64_t document_revision(const struct document* document) {
+    return document->revision;
+}
+
+void document_insert(struct document* document, size_t pos, const uint16_t* text, size_t length) {
+    if (!length)
+        return;
+
+    touch(document);
+    if (pos > document_length(document))
+        pos = document_length(document);
+
+    // When typing, the new text usually directly follows the previous insertion,
+    // in that case we just make the previous piece longer instead of adding a new one
+    struct buffer* block = document->append;
+    if (block && block->capacity - block->size >= length) {
+        const struct piece* last = piece_ending_at(document->root, pos);
+        if (last && last->buffer == block && last->start + last->length == block->size) {
+            memcpy((uint16_t*)block->data + block->size, text, length * sizeof(uint16_t));
+            block->size += length;
+            document->root = extend(document->root, pos, length, linebreak_count_utf16(text, length));
+            return;
+        }
+    }
+
+    struct node* inserted = append_text(document, text, length);
+
+    struct node *left, *right;
+    split(document, document->root, pos, &left, &right);
+    document->root = merge(merge(left, inserted), right);
+}
+
+void document_erase(struct document* document, size_t pos, size_t length) {
+    const size_t total = document_length(document);
+    if (pos >= total || !length)
+        return;
+    if (length > total - pos)
+        length = total - pos;
+    touch(document);
+
+    struct node *left, *middle, *right;
+    split(document, document->root, pos, &left, &right);
+    split(document, right, length, &middle, &right);
+    node_release(middle);
+
+    document->root = merge(left, right);
+}
+
+// A slice of an original piece shorter than this is copied next to the replacements around it, a node costs about
+// as much memory as that many code units, so replacing lots of matches close to each other doesn't make a node of every slice
+#define REPLACE_GATHER 128
+
+// The new tree document_replace_all builds, in order
+struct rebuild {
+    struct document* document;
+    // The right spine of the tree, as in build()
+    struct node** stack;
+    size_t top, capacity;
+
+    // The buffer the replacements and the short slices between them are copied into, in the encoding of the slices,
+    // the text from 'gathered' on ('gathered_length' code units) isn't a part of a piece yet
+    struct buffer* gather;
+    size_t gathered, gathered_length;
+
+    // The next match, the end of the text the last one removes and where the current piece starts in the document
+    const size_t* positions;
+    const size_t* lengths;
+    size_t next, count, removed, skip, base;
+    // The replacement, and its UTF-8 form if it has one (NULL if it has a half of a surrogate pair)
+    const uint16_t* text;
+    size_t length;
+    const uint8_t* text8;
+    size_t size8;
+};
+
+static void rebuild_push(struct rebuild* rebuild, const struct piece piece) {
+    if (rebuild->top == rebuild->capacity) {
+        rebuild->capacity = rebuild->capacity ? rebuild->capacity * 2 : 64;
+        rebuild->stack = mem_realloc(rebuild->stack, rebuild->capacity * sizeof(*rebuild->stack));
+    }
+    push_node(rebuild->stack, &rebuild->top, node_create(rebuild->document, piece));
+}
+
+// Turns the gathered text into a piece
+static void rebuild_flush(struct rebuild* rebuild) {
+    struct buffer* gather = rebuild->gather;
+    if (!gather || rebuild->gathered == gather->size)
+        return;
+
+    const size_t size = gather->size - rebuild->gathered;
+    rebuild_push(rebuild, (struct piece){
+        .buffer = gather,
+        .start = rebuild->gathered,
+        .size = size,
+        .length = rebuild->gathered_length,
+        .lines = count_lines(gather, rebuild->gathered, size)
+    });
+    rebuild->gathered = gather->size;
+    rebuild->gathered_length = 0;
+}
+
+// Copies text to the gathered text, 'size' elements of the encoding that decode to 'length' code units
+// Text in another encoding than the gathered one starts a new buffer, UTF-8 is only ever gathered in whole characters
+static void rebuild_gather(struct rebuild* rebuild, enum encoding encoding, const void* data, size_t size, size_t length) {
+    if (!size)
+        return;
+
+    const size_t element = encoding == ENCODING_UTF8 ? 1 : sizeof(uint16_t);
+    struct buffer* gather = rebuild->gather;
+    if (!gather || gather->encoding != encoding || gather->capacity - gather->size < size) {
+        rebuild_flush(rebuild);
+        buffer_release(gather);
+
+        const size_t capacity = size > DOCUMENT_CHUNK ? size : DOCUMENT_CHUNK;
+        gather = rebuild->gather = buffer_create(mem_alloc(capacity * element), encoding, 0, capacity, free_owned, NULL);
+        rebuild->gathered = 0;
+    }
+
+    memcpy((uint8_t*)gather->data + gather->size * element, data, size * element);
+    gather->size += size;
+    rebuild->gathered_length += length;
+}
+
+// Gathers the replacement, in UTF-8 unless the text gathered so far is in UTF-16
+static void rebuild_replacement(struct rebuild* rebuild) {
+    if (rebuild->text8 && (!rebuild->gather || rebuild->gather->encoding == ENCODING_UTF8))
+        rebuild_gather(rebuild, ENCODING_UTF8, rebuild->text8, rebuild->size8, rebuild->length);
+    else
+        rebuild_gather(rebuild, ENCODING_UTF16, rebuild->text, rebuild->length, rebuild->length);
+}
+
+// Adds a range of a piece that is kept, the piece itself if it's the whole of it
+// 'from_element' and 'to_element' are where the range is in the elements of the buffer, unless it starts or ends
+// in the middle of a surrogate pair, in which case they point to the start of the pair
+static void rebuild_keep(struct rebuild* rebuild, const struct piece* piece, size_t from, size_t to, size_t from_element, size_t to_element, bool from_inside, bool to_inside) {
+    if (from == to)
+        return;
+
+    if (!from && to == piece->length) {
+        rebuild_flush(rebuild);
+        rebuild_push(rebuild, *piece);
+        return;
+    }
+
+    const size_t start = piece->start + from_element, size = to_element - from_element;
+    if (to - from >= REPLACE_GATHER && !from_inside && !to_inside) {
+        rebuild_flush(rebuild);
+        rebuild_push(rebuild, (struct piece){
+            .buffer = piece->buffer,
+            .start = start,
+            .size = size,
+            .length = to - from,
+            .lines = count_lines(piece->buffer, start, size)
+        });
+        return;
+    }
+
+    // UTF-8 is copied as it is, so the gathered text takes no more memory than the file did
+    if (piece->buffer->encoding == ENCODING_UTF16) {
+        rebuild_gather(rebuild, ENCODING_UTF16, (const uint16_t*)piece->buffer->data + start, size, size);
+        return;
+    } else if (!from_inside && !to_inside) {
+        rebuild_gather(rebuild, ENCODING_UTF8, (const uint8_t*)piece->buffer->data + start, size, to - from);
+        return;
+    }
+
+    // A half of a surrogate pair at either end is decoded with the whole pair, and then left out
+    const size_t rest = piece->start + piece->size - start;
+    const size_t decode = to_inside ? (rest < size + 4 ? rest : size + 4) : size;
+    const size_t length = to - from + 1;
+    uint16_t* units = mem_alloc((decode > length ? decode : length) * sizeof(uint16_t));
+    decode_units((const uint8_t*)piece->buffer->data + start, decode, units, length);
+    rebuild_gather(rebuild, ENCODING_UTF16, units + (from_inside ? 1 : 0), to - from, to - from);
+    mem_free(units);
+}
+
+// Goes through a UTF-8 piece code unit by code unit, only ever forward, so that finding all of the offsets is O(piece)
+struct piece_cursor {
+    size_t unit, element;
+};
+
+// Returns the offset in elements of a code unit of a piece (or of the start of its pair, setting '*inside_pair')
+static size_t cursor_seek(const struct piece* piece, struct piece_cursor* cursor, size_t unit, bool* inside_pair) {
+    *inside_pair = false;
+    if (piece->buffer->encoding == ENCODING_UTF16 || piece->size == piece->length)
+        return unit;
+
+    const uint8_t* data = (const uint8_t*)piece->buffer->data + piece->start;
+    cursor->element += utf8_offset_of(data + cursor->element, piece->size - cursor->element, unit - cursor->unit, inside_pair);
+    cursor->unit = *inside_pair ? unit - 1 : unit;
+    return cursor->element;
+}
+
+// Rebuilds the pieces of a subtree in order, cutting out the matches and putting in the replacements
+static void rebuild_node(struct rebuild* rebuild, const struct node* node) {
+    while (node) {
+        rebuild_node(rebuild, node->left);
+
+        const struct piece* piece = &node->piece;
+        const size_t base = rebuild->base, end = base + piece->length;
+        struct piece_cursor cursor = { 0, 0 };
+        bool from_inside = false, to_inside;
+
+        // The text the last match removes may go on into this piece
+        size_t from = (rebuild->skip > base ? (rebuild->skip < end ? rebuild->skip : end) : base) - base;
+        size_t from_element = cursor_seek(piece, &cursor, from, &from_inside);
+
+        while (rebuild->next < rebuild->count && rebuild->positions[rebuild->next] < end) {
+            const size_t removed = rebuild->lengths ? rebuild->lengths[rebuild->next] : rebuild->removed;
+            const size_t at = rebuild->positions[rebuild->next++] - base;
+            const size_t at_element = cursor_seek(piece, &cursor, at, &to_inside);
+            rebuild_keep(rebuild, piece, from, at, from_element, at_element, from_inside, to_inside);
+            rebuild_replacement(rebuild);
+
+            rebuild->skip = base + at + removed;
+            from = (rebuild->skip < end ? rebuild->skip : end) - base;
+            from_element = cursor_seek(piece, &cursor, from, &from_inside);
+        }
+
+        rebuild_keep(rebuild, piece, from, piece->length, from_element, piece->size, from_inside, false);
+        rebuild->base = end;
+        node = node->right;
+    }
+}
+
+void document_replace_all(struct document* document, const size_t* positions, const size_t* lengths, size_t count, size_t removed, const uint16_t* text, size_t length) {
+    if (!count)
+        return;
+
+    touch(document);
+    struct rebuild rebuild = {
+        .document = document,
+        .positions = positions,
+        .lengths = lengths,
+        .count = count,
+        .removed = removed,
+        .text = text,
+        .length = length
+    };
+
+    // UTF-8 can't hold a half of a surrogate pair, such a replacement only goes in as UTF-16
+    bool paired = true;
+    for (size_t i = 0; i < length && paired; i++) {
+        if (text[i] >= 0xD800 && text[i] <= 0xDBFF && i + 1 < length && text[i + 1] >= 0xDC00 && text[i + 1] <= 0xDFFF)
+            i++;
+        else
+            paired = text[i] < 0xD800 || text[i] > 0xDFFF;
+    }
+    uint8_t* text8 = NULL;
+    if (paired && length) {
+        text8 = mem_alloc(length * 3);
+        rebuild.size8 = utf16_to_utf8(text, length, text8);
+        rebuild.text8 = text8;
+    }
+
+    rebuild_node(&rebuild, document->root);
+
+    // Matches at the very end (which only an empty one can be) have no piece to be in
+    while (rebuild.next++ < count)
+        rebuild_replacement(&rebuild);
+
+    rebuild_flush(&rebuild);
+    buffer_release(rebuild.gather);
+    mem_free(text8);
+
+    node_release(document->root);
+    document->root = finish_tree(rebuild.stack, rebuild.top);
+    mem_free(rebuild.stack);
+}
+
+// The number of elements counted at once when looking for a line break inside of a piece
+#define LINE_BLOCK 1024
+
+// Counts the LFs in the first 'offset' code units of a piece
+static size_t piece_lines_before(const struct piece* piece, size_t offset) {
+    if (piece->buffer->encoding == ENCODING_UTF16)
+        return count_lines(piece->buffer, piece->start, offset);
+
+    bool inside_pair;
+    return count_lines(piece->buffer, piece->start, piece_offset_of(piece, offset, &inside_pair));
+}
+
+// Returns the offset (in code units) right after the 'line'-th LF of a piece, counted from 1, the piece should have that many
+// (or its end if it hasn't, which only a piece out of stale checkpoints can do)
+// The whole blocks before the LF are only counted, so this is not much slower than counting the LFs in the piece
+static size_t piece_line_start(const struct piece* piece, size_t line) {
+    size_t i = 0;
+    while (piece->size - i > LINE_BLOCK) {
+        const size_t count = count_lines(piece->buffer, piece->start + i, LINE_BLOCK);
+        if (count >= line)
+            break;
+        line -= count;
+        i += LINE_BLOCK;
+    }
+
+    if (piece->buffer->encoding == ENCODING_UTF16) {
+        const uint16_t* data = (const uint16_t*)piece->buffer->data + piece->start;
+        while (i < piece->size && (data[i] != '\n' || --line))
+            i++;
+        return i < piece->size ? i + 1 : piece->length;
+    }
+
+    // Right after an LF is always the start of a character, so the bytes before it decode to whole code units
+    const uint8_t* data = (const uint8_t*)piece->buffer->data + piece->start;
+    while (i < piece->size && (data[i] != '\n' || --line))
+        i++;
+    if (i == piece->size)
+        return piece->length;
+    const size_t offset = piece->size == piece->length ? i + 1 : utf8_length_utf16_lossy(data, i + 1);
+    return offset < piece->length ? offset : piece->length;
+}
+
+size_t document_line_count(const struct document* document) {
+    return lines_of(document->root) + 1;
+}
+
+size_t document_line_of(const struct document* document, size_t pos) {
+    const struct node* node = document->root;
+    size_t lines = 0;
+
+    while (node) {
+        const size_t left_length = length_of(node->left);
+
+        if (pos < left_length) {
+            node = node->left;
+        } else if (pos < left_length + node->piece.length) {
+            return lines + lines_of(node->left) + piece_lines_before(&node->piece, pos - left_length);
+        } else {
+            lines += lines_of(node->left) + node->piece.lines;
+            pos -= left_length + node->piece.length;
+            node = node->right;
+        }
+    }
+
+    return lines;
+}
+
+size_t document_line_start(const struct document* document, size_t line) {
+    if (line > lines_of(document->root))
+        line = lines_of(document->root);
+
+    const struct node* node = document->root;
+    size_t offset = 0;
+
+    // We are looking for the node that has the 'line'-th LF
+    while (line) {
+        const size_t left_lines = lines_of(node->left);
+
+        if (line <= left_lines) {
+            node = node->left;
+        } else if (line <= left_lines + node->piece.lines) {
+            return offset + length_of(node->left) + piece_line_start(&node->piece, line - left_lines);
+        } else {
+            line -= left_lines + node->piece.lines;
+            offset += length_of(node->left) + node->piece.length;
+            node = node->right;
+        }
+    }
+
+    return offset;
+}
+
+// Passes the specified range of a piece to a document_walk callback, decoding it if needed
+static bool walk_piece(const struct piece* piece, size_t from, size_t to, document_span_fn fn, void* ctx) {
+
+    if (piece->buffer->encoding == ENCODING_UTF16)
+        return fn(ctx, (const uint16_t*)piece->buffer->data + piece->start + from, to - from);
+
+    // UTF-8 gets decoded in small steps, so that we never need more than a bit of stack
+    const uint8_t* data = (const uint8_t*)piece->buffer->data + piece->start;
+    uint16_t scratch[WALK_SCRATCH];
+
+    bool inside_pair;
+    size_t offset = piece_offset_of(piece, from, &inside_pair);
+    // If we start in the middle of a surrogate pair, the first code unit is not ours
+    size_t skip = inside_pair ? 1 : 0;
+    size_t remaining = to - from;
+
+    while (remaining) {
+        const size_t available = piece->size - offset;
+        const size_t window = available < WALK_SCRATCH ? available : WALK_SCRATCH;
+        size_t length;
+
+        if (available) {
+            // Only a character cut off at the very end of the piece can leave nothing complete, see decode_units
+            size_t chunk = utf8_complete(data + offset, window);
+            if (!chunk)
+                chunk = window;
+            length = utf8_to_utf16_lossy(data + offset, chunk, scratch);
+            offset += chunk;
+        } else {
+            // The bytes are short of the code units the piece is said to have, the rest of them are U+FFFD
+            length = remaining + skip < WALK_SCRATCH ? remaining + skip : WALK_SCRATCH;
+            for (size_t i = 0; i < length; i++)
+                scratch[i] = 0xFFFD;
+        }
+
+        if (length <= skip) {
+            skip -= length;
+            continue;
+        }
+        length -= skip;
+        if (length > remaining)
+            length = remaining;
+        if (!fn(ctx, scratch + skip, length))
+            return false;
+
+        remaining -= length;
+        skip = 0;
+    }
+
+    return true;
+}
+
+// The recursive part of document_walk, the range is relative to the subtree
+static bool walk(const struct node* node, size_t pos, size_t end, document_span_fn fn, void* ctx) {
+    while (node && pos < end) {
+        const size_t left_length = length_of(node->left);
+        const size_t piece_end = left_length + node->piece.length;
+
+        if (pos < left_length && !walk(node->left, pos, end < left_length ? end : left_length, fn, ctx))
+            return false;
+
+        if (pos < piece_end && end > left_length) {
+            const size_t from = (pos > left_length ? pos : left_length) - left_length;
+            const size_t to = (end < piece_end ? end : piece_end) - left_length;
+            if (!walk_piece(&node->piece, from, to, fn, ctx))
+                return false;
+        }
+
+        if (end <= piece_end)
+            break;
+
+        // Continue with the right subtree iteratively, there is no need to recurse for it
+        pos = pos > piece_end ? pos - piece_end : 0;
+        end -= piece_end;
+        node = node->right;
+    }
+
+    return true;
+}
+
+bool document_walk(const struct document* document, size_t pos, size_t length, document_span_fn fn, void* ctx) {
+    const size_t total = document_length(document);
+    if (pos >= total)
+        return true;
+
+    return walk(document->root, pos, length > total - pos ? total : pos + length, fn, ctx);
+}
+
+// The recursive part of document_walk_pieces, 'base' is where the subtree starts in the document
+static bool walk_pieces(const struct node* node, size_t base, size_t pos, size_t end, document_piece_fn fn, void* ctx) {
+    while (node && pos < end) {
+        const size_t left_length = length_of(node->left);
+        const size_t piece_end = left_length + node->piece.length;
+
+        if (pos < left_length && !walk_pieces(node->left, base, pos, end < left_length ? end : left_length, fn, ctx))
+            return false;
+
+        if (pos < piece_end && end > left_length) {
+            const struct piece* piece = &node->piece;
+            const size_t element = piece->buffer->encoding == ENCODING_UTF8 ? 1 : sizeof(uint16_t);
+            if (!fn(ctx, base + left_length, (const uint8_t*)piece->buffer->data + piece->start * element, piece->size, piece->length, piece->buffer->encoding))
+                return false;
+        }
+
+        if (end <= piece_end)
+            break;
+
+        pos = pos > piece_end ? pos - piece_end : 0;
+        end -= piece_end;
+        base += piece_end;
+        node = node->right;
+    }
+
+    return true;
+}
+
+bool document_walk_pieces(const struct document* document, size_t pos, size_t length, document_piece_fn fn, void* ctx) {
+    const size_t total = document_length(document);
+    if (pos >= total)
+        return true;
+
+    return walk_pieces(document->root, 0, pos, length > total - pos ? total : pos + length, fn, ctx);
+}
+
+// The document_walk callback used by document_read
+static bool read_span(void* ctx, const uint16_t* text, size_t length) {
+    uint16_t** out = ctx;
+    memcpy(*out, text, length * sizeof(uint16_t));
+    *out += length;
+    return true;
+}
+
+size_t document_read(const struct document* document, size_t pos, uint16_t* out, size_t length) {
+    uint16_t* end = out;
+    document_walk(document, pos, length, read_span, &end);
+    return end - out;
+}
@@ -0,0 +1,155 @@
+#pragma once
+// The document engine, a piece table which owns the text of the opened file
+//
+// The text is never kept in one big buffer. Instead, the document is a sequence of pieces, each of which
+// points into a buffer: either an "original" buffer (the loaded file, which is never modified) or one of
+// the append blocks, where everything the user types ends up. The pieces live in a balanced tree (a treap)
+// ordered by position, so inserting and erasing is O(log n) no matter how big the file is.
+//
+// The tree nodes are reference counted and copied on write, which makes snapshots O(1): a snapshot
+// just shares the root with the document and whoever modifies a shared node first makes its own copy.
+// Snapshots may be handed over to other threads (for saving, searching...) while the original is edited.
+//
+// The text is addressed in UTF-16 code units, the same units that Win32 uses everywhere. Original buffers
+// can also be UTF-8 (e.g. a memory mapped file), those are only decoded when somebody reads from them.
+
+#include "format.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+struct document;
+
+// The state of a document created by document_create_lazy, other documents are always loaded
+enum document_state {
+    // There is still text that the document doesn't know about
+    DOCUMENT_LOADING,
+    DOCUMENT_LOADED,
+    // Loading has stopped because the text is not valid in its encoding
+    DOCUMENT_INVALID
+};
+
+// The largest piece the document ever creates, in code units
+// Keeping the pieces small bounds the work needed to look inside of one
+#define DOCUMENT_CHUNK (64 * 1024)
+
+// Called once no piece references an original buffer anymore, 'size' is in bytes
+typedef void (*buffer_release_fn)(void* ctx, const void* data, size_t size);
+
+// Called by document_walk for every contiguous span of text, returning false stops the walk
+typedef bool (*document_span_fn)(void* ctx, const uint16_t* text, size_t length);
+
+// Creates an empty document
+struct document* document_create(void);
+
+// Creates a document from an existing UTF-16 buffer without copying it
+// The buffer has to stay valid and unchanged until 'release' gets called (which may be NULL)
+struct document* document_create_from(const uint16_t* text, size_t length, buffer_release_fn release, void* release_ctx);
+
+// Appends an existing UTF-16 buffer to the end of the document without copying it, the same way document_create_from
+// creates one, e.g. for text converted in big blocks
+void document_append_from(struct document* document, const uint16_t* text, size_t length, buffer_release_fn release, void* release_ctx);
+
+// Creates a document over a (usually memory mapped) encoded buffer, without the BOM
+// The encoding is either UTF-8 or UTF-16, big endian text has to be converted first
+// Nothing is decoded up front, the text is not even scanned, the document knows about it only
+// as far as document_load_more has gotten, so opening is O(1) no matter the size of the buffer
+// The buffer has to stay valid and unchanged until 'release' gets called (which may be NULL)
+struct document* document_create_lazy(const void* data, size_t size, enum encoding encoding, buffer_release_fn release, void* release_ctx);
+
+// Validates and indexes at least 'bytes' more bytes of a lazily loaded document, appending them to the end
+// The text is measured and its LFs are counted, but it is not decoded, so this is cheap and uses no memory per byte
+enum document_state document_load_more(struct document* document, size_t bytes);
+
+// Returns the loading state of the document
+enum document_state document_state(const struct document* document);
+
+// Where a piece of a lazily loaded document starts: 'offset' in bytes of the buffer, 'position' in code units and
+// 'line' as the number of LFs before it
+// The pieces are cut between whole characters, so nothing of the text before one is needed to read from it
+struct document_checkpoint {
+    uint64_t offset, position, line;
+};
+
+// Returns the checkpoints of a document created by document_create_lazy that is loaded and hasn't been edited since,
+// one for every piece and one for the end, to be kept for document_create_indexed (see checkpoint.h)
+// Returns NULL otherwise, the checkpoints are freed with mem_free
+struct document_checkpoint* document_checkpoints(const struct document* document, size_t* count);
+
+// Creates a loaded document over an encoded buffer the same way document_create_lazy and document_load_more would,
+// but out of the checkpoints of an earlier load, in O(count) and without touching the text
+// The checkpoints are trusted to be of the same text, only whether they fit the buffer at all is checked
+// If the text has changed since all the same, reading it never fails: what isn't valid or isn't there reads as U+FFFD
+// Returns NULL if they don't, 'release' is not called then
+struct document* document_create_indexed(const void* data, size_t size, enum encoding encoding,
+    const struct document_checkpoint* checkpoints, size_t count, buffer_release_fn release, void* release_ctx);
+
+// Returns the number of bytes document_load_more still has to go through
+// If the document is invalid, this is counted from the first invalid byte
+size_t document_pending_bytes(const struct document* document);
+
+// Creates an independent copy of the document in O(1), the text itself is shared
+// Changes to the snapshot don't affect the original and vice versa
+// Only the text that has already been loaded is a part of the snapshot
+struct document* document_snapshot(const struct document* document);
+
+// Creates a copy of the document that doesn't share any buffers with it, e.g. so that the file it reads from can be
+// replaced, the text is copied the way it is stored, UTF-8 pieces stay UTF-8
+// Only the text that has already been loaded is copied
+struct document* document_copy(const struct document* document);
+
+// Frees the document, the buffers are released once nothing else references them
+void document_free(struct document* document);
+
+// Returns the length of the whole document in code units
+size_t document_length(const struct document* document);
+
+// Returns the revision of the text, every edit (and every part a lazy document loads) gives the document a new one
+// The revisions are never reused by any document, so whatever was found in a document is still valid if it's the same
+// A snapshot starts with the revision of the original
+uint64_t document_revision(const struct document* document);
+
+// Lines are separated by LFs (so a CRLF line ends with its CR) and are counted from 0, wrapping has nothing to do with them
+// Every node knows how many LFs its subtree has, so all of these are O(log n) plus a look into at most one piece
+// While a document is still loading, they only know about the text that has been loaded so far
+
+// Returns the number of lines, an empty document (or one ending with an LF) has an empty last line
+size_t document_line_count(const struct document* document);
+
+// Returns the line that the code unit at 'pos' is on, positions past the end are on the last line
+size_t document_line_of(const struct document* document, size_t pos);
+
+// Returns the position of the first code unit of a line, lines past the end start where the last line does
+size_t document_line_start(const struct document* document, size_t line);
+
+// Inserts 'length' code units at 'pos', the text is copied
+void document_insert(struct document* document, size_t pos, const uint16_t* text, size_t length);
+
+// Erases 'length' code units starting at 'pos'
+void document_erase(struct document* document, size_t pos, size_t length);
+
+// Replaces 'removed' code units at each of the positions with 'text', the positions must be sorted and the ranges
+// must not overlap (find_all gives them like that), the positions are where the matches are before any of them is replaced
+// If the matches aren't all as long, 'lengths' has the number of code units to remove at each position ('removed' is ignored),
+// otherwise it's NULL
+// The new tree is built in a single pass over the pieces, the text between the matches isn't copied unless it's short
+void document_replace_all(struct document* document, const size_t* positions, const size_t* lengths, size_t count, size_t removed, const uint16_t* text, size_t length);
+
+// Calls 'fn' for every contiguous span of text in the specified range, in order
+// Returns false if 'fn' has stopped the walk
+bool document_walk(const struct document* document, size_t pos, size_t length, document_span_fn fn, void* ctx);
+
+// Called by document_walk_pieces for every piece of text as it is stored, 'size' is in elements of the encoding
+// (bytes of UTF-8 or UTF-16 code units), 'pos' is where the piece starts in the document and 'length' is
+// the number of code units it decodes to
+typedef bool (*document_piece_fn)(void* ctx, size_t pos, const void* data, size_t size, size_t length, enum encoding encoding);
+
+// Calls 'fn' for every piece that overlaps the specified range, in order, the first and the last one may reach out of it
+// Nothing gets decoded, which is what searching needs to go through UTF-8 text as fast as through UTF-16 text
+// Returns false if 'fn' has stopped the walk
+bool document_walk_pieces(const struct document* document, size_t pos, size_t length, document_piece_fn fn, void* ctx);
+
+// Copies the specified range into 'out', returns the number of code units copied
+// (which is less than 'length' only if the range goes past the end of the document)
+size_t document_read(const struct document* document, size_t pos, uint16_t* out, size_t length);
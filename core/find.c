@@ -0,0 +1,781 @@
+#include "find.h"
+#include "memory.h"
+#include "pool.h"
+#include "simd.h"
+#include "utf.h"
+
+#include <stdatomic.h>
+#include <string.h>
+
+// The number of positions the vectorized filter looks at at once, one bit of a mask each
+#define BLOCK 32
+
+// Once comparing candidates has cost this many elements per element of the text (and a bit more for
+// the first few candidates), the pattern keeps matching almost everywhere and Two-Way takes over
+#define FALLBACK_RATIO 8
+#define FALLBACK_SLACK 4096
+
+// find_all splits the document into this many chunks per thread, none of them shorter than the minimum
+#define FIND_TASKS_PER_THREAD 4
+#define FIND_MIN_CHUNK (1024 * 1024)
+
+// The tables of the case folding, built on the first use: the form every code unit is compared in
+// and the other code unit that folds to the same one (every folded unit has at most one)
+static uint16_t Fold[65536], Other[65536];
+// 0 until the tables are built, 1 while they are being built and 2 once they are ready
+static atomic_int Folding = 0;
+
+// A pattern in the width of the text it's searched for in, UTF-8 is stored one byte per element
+struct needle {
+    // The elements (folded if the case doesn't matter) and the bytes of a UTF-8 pattern
+    uint16_t* elements;
+    uint8_t* bytes;
+    size_t length;
+    bool wide, fold;
+
+    // Both cases of the first and the last element, the same one twice if there is just one
+    uint16_t first[2], last[2];
+
+    // The critical factorization for Two-Way, whether the pattern repeats with the period, and how far it moves
+    ptrdiff_t critical;
+    size_t period;
+    bool periodic;
+
+    // How far Horspool moves the pattern, by the low byte of the last element under it
+    size_t shift[256];
+};
+
+struct finder {
+    struct needle wide;
+    // The UTF-8 form of the pattern, empty if UTF-8 text has to be decoded to be searched
+    // (the case of non-ASCII characters can't be ignored in UTF-8, and unpaired surrogates can't be encoded)
+    struct needle narrow;
+};
+
+// Folds a range of upper case letters that are a fixed distance away from the lower case ones
+static void fold_range(unsigned first, unsigned last, int distance) {
+    for (unsigned c = first; c <= last; c++)
+        Fold[c] = (uint16_t)(c + distance);
+}
+
+// Folds a range of pairs, an upper case letter followed by its lower case one
+static void fold_pairs(unsigned first, unsigned last) {
+    for (unsigned c = first; c < last; c += 2)
+        Fold[c] = (uint16_t)(c + 1);
+}
+
+static void build_tables(void) {
+    for (unsigned c = 0; c < 65536; c++)
+        Fold[c] = (uint16_t)c;
+
+    // Latin
+    fold_range('A', 'Z', 0x20);
+    fold_range(0xC0, 0xD6, 0x20);
+    fold_range(0xD8, 0xDE, 0x20);
+    // The dotted capital I and the dotless small i (0x130 and 0x131) aren't a pair, they fold to nothing else
+    fold_pairs(0x100, 0x12F);
+    fold_pairs(0x132, 0x137);
+    fold_pairs(0x139, 0x148);
+    fold_pairs(0x14A, 0x177);
+    Fold[0x178] = 0xFF;
+    fold_pairs(0x179, 0x17E);
+    fold_pairs(0x1CD, 0x1DC);
+    fold_pairs(0x1DE, 0x1EF);
+    fold_pairs(0x1F8, 0x21F);
+    fold_pairs(0x222, 0x233);
+    fold_pairs(0x1E00, 0x1E95);
+    fold_pairs(0x1EA0, 0x1EFF);
+
+    // Greek, the final sigma stays as it is, every folded letter may only have one other case
+    Fold[0x386] = 0x3AC;
+    fold_range(0x388, 0x38A, 0x25);
+    Fold[0x38C] = 0x3CC;
+    fold_range(0x38E, 0x38F, 0x3F);
+    fold_range(0x391, 0x3A1, 0x20);
+    fold_range(0x3A3, 0x3AB, 0x20);
+    fold_pairs(0x3D8, 0x3EF);
+
+    // Cyrillic and Armenian
+    fold_range(0x400, 0x40F, 0x50);
+    fold_range(0x410, 0x42F, 0x20);
+    fold_pairs(0x460, 0x481);
+    fold_pairs(0x48A, 0x4BF);
+    fold_pairs(0x4C1, 0x4CE);
+    fold_pairs(0x4D0, 0x52F);
+    fold_range(0x531, 0x556, 0x30);
+
+    // Roman numerals, circled letters and the fullwidth forms
+    fold_range(0x2160, 0x216F, 0x10);
+    fold_range(0x24B6, 0x24CF, 0x1A);
+    fold_range(0xFF21, 0xFF3A, 0x20);
+
+    for (unsigned c = 0; c < 65536; c++)
+        Other[c] = (uint16_t)c;
+    for (unsigned c = 0; c < 65536; c++) {
+        if (Fold[c] != c)
+            Other[Fold[c]] = (uint16_t)c;
+    }
+}
+
+// Builds the tables unless they are built already, another thread that needs them meanwhile waits for them
+static void prepare_tables(void) {
+    int state = 0;
+    if (atomic_compare_exchange_strong(&Folding, &state, 1)) {
+        build_tables();
+        atomic_store(&Folding, 2);
+        return;
+    }
+
+    while (atomic_load(&Folding) != 2);
+}
+
+uint16_t find_fold(uint16_t c) {
+    prepare_tables();
+    return Fold[c];
+}
+
+static inline uint16_t element_at(const void* text, size_t i, bool wide) {
+    return wide ? ((const uint16_t*)text)[i] : ((const uint8_t*)text)[i];
+}
+
+// Returns an element of the text the way the pattern is stored
+static inline uint16_t folded(const struct needle* needle, const void* text, size_t i) {
+    const uint16_t c = element_at(text, i, needle->wide);
+    return needle->fold ? Fold[c] : c;
+}
+
+static bool matches_at(const struct needle* needle, const void* text, size_t pos) {
+    if (!needle->fold) {
+        if (needle->wide)
+            return !memcmp((const uint16_t*)text + pos, needle->elements, needle->length * sizeof(uint16_t));
+        return !memcmp((const uint8_t*)text + pos, needle->bytes, needle->length);
+    }
+
+    for (size_t i = 0; i < needle->length; i++) {
+        if (folded(needle, text, pos + i) != needle->elements[i])
+            return false;
+    }
+    return true;
+}
+
+// Two-Way (Crochemore and Perrin), linear in the length of the text no matter what the pattern is
+
+// Returns the position before the maximal suffix of the pattern, for one order of the elements or the reverse one
+static ptrdiff_t maximal_suffix(const uint16_t* x, ptrdiff_t m, ptrdiff_t* period, bool reverse) {
+    ptrdiff_t suffix = -1, j = 0, k = 1;
+    *period = 1;
+
+    while (j + k < m) {
+        const uint16_t a = x[j + k], b = x[suffix + k];
+        if (reverse ? a > b : a < b) {
+            j += k;
+            k = 1;
+            *period = j - suffix;
+        } else if (a == b) {
+            if (k != *period) {
+                k++;
+            } else {
+                j += *period;
+                k = 1;
+            }
+        } else {
+            suffix = j++;
+            k = *period = 1;
+        }
+    }
+
+    return suffix;
+}
+
+static void factorize(struct needle* needle) {
+    const ptrdiff_t m = (ptrdiff_t)needle->length;
+    ptrdiff_t p, q;
+    const ptrdiff_t i = maximal_suffix(needle->elements, m, &p, false);
+    const ptrdiff_t j = maximal_suffix(needle->elements, m, &q, true);
+
+    needle->critical = i > j ? i : j;
+    ptrdiff_t period = i > j ? p : q;
+
+    // If the part before the critical position repeats, the matched prefix is remembered when moving by the period
+    needle->periodic = !memcmp(needle->elements, needle->elements + period, (needle->critical + 1) * sizeof(uint16_t));
+    if (!needle->periodic)
+        period = (needle->critical + 1 > m - needle->critical - 1 ? needle->critical + 1 : m - needle->critical - 1) + 1;
+    needle->period = (size_t)period;
+}
+
+static size_t two_way(const struct needle* needle, const void* text, size_t n, size_t from) {
+    const uint16_t* x = needle->elements;
+    const ptrdiff_t m = (ptrdiff_t)needle->length;
+    const ptrdiff_t critical = needle->critical;
+    ptrdiff_t memory = -1;
+
+    for (size_t j = from; n - j >= (size_t)m && j <= n;) {
+        // The right part first, then the left one
+        ptrdiff_t i = (critical > memory ? critical : memory) + 1;
+        while (i < m && x[i] == folded(needle, text, j + i))
+            i++;
+
+        if (i < m) {
+            j += i - critical;
+            memory = -1;
+            continue;
+        }
+
+        i = critical;
+        while (i > memory && x[i] == folded(needle, text, j + i))
+            i--;
+        if (i <= memory)
+            return j;
+
+        j += needle->period;
+        memory = needle->periodic ? m - (ptrdiff_t)needle->period - 1 : -1;
+    }
+
+    return SIZE_MAX;
+}
+
+// Horspool, moves the pattern by how far the element under its end is from the end of the pattern
+static size_t horspool(const struct needle* needle, const void* text, size_t n, size_t from) {
+    const size_t m = needle->length;
+    const uint16_t last = needle->elements[m - 1];
+    size_t work = 0;
+
+    for (size_t j = from; n - j >= m;) {
+        const uint16_t c = folded(needle, text, j + m - 1);
+        if (c == last) {
+            if (matches_at(needle, text, j))
+                return j;
+            work += m;
+            if (work > (j - from) * FALLBACK_RATIO + FALLBACK_SLACK)
+                return two_way(needle, text, n, j + 1);
+        }
+        j += needle->shift[c & 0xFF];
+    }
+
+    return SIZE_MAX;
+}
+
+// Compares the candidates of a block of the vectorized filter with the whole pattern
+static inline size_t check_block(const struct needle* needle, const void* text, size_t pos, uint32_t mask, size_t* work) {
+    while (mask) {
+        const size_t candidate = pos + simd_ctz(mask);
+        if (matches_at(needle, text, candidate))
+            return candidate;
+        *work += needle->length;
+        mask &= mask - 1;
+    }
+    return SIZE_MAX;
+}
+
+#ifdef SIMD_X86
+
+// Sets a bit for each of the next BLOCK positions where both the first and the last element of the pattern are
+
+static inline __m128i either_sse2(__m128i v, const uint16_t cases[2], bool wide) {
+    if (wide)
+        return _mm_or_si128(_mm_cmpeq_epi16(v, _mm_set1_epi16((short)cases[0])), _mm_cmpeq_epi16(v, _mm_set1_epi16((short)cases[1])));
+    return _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8((char)cases[0])), _mm_cmpeq_epi8(v, _mm_set1_epi8((char)cases[1])));
+}
+
+static inline __m128i pair_sse2(const struct needle* needle, const uint8_t* first, const uint8_t* last) {
+    return _mm_and_si128(
+        either_sse2(_mm_loadu_si128((const __m128i*)first), needle->first, needle->wide),
+        either_sse2(_mm_loadu_si128((const __m128i*)last), needle->last, needle->wide));
+}
+
+static inline uint32_t mask_sse2(const struct needle* needle, const void* text, size_t pos) {
+    const size_t size = needle->wide ? sizeof(uint16_t) : 1;
+    const uint8_t* first = (const uint8_t*)text + pos * size;
+    const uint8_t* last = first + (needle->length - 1) * size;
+
+    // The comparison gives 0 or -1 for every unit, which survives the packing into bytes
+    if (needle->wide) {
+        return (uint32_t)_mm_movemask_epi8(_mm_packs_epi16(pair_sse2(needle, first, last), pair_sse2(needle, first + 16, last + 16)))
+            | (uint32_t)_mm_movemask_epi8(_mm_packs_epi16(pair_sse2(needle, first + 32, last + 32), pair_sse2(needle, first + 48, last + 48))) << 16;
+    }
+    return (uint32_t)_mm_movemask_epi8(pair_sse2(needle, first, last))
+        | (uint32_t)_mm_movemask_epi8(pair_sse2(needle, first + 16, last + 16)) << 16;
+}
+
+static size_t search_sse2(const struct needle* needle, const void* text, size_t n, size_t from) {
+    const size_t m = needle->length;
+    size_t pos = from, work = 0;
+
+    while (n - pos >= m - 1 + BLOCK) {
+        const size_t match = check_block(needle, text, pos, mask_sse2(needle, text, pos), &work);
+        if (match != SIZE_MAX)
+            return match;
+
+        pos += BLOCK;
+        if (work > (pos - from) * FALLBACK_RATIO + FALLBACK_SLACK)
+            break;
+    }
+
+    return two_way(needle, text, n, pos);
+}
+
+TARGET_AVX2 static inline __m256i either_avx2(__m256i v, const uint16_t cases[2], bool wide) {
+    if (wide)
+        return _mm256_or_si256(_mm256_cmpeq_epi16(v, _mm256_set1_epi16((short)cases[0])), _mm256_cmpeq_epi16(v, _mm256_set1_epi16((short)cases[1])));
+    return _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8((char)cases[0])), _mm256_cmpeq_epi8(v, _mm256_set1_epi8((char)cases[1])));
+}
+
+TARGET_AVX2 static inline __m256i pair_avx2(const struct needle* needle, const uint8_t* first, const uint8_t* last) {
+    return _mm256_and_si256(
+        either_avx2(_mm256_loadu_si256((const __m256i*)first), needle->first, needle->wide),
+        either_avx2(_mm256_loadu_si256((const __m256i*)last), needle->last, needle->wide));
+}
+
+TARGET_AVX2 static inline uint32_t mask_avx2(const struct needle* needle, const void* text, size_t pos) {
+    const size_t size = needle->wide ? sizeof(uint16_t) : 1;
+    const uint8_t* first = (const uint8_t*)text + pos * size;
+    const uint8_t* last = first + (needle->length - 1) * size;
+
+    // Packing works within the 128-bit lanes, the permutation puts the four quarters back in order
+    if (needle->wide) {
+        const __m256i packed = _mm256_packs_epi16(pair_avx2(needle, first, last), pair_avx2(needle, first + 32, last + 32));
+        return (uint32_t)_mm256_movemask_epi8(_mm256_permute4x64_epi64(packed, 0xD8));
+    }
+    return (uint32_t)_mm256_movemask_epi8(pair_avx2(needle, first, last));
+}
+
+TARGET_AVX2 static size_t search_avx2(const struct needle* needle, const void* text, size_t n, size_t from) {
+    const size_t m = needle->length;
+    size_t pos = from, work = 0;
+
+    while (n - pos >= m - 1 + BLOCK) {
+        const size_t match = check_block(needle, text, pos, mask_avx2(needle, text, pos), &work);
+        if (match != SIZE_MAX)
+            return match;
+
+        pos += BLOCK;
+        if (work > (pos - from) * FALLBACK_RATIO + FALLBACK_SLACK)
+            break;
+    }
+
+    return two_way(needle, text, n, pos);
+}
+
+#endif
+
+// Finds the first match in 'n' elements of text, starting at 'from'
+static size_t find_span(const struct needle* needle, const void* text, size_t n, size_t from) {
+    if (from > n || n - from < needle->length)
+        return SIZE_MAX;
+
+#ifdef SIMD_X86
+    switch (simd_level()) {
+        case SIMD_AVX2: return search_avx2(needle, text, n, from);
+        case SIMD_SSE2: return search_sse2(needle, text, n, from);
+        case SIMD_NONE: break;
+    }
+#endif
+
+    return horspool(needle, text, n, from);
+}
+
+static void needle_create(struct needle* needle, const uint16_t* elements, size_t length, bool wide, bool fold) {
+    needle->length = length;
+    needle->wide = wide;
+    needle->fold = fold;
+
+    needle->elements = mem_alloc(length * sizeof(uint16_t));
+    for (size_t i = 0; i < length; i++)
+        needle->elements[i] = fold ? Fold[elements[i]] : elements[i];
+
+    if (!wide) {
+        needle->bytes = mem_alloc(length);
+        for (size_t i = 0; i < length; i++)
+            needle->bytes[i] = (uint8_t)elements[i];
+    }
+
+    const uint16_t first = needle->elements[0], last = needle->elements[length - 1];
+    needle->first[0] = first;
+    needle->first[1] = fold ? Other[first] : first;
+    needle->last[0] = last;
+    needle->last[1] = fold ? Other[last] : last;
+
+    factorize(needle);
+
+    for (size_t i = 0; i < 256; i++)
+        needle->shift[i] = length;
+    for (size_t i = 0; i + 1 < length; i++)
+        needle->shift[needle->elements[i] & 0xFF] = length - 1 - i;
+}
+
+static void needle_free(struct needle* needle) {
+    mem_free(needle->elements);
+    mem_free(needle->bytes);
+}
+
+struct finder* find_create(const uint16_t* pattern, size_t length, bool ignore_case) {
+    if (!length || length > FIND_MAX_PATTERN)
+        return NULL;
+
+    prepare_tables();
+    struct finder* finder = mem_calloc(1, sizeof(*finder));
+    needle_create(&finder->wide, pattern, length, true, ignore_case);
+
+    // Only a pattern that is all ASCII can be folded byte by byte, and only a valid one can be encoded
+    bool ascii = true, valid = true;
+    for (size_t i = 0; i < length; i++) {
+        ascii = ascii && pattern[i] < 0x80;
+        if (pattern[i] >= 0xD800 && pattern[i] <= 0xDBFF && i + 1 < length && pattern[i + 1] >= 0xDC00 && pattern[i + 1] <= 0xDFFF)
+            i++;
+        else if (pattern[i] >= 0xD800 && pattern[i] <= 0xDFFF)
+            valid = false;
+    }
+
+    if (valid && (ascii || !ignore_case)) {
+        uint8_t* bytes = mem_alloc(length * 3);
+        const size_t size = utf16_to_utf8(pattern, length, bytes);
+
+        uint16_t* elements = mem_alloc(size * sizeof(uint16_t));
+        for (size_t i = 0; i < size; i++)
+            elements[i] = bytes[i];
+        needle_create(&finder->narrow, elements, size, false, ignore_case);
+
+        mem_free(elements);
+        mem_free(bytes);
+    }
+
+    return finder;
+}
+
+void find_free(struct finder* finder) {
+    if (!finder)
+        return;
+
+    needle_free(&finder->wide);
+    needle_free(&finder->narrow);
+    mem_free(finder);
+}
+
+size_t find_length(const struct finder* finder) {
+    return finder->wide.length;
+}
+
+size_t find_in(const struct finder* finder, const uint16_t* text, size_t length, size_t from) {
+    return find_span(&finder->wide, text, length, from);
+}
+
+// What find_next and find_all keep track of while going through the pieces
+struct search {
+    const struct finder* finder;
+    // Matches are looked for from 'from' (which moves past every match find_all collects) up to 'to'
+    size_t from, to;
+
+    // The code units at the end of the pieces before (the tail) followed by the start of the current one,
+    // a match that starts in the tail and ends in the current piece is found here
+    uint16_t* window;
+    size_t tail, tail_pos;
+
+    // Room for decoding a few characters of UTF-8, and a whole piece of it if the pattern has to be searched for in UTF-16
+    uint16_t* decoded;
+    uint16_t* scratch;
+    size_t scratch_capacity;
+
+    // find_next stops at the first match, find_all collects all of them
+    bool all;
+    size_t match;
+    bool found;
+    size_t* matches;
+    size_t count, capacity;
+};
+
+// Decodes the first 'count' code units of a piece into 'out'
+static void decode_head(struct search* search, const void* data, size_t size, size_t length, enum encoding encoding, size_t count, uint16_t* out) {
+    if (encoding == ENCODING_UTF16) {
+        memcpy(out, data, count * sizeof(uint16_t));
+        return;
+    }
+
+    const uint8_t* bytes = data;
+    if (size == length) {
+        for (size_t i = 0; i < count; i++)
+            out[i] = bytes[i];
+        return;
+    }
+
+    // A surrogate pair that is cut in half is decoded as a whole
+    // The text of a document built out of checkpoints isn't trusted to be what they say (see decode_units in document.c)
+    bool inside_pair;
+    size_t end = utf8_offset_of(bytes, size, count, &inside_pair);
+    if (inside_pair)
+        end = size - end > 4 ? end + 4 : size;
+    for (size_t i = utf8_to_utf16_lossy(bytes, end, search->decoded); i < count; i++)
+        search->decoded[i] = 0xFFFD;
+    memcpy(out, search->decoded, count * sizeof(uint16_t));
+}
+
+// Decodes the last 'count' code units of a piece into 'out'
+static void decode_tail(struct search* search, const void* data, size_t size, size_t length, enum encoding encoding, size_t count, uint16_t* out) {
+    if (encoding == ENCODING_UTF16) {
+        memcpy(out, (const uint16_t*)data + size - count, count * sizeof(uint16_t));
+        return;
+    }
+
+    const uint8_t* bytes = data;
+    if (size == length) {
+        for (size_t i = 0; i < count; i++)
+            out[i] = bytes[size - count + i];
+        return;
+    }
+
+    // Go back character by character, a four byte one is two code units, and none is longer than that
+    size_t start = size, units = 0;
+    while (units < count && start) {
+        size_t lead = start - 1;
+        while (lead && start - lead < 4 && (bytes[lead] & 0xC0) == 0x80)
+            lead--;
+        start = lead;
+        units += bytes[start] >= 0xF0 ? 2 : 1;
+    }
+
+    // Invalid text (see decode_head) may decode to fewer code units than it should, the missing ones come first
+    const size_t decoded = utf8_to_utf16_lossy(bytes + start, size - start, search->decoded);
+    const size_t missing = decoded < count ? count - decoded : 0;
+    for (size_t i = 0; i < missing; i++)
+        out[i] = 0xFFFD;
+    memcpy(out + missing, search->decoded + decoded - (count - missing), (count - missing) * sizeof(uint16_t));
+}
+
+// Reports a match, returns false if there is no need to go on
+static bool report(struct search* search, size_t match) {
+    if (match >= search->to)
+        return false;
+
+    if (!search->all) {
+        search->match = match;
+        search->found = true;
+        return false;
+    }
+
+    if (search->count == search->capacity) {
+        search->capacity = search->capacity ? search->capacity * 2 : 256;
+        search->matches = mem_realloc(search->matches, search->capacity * sizeof(size_t));
+    }
+    search->matches[search->count++] = match;
+
+    // The next match may only start after this one
+    search->from = match + find_length(search->finder);
+    return true;
+}
+
+// Reports the matches of the wide pattern in UTF-16 text that starts at 'pos' in the document
+static bool search_units(struct search* search, size_t pos, const uint16_t* text, size_t length) {
+    for (;;) {
+        const size_t first = search->from > pos ? search->from - pos : 0;
+        const size_t match = find_span(&search->finder->wide, text, length, first);
+        if (match == SIZE_MAX)
+            return true;
+        if (!report(search, pos + match))
+            return false;
+    }
+}
+
+// Reports the matches inside of a piece, returns false if the search is over
+static bool search_inside(struct search* search, size_t pos, const void* data, size_t size, size_t length, enum encoding encoding) {
+    const struct finder* finder = search->finder;
+    if (encoding == ENCODING_UTF16)
+        return search_units(search, pos, data, length);
+
+    const uint8_t* bytes = data;
+    if (!finder->narrow.length) {
+        if (search->scratch_capacity < size) {
+            mem_free(search->scratch);
+            search->scratch_capacity = size;
+            search->scratch = mem_alloc(size * sizeof(uint16_t));
+        }
+
+        const size_t decoded = utf8_to_utf16_lossy(bytes, size, search->scratch);
+        return search_units(search, pos, search->scratch, decoded);
+    }
+
+    // The bytes are searched from 'byte', which is where the code unit 'unit' is, both only ever go forward
+    const size_t first = search->from > pos ? search->from - pos : 0;
+    bool inside_pair = false;
+    size_t byte = size == length ? first : utf8_offset_of(bytes, size, first, &inside_pair);
+    size_t unit = inside_pair ? first - 1 : first;
+
+    for (;;) {
+        const size_t match = find_span(&finder->narrow, bytes, size, byte);
+        if (match == SIZE_MAX)
+            return true;
+
+        unit += size == length ? match - byte : utf8_length_utf16_lossy(bytes + byte, match - byte);
+        byte = match;
+
+        if (pos + unit >= search->from) {
+            if (!report(search, pos + unit))
+                return false;
+            // A match is the pattern exactly, as many bytes and code units as it has
+            byte += finder->narrow.length;
+            unit += finder->wide.length;
+        } else {
+            // Only a match of a surrogate pair that has been cut in half can start before 'from', skip the pair
+            byte += 4;
+            unit += 2;
+        }
+    }
+}
+
+// The document_walk_pieces callback of find_next and find_all
+static bool search_piece(void* ctx, size_t pos, const void* data, size_t size, size_t length, enum encoding encoding) {
+    struct search* search = ctx;
+    const size_t keep = find_length(search->finder) - 1;
+    const size_t head = length < keep ? length : keep;
+
+    // The matches that start in the pieces before this one and end in it
+    if (head) {
+        decode_head(search, data, size, length, encoding, head, search->window + search->tail);
+
+        while (search->tail) {
+            const size_t start = search->from > search->tail_pos ? search->from - search->tail_pos : 0;
+            const size_t match = find_span(&search->finder->wide, search->window, search->tail + head, start);
+            if (match >= search->tail)
+                break;
+            if (!report(search, search->tail_pos + match))
+                return false;
+        }
+    }
+
+    if (search->from < pos + length && !search_inside(search, pos, data, size, length, encoding))
+        return false;
+
+    // Keep the end of the text for the next piece, a short piece only adds itself to what has been kept
+    if (length >= keep) {
+        decode_tail(search, data, size, length, encoding, keep, search->window);
+        search->tail = keep;
+    } else {
+        const size_t total = search->tail + length;
+        search->tail = total < keep ? total : keep;
+        memmove(search->window, search->window + total - search->tail, search->tail * sizeof(uint16_t));
+    }
+    search->tail_pos = pos + length - search->tail;
+
+    return true;
+}
+
+// Goes through the pieces from 'from' to 'to' (and a bit further, for the matches that start before 'to')
+static void run_search(struct search* search, const struct document* document, size_t from, size_t to) {
+    const size_t m = find_length(search->finder);
+    search->from = from;
+    search->to = to;
+    search->window = mem_alloc(2 * m * sizeof(uint16_t));
+    search->decoded = mem_alloc((4 * m + 4) * sizeof(uint16_t));
+
+    // The last match that can start before 'to' ends 'm' - 1 code units after it
+    const size_t length = to - from < SIZE_MAX - m ? to - from + m - 1 : SIZE_MAX;
+    document_walk_pieces(document, from, length, search_piece, search);
+
+    mem_free(search->window);
+    mem_free(search->decoded);
+    mem_free(search->scratch);
+}
+
+bool find_next(const struct finder* finder, const struct document* document, size_t from, size_t to, size_t* match) {
+    if (to <= from)
+        return false;
+
+    struct search search = { .finder = finder };
+    run_search(&search, document, from, to);
+
+    if (search.found)
+        *match = search.match;
+    return search.found;
+}
+
+// A part of the document find_all searches on its own, and the matches that start in it
+struct chunk {
+    size_t from, to;
+    size_t* matches;
+    size_t count;
+};
+
+struct find_all_job {
+    const struct finder* finder;
+    const struct document* document;
+    struct chunk* chunks;
+};
+
+// The task of find_all, searches one chunk
+static void search_chunk(void* ctx, size_t index) {
+    const struct find_all_job* job = ctx;
+    struct chunk* chunk = &job->chunks[index];
+
+    struct search search = { .finder = job->finder, .all = true };
+    run_search(&search, job->document, chunk->from, chunk->to);
+    chunk->matches = search.matches;
+    chunk->count = search.count;
+}
+
+// Appends a match to the merged list
+static void append_match(size_t** matches, size_t* count, size_t* capacity, size_t match) {
+    if (*count == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 256;
+        *matches = mem_realloc(*matches, *capacity * sizeof(size_t));
+    }
+    (*matches)[(*count)++] = match;
+}
+
+size_t find_all(const struct finder* finder, const struct document* document, struct pool* pool, size_t** matches) {
+    const size_t length = document_length(document), m = find_length(finder);
+
+    // A few chunks per thread keep all of them busy, but a chunk shouldn't be too small to be worth a task
+    size_t chunk_count = pool ? pool_threads(pool) * FIND_TASKS_PER_THREAD : 1;
+    if (chunk_count > length / FIND_MIN_CHUNK)
+        chunk_count = length / FIND_MIN_CHUNK ? length / FIND_MIN_CHUNK : 1;
+
+    struct chunk* chunks = mem_calloc(chunk_count, sizeof(struct chunk));
+    size_t total = 0;
+    for (size_t i = 0; i < chunk_count; i++) {
+        chunks[i].from = length / chunk_count * i;
+        chunks[i].to = i + 1 < chunk_count ? length / chunk_count * (i + 1) : length;
+    }
+
+    struct find_all_job job = { finder, document, chunks };
+    if (chunk_count > 1)
+        pool_run(pool, search_chunk, &job, chunk_count);
+    else
+        search_chunk(&job, 0);
+
+    for (size_t i = 0; i < chunk_count; i++)
+        total += chunks[i].count;
+
+    // The chunks are merged in order, a chunk that starts inside of the last match of the one before has its first
+    // matches wrong, those are searched for again from the end of that match until they agree with the chunk's ones
+    size_t* merged = total ? mem_alloc(total * sizeof(size_t)) : NULL;
+    size_t count = 0, capacity = total, end = 0;
+    for (size_t i = 0; i < chunk_count; i++) {
+        const struct chunk* chunk = &chunks[i];
+        size_t j = 0;
+
+        while (j < chunk->count && chunk->matches[j] < end) {
+            size_t match;
+            if (!find_next(finder, document, end, chunk->to, &match)) {
+                j = chunk->count;
+                break;
+            }
+
+            while (j < chunk->count && chunk->matches[j] < match)
+                j++;
+            if (j < chunk->count && chunk->matches[j] == match)
+                break;
+
+            append_match(&merged, &count, &capacity, match);
+            end = match + m;
+        }
+
+        for (; j < chunk->count; j++)
+            append_match(&merged, &count, &capacity, chunk->matches[j]);
+        if (count)
+            end = merged[count - 1] + m;
+
+        mem_free(chunk->matches);
+    }
+
+    mem_free(chunks);
+    *matches = merged;
+    return count;
+}
@@ -0,0 +1,53 @@
+#pragma once
+// Finding text in a document
+//
+// The pieces of the document are searched as they are stored, a UTF-8 piece of a mapped file is searched for the
+// UTF-8 form of the pattern, so nothing needs to be decoded unless there is a match. The vectorized loops look for
+// the first and the last element of the pattern at once and only compare the rest where both are there. A pattern
+// that keeps matching almost everywhere (e.g. "aaab" in "aaaa...") falls back to the Two-Way algorithm, which
+// guarantees linear time, and the plain C version uses Horspool instead of the vectorized filter.
+//
+// Ignoring the case folds both the pattern and the text through tables of the simple, one to one case pairs
+// (Latin, Greek, Cyrillic, Armenian and the fullwidth forms). Matches across the boundaries of pieces are found
+// in a small window that joins the end of one piece with the start of the next one.
+//
+// Finding all of the matches splits the document into chunks that are searched on a pool of threads, a chunk's
+// search goes on past its end for the matches that start in it. Where the last match of a chunk overlaps the first
+// ones of the next chunk, those are searched for again while merging, so the result is the same as from one thread.
+
+#include "document.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// The longest pattern that can be searched for, in code units
+#define FIND_MAX_PATTERN 4096
+
+struct pool;
+
+// A compiled pattern, it is never modified, so it may be used by many threads at once
+struct finder;
+
+// Compiles a pattern, returns NULL if it's empty or longer than FIND_MAX_PATTERN
+struct finder* find_create(const uint16_t* pattern, size_t length, bool ignore_case);
+void find_free(struct finder* finder);
+
+// Returns the length of the pattern, which is the length of every match
+size_t find_length(const struct finder* finder);
+
+// Finds the first match that starts in the range from 'from' up to 'to', it may end after 'to'
+// Returns true and the position of the match in '*match', or false if there is none
+bool find_next(const struct finder* finder, const struct document* document, size_t from, size_t to, size_t* match);
+
+// Finds all of the matches that don't overlap, each one starts after the end of the one before (like replacing them needs)
+// The chunks of the document are searched on the threads of 'pool', or just on this one if it's NULL
+// Returns the number of matches, '*matches' gets their sorted positions (allocated with mem_alloc, NULL if there are none)
+size_t find_all(const struct finder* finder, const struct document* document, struct pool* pool, size_t** matches);
+
+// Finds the first match in a buffer of UTF-16 text, starting at 'from'
+// Returns the position of the match or SIZE_MAX if there is none
+size_t find_in(const struct finder* finder, const uint16_t* text, size_t length, size_t from);
+
+// Folds a code unit to the case it is compared in when ignoring the case
+uint16_t find_fold(uint16_t c);
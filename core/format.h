@@ -0,0 +1,27 @@
+#pragma once
+// The description of how a text file is stored on the disk
+
+#include <stdbool.h>
+
+// Describes if the string loaded uses '\n' or '\r\n' to signify line breaks
+enum linebreak {
+    LINEBREAK_UNIX,
+    LINEBREAK_WIN,
+    // Only for converting to: every line break stays the way it is, so a file with both kinds keeps them
+    LINEBREAK_KEEP
+};
+
+// Describes the encoding of a string
+// ENCODING_UTF16 is little endian, the same as the editor uses internally
+enum encoding {
+    ENCODING_UTF8,
+    ENCODING_UTF16,
+    ENCODING_UTF16BE
+};
+
+// A so-called format specifies the encoding, linebreak type and the BOM
+struct format {
+    enum encoding encoding;
+    enum linebreak linebreak;
+    bool bom;
+};
@@ -0,0 +1,271 @@
+#include "isearch.h"
+#include "find.h"
+#include "memory.h"
+#include "utf.h"
+
+#include <string.h>
+
+// The code units the matches are looked for in at once, the block is read from the document with a bit more
+// at the end, so that a match that starts in it can end after it
+#define ISEARCH_BLOCK (64 * 1024)
+
+// The matches of a shorter query are checked a range of this many code units of the document at a time
+#define ISEARCH_CHECK_SPAN (256 * 1024)
+
+// Checking a match costs about as much as searching this many code units
+#define ISEARCH_CHECK_COST 16
+
+struct isearch {
+    uint16_t* query;
+    size_t length;
+    bool ignore_case;
+    // NULL if there is no query to search for
+    struct finder* finder;
+
+    // The revision of the document the matches are from
+    uint64_t revision;
+
+    // The sorted positions of the matches, while a longer query is being checked, the ones from 'checked' on are
+    // the matches of the shorter one and the ones before 'kept' have turned out to match the longer one too
+    size_t* matches;
+    size_t count, capacity, kept, checked;
+    // All of the matches found, even the ones that didn't fit, and where the first of those is (SIZE_MAX if none)
+    size_t total, overflow;
+    // The text before this has been searched
+    size_t scanned;
+
+    uint16_t* block;
+};
+
+struct isearch* isearch_create(void) {
+    struct isearch* search = mem_alloc(sizeof(*search));
+    *search = (struct isearch){
+        .query = mem_alloc(FIND_MAX_PATTERN * sizeof(uint16_t)),
+        .overflow = SIZE_MAX,
+        .block = mem_alloc((ISEARCH_BLOCK + FIND_MAX_PATTERN) * sizeof(uint16_t))
+    };
+    return search;
+}
+
+void isearch_free(struct isearch* search) {
+    if (!search)
+        return;
+
+    find_free(search->finder);
+    mem_free(search->query);
+    mem_free(search->matches);
+    mem_free(search->block);
+    mem_free(search);
+}
+
+// Forgets all of the matches, the whole document gets searched again
+static void restart(struct isearch* search) {
+    search->count = search->kept = search->checked = 0;
+    search->total = 0;
+    search->overflow = SIZE_MAX;
+    search->scanned = 0;
+}
+
+bool isearch_query(struct isearch* search, const uint16_t* query, size_t length, bool ignore_case) {
+    // The matches of a longer query start where the ones of this one do, so only those have to be checked,
+    // unless there were too many of them to keep
+    const bool longer = search->finder && ignore_case == search->ignore_case && length > search->length &&
+        !memcmp(query, search->query, search->length * sizeof(uint16_t)) && search->overflow == SIZE_MAX;
+
+    find_free(search->finder);
+    search->finder = find_create(query, length, ignore_case);
+    if (!search->finder) {
+        search->length = 0;
+        restart(search);
+        return false;
+    }
+
+    memcpy(search->query, query, length * sizeof(uint16_t));
+    search->length = length;
+    search->ignore_case = ignore_case;
+
+    if (longer) {
+        search->kept = search->checked = 0;
+        search->total = 0;
+    } else {
+        restart(search);
+    }
+    return true;
+}
+
+// Compares the text of a match with the query
+static bool same(const struct isearch* search, const uint16_t* text) {
+    if (!search->ignore_case)
+        return !memcmp(text, search->query, search->length * sizeof(uint16_t));
+
+    for (size_t i = 0; i < search->length; i++)
+        if (find_fold(text[i]) != find_fold(search->query[i]))
+            return false;
+    return true;
+}
+
+static void add(struct isearch* search, size_t pos) {
+    search->total++;
+    if (search->overflow != SIZE_MAX)
+        return;
+    if (search->count == ISEARCH_MAX_MATCHES) {
+        search->overflow = pos;
+        return;
+    }
+
+    if (search->count == search->capacity) {
+        search->capacity = search->capacity ? search->capacity * 2 : 1024;
+        search->matches = mem_realloc(search->matches, search->capacity * sizeof(size_t));
+    }
+    search->matches[search->count++] = pos;
+    search->kept = search->checked = search->count;
+}
+
+// What checking the matches of the shorter query keeps track of while going through the pieces
+struct check {
+    struct isearch* search;
+    const struct document* document;
+    // The matches up to this one get checked in this walk
+    size_t end;
+    // The code units (or bytes of UTF-8) gone through
+    size_t work;
+};
+
+// Checks the matches in a piece, the UTF-8 ones are compared with the query where they are, a cursor only ever moves
+// forward through the piece to find them, so this never decodes more than the matches themselves
+// Reading the document at every match instead would find its way to it through the piece from its start every time
+static bool check_piece(void* ctx, size_t pos, const void* data, size_t size, size_t length, enum encoding encoding) {
+    struct check* check = ctx;
+    struct isearch* search = check->search;
+    size_t unit = 0, element = 0;
+
+    while (search->checked < check->end && search->matches[search->checked] - pos < length) {
+        const size_t match = search->matches[search->checked++], at = match - pos;
+        const uint16_t* text = NULL;
+
+        if (encoding == ENCODING_UTF16) {
+            if (at + search->length <= length)
+                text = (const uint16_t*)data + at;
+        } else {
+            const uint8_t* bytes = data;
+            bool inside_pair;
+            element += utf8_offset_of(bytes + element, size - element, at - unit, &inside_pair);
+            unit = inside_pair ? at - 1 : at;
+
+            // A UTF-16 code unit takes at most three bytes
+            const size_t window = size - element < search->length * 3 ? size - element : search->length * 3;
+            if (!inside_pair && utf8_to_utf16_lossy(bytes + element, utf8_complete(bytes + element, window), search->block) >= search->length)
+                text = search->block;
+        }
+
+        // The rare match that goes on into the next piece (or starts inside of a surrogate pair) gets read as it is
+        if (!text && document_read(check->document, match, search->block, search->length) == search->length)
+            text = search->block;
+
+        if (text && same(search, text)) {
+            search->matches[search->kept++] = match;
+            search->total++;
+        }
+        check->work += ISEARCH_CHECK_COST;
+    }
+
+    check->work += encoding == ENCODING_UTF16 ? 0 : element;
+    return search->checked < check->end;
+}
+
+// Subtracts the work done from the budget
+static size_t spend(size_t budget, size_t work) {
+    return budget > work ? budget - work : 0;
+}
+
+bool isearch_step(struct isearch* search, const struct document* document, size_t budget) {
+    if (!search->finder)
+        return true;
+
+    if (search->revision != document_revision(document)) {
+        restart(search);
+        search->revision = document_revision(document);
+    }
+
+    const size_t total = document_length(document);
+    const size_t length = search->length;
+
+    // The matches of the shorter query get checked first, none of them is after where the search has gotten
+    while (search->checked < search->count && budget) {
+        const size_t start = search->matches[search->checked];
+        struct check check = { search, document, search->checked + 1, 0 };
+        while (check.end < search->count && search->matches[check.end] - start < ISEARCH_CHECK_SPAN)
+            check.end++;
+
+        document_walk_pieces(document, start, search->matches[check.end - 1] - start + 1, check_piece, &check);
+        // Whatever is past the end of the document can't match
+        search->checked = check.end;
+        budget = spend(budget, check.work);
+    }
+    if (search->checked < search->count)
+        return false;
+    search->count = search->checked = search->kept;
+
+    // Then the rest of the document
+    while (search->scanned < total && budget) {
+        const size_t pos = search->scanned;
+        const size_t size = total - pos < ISEARCH_BLOCK ? total - pos : ISEARCH_BLOCK;
+        const size_t read = total - pos < size + length - 1 ? total - pos : size + length - 1;
+        document_read(document, pos, search->block, read);
+
+        for (size_t at = 0; (at = find_in(search->finder, search->block, read, at)) < size; at++)
+            add(search, pos + at);
+
+        search->scanned += size;
+        budget = spend(budget, size);
+    }
+
+    return search->scanned >= total;
+}
+
+bool isearch_done(const struct isearch* search, const struct document* document) {
+    return !search->finder || (search->revision == document_revision(document) &&
+        search->checked == search->count && search->scanned >= document_length(document));
+}
+
+size_t isearch_count(const struct isearch* search) {
+    return search->total;
+}
+
+size_t isearch_progress(const struct isearch* search) {
+    return search->checked < search->count ? search->matches[search->checked] : search->scanned;
+}
+
+bool isearch_next(const struct isearch* search, const struct document* document, size_t pos, size_t* match) {
+    if (!search->finder || search->revision != document_revision(document))
+        return false;
+
+    // Only the matches that have been checked count while a longer query is being checked
+    size_t lo = 0, hi = search->checked < search->count ? search->kept : search->count;
+    const size_t known = hi;
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (search->matches[mid] < pos)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo < known) {
+        *match = search->matches[lo];
+        return true;
+    }
+
+    // The matches that didn't fit are looked for in the document
+    if (search->overflow != SIZE_MAX && find_next(search->finder, document, pos > search->overflow ? pos : search->overflow, search->scanned, match))
+        return true;
+
+    // There may be more matches after 'pos' until the search is done
+    if (!isearch_done(search, document) || (!known && search->overflow == SIZE_MAX))
+        return false;
+    *match = known ? search->matches[0] : search->overflow;
+    return true;
+}
+
+size_t isearch_length(const struct isearch* search) {
+    return search->length;
+}
@@ -0,0 +1,46 @@
+#pragma once
+// Incremental search, the matches of a query that is being typed a character at a time
+//
+// Every occurrence of the query is kept (the overlapping ones too), so when the query gets longer, its matches can
+// only be among the ones of the shorter query, and only those get checked instead of the whole document. A query
+// that isn't an extension of the last one (e.g. after a backspace) or an edit of the document starts from scratch.
+// The work is done in steps of a bounded size, so the caller can go on with other things (like the next keystroke)
+// between them, the matches found so far are usable at any point.
+
+#include "document.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// At most this many matches are kept, a query with more than that is searched for in the document again every time
+#define ISEARCH_MAX_MATCHES (4 * 1024 * 1024)
+
+struct isearch;
+
+struct isearch* isearch_create(void);
+void isearch_free(struct isearch* search);
+
+// Sets the query, nothing is searched for until isearch_step, returns false if it's empty or too long to be searched for
+bool isearch_query(struct isearch* search, const uint16_t* query, size_t length, bool ignore_case);
+
+// Does about 'budget' code units worth of searching or checking of the matches
+// The matches are found again from scratch if the document isn't the revision they were found in
+// Returns true once all of the matches in the document have been found
+bool isearch_step(struct isearch* search, const struct document* document, size_t budget);
+
+// Returns true if all of the matches in this revision of the document have been found (or there is no query)
+bool isearch_done(const struct isearch* search, const struct document* document);
+
+// Returns the number of matches found so far (which may be more than ISEARCH_MAX_MATCHES)
+size_t isearch_count(const struct isearch* search);
+
+// Returns how far into the document the search has gotten, every match before that has been found
+size_t isearch_progress(const struct isearch* search);
+
+// Finds the first match at or after 'pos', wrapping around to the start of the document
+// Returns true and the position in '*match', or false if none has been found yet
+bool isearch_next(const struct isearch* search, const struct document* document, size_t pos, size_t* match);
+
+// Returns the length of the query, which is the length of every match
+size_t isearch_length(const struct isearch* search);
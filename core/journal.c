@@ -0,0 +1,348 @@
+#include "journal.h"
+#include "memory.h"
+
+#include <string.h>
+
+// The size of an arena block in code units, an edit with more text than this gets a block of its own
+#define JOURNAL_BLOCK (64 * 1024)
+
+// Typing and erasing one character at a time (a surrogate pair or a CRLF is one too) makes a run
+#define JOURNAL_RUN_LENGTH 2
+
+// Replacements closer to each other than this (in code units) get their removed text read from the document at once
+#define JOURNAL_READ_SPAN 4096
+
+// A block of the arena, the text is only ever appended to the last one
+struct block {
+    uint16_t* text;
+    size_t used, capacity;
+};
+
+// An edit, its removed text starts at 'offset' in the block and the inserted text follows right after it
+struct entry {
+    size_t pos, removed, inserted;
+    // The number of the block, blocks are numbered from the first one the journal ever had
+    size_t block, offset;
+    // Whether this edit is a part of the same step as the one before it
+    bool joined;
+};
+
+struct journal {
+    size_t budget;
+
+    // The blocks still in use, 'blocks[0]' is the block number 'block_base'
+    struct block* blocks;
+    size_t block_count, block_capacity, block_base;
+    // The bytes of text the blocks can hold
+    size_t text_bytes;
+
+    // The history goes from 'first' to 'count', the entries before 'current' are done, the rest can be redone
+    struct entry* entries;
+    size_t first, current, count, capacity;
+
+    // The nesting of groups, whether the open group has an entry yet and whether it didn't fit into the budget
+    size_t depth;
+    bool grouped, discarding;
+    // Whether the last entry can still be continued by typing or erasing
+    bool run;
+};
+
+static struct block* block_of(const struct journal* journal, size_t block) {
+    return &journal->blocks[block - journal->block_base];
+}
+
+static uint16_t* text_of(const struct journal* journal, const struct entry* entry) {
+    return block_of(journal, entry->block)->text + entry->offset;
+}
+
+// Frees the blocks before the one numbered 'keep' (all of them if there is no such block yet)
+static void free_blocks_before(struct journal* journal, size_t keep) {
+    size_t count = keep - journal->block_base;
+    if (count > journal->block_count)
+        count = journal->block_count;
+    if (!count)
+        return;
+
+    for (size_t i = 0; i < count; i++) {
+        journal->text_bytes -= journal->blocks[i].capacity * sizeof(uint16_t);
+        mem_free(journal->blocks[i].text);
+    }
+
+    memmove(journal->blocks, journal->blocks + count, (journal->block_count - count) * sizeof(struct block));
+    journal->block_count -= count;
+    journal->block_base += count;
+}
+
+// Frees the blocks after the one numbered 'keep'
+static void free_blocks_after(struct journal* journal, size_t keep) {
+    while (journal->block_count && journal->block_base + journal->block_count - 1 > keep) {
+        struct block* block = &journal->blocks[--journal->block_count];
+        journal->text_bytes -= block->capacity * sizeof(uint16_t);
+        mem_free(block->text);
+    }
+}
+
+// Finds room for 'length' code units at the end of the arena, returns the number of the block
+static size_t reserve(struct journal* journal, size_t length, size_t* offset) {
+    if (journal->block_count) {
+        struct block* last = &journal->blocks[journal->block_count - 1];
+        if (last->capacity - last->used >= length) {
+            *offset = last->used;
+            last->used += length;
+            return journal->block_base + journal->block_count - 1;
+        }
+    }
+
+    if (journal->block_count == journal->block_capacity) {
+        journal->block_capacity = journal->block_capacity ? journal->block_capacity * 2 : 16;
+        journal->blocks = mem_realloc(journal->blocks, journal->block_capacity * sizeof(struct block));
+    }
+
+    const size_t capacity = length > JOURNAL_BLOCK ? length : JOURNAL_BLOCK;
+    journal->blocks[journal->block_count++] = (struct block){
+        .text = mem_alloc(capacity * sizeof(uint16_t)),
+        .used = length,
+        .capacity = capacity
+    };
+    journal->text_bytes += capacity * sizeof(uint16_t);
+
+    *offset = 0;
+    return journal->block_base + journal->block_count - 1;
+}
+
+// Returns true if the text of an entry is at the very end of the arena and it can grow by 'length' code units
+static bool can_extend(const struct journal* journal, const struct entry* entry, size_t length) {
+    if (entry->block != journal->block_base + journal->block_count - 1)
+        return false;
+
+    const struct block* block = block_of(journal, entry->block);
+    return block->used == entry->offset + entry->removed + entry->inserted && block->capacity - block->used >= length;
+}
+
+// Copies the text an edit removes and the text it inserts, the removed text is read from the document unless it's in 'old'
+static void copy_text(uint16_t* out, const struct document* document, size_t pos, const uint16_t* old, size_t removed, const uint16_t* text, size_t length) {
+    if (old)
+        memcpy(out, old, removed * sizeof(uint16_t));
+    else
+        document_read(document, pos, out, removed);
+    if (length)
+        memcpy(out + removed, text, length * sizeof(uint16_t));
+}
+
+// Forgets the steps that have been undone
+static void drop_redo(struct journal* journal) {
+    if (journal->current == journal->count)
+        return;
+
+    // The text is appended in the order of the entries, so the text of the dropped ones is all at the end
+    const struct entry* entry = &journal->entries[journal->current];
+    free_blocks_after(journal, entry->block);
+    block_of(journal, entry->block)->used = entry->offset;
+    journal->count = journal->current;
+}
+
+// Forgets the oldest step, unless it's the only one, returns false if it was
+static bool drop_oldest(struct journal* journal) {
+    size_t next = journal->first + 1;
+    while (next < journal->count && journal->entries[next].joined)
+        next++;
+    if (next >= journal->count)
+        return false;
+
+    journal->first = next;
+    free_blocks_before(journal, journal->entries[next].block);
+
+    // The array only gets moved once half of it is unused
+    if (journal->first >= journal->count / 2) {
+        memmove(journal->entries, journal->entries + journal->first, (journal->count - journal->first) * sizeof(struct entry));
+        journal->count -= journal->first;
+        journal->current -= journal->first;
+        journal->first = 0;
+    }
+
+    return true;
+}
+
+struct journal* journal_create(size_t budget) {
+    struct journal* journal = mem_calloc(1, sizeof(*journal));
+    journal->budget = budget;
+    return journal;
+}
+
+void journal_free(struct journal* journal) {
+    if (!journal)
+        return;
+
+    journal_clear(journal);
+    mem_free(journal->blocks);
+    mem_free(journal->entries);
+    mem_free(journal);
+}
+
+void journal_clear(struct journal* journal) {
+    free_blocks_before(journal, journal->block_base + journal->block_count);
+    journal->first = journal->current = journal->count = 0;
+    journal->grouped = journal->run = false;
+}
+
+// Records an edit, its removed text is 'old' if it has already been read, otherwise it's read from the document
+static void record(struct journal* journal, const struct document* document, size_t pos, const uint16_t* old, size_t removed, const uint16_t* text, size_t length) {
+    if (journal->discarding || (!removed && !length))
+        return;
+
+    drop_redo(journal);
+
+    // An edit that could never fit takes the whole history with it, and the rest of its group too
+    if ((removed + length) * sizeof(uint16_t) + sizeof(struct entry) > journal->budget) {
+        journal_clear(journal);
+        journal->discarding = journal->depth > 0;
+        return;
+    }
+
+    // Typing and erasing continues the last entry if it's right next to it
+    struct entry* last = journal->count > journal->first ? &journal->entries[journal->count - 1] : NULL;
+    const bool continues = journal->run && last && !journal->depth && (
+        // Typing
+        (!removed && length && length <= JOURNAL_RUN_LENGTH && last->inserted && pos == last->pos + last->inserted) ||
+        // Backspace and delete
+        (!length && removed && removed <= JOURNAL_RUN_LENGTH && !last->inserted && (pos + removed == last->pos || pos == last->pos))
+    );
+
+    // The text goes right after the last entry's if there is room, a backspace can't do that, its text goes before
+    if (continues && pos + removed != last->pos && can_extend(journal, last, removed + length)) {
+        copy_text(text_of(journal, last) + last->removed + last->inserted, document, pos, old, removed, text, length);
+        block_of(journal, last->block)->used += removed + length;
+        last->removed += removed;
+        last->inserted += length;
+    } else {
+        if (journal->count == journal->capacity) {
+            journal->capacity = journal->capacity ? journal->capacity * 2 : 256;
+            journal->entries = mem_realloc(journal->entries, journal->capacity * sizeof(struct entry));
+        }
+
+        struct entry* entry = &journal->entries[journal->count++];
+        *entry = (struct entry){
+            .pos = pos,
+            .removed = removed,
+            .inserted = length,
+            .joined = continues || (journal->depth && journal->grouped)
+        };
+        entry->block = reserve(journal, removed + length, &entry->offset);
+
+        copy_text(text_of(journal, entry), document, pos, old, removed, text, length);
+        journal->grouped = journal->depth > 0;
+    }
+    journal->current = journal->count;
+
+    // Pasting or erasing a selection starts no run, and a line break ends one
+    journal->run = length ? length <= JOURNAL_RUN_LENGTH : removed <= JOURNAL_RUN_LENGTH;
+    for (size_t i = 0; i < length && journal->run; i++)
+        journal->run = text[i] != '\n';
+
+    // The oldest steps go until the journal fits, if even the newest one alone doesn't, nothing can be undone
+    while (journal_bytes(journal) > journal->budget) {
+        if (!drop_oldest(journal)) {
+            journal_clear(journal);
+            journal->discarding = journal->depth > 0;
+            return;
+        }
+    }
+}
+
+void journal_record(struct journal* journal, const struct document* document, size_t pos, size_t removed, const uint16_t* text, size_t length) {
+    record(journal, document, pos, NULL, removed, text, length);
+}
+
+void journal_record_all(struct journal* journal, const struct document* document, const size_t* positions, const size_t* lengths, size_t count, size_t removed, const uint16_t* text, size_t length) {
+    journal_begin_group(journal);
+
+    // Finding a position in the document costs more than reading a few kilobytes of it, so the replacements close
+    // to each other get read together
+    size_t capacity = JOURNAL_READ_SPAN;
+    uint16_t* old = mem_alloc(capacity * sizeof(uint16_t));
+    // The replacements so far have removed this many code units, and inserted 'length' each
+    size_t gone = 0;
+    for (size_t i = 0, end; i < count && !journal->discarding; i = end) {
+        end = i + 1;
+        while (end < count && positions[end] + (lengths ? lengths[end] : removed) - positions[i] <= JOURNAL_READ_SPAN)
+            end++;
+
+        const size_t span = positions[end - 1] + (lengths ? lengths[end - 1] : removed) - positions[i];
+        if (span > capacity) {
+            capacity = span;
+            old = mem_realloc(old, capacity * sizeof(uint16_t));
+        }
+        document_read(document, positions[i], old, span);
+
+        // Every replacement moves the ones after it by the difference of the lengths
+        for (size_t j = i; j < end; j++) {
+            const size_t removed_at = lengths ? lengths[j] : removed;
+            record(journal, document, positions[j] - gone + j * length, old + positions[j] - positions[i], removed_at, text, length);
+            gone += removed_at;
+        }
+    }
+    mem_free(old);
+
+    journal_end_group(journal);
+}
+
+void journal_begin_group(struct journal* journal) {
+    if (!journal->depth++) {
+        journal->grouped = false;
+        journal->run = false;
+    }
+}
+
+void journal_end_group(struct journal* journal) {
+    if (journal->depth && !--journal->depth)
+        journal->discarding = false;
+}
+
+void journal_break(struct journal* journal) {
+    journal->run = false;
+}
+
+bool journal_can_undo(const struct journal* journal) {
+    return journal->current > journal->first;
+}
+
+bool journal_can_redo(const struct journal* journal) {
+    return journal->current < journal->count;
+}
+
+bool journal_undo(struct journal* journal, journal_apply_fn apply, void* ctx) {
+    if (!journal_can_undo(journal))
+        return false;
+
+    journal->run = false;
+    do {
+        const struct entry* entry = &journal->entries[--journal->current];
+        apply(ctx, entry->pos, entry->inserted, text_of(journal, entry), entry->removed);
+    } while (journal->entries[journal->current].joined && journal->current > journal->first);
+
+    return true;
+}
+
+bool journal_redo(struct journal* journal, journal_apply_fn apply, void* ctx) {
+    if (!journal_can_redo(journal))
+        return false;
+
+    journal->run = false;
+    do {
+        const struct entry* entry = &journal->entries[journal->current++];
+        apply(ctx, entry->pos, entry->removed, text_of(journal, entry) + entry->removed, entry->inserted);
+    } while (journal->current < journal->count && journal->entries[journal->current].joined);
+
+    return true;
+}
+
+size_t journal_bytes(const struct journal* journal) {
+    return sizeof(*journal) + journal->text_bytes + journal->capacity * sizeof(struct entry) + journal->block_capacity * sizeof(struct block);
+}
+
+size_t journal_steps(const struct journal* journal) {
+    size_t steps = 0;
+    for (size_t i = journal->first; i < journal->current; i++)
+        steps += !journal->entries[i].joined;
+    return steps;
+}
@@ -0,0 +1,63 @@
+#pragma once
+// The undo history of a document, a journal of the edits made to it
+//
+// Every edit is a delta: where it happened, the text it removed and the text it inserted. The text of the deltas
+// is appended to an arena of big blocks and the entries only reference it, so an entry is a few words no matter
+// how much text it has. Undoing an edit replaces the inserted text with the removed one and redoing does the
+// opposite, which costs as much as the edit itself, never anything that depends on the size of the document.
+//
+// Typing runs are coalesced into a single entry (or at least a single undo step), and any number of edits can be
+// grouped into one step, e.g. replacing all of the matches of a search. Instead of a number of steps, the journal
+// keeps to a budget of bytes, once it goes over it the oldest steps are forgotten.
+
+#include "document.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// The default budget, the history can go back quite a long way with it
+#define JOURNAL_DEFAULT_BUDGET (64 * 1024 * 1024)
+
+// Called for every edit an undo or a redo makes, 'removed' code units at 'pos' get replaced with 'text'
+// The text belongs to the journal and is only valid during the call
+typedef void (*journal_apply_fn)(void* ctx, size_t pos, size_t removed, const uint16_t* text, size_t length);
+
+struct journal;
+
+// Creates an empty journal that never uses much more than 'budget' bytes
+struct journal* journal_create(size_t budget);
+void journal_free(struct journal* journal);
+
+// Forgets all of the history, e.g. when another file has been opened
+void journal_clear(struct journal* journal);
+
+// Records an edit that is going to replace 'removed' code units at 'pos' of the document with 'text'
+// It has to be called before the edit is made, the removed text is read from the document
+// Anything that has been undone can't be redone after this
+// An edit that doesn't fit into the budget at all can't be undone, the whole history is forgotten
+void journal_record(struct journal* journal, const struct document* document, size_t pos, size_t removed, const uint16_t* text, size_t length);
+
+// Records replacing 'removed' code units (or 'lengths[i]' of them) at each of the sorted positions with 'text' as one step,
+// it has to be called before document_replace_all makes the edit, with the same arguments
+void journal_record_all(struct journal* journal, const struct document* document, const size_t* positions, const size_t* lengths, size_t count, size_t removed, const uint16_t* text, size_t length);
+
+// Edits recorded between these two are undone and redone together, the groups may be nested
+void journal_begin_group(struct journal* journal);
+void journal_end_group(struct journal* journal);
+
+// Ends the current typing run, the next edit is a new step even if it continues the run (e.g. after the caret moved)
+void journal_break(struct journal* journal);
+
+bool journal_can_undo(const struct journal* journal);
+bool journal_can_redo(const struct journal* journal);
+
+// Undoes or redoes a step, calling 'apply' for each of its edits in the order they have to be made
+// Returns false if there was nothing to undo or redo
+bool journal_undo(struct journal* journal, journal_apply_fn apply, void* ctx);
+bool journal_redo(struct journal* journal, journal_apply_fn apply, void* ctx);
+
+// Returns the number of bytes the journal uses, the text and the entries
+size_t journal_bytes(const struct journal* journal);
+// Returns the number of steps that can be undone
+size_t journal_steps(const struct journal* journal);
@@ -0,0 +1,365 @@
+#include "linebreak.h"
+#include "simd.h"
+
+#include <string.h>
+
+// The number of characters the vectorized loops look at at once, one bit of a mask each
+#define BLOCK 32
+
+#ifdef SIMD_X86
+
+// Sets the bits of the LFs and the CRs in the next BLOCK characters
+// SSE2 is enough here, the loops are limited by the memory, not the instructions
+
+static inline void masks_utf8(const uint8_t* src, uint32_t* lf, uint32_t* cr) {
+    const __m128i a = _mm_loadu_si128((const __m128i*)src);
+    const __m128i b = _mm_loadu_si128((const __m128i*)(src + 16));
+    const __m128i n = _mm_set1_epi8('\n');
+    const __m128i r = _mm_set1_epi8('\r');
+
+    *lf = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(a, n)) | (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(b, n)) << 16;
+    *cr = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(a, r)) | (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(b, r)) << 16;
+}
+
+// The characters are passed in, so that big endian text can be looked at as well
+static inline void masks_utf16(const uint16_t* src, uint16_t lf_unit, uint16_t cr_unit, uint32_t* lf, uint32_t* cr) {
+    const __m128i a = _mm_loadu_si128((const __m128i*)src);
+    const __m128i b = _mm_loadu_si128((const __m128i*)(src + 8));
+    const __m128i c = _mm_loadu_si128((const __m128i*)(src + 16));
+    const __m128i d = _mm_loadu_si128((const __m128i*)(src + 24));
+    const __m128i n = _mm_set1_epi16((short)lf_unit);
+    const __m128i r = _mm_set1_epi16((short)cr_unit);
+
+    // The comparison gives 0 or -1 for every unit, which survives the packing into bytes
+    *lf = (uint32_t)_mm_movemask_epi8(_mm_packs_epi16(_mm_cmpeq_epi16(a, n), _mm_cmpeq_epi16(b, n)))
+        | (uint32_t)_mm_movemask_epi8(_mm_packs_epi16(_mm_cmpeq_epi16(c, n), _mm_cmpeq_epi16(d, n))) << 16;
+    *cr = (uint32_t)_mm_movemask_epi8(_mm_packs_epi16(_mm_cmpeq_epi16(a, r), _mm_cmpeq_epi16(b, r)))
+        | (uint32_t)_mm_movemask_epi8(_mm_packs_epi16(_mm_cmpeq_epi16(c, r), _mm_cmpeq_epi16(d, r))) << 16;
+}
+
+#endif
+
+// The vectorized loops copy the blocks which don't need any change as a whole and the others
+// run by run, a run ending at every line break that changes. Whatever is left is done one by one.
+
+size_t linebreak_to_win_utf16(const uint16_t* src, size_t length, uint16_t* dst, bool* cr) {
+    const uint16_t* s = src;
+    const uint16_t* end = src + length;
+    uint16_t* d = dst;
+    bool last_cr = *cr;
+
+#ifdef SIMD_X86
+    if (simd_level() != SIMD_NONE) {
+        uint32_t carry = last_cr;
+        while (end - s >= BLOCK) {
+            uint32_t lf, crs;
+            masks_utf16(s, '\n', '\r', &lf, &crs);
+            const uint32_t lone = lf & ~(crs << 1 | carry);
+            carry = crs >> 31;
+
+            if (!lone) {
+                memcpy(d, s, BLOCK * sizeof(*s));
+                s += BLOCK;
+                d += BLOCK;
+                continue;
+            }
+
+            const uint16_t* block = s;
+            for (uint32_t m = lone; m; m &= m - 1) {
+                const uint16_t* run_end = block + simd_ctz(m);
+                memcpy(d, s, (run_end - s) * sizeof(*s));
+                d += run_end - s;
+                s = run_end;
+                *d++ = '\r';
+            }
+            memcpy(d, s, (block + BLOCK - s) * sizeof(*s));
+            d += block + BLOCK - s;
+            s = block + BLOCK;
+        }
+        last_cr = carry;
+    }
+#endif
+
+    for (; s < end; s++) {
+        if (*s == '\n' && !last_cr)
+            *d++ = '\r';
+        last_cr = *s == '\r';
+        *d++ = *s;
+    }
+
+    *cr = last_cr;
+    return d - dst;
+}
+
+size_t linebreak_to_win_utf8(const uint8_t* src, size_t size, uint8_t* dst, bool* cr) {
+    const uint8_t* s = src;
+    const uint8_t* end = src + size;
+    uint8_t* d = dst;
+    bool last_cr = *cr;
+
+#ifdef SIMD_X86
+    if (simd_level() != SIMD_NONE) {
+        uint32_t carry = last_cr;
+        while (end - s >= BLOCK) {
+            uint32_t lf, crs;
+            masks_utf8(s, &lf, &crs);
+            const uint32_t lone = lf & ~(crs << 1 | carry);
+            carry = crs >> 31;
+
+            if (!lone) {
+                memcpy(d, s, BLOCK);
+                s += BLOCK;
+                d += BLOCK;
+                continue;
+            }
+
+            const uint8_t* block = s;
+            for (uint32_t m = lone; m; m &= m - 1) {
+                const uint8_t* run_end = block + simd_ctz(m);
+                memcpy(d, s, run_end - s);
+                d += run_end - s;
+                s = run_end;
+                *d++ = '\r';
+            }
+            memcpy(d, s, block + BLOCK - s);
+            d += block + BLOCK - s;
+            s = block + BLOCK;
+        }
+        last_cr = carry;
+    }
+#endif
+
+    for (; s < end; s++) {
+        if (*s == '\n' && !last_cr)
+            *d++ = '\r';
+        last_cr = *s == '\r';
+        *d++ = *s;
+    }
+
+    *cr = last_cr;
+    return d - dst;
+}
+
+size_t linebreak_to_unix_utf16(const uint16_t* src, size_t length, uint16_t* dst, bool* cr) {
+    const uint16_t* s = src;
+    const uint16_t* end = src + length;
+    uint16_t* d = dst;
+
+    // Write the CR held back from the last block, unless it's a part of a CRLF
+    if (*cr && s < end) {
+        if (*s != '\n')
+            *d++ = '\r';
+        *cr = false;
+    }
+
+#ifdef SIMD_X86
+    if (simd_level() != SIMD_NONE) {
+        // The character after the block has to be there, a CR at the end of the block may be followed by an LF
+        while (end - s > BLOCK) {
+            uint32_t lf, crs;
+            masks_utf16(s, '\n', '\r', &lf, &crs);
+            const uint32_t drop = crs & (lf >> 1 | (uint32_t)(s[BLOCK] == '\n') << 31);
+
+            if (!drop) {
+                memcpy(d, s, BLOCK * sizeof(*s));
+                s += BLOCK;
+                d += BLOCK;
+                continue;
+            }
+
+            const uint16_t* block = s;
+            for (uint32_t m = drop; m; m &= m - 1) {
+                const uint16_t* run_end = block + simd_ctz(m);
+                memcpy(d, s, (run_end - s) * sizeof(*s));
+                d += run_end - s;
+                s = run_end + 1;
+            }
+            memcpy(d, s, (block + BLOCK - s) * sizeof(*s));
+            d += block + BLOCK - s;
+            s = block + BLOCK;
+        }
+    }
+#endif
+
+    for (; s < end; s++) {
+        if (*s == '\r') {
+            if (s + 1 == end) {
+                *cr = true;
+                break;
+            }
+            if (s[1] == '\n')
+                continue;
+        }
+        *d++ = *s;
+    }
+
+    return d - dst;
+}
+
+size_t linebreak_to_unix_utf8(const uint8_t* src, size_t size, uint8_t* dst, bool* cr) {
+    const uint8_t* s = src;
+    const uint8_t* end = src + size;
+    uint8_t* d = dst;
+
+    if (*cr && s < end) {
+        if (*s != '\n')
+            *d++ = '\r';
+        *cr = false;
+    }
+
+#ifdef SIMD_X86
+    if (simd_level() != SIMD_NONE) {
+        while (end - s > BLOCK) {
+            uint32_t lf, crs;
+            masks_utf8(s, &lf, &crs);
+            const uint32_t drop = crs & (lf >> 1 | (uint32_t)(s[BLOCK] == '\n') << 31);
+
+            if (!drop) {
+                memcpy(d, s, BLOCK);
+                s += BLOCK;
+                d += BLOCK;
+                continue;
+            }
+
+            const uint8_t* block = s;
+            for (uint32_t m = drop; m; m &= m - 1) {
+                const uint8_t* run_end = block + simd_ctz(m);
+                memcpy(d, s, run_end - s);
+                d += run_end - s;
+                s = run_end + 1;
+            }
+            memcpy(d, s, block + BLOCK - s);
+            d += block + BLOCK - s;
+            s = block + BLOCK;
+        }
+    }
+#endif
+
+    for (; s < end; s++) {
+        if (*s == '\r') {
+            if (s + 1 == end) {
+                *cr = true;
+                break;
+            }
+            if (s[1] == '\n')
+                continue;
+        }
+        *d++ = *s;
+    }
+
+    return d - dst;
+}
+
+size_t linebreak_count_utf16(const uint16_t* src, size_t length) {
+    size_t count = 0;
+    size_t i = 0;
+
+#ifdef SIMD_X86
+    if (simd_level() != SIMD_NONE) {
+        // Every match subtracts -1 from a byte counter, the counters are summed up before they can overflow
+        const __m128i n = _mm_set1_epi16('\n');
+        const __m128i zero = _mm_setzero_si128();
+        while (length - i >= 16) {
+            __m128i counters = zero;
+            for (int round = 0; round < 255 && length - i >= 16; round++, i += 16) {
+                const __m128i a = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)(src + i)), n);
+                const __m128i b = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)(src + i + 8)), n);
+                counters = _mm_sub_epi8(counters, _mm_packs_epi16(a, b));
+            }
+            const __m128i sums = _mm_sad_epu8(counters, zero);
+            count += (size_t)_mm_cvtsi128_si32(sums) + (size_t)_mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+        }
+    }
+#endif
+
+    for (; i < length; i++)
+        count += src[i] == '\n';
+
+    return count;
+}
+
+size_t linebreak_count_utf8(const uint8_t* src, size_t size) {
+    size_t count = 0;
+    size_t i = 0;
+
+#ifdef SIMD_X86
+    if (simd_level() != SIMD_NONE) {
+        const __m128i n = _mm_set1_epi8('\n');
+        const __m128i zero = _mm_setzero_si128();
+        while (size - i >= 16) {
+            __m128i counters = zero;
+            for (int round = 0; round < 255 && size - i >= 16; round++, i += 16)
+                counters = _mm_sub_epi8(counters, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(src + i)), n));
+            const __m128i sums = _mm_sad_epu8(counters, zero);
+            count += (size_t)_mm_cvtsi128_si32(sums) + (size_t)_mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+        }
+    }
+#endif
+
+    for (; i < size; i++)
+        count += src[i] == '\n';
+
+    return count;
+}
+
+void linebreak_stats_utf8(const uint8_t* src, size_t size, struct linebreak_stats* stats) {
+    size_t crlf = 0, lf = 0, cr = 0, i = 0;
+    uint32_t last_cr = 0;
+
+#ifdef SIMD_X86
+    if (simd_level() != SIMD_NONE) {
+        for (; size - i >= BLOCK; i += BLOCK) {
+            uint32_t lfs, crs;
+            masks_utf8(src + i, &lfs, &crs);
+            if (lfs | crs) {
+                crlf += simd_popcount(crs & (lfs >> 1)) + (last_cr & lfs);
+                lf += simd_popcount(lfs);
+                cr += simd_popcount(crs);
+            }
+            last_cr = crs >> 31;
+        }
+    }
+#endif
+
+    for (; i < size; i++) {
+        crlf += last_cr && src[i] == '\n';
+        lf += src[i] == '\n';
+        cr += last_cr = src[i] == '\r';
+    }
+
+    stats->crlf += crlf;
+    stats->lf += lf - crlf;
+    stats->cr += cr - crlf;
+}
+
+void linebreak_stats_utf16(const uint16_t* src, size_t length, bool big_endian, struct linebreak_stats* stats) {
+    const uint16_t lf_unit = big_endian ? 0x0A00 : '\n';
+    const uint16_t cr_unit = big_endian ? 0x0D00 : '\r';
+    size_t crlf = 0, lf = 0, cr = 0, i = 0;
+    uint32_t last_cr = 0;
+
+#ifdef SIMD_X86
+    if (simd_level() != SIMD_NONE) {
+        for (; length - i >= BLOCK; i += BLOCK) {
+            uint32_t lfs, crs;
+            masks_utf16(src + i, lf_unit, cr_unit, &lfs, &crs);
+            if (lfs | crs) {
+                crlf += simd_popcount(crs & (lfs >> 1)) + (last_cr & lfs);
+                lf += simd_popcount(lfs);
+                cr += simd_popcount(crs);
+            }
+            last_cr = crs >> 31;
+        }
+    }
+#endif
+
+    for (; i < length; i++) {
+        crlf += last_cr && src[i] == lf_unit;
+        lf += src[i] == lf_unit;
+        cr += last_cr = src[i] == cr_unit;
+    }
+
+    stats->crlf += crlf;
+    stats->lf += lf - crlf;
+    stats->cr += cr - crlf;
+}
@@ -0,0 +1,37 @@
+#pragma once
+// Translation between CRLF and LF line breaks, for UTF-8 and UTF-16 text
+//
+// The text can be translated in blocks of any size, the state between them is kept in a single flag:
+// when translating to CRLF, it says that the last character was a CR (so that an LF after it is left alone),
+// when translating to LF, it says that a CR at the end of the last block was held back, because it wasn't known
+// if an LF follows. Whoever translates the last block to LF has to write the held back CR themselves.
+// Lone CRs are never touched.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Turns every LF that doesn't follow a CR into CRLF, 'dst' must have room for 2 * 'length' units
+// Returns the number of units written
+size_t linebreak_to_win_utf16(const uint16_t* src, size_t length, uint16_t* dst, bool* cr);
+size_t linebreak_to_win_utf8(const uint8_t* src, size_t size, uint8_t* dst, bool* cr);
+
+// Turns every CRLF into LF, 'dst' must have room for 'length' + 1 units (for the held back CR)
+// Returns the number of units written
+size_t linebreak_to_unix_utf16(const uint16_t* src, size_t length, uint16_t* dst, bool* cr);
+size_t linebreak_to_unix_utf8(const uint8_t* src, size_t size, uint8_t* dst, bool* cr);
+
+// Counts the LFs
+size_t linebreak_count_utf16(const uint16_t* src, size_t length);
+size_t linebreak_count_utf8(const uint8_t* src, size_t size);
+
+// The numbers of the different line breaks in a text
+struct linebreak_stats {
+    size_t crlf;
+    // Only the LFs and CRs which are not a part of a CRLF
+    size_t lf, cr;
+};
+
+// Adds the line breaks of the text to 'stats'
+void linebreak_stats_utf8(const uint8_t* src, size_t size, struct linebreak_stats* stats);
+void linebreak_stats_utf16(const uint16_t* src, size_t length, bool big_endian, struct linebreak_stats* stats);
@@ -0,0 +1,369 @@
+#include "loader.h"
+#include "arena.h"
+#include "convert.h"
+#include "linebreak.h"
+#include "memory.h"
+#include "pool.h"
+#include "thread.h"
+#include "trace.h"
+#include "utf.h"
+
+#include <stdatomic.h>
+
+// The threads the loads convert on, 0 for every processor
+static atomic_size_t Threads = 0;
+
+struct loader {
+    const uint8_t* data;
+    size_t size;
+    struct format from;
+    enum linebreak linebreak;
+    // Kept from an earlier load of the same input, NULL if there are none
+    struct document_checkpoint* checkpoints;
+    size_t checkpoint_count;
+
+    buffer_release_fn release;
+    void* release_ctx;
+
+    loader_fn fn;
+    void* ctx;
+
+    atomic_bool cancelled;
+    struct thread* thread;
+};
+
+// Returns the number of bytes of the BOM at the start of the input
+static size_t bom_size(struct format format) {
+    if (!format.bom)
+        return 0;
+    return format.encoding == ENCODING_UTF8 ? 3 : 2;
+}
+
+// Hands a snapshot over to the callback
+static void report(struct loader* loader, struct document* document, size_t done, bool mapped) {
+    const uint64_t span = trace_begin();
+    const struct loader_progress progress = {
+        .status = LOADER_LOADING,
+        .snapshot = document_snapshot(document),
+        .done = done,
+        .total = loader->size,
+        .mapped = mapped
+    };
+    loader->fn(loader->ctx, &progress);
+    trace_end(span, "load: report");
+}
+
+// The converter sink, appends the converted text to the end of the document
+static bool append_sink(void* ctx, const void* data, size_t size) {
+    struct document* document = ctx;
+    document_insert(document, document_length(document), data, size / sizeof(uint16_t));
+    return true;
+}
+
+// Converts the input on the loader's thread, one step after the other
+static void convert_serial(struct loader* loader, struct document* document, struct format to, struct loader_progress* result) {
+    // The converter (with its block buffers) comes from the pool saving uses too, so loads and saves share the memory
+    struct arena arena;
+    arena_init(&arena);
+    struct converter* converter = arena_alloc(&arena, sizeof(*converter));
+    converter_init(converter, loader->from, to, append_sink, document);
+
+    size_t done = 0, step = LOADER_FIRST_STEP;
+    enum convert_status status = CONVERT_OK;
+    while (done < loader->size) {
+        const size_t chunk = loader->size - done < step ? loader->size - done : step;
+        const uint64_t span = trace_begin();
+        status = converter_feed(converter, loader->data + done, chunk);
+        trace_end(span, "load: convert");
+        if (status != CONVERT_OK)
+            break;
+        done += chunk;
+
+        if (atomic_load_explicit(&loader->cancelled, memory_order_relaxed))
+            break;
+        if (done < loader->size)
+            report(loader, document, done, false);
+        step = step * 2 < LOADER_STEP ? step * 2 : LOADER_STEP;
+    }
+
+    if (status == CONVERT_OK && done == loader->size)
+        status = converter_finish(converter);
+    if (status == CONVERT_INVALID) {
+        result->status = LOADER_INVALID;
+        result->error = converter_error(converter);
+    }
+    arena_reset(&arena);
+}
+
+// A part of a step converted on its own, the offsets are in bytes of the input
+struct chunk {
+    size_t start, end;
+    // The number of code units it converts to (or UTF_INVALID) and where they go in the output of the step
+    size_t length, offset;
+    // The offset of the first invalid byte, if the length is UTF_INVALID
+    size_t error;
+};
+
+// What the tasks of a step share
+struct step {
+    const struct loader* loader;
+    // The format of the input without the BOM, the step never starts with it
+    struct format from, to;
+    struct chunk* chunks;
+    // A converter for every chunk, they're too big for the stacks of the threads
+    struct converter* converters;
+    uint16_t* out;
+};
+
+// Returns the UTF-16 code unit starting at the byte offset
+static uint16_t unit_at(const struct loader* loader, size_t offset) {
+    const uint8_t* unit = loader->data + offset;
+    return loader->from.encoding == ENCODING_UTF16BE ? (uint16_t)(unit[0] << 8 | unit[1]) : (uint16_t)(unit[1] << 8 | unit[0]);
+}
+
+// Moves a cut between 'start' and the end of the input back to where the conversion can start afresh,
+// which is neither inside of a character (or a code unit) nor between the CR and the LF of a CRLF
+static size_t safe_cut(const struct loader* loader, size_t start, size_t cut) {
+    if (loader->from.encoding == ENCODING_UTF8) {
+        cut = start + utf8_complete(loader->data + start, cut - start);
+        if (cut > start && loader->data[cut - 1] == '\r' && loader->data[cut] == '\n')
+            cut--;
+    } else {
+        cut -= (cut - start) % 2;
+        if (cut > start && cut + 2 <= loader->size && unit_at(loader, cut - 2) == '\r' && unit_at(loader, cut) == '\n')
+            cut -= 2;
+    }
+    return cut;
+}
+
+// Counts the code units a chunk converts to, validating it
+// A chunk never splits a CRLF, so its line breaks turn out the same as if the whole text was converted at once
+static void count_task(void* ctx, size_t index) {
+    struct step* step = ctx;
+    struct chunk* chunk = &step->chunks[index];
+    const uint8_t* src = step->loader->data + chunk->start;
+    const size_t size = chunk->end - chunk->start;
+
+    struct linebreak_stats linebreaks = {0};
+    size_t length;
+    if (step->from.encoding == ENCODING_UTF8) {
+        size_t error;
+        length = utf8_length_utf16(src, size, &error);
+        if (length == UTF_INVALID) {
+            chunk->length = UTF_INVALID;
+            chunk->error = chunk->start + error;
+            return;
+        }
+        linebreak_stats_utf8(src, size, &linebreaks);
+    } else {
+        // A stray odd byte at the very end is dropped by the converter too
+        length = size / 2;
+        linebreak_stats_utf16((const uint16_t*)src, length, step->from.encoding == ENCODING_UTF16BE, &linebreaks);
+    }
+
+    if (step->to.linebreak == LINEBREAK_WIN)
+        length += linebreaks.lf;
+    else if (step->to.linebreak == LINEBREAK_UNIX)
+        length -= linebreaks.crlf;
+    chunk->length = length;
+}
+
+// Converts a chunk into its place in the output of the step
+static void convert_task(void* ctx, size_t index) {
+    struct step* step = ctx;
+    const struct chunk* chunk = &step->chunks[index];
+    struct converter* converter = &step->converters[index];
+
+    converter_init_buffer(converter, step->from, step->to, step->out + chunk->offset);
+    converter_feed(converter, step->loader->data + chunk->start, chunk->end - chunk->start);
+    converter_finish(converter);
+}
+
+// Lets go of the output of a step once the document doesn't need it anymore
+static void free_output(void* ctx, const void* data, size_t size) {
+    (void)ctx;
+    (void)size;
+    mem_free((void*)data);
+}
+
+// Converts the input on a pool of its own, a step for every thread at a time
+static void convert_parallel(struct loader* loader, struct document* document, struct format to, size_t threads, struct loader_progress* result) {
+    struct pool* pool = pool_create(threads);
+    const size_t tasks = threads * LOADER_TASKS;
+
+    struct arena arena;
+    arena_init(&arena);
+    struct step step = {
+        .loader = loader,
+        .from = { .encoding = loader->from.encoding, .linebreak = loader->from.linebreak, .bom = false },
+        .to = to,
+        .chunks = arena_alloc(&arena, tasks * sizeof(struct chunk)),
+        .converters = arena_alloc(&arena, tasks * sizeof(struct converter))
+    };
+
+    size_t done = bom_size(loader->from), size = LOADER_FIRST_STEP;
+    while (done < loader->size) {
+        const size_t end = loader->size - done <= size * threads ? loader->size : safe_cut(loader, done, done + size * threads);
+
+        // Small steps aren't worth cutting into as many chunks
+        size_t count = (end - done) / LOADER_FIRST_STEP;
+        count = count < 1 ? 1 : count > tasks ? tasks : count;
+        for (size_t i = 0, start = done; i < count; i++) {
+            const size_t cut = i + 1 == count ? end : safe_cut(loader, start, done + (end - done) / count * (i + 1));
+            step.chunks[i] = (struct chunk){ .start = start, .end = cut };
+            start = cut;
+        }
+
+        uint64_t span = trace_begin();
+        pool_run(pool, count_task, &step, count);
+        trace_end(span, "load: count");
+
+        // The chunks are in the order of the input, so the first invalid one has the first invalid byte
+        size_t length = 0;
+        for (size_t i = 0; i < count && result->status != LOADER_INVALID; i++) {
+            if (step.chunks[i].length == UTF_INVALID) {
+                result->status = LOADER_INVALID;
+                result->error = step.chunks[i].error;
+            }
+            step.chunks[i].offset = length;
+            length += step.chunks[i].length;
+        }
+        if (result->status == LOADER_INVALID)
+            break;
+
+        if (length) {
+            span = trace_begin();
+            step.out = mem_alloc(length * sizeof(uint16_t));
+            pool_run(pool, convert_task, &step, count);
+            document_append_from(document, step.out, length, free_output, NULL);
+            trace_end(span, "load: convert");
+        }
+        done = end;
+
+        if (atomic_load_explicit(&loader->cancelled, memory_order_relaxed))
+            break;
+        if (done < loader->size)
+            report(loader, document, done, false);
+        size = size * 2 < LOADER_STEP ? size * 2 : LOADER_STEP;
+    }
+
+    arena_reset(&arena);
+    pool_free(pool);
+}
+
+void loader_set_threads(size_t threads) {
+    atomic_store_explicit(&Threads, threads, memory_order_relaxed);
+}
+
+static void worker(void* ctx) {
+    struct loader* loader = ctx;
+    struct loader_progress result = { .status = LOADER_DONE, .total = loader->size };
+    struct document* document;
+    size_t step = LOADER_FIRST_STEP;
+
+    // Text in the format of the document is only indexed, the document reads straight from the input
+    result.mapped = loader->from.encoding != ENCODING_UTF16BE && (loader->linebreak == LINEBREAK_KEEP || loader->from.linebreak == loader->linebreak);
+
+    if (result.mapped) {
+        const size_t bom = bom_size(loader->from);
+        document = NULL;
+        if (loader->checkpoints) {
+            const uint64_t span = trace_begin();
+            document = document_create_indexed(loader->data + bom, loader->size - bom, loader->from.encoding,
+                loader->checkpoints, loader->checkpoint_count, loader->release, loader->release_ctx);
+            trace_end(span, "load: checkpoints");
+        }
+
+        // Checkpoints that don't fit are as good as none, the text gets indexed the usual way
+        result.indexed = document != NULL;
+        if (!document)
+            document = document_create_lazy(loader->data + bom, loader->size - bom, loader->from.encoding, loader->release, loader->release_ctx);
+
+        enum document_state state = document_state(document);
+        while (state == DOCUMENT_LOADING) {
+            const uint64_t span = trace_begin();
+            state = document_load_more(document, step);
+            trace_end(span, "load: index");
+            if (state != DOCUMENT_LOADING || atomic_load_explicit(&loader->cancelled, memory_order_relaxed))
+                break;
+            report(loader, document, loader->size - document_pending_bytes(document), true);
+            step = step * 2 < LOADER_STEP ? step * 2 : LOADER_STEP;
+        }
+
+        if (state == DOCUMENT_INVALID) {
+            result.status = LOADER_INVALID;
+            result.error = loader->size - document_pending_bytes(document);
+        }
+    } else {
+        document = document_create();
+
+        // The converter only wants the line breaks, the rest of the format is what the document always uses
+        const struct format to = { .encoding = ENCODING_UTF16, .linebreak = loader->linebreak, .bom = false };
+        size_t threads = atomic_load_explicit(&Threads, memory_order_relaxed);
+        if (!threads)
+            threads = thread_count();
+
+        if (threads > 1 && loader->size >= LOADER_PARALLEL)
+            convert_parallel(loader, document, to, threads, &result);
+        else
+            convert_serial(loader, document, to, &result);
+
+        // The converted text is in the document's own buffers, the input isn't needed anymore
+        if (loader->release)
+            loader->release(loader->release_ctx, loader->data, loader->size);
+    }
+
+    if (atomic_load_explicit(&loader->cancelled, memory_order_relaxed) && result.status == LOADER_DONE)
+        result.status = LOADER_CANCELLED;
+    if (result.status == LOADER_DONE) {
+        result.snapshot = document_snapshot(document);
+        result.done = loader->size;
+    }
+
+    document_free(document);
+    loader->fn(loader->ctx, &result);
+}
+
+struct loader* loader_start(const void* data, size_t size, struct format from, enum linebreak linebreak,
+    buffer_release_fn release, void* release_ctx, loader_fn fn, void* ctx) {
+
+    return loader_start_indexed(data, size, from, linebreak, NULL, 0, release, release_ctx, fn, ctx);
+}
+
+struct loader* loader_start_indexed(const void* data, size_t size, struct format from, enum linebreak linebreak,
+    struct document_checkpoint* checkpoints, size_t checkpoint_count, buffer_release_fn release, void* release_ctx, loader_fn fn, void* ctx) {
+
+    struct loader* loader = mem_alloc(sizeof(*loader));
+    loader->data = data;
+    loader->size = size;
+    loader->from = from;
+    loader->linebreak = linebreak;
+    loader->checkpoints = checkpoints;
+    loader->checkpoint_count = checkpoint_count;
+    loader->release = release;
+    loader->release_ctx = release_ctx;
+    loader->fn = fn;
+    loader->ctx = ctx;
+    atomic_init(&loader->cancelled, false);
+
+    if (!(loader->thread = thread_start(worker, loader))) {
+        mem_free(loader);
+        return NULL;
+    }
+
+    return loader;
+}
+
+void loader_cancel(struct loader* loader) {
+    atomic_store_explicit(&loader->cancelled, true, memory_order_relaxed);
+}
+
+void loader_free(struct loader* loader) {
+    if (!loader)
+        return;
+
+    loader_cancel(loader);
+    thread_join(loader->thread);
+    mem_free(loader->checkpoints);
+    mem_free(loader);
+}
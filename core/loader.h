@@ -0,0 +1,79 @@
+#pragma once
+// Loading a document on a worker thread, so that even a huge file can be looked at while it's still loading
+//
+// The worker builds its own document and, after every step, hands a snapshot of what it has so far to a callback.
+// The steps start small, so the first screen comes quickly, and grow from there. Text that is already in the
+// format of the document is only indexed (see document_create_lazy), anything else goes through the converter.
+//
+// Big text that has to be converted is converted on every processor: every step is cut into chunks where the
+// conversion doesn't depend on what came before (never inside of a character or a CRLF), the threads count what
+// their chunks convert to, which gives every chunk its place in a single buffer for the whole step, and then
+// convert them right into it. The buffer becomes a part of the document as it is, nothing is copied again.
+
+#include "document.h"
+#include "format.h"
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// The size of the first step and the most the steps grow to, in bytes of the input
+#define LOADER_FIRST_STEP (64 * 1024)
+#define LOADER_STEP (16 * 1024 * 1024)
+
+// The smallest input converted on more than one thread, in bytes, its steps are as big as above for every thread
+#define LOADER_PARALLEL (8 * 1024 * 1024)
+// The chunks a step is cut into for every thread, so that a thread that gets to run late doesn't hold up the rest
+#define LOADER_TASKS 4
+
+enum loader_status {
+    LOADER_LOADING,
+    LOADER_DONE,
+    // The input is not valid in its encoding
+    LOADER_INVALID,
+    LOADER_CANCELLED
+};
+
+struct loader_progress {
+    enum loader_status status;
+    // A snapshot of everything loaded so far, which the callback takes over (and has to free)
+    // NULL unless the status is LOADER_LOADING or LOADER_DONE
+    struct document* snapshot;
+    // The number of input bytes done and all of them
+    size_t done, total;
+    // The offset of the first invalid byte (including the BOM) after LOADER_INVALID
+    size_t error;
+    // The document reads straight from the input, instead of a converted copy
+    bool mapped;
+    // The document was built out of checkpoints (see loader_start_indexed) without reading the input
+    bool indexed;
+};
+
+// Called on the worker thread after every step, the last call is the one whose status isn't LOADER_LOADING
+// The first call can come before loader_start has even returned, so whatever the callback shares with the caller
+// (like the loader itself) has to be set up under a lock, or before starting
+typedef void (*loader_fn)(void* ctx, const struct loader_progress* progress);
+
+struct loader;
+
+// Starts loading the input (BOM included, if 'from' has one) into a UTF-16 document with the specified line breaks
+// (LINEBREAK_KEEP leaves them the way they are in the input)
+// The input has to stay valid until 'release' gets called (which may be NULL), either by the loader or by the document
+// Returns NULL if the worker thread couldn't be started, 'release' is not called then
+struct loader* loader_start(const void* data, size_t size, struct format from, enum linebreak linebreak,
+    buffer_release_fn release, void* release_ctx, loader_fn fn, void* ctx);
+
+// Starts loading the same way as loader_start, but input that would be read straight from (see loader_progress.mapped)
+// is built out of checkpoints kept from an earlier load of it (see checkpoint.h) in a single step, without reading it
+// The loader takes the checkpoints over (unless it returns NULL), if they don't fit the input, it's indexed as usual
+struct loader* loader_start_indexed(const void* data, size_t size, struct format from, enum linebreak linebreak,
+    struct document_checkpoint* checkpoints, size_t checkpoint_count, buffer_release_fn release, void* release_ctx, loader_fn fn, void* ctx);
+
+// Sets the number of threads a load converts on, or 0 for as many as there are processors (the default)
+// Mainly for benchmarks comparing them, the loads already started keep theirs
+void loader_set_threads(size_t threads);
+
+// Asks the loader to stop, it finishes the current step and reports LOADER_CANCELLED (unless it has already finished)
+void loader_cancel(struct loader* loader);
+
+// Cancels the loading, waits for the worker to finish and frees the loader, no more callbacks are made after this
+void loader_free(struct loader* loader);
@@ -0,0 +1,98 @@
+#ifndef _WIN32
+    #define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "mapping.h"
+
+#ifdef _WIN32
+
+#include <windows.h>
+
+bool mapping_open(struct mapping* mapping, const path_char* path) {
+
+    // Other programs can still read the file, but they can't write to it while we have it open
+    HANDLE file = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER size;
+    FILETIME modified;
+    if (!GetFileSizeEx(file, &size) || !GetFileTime(file, NULL, NULL, &modified)) {
+        CloseHandle(file);
+        return false;
+    }
+
+    mapping->data = NULL;
+    mapping->size = (size_t)size.QuadPart;
+    mapping->modified = (uint64_t)modified.dwHighDateTime << 32 | modified.dwLowDateTime;
+
+    // CreateFileMapping refuses empty files, there is nothing to map anyway
+    if (mapping->size == 0) {
+        CloseHandle(file);
+        return true;
+    }
+
+    HANDLE section = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    // The view keeps the section (and the file) alive, so the handles are not needed anymore
+    CloseHandle(file);
+    if (!section)
+        return false;
+
+    mapping->data = MapViewOfFile(section, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(section);
+
+    return mapping->data != NULL;
+}
+
+void mapping_close(struct mapping* mapping) {
+    if (mapping->data)
+        UnmapViewOfFile(mapping->data);
+    mapping->data = NULL;
+    mapping->size = 0;
+}
+
+#else
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool mapping_open(struct mapping* mapping, const path_char* path) {
+
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return false;
+    }
+
+    mapping->data = NULL;
+    mapping->size = (size_t)st.st_size;
+    mapping->modified = (uint64_t)st.st_mtim.tv_sec * 1000000000u + (uint64_t)st.st_mtim.tv_nsec;
+
+    if (mapping->size == 0) {
+        close(fd);
+        return true;
+    }
+
+    void* data = mmap(NULL, mapping->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return false;
+
+    mapping->data = data;
+    return true;
+}
+
+void mapping_close(struct mapping* mapping) {
+    if (mapping->data)
+        munmap((void*)mapping->data, mapping->size);
+    mapping->data = NULL;
+    mapping->size = 0;
+}
+
+#endif
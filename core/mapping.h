@@ -0,0 +1,23 @@
+#pragma once
+// Read-only memory mapped files
+// The contents are paged in by the system only when they are touched, so mapping even a huge file is cheap
+
+#include "platform.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+struct mapping {
+    const void* data;
+    size_t size;
+    // When the file was last written to, in the system's own units, it's only ever compared with another one
+    uint64_t modified;
+};
+
+// Maps the whole file into memory, an empty file results in a NULL 'data' and a zero 'size'
+// Returns false on failure, GetLastError (or errno) describes the reason
+bool mapping_open(struct mapping* mapping, const path_char* path);
+
+// Unmaps the file, the mapping must not be used afterwards
+void mapping_close(struct mapping* mapping);
@@ -0,0 +1,85 @@
+#include "memory.h"
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Every block starts with its size, so that freeing it can take it off the counters
+// The header is as big as the alignment malloc guarantees, so the memory after it is aligned the same way
+#define HEADER alignof(max_align_t)
+
+static atomic_size_t Allocations = 0, Frees = 0, Bytes = 0, Peak = 0;
+
+static void default_oom_handler(void) {
+    fputs("Out of memory\n", stderr);
+    abort();
+}
+
+static void (*Oom_handler)(void) = default_oom_handler;
+
+void mem_set_oom_handler(void (*handler)(void)) {
+    Oom_handler = handler ? handler : default_oom_handler;
+}
+
+// Counts a new block and returns the memory after its header
+static void* track(void* block, size_t size) {
+    if (!block)
+        Oom_handler();
+
+    *(size_t*)block = size;
+    atomic_fetch_add_explicit(&Allocations, 1, memory_order_relaxed);
+    const size_t bytes = atomic_fetch_add_explicit(&Bytes, size, memory_order_relaxed) + size;
+    size_t peak = atomic_load_explicit(&Peak, memory_order_relaxed);
+    while (bytes > peak && !atomic_compare_exchange_weak_explicit(&Peak, &peak, bytes, memory_order_relaxed, memory_order_relaxed));
+
+    return (uint8_t*)block + HEADER;
+}
+
+// Takes a block off the counters and returns the start of its header
+static void* untrack(void* ptr) {
+    void* block = (uint8_t*)ptr - HEADER;
+    atomic_fetch_add_explicit(&Frees, 1, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&Bytes, *(size_t*)block, memory_order_relaxed);
+    return block;
+}
+
+void* mem_alloc(size_t size) {
+    if (size > SIZE_MAX - HEADER)
+        Oom_handler();
+    return track(malloc(HEADER + size), size);
+}
+
+void* mem_calloc(size_t count, size_t size) {
+    if (size && count > (SIZE_MAX - HEADER) / size)
+        Oom_handler();
+    return track(calloc(1, HEADER + count * size), count * size);
+}
+
+void* mem_realloc(void* ptr, size_t size) {
+    if (!ptr)
+        return mem_alloc(size);
+    if (size > SIZE_MAX - HEADER)
+        Oom_handler();
+
+    // The old block is taken off the counters first, if realloc fails, the handler doesn't return anyway
+    return track(realloc(untrack(ptr), HEADER + size), size);
+}
+
+void mem_free(void* ptr) {
+    if (ptr)
+        free(untrack(ptr));
+}
+
+void mem_get_stats(struct mem_stats* stats) {
+    stats->allocations = atomic_load_explicit(&Allocations, memory_order_relaxed);
+    stats->frees = atomic_load_explicit(&Frees, memory_order_relaxed);
+    stats->bytes = atomic_load_explicit(&Bytes, memory_order_relaxed);
+    stats->peak = atomic_load_explicit(&Peak, memory_order_relaxed);
+}
+
+void mem_reset_peak(void) {
+    atomic_store_explicit(&Peak, atomic_load_explicit(&Bytes, memory_order_relaxed), memory_order_relaxed);
+}
@@ -0,0 +1,32 @@
+#pragma once
+// Allocation wrappers used by the whole portable core
+// Running out of memory is treated as fatal everywhere in Jittey, so these never return NULL,
+// instead they call the out-of-memory handler (which aborts unless the application sets its own)
+// Every block is counted, so the benchmarks can tell how many allocations an operation makes and how much it needs
+
+#include <stddef.h>
+
+// Allocates 'size' bytes, never returns NULL
+void* mem_alloc(size_t size);
+// Same as mem_alloc, but the memory is zeroed
+void* mem_calloc(size_t count, size_t size);
+// Resizes a block previously returned by mem_alloc, never returns NULL
+void* mem_realloc(void* ptr, size_t size);
+// Frees a block returned by one of the above, NULL is allowed
+void mem_free(void* ptr);
+
+// Sets the function called when an allocation fails, it must not return
+// The GUI uses this to show its usual fatal error box
+void mem_set_oom_handler(void (*handler)(void));
+
+// The counters of all of the allocations of the process
+struct mem_stats {
+    // The number of blocks allocated and freed so far, resizing counts as both
+    size_t allocations, frees;
+    // The bytes allocated right now and the most there have been at once (since the start or mem_reset_peak)
+    size_t bytes, peak;
+};
+
+void mem_get_stats(struct mem_stats* stats);
+// Makes the peak start over from the bytes allocated right now
+void mem_reset_peak(void);
@@ -0,0 +1,10 @@
+#pragma once
+// The few things that differ between Windows and everything else
+
+#ifdef _WIN32
+    #include <wchar.h>
+    // Paths are UTF-16 on Windows, the same as the rest of Win32
+    typedef wchar_t path_char;
+#else
+    typedef char path_char;
+#endif
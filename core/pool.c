@@ -0,0 +1,136 @@
+#include "pool.h"
+#include "memory.h"
+#include "thread.h"
+
+#include <stdatomic.h>
+
+struct pool {
+    struct thread** workers;
+    size_t worker_count;
+
+    struct mutex* mutex;
+    // Wakes the workers up when there is a new job, and the caller once the job is done
+    struct condition* wake;
+    struct condition* done;
+
+    // The current job, every job gets a new number so that the workers know there is one
+    pool_task_fn fn;
+    void* ctx;
+    size_t count, generation;
+    // The next task to be taken, the tasks that have finished and the workers that are still on the job
+    atomic_size_t next;
+    size_t finished, active;
+    bool quit;
+};
+
+// Runs tasks of the current job until there are none left
+static void work(struct pool* pool, pool_task_fn fn, void* ctx, size_t count) {
+    size_t finished = 0;
+    for (size_t i; (i = atomic_fetch_add_explicit(&pool->next, 1, memory_order_relaxed)) < count; finished++)
+        fn(ctx, i);
+
+    mutex_lock(pool->mutex);
+    pool->finished += finished;
+    if (pool->finished == pool->count)
+        condition_broadcast(pool->done);
+    mutex_unlock(pool->mutex);
+}
+
+static void worker(void* ctx) {
+    struct pool* pool = ctx;
+    size_t generation = 0;
+
+    mutex_lock(pool->mutex);
+    for (;;) {
+        while (!pool->quit && pool->generation == generation)
+            condition_wait(pool->wake, pool->mutex);
+        if (pool->quit)
+            break;
+
+        // The job can't change while any worker is still on it
+        generation = pool->generation;
+        const pool_task_fn fn = pool->fn;
+        void* const job_ctx = pool->ctx;
+        const size_t count = pool->count;
+        pool->active++;
+        mutex_unlock(pool->mutex);
+
+        work(pool, fn, job_ctx, count);
+
+        mutex_lock(pool->mutex);
+        if (!--pool->active)
+            condition_broadcast(pool->done);
+    }
+    mutex_unlock(pool->mutex);
+}
+
+struct pool* pool_create(size_t threads) {
+    struct pool* pool = mem_calloc(1, sizeof(*pool));
+    pool->mutex = mutex_create();
+    pool->wake = condition_create();
+    pool->done = condition_create();
+    atomic_init(&pool->next, 0);
+
+    if (!threads)
+        threads = thread_count();
+
+    // If a thread can't be started, the pool just has fewer of them
+    pool->workers = mem_alloc((threads - 1 ? threads - 1 : 1) * sizeof(struct thread*));
+    for (size_t i = 0; i + 1 < threads; i++) {
+        struct thread* thread = thread_start(worker, pool);
+        if (!thread)
+            break;
+        pool->workers[pool->worker_count++] = thread;
+    }
+
+    return pool;
+}
+
+void pool_free(struct pool* pool) {
+    if (!pool)
+        return;
+
+    mutex_lock(pool->mutex);
+    pool->quit = true;
+    condition_broadcast(pool->wake);
+    mutex_unlock(pool->mutex);
+
+    for (size_t i = 0; i < pool->worker_count; i++)
+        thread_join(pool->workers[i]);
+
+    condition_free(pool->done);
+    condition_free(pool->wake);
+    mutex_free(pool->mutex);
+    mem_free(pool->workers);
+    mem_free(pool);
+}
+
+size_t pool_threads(const struct pool* pool) {
+    return pool->worker_count + 1;
+}
+
+void pool_run(struct pool* pool, pool_task_fn fn, void* ctx, size_t count) {
+    if (!count)
+        return;
+
+    // A worker that woke up too late for the last job may still be looking at it
+    mutex_lock(pool->mutex);
+    while (pool->active)
+        condition_wait(pool->done, pool->mutex);
+
+    pool->fn = fn;
+    pool->ctx = ctx;
+    pool->count = count;
+    pool->finished = 0;
+    atomic_store_explicit(&pool->next, 0, memory_order_relaxed);
+    pool->generation++;
+    condition_broadcast(pool->wake);
+    mutex_unlock(pool->mutex);
+
+    work(pool, fn, ctx, count);
+
+    mutex_lock(pool->mutex);
+    while (pool->finished < pool->count || pool->active)
+        condition_wait(pool->done, pool->mutex);
+    mutex_unlock(pool->mutex);
+}
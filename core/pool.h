@@ -0,0 +1,23 @@
+#pragma once
+// A pool of threads that run the tasks of one job at a time, e.g. searching the chunks of a document
+//
+// The thread that runs a job works on its tasks too, so a pool of one thread has no workers at all and runs
+// everything on the caller's thread. Tasks are taken one at a time by whichever thread is free, so a few more
+// tasks than threads keep all of them busy even if some tasks take longer than others.
+
+#include <stddef.h>
+
+// Called for every task of a job, 'index' goes from 0 to the number of tasks
+typedef void (*pool_task_fn)(void* ctx, size_t index);
+
+struct pool;
+
+// Creates a pool of 'threads' threads (counting the caller), or as many as there are processors if it's 0
+struct pool* pool_create(size_t threads);
+void pool_free(struct pool* pool);
+
+// Returns the number of threads that run the tasks, the caller included
+size_t pool_threads(const struct pool* pool);
+
+// Runs 'count' tasks and waits for all of them to finish, only one thread may run jobs at a time
+void pool_run(struct pool* pool, pool_task_fn fn, void* ctx, size_t count);
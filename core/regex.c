@@ -0,0 +1,1449 @@
+#include "regex.h"
+#include "find.h"
+#include "memory.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// The most instructions a pattern may compile to, a counted repeat is a copy of what it repeats for every count
+#define REGEX_MAX_PROGRAM 32768
+// The most a counted repeat may count to
+#define REGEX_MAX_COUNT 1000
+
+// The code units read from the document at once
+#define REGEX_BLOCK (64 * 1024)
+
+// The bytes the states of the DFA may take, once it needs more, it gets thrown away and built again from scratch
+#define REGEX_DFA_BUDGET (4 * 1024 * 1024)
+
+// The literal prefilter gets turned off for the rest of a search if after this many jumps
+// it hasn't skipped this many code units per jump, the DFA alone is faster then
+#define REGEX_PREFILTER_TRIES 16
+#define REGEX_PREFILTER_SKIP 32
+
+// No limit on the number of times something repeats, or on how long its match is
+#define UNBOUNDED UINT32_MAX
+
+// A range of code units, both ends included
+struct range {
+    uint16_t lo, hi;
+};
+
+// A set of code units, the ranges from 'first' on, sorted and not touching each other
+struct set {
+    size_t first, count;
+};
+
+enum op {
+    // Consumes a code unit that is in set 'x'
+    OP_SET,
+    // Goes on at both 'x' and 'y', 'x' is preferred
+    OP_SPLIT,
+    OP_JUMP,
+    // Go on to the next instruction only if the code unit the scan went past last, or the one it's going to go past
+    // next, is one of the line breaks in 'x', the reverse program has these the other way around
+    OP_PREVIOUS,
+    OP_NEXT,
+    OP_MATCH
+};
+
+// The line breaks the assertions look for, the start and the end of the text count as both
+#define BREAK_LF 1
+#define BREAK_CR 2
+#define BREAK_ANY (BREAK_LF | BREAK_CR)
+
+struct inst {
+    enum op op;
+    uint32_t x, y;
+};
+
+// A sparse set of instructions, it can be emptied without touching its memory, and it keeps the order they were added in
+struct sparse {
+    uint32_t *dense, *index;
+    uint32_t count;
+};
+
+// A state of the DFA: the instructions of the threads in progress in the order of their priority (no splits nor jumps),
+// the line breaks of the code unit the scan went past last, and whether new threads still start
+struct dstate {
+    size_t first;
+    uint32_t count;
+    uint8_t flags;
+};
+
+#define STATE_STARTING 4
+
+// The states without any instructions, one for every combination of the flags, their number is their flags
+#define EMPTY_STATES 8
+
+// The budget keeps the rows far below this
+#define TRANSITION_MATCH 0x40000000u
+#define TRANSITION_UNKNOWN UINT32_MAX
+
+// The lazily built DFA, a transition is the row of the next state ('state * width') with TRANSITION_MATCH if a match ends
+// right before the code unit, or TRANSITION_UNKNOWN if it hasn't been built yet. The row is stored instead of the state
+// itself so that going from one transition to the next is a single load, without any arithmetic in between
+struct dfa {
+    struct dstate* states;
+    size_t state_count, state_capacity;
+    uint32_t* pcs;
+    size_t pc_count, pc_capacity;
+    uint32_t* table;
+
+    // An open addressing table of the states, 0 is an empty slot, otherwise it's the index of a state + 1
+    uint32_t* hash;
+    size_t hash_capacity;
+
+    // For building a state: the instructions before and after the code unit, and the next state's ones
+    struct sparse current, next;
+    uint32_t *stack, *key;
+    // Counts the times the DFA was thrown away, a transition being built is only stored if its state is still there
+    size_t generation;
+    // The states a match starts in for the line breaks before it (the reverse scan doesn't look for matches
+    // anywhere else), they're built when they're first needed, UINT32_MAX if they haven't been yet
+    uint32_t anchored[BREAK_ANY + 1];
+};
+
+// A program and the DFA built out of it, the forward one finds where the leftmost-first match ends, the reverse one
+// (which matches the pattern backwards) runs back from there to find where it starts
+struct machine {
+    struct inst* program;
+    size_t size, capacity;
+    // The reverse one looks for the longest match instead, the one that starts the furthest back
+    bool longest;
+    struct dfa dfa;
+};
+
+struct regex {
+    struct range* ranges;
+    size_t range_count, range_capacity;
+    struct set* sets;
+    size_t set_count, set_capacity;
+
+    // The classes of the code units, the units of a class are in the same sets, so the DFA needs a transition
+    // for a class and not for every unit, the end of the text has a class of its own, 'class_count'
+    uint16_t* classes;
+    size_t class_count;
+    // The line breaks of every class
+    uint8_t* class_breaks;
+    // Whether the units of a class are in a set, 'member[set * (class_count + 1) + class]'
+    uint8_t* member;
+
+    // The literal every match contains, and the most code units a match can have before it
+    struct finder* literal;
+    size_t literal_before;
+
+    struct machine forward, reverse;
+};
+
+// The nodes of a parsed pattern
+enum ast_type {
+    AST_EMPTY,
+    AST_SET,
+    AST_LINE_START,
+    AST_LINE_END,
+    AST_CONCAT,
+    AST_ALTERNATE,
+    AST_REPEAT
+};
+
+// A node, CONCAT and ALTERNATE have two children, REPEAT has the one in 'left'
+// A literal character is a set of the unit (and its other cases), it has the unit in 'literal', other nodes have -1
+struct ast {
+    enum ast_type type;
+    int32_t left, right;
+    uint32_t set;
+    int32_t literal;
+    uint32_t min, max;
+    bool lazy;
+};
+
+struct parser {
+    const uint16_t* pattern;
+    size_t length, pos;
+    bool ignore_case, failed;
+    size_t error_at;
+
+    struct ast* nodes;
+    size_t node_count, node_capacity;
+
+    // The ranges of the set being parsed
+    struct range* scratch;
+    size_t scratch_count, scratch_capacity;
+
+    // When ignoring the case: a bit for every code unit, and the units grouped by what they fold to,
+    // the units that fold to 'f' are 'by_fold[fold_start[f]]' up to 'by_fold[fold_start[f + 1]]'
+    uint64_t* bits;
+    uint16_t* by_fold;
+    uint32_t* fold_start;
+
+    struct regex* regex;
+    // The program being compiled, and whether it's the reverse one
+    struct machine* machine;
+    bool reversed;
+};
+
+static void fail(struct parser* parser, size_t at) {
+    if (!parser->failed) {
+        parser->failed = true;
+        parser->error_at = at;
+    }
+}
+
+static int32_t add_node(struct parser* parser, struct ast node) {
+    if (parser->node_count == parser->node_capacity) {
+        parser->node_capacity = parser->node_capacity ? parser->node_capacity * 2 : 64;
+        parser->nodes = mem_realloc(parser->nodes, parser->node_capacity * sizeof(struct ast));
+    }
+
+    parser->nodes[parser->node_count] = node;
+    return (int32_t)parser->node_count++;
+}
+
+static int32_t add_simple(struct parser* parser, enum ast_type type, int32_t left, int32_t right) {
+    return add_node(parser, (struct ast){ .type = type, .left = left, .right = right, .literal = -1 });
+}
+
+static void add_range(struct parser* parser, uint16_t lo, uint16_t hi) {
+    if (parser->scratch_count == parser->scratch_capacity) {
+        parser->scratch_capacity = parser->scratch_capacity ? parser->scratch_capacity * 2 : 16;
+        parser->scratch = mem_realloc(parser->scratch, parser->scratch_capacity * sizeof(struct range));
+    }
+    parser->scratch[parser->scratch_count++] = (struct range){ lo, hi };
+}
+
+static int compare_ranges(const void* a, const void* b) {
+    const struct range *x = a, *y = b;
+    return x->lo < y->lo ? -1 : x->lo > y->lo;
+}
+
+// Sorts the scratch ranges and merges the ones that overlap or touch
+static void normalize(struct parser* parser) {
+    if (!parser->scratch_count)
+        return;
+
+    qsort(parser->scratch, parser->scratch_count, sizeof(struct range), compare_ranges);
+
+    size_t count = 1;
+    for (size_t i = 1; i < parser->scratch_count; i++) {
+        struct range* last = &parser->scratch[count - 1];
+        const struct range range = parser->scratch[i];
+        if ((uint32_t)range.lo <= (uint32_t)last->hi + 1) {
+            if (range.hi > last->hi)
+                last->hi = range.hi;
+        } else {
+            parser->scratch[count++] = range;
+        }
+    }
+    parser->scratch_count = count;
+}
+
+// Adds every unit that folds the same as one of the scratch ranges' units, the ranges must be normalized
+static void fold_ranges(struct parser* parser) {
+    if (!parser->bits) {
+        parser->bits = mem_alloc(65536 / 8);
+        parser->by_fold = mem_alloc(65536 * sizeof(uint16_t));
+        parser->fold_start = mem_calloc(65537, sizeof(uint32_t));
+
+        for (uint32_t u = 0; u < 65536; u++)
+            parser->fold_start[find_fold((uint16_t)u) + 1]++;
+        for (uint32_t f = 0; f < 65536; f++)
+            parser->fold_start[f + 1] += parser->fold_start[f];
+
+        uint32_t* cursor = mem_alloc(65536 * sizeof(uint32_t));
+        memcpy(cursor, parser->fold_start, 65536 * sizeof(uint32_t));
+        for (uint32_t u = 0; u < 65536; u++)
+            parser->by_fold[cursor[find_fold((uint16_t)u)]++] = (uint16_t)u;
+        mem_free(cursor);
+    }
+
+    memset(parser->bits, 0, 65536 / 8);
+    for (size_t i = 0; i < parser->scratch_count; i++) {
+        for (uint32_t u = parser->scratch[i].lo; u <= parser->scratch[i].hi; u++) {
+            const uint16_t f = find_fold((uint16_t)u);
+            for (uint32_t k = parser->fold_start[f]; k < parser->fold_start[f + 1]; k++)
+                parser->bits[parser->by_fold[k] / 64] |= 1ull << (parser->by_fold[k] % 64);
+        }
+    }
+
+    // Back to ranges, skipping the empty words
+    parser->scratch_count = 0;
+    for (uint32_t word = 0; word < 65536 / 64; word++) {
+        if (!parser->bits[word])
+            continue;
+        for (uint32_t bit = 0; bit < 64; bit++) {
+            if (!(parser->bits[word] & (1ull << bit)))
+                continue;
+            const uint16_t u = (uint16_t)(word * 64 + bit);
+            if (parser->scratch_count && parser->scratch[parser->scratch_count - 1].hi + 1 == u)
+                parser->scratch[parser->scratch_count - 1].hi = u;
+            else
+                add_range(parser, u, u);
+        }
+    }
+}
+
+// Replaces the normalized scratch ranges with the units that aren't in them
+static void complement(struct parser* parser) {
+    const size_t count = parser->scratch_count;
+    struct range* ranges = mem_alloc((count ? count : 1) * sizeof(struct range));
+    memcpy(ranges, parser->scratch, count * sizeof(struct range));
+
+    parser->scratch_count = 0;
+    uint32_t next = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (ranges[i].lo > next)
+            add_range(parser, (uint16_t)next, ranges[i].lo - 1);
+        next = (uint32_t)ranges[i].hi + 1;
+    }
+    if (next <= 0xFFFF)
+        add_range(parser, (uint16_t)next, 0xFFFF);
+
+    mem_free(ranges);
+}
+
+// Turns the scratch ranges into a set of the regex, the same set is only stored once
+static uint32_t finish_set(struct parser* parser, bool negated) {
+    normalize(parser);
+    if (parser->ignore_case) {
+        fold_ranges(parser);
+        normalize(parser);
+    }
+    if (negated)
+        complement(parser);
+
+    struct regex* regex = parser->regex;
+    const size_t count = parser->scratch_count;
+    for (size_t i = 0; i < regex->set_count; i++) {
+        const struct set* set = &regex->sets[i];
+        if (set->count == count && !memcmp(regex->ranges + set->first, parser->scratch, count * sizeof(struct range))) {
+            parser->scratch_count = 0;
+            return (uint32_t)i;
+        }
+    }
+
+    if (regex->range_count + count > regex->range_capacity) {
+        while (regex->range_count + count > regex->range_capacity)
+            regex->range_capacity = regex->range_capacity ? regex->range_capacity * 2 : 64;
+        regex->ranges = mem_realloc(regex->ranges, regex->range_capacity * sizeof(struct range));
+    }
+    if (regex->set_count == regex->set_capacity) {
+        regex->set_capacity = regex->set_capacity ? regex->set_capacity * 2 : 16;
+        regex->sets = mem_realloc(regex->sets, regex->set_capacity * sizeof(struct set));
+    }
+
+    memcpy(regex->ranges + regex->range_count, parser->scratch, count * sizeof(struct range));
+    regex->sets[regex->set_count] = (struct set){ regex->range_count, count };
+    regex->range_count += count;
+    parser->scratch_count = 0;
+    return (uint32_t)regex->set_count++;
+}
+
+// Adds the ranges of \d, \w or \s, or of their complements for the upper case letters
+static void add_class_escape(struct parser* parser, uint16_t c) {
+    struct range ranges[4];
+    size_t count = 0;
+    switch (c | 0x20) {
+        case 'd':
+            ranges[count++] = (struct range){ '0', '9' };
+        break;
+        case 'w':
+            ranges[count++] = (struct range){ '0', '9' };
+            ranges[count++] = (struct range){ 'A', 'Z' };
+            ranges[count++] = (struct range){ '_', '_' };
+            ranges[count++] = (struct range){ 'a', 'z' };
+        break;
+        case 's':
+            ranges[count++] = (struct range){ '\t', '\r' };
+            ranges[count++] = (struct range){ ' ', ' ' };
+        break;
+    }
+
+    if (c >= 'a') {
+        for (size_t i = 0; i < count; i++)
+            add_range(parser, ranges[i].lo, ranges[i].hi);
+        return;
+    }
+
+    uint32_t next = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (ranges[i].lo > next)
+            add_range(parser, (uint16_t)next, ranges[i].lo - 1);
+        next = (uint32_t)ranges[i].hi + 1;
+    }
+    add_range(parser, (uint16_t)next, 0xFFFF);
+}
+
+static int hex_digit(uint16_t c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+        return (c | 0x20) - 'a' + 10;
+    return -1;
+}
+
+// Parses an escape after a backslash, a class escape adds its ranges to the scratch and returns -1,
+// any other one returns the code unit it stands for
+static int32_t parse_escape(struct parser* parser) {
+    const size_t at = parser->pos - 1;
+    if (parser->pos >= parser->length) {
+        fail(parser, at);
+        return 0;
+    }
+
+    const uint16_t c = parser->pattern[parser->pos++];
+    switch (c) {
+        case 'd': case 'D': case 'w': case 'W': case 's': case 'S':
+            add_class_escape(parser, c);
+        return -1;
+        case 't': return '\t';
+        case 'n': return '\n';
+        case 'r': return '\r';
+        case 'f': return '\f';
+        case 'v': return '\v';
+        case 'x':
+        case 'u': {
+            const size_t digits = c == 'x' ? 2 : 4;
+            int32_t value = 0;
+            for (size_t i = 0; i < digits; i++) {
+                const int digit = parser->pos < parser->length ? hex_digit(parser->pattern[parser->pos]) : -1;
+                if (digit < 0) {
+                    fail(parser, at);
+                    return 0;
+                }
+                value = value * 16 + digit;
+                parser->pos++;
+            }
+            return value;
+        }
+    }
+
+    // Escaped letters and digits that mean nothing (yet) are errors, so that they can mean something later
+    if ((c >= '0' && c <= '9') || ((c | 0x20) >= 'a' && (c | 0x20) <= 'z')) {
+        fail(parser, at);
+        return 0;
+    }
+    return c;
+}
+
+// Parses a class after its '['
+static int32_t parse_class(struct parser* parser) {
+    const size_t at = parser->pos - 1;
+    bool negated = false;
+    if (parser->pos < parser->length && parser->pattern[parser->pos] == '^') {
+        negated = true;
+        parser->pos++;
+    }
+
+    // A ']' right at the start is a literal one
+    for (bool first = true;; first = false) {
+        if (parser->pos >= parser->length) {
+            fail(parser, at);
+            return -1;
+        }
+
+        uint16_t c = parser->pattern[parser->pos++];
+        if (c == ']' && !first)
+            break;
+
+        int32_t lo = c;
+        if (c == '\\' && (lo = parse_escape(parser)) < 0)
+            continue;
+
+        int32_t hi = lo;
+        if (parser->pos + 1 < parser->length && parser->pattern[parser->pos] == '-' && parser->pattern[parser->pos + 1] != ']') {
+            parser->pos++;
+            c = parser->pattern[parser->pos++];
+            hi = c;
+            if (c == '\\' && (hi = parse_escape(parser)) < 0)
+                fail(parser, parser->pos - 2);
+            if (hi < lo)
+                fail(parser, parser->pos - 1);
+        }
+        if (parser->failed)
+            return -1;
+
+        add_range(parser, (uint16_t)lo, (uint16_t)hi);
+    }
+
+    return add_node(parser, (struct ast){ .type = AST_SET, .set = finish_set(parser, negated), .literal = -1 });
+}
+
+// Parses a number of a counted repeat, returns false if there is none
+static bool parse_count(struct parser* parser, uint32_t* count) {
+    const size_t start = parser->pos;
+    uint32_t value = 0;
+    while (parser->pos < parser->length && parser->pattern[parser->pos] >= '0' && parser->pattern[parser->pos] <= '9') {
+        value = value * 10 + (parser->pattern[parser->pos++] - '0');
+        if (value > REGEX_MAX_COUNT)
+            value = REGEX_MAX_COUNT + 1;
+    }
+    *count = value;
+    return parser->pos > start;
+}
+
+// Parses a counted repeat after its '{', returns false (and doesn't move) if it isn't one, then the '{' is a literal
+static bool parse_counted(struct parser* parser, uint32_t* min, uint32_t* max) {
+    const size_t start = parser->pos;
+    if (!parse_count(parser, min))
+        goto literal;
+
+    *max = *min;
+    if (parser->pos < parser->length && parser->pattern[parser->pos] == ',') {
+        parser->pos++;
+        if (!parse_count(parser, max))
+            *max = UNBOUNDED;
+    }
+    if (parser->pos >= parser->length || parser->pattern[parser->pos] != '}')
+        goto literal;
+    parser->pos++;
+
+    if (*min > REGEX_MAX_COUNT || (*max != UNBOUNDED && (*max > REGEX_MAX_COUNT || *max < *min)))
+        fail(parser, start - 1);
+    return true;
+
+literal:
+    parser->pos = start;
+    return false;
+}
+
+static int32_t parse_alternate(struct parser* parser);
+
+static int32_t parse_atom(struct parser* parser) {
+    const size_t at = parser->pos;
+    const uint16_t c = parser->pattern[parser->pos++];
+
+    switch (c) {
+        case '(': {
+            if (parser->pos + 1 < parser->length && parser->pattern[parser->pos] == '?' && parser->pattern[parser->pos + 1] == ':')
+                parser->pos += 2;
+
+            const int32_t node = parse_alternate(parser);
+            if (parser->pos >= parser->length || parser->pattern[parser->pos] != ')') {
+                fail(parser, at);
+                return -1;
+            }
+            parser->pos++;
+            return node;
+        }
+        case '[':
+            return parse_class(parser);
+        case '.':
+            add_range(parser, '\n', '\n');
+            add_range(parser, '\r', '\r');
+            return add_node(parser, (struct ast){ .type = AST_SET, .set = finish_set(parser, true), .literal = -1 });
+        case '^':
+            return add_simple(parser, AST_LINE_START, -1, -1);
+        case '$':
+            return add_simple(parser, AST_LINE_END, -1, -1);
+        case '*':
+        case '+':
+        case '?':
+            // Nothing to repeat
+            fail(parser, at);
+        return -1;
+    }
+
+    int32_t unit = c;
+    if (c == '\\' && (unit = parse_escape(parser)) < 0)
+        return add_node(parser, (struct ast){ .type = AST_SET, .set = finish_set(parser, false), .literal = -1 });
+
+    add_range(parser, (uint16_t)unit, (uint16_t)unit);
+    return add_node(parser, (struct ast){ .type = AST_SET, .set = finish_set(parser, false), .literal = unit });
+}
+
+static int32_t parse_repeat(struct parser* parser) {
+    int32_t node = parse_atom(parser);
+
+    while (!parser->failed && parser->pos < parser->length) {
+        const uint16_t c = parser->pattern[parser->pos];
+        uint32_t min, max;
+        if (c == '*' || c == '+' || c == '?') {
+            parser->pos++;
+            min = c == '+';
+            max = c == '?' ? 1 : UNBOUNDED;
+        } else if (c == '{') {
+            parser->pos++;
+            if (!parse_counted(parser, &min, &max)) {
+                parser->pos--;
+                break;
+            }
+        } else {
+            break;
+        }
+
+        bool lazy = false;
+        if (parser->pos < parser->length && parser->pattern[parser->pos] == '?') {
+            lazy = true;
+            parser->pos++;
+        }
+        node = add_node(parser, (struct ast){ .type = AST_REPEAT, .left = node, .literal = -1, .min = min, .max = max, .lazy = lazy });
+    }
+
+    return node;
+}
+
+static int32_t parse_concat(struct parser* parser) {
+    int32_t node = -1;
+    while (!parser->failed && parser->pos < parser->length && parser->pattern[parser->pos] != '|' && parser->pattern[parser->pos] != ')') {
+        const int32_t item = parse_repeat(parser);
+        node = node < 0 ? item : add_simple(parser, AST_CONCAT, node, item);
+    }
+
+    return node < 0 ? add_simple(parser, AST_EMPTY, -1, -1) : node;
+}
+
+static int32_t parse_alternate(struct parser* parser) {
+    int32_t node = parse_concat(parser);
+    while (!parser->failed && parser->pos < parser->length && parser->pattern[parser->pos] == '|') {
+        parser->pos++;
+        node = add_simple(parser, AST_ALTERNATE, node, parse_concat(parser));
+    }
+
+    return node;
+}
+
+static uint32_t emit(struct parser* parser, enum op op, uint32_t x, uint32_t y) {
+    struct machine* machine = parser->machine;
+    if (machine->size == REGEX_MAX_PROGRAM) {
+        fail(parser, parser->length);
+        return 0;
+    }
+
+    if (machine->size == machine->capacity) {
+        machine->capacity = machine->capacity ? machine->capacity * 2 : 64;
+        machine->program = mem_realloc(machine->program, machine->capacity * sizeof(struct inst));
+    }
+    machine->program[machine->size] = (struct inst){ op, x, y };
+    return (uint32_t)machine->size++;
+}
+
+// Compiles a node, the reverse program has the concatenations the other way around, and the assertions look
+// at the code units on the other side
+static void compile_node(struct parser* parser, int32_t index) {
+    if (parser->failed)
+        return;
+
+    struct machine* machine = parser->machine;
+    const struct ast node = parser->nodes[index];
+    switch (node.type) {
+        case AST_EMPTY:
+        break;
+        case AST_SET:
+            emit(parser, OP_SET, node.set, 0);
+        break;
+        case AST_LINE_START:
+            emit(parser, parser->reversed ? OP_NEXT : OP_PREVIOUS, BREAK_LF, 0);
+        break;
+        case AST_LINE_END:
+            emit(parser, parser->reversed ? OP_PREVIOUS : OP_NEXT, BREAK_ANY, 0);
+        break;
+        case AST_CONCAT:
+            compile_node(parser, parser->reversed ? node.right : node.left);
+            compile_node(parser, parser->reversed ? node.left : node.right);
+        break;
+        case AST_ALTERNATE: {
+            const uint32_t split = emit(parser, OP_SPLIT, 0, 0);
+            compile_node(parser, node.left);
+            const uint32_t jump = emit(parser, OP_JUMP, 0, 0);
+            const uint32_t right = (uint32_t)machine->size;
+            compile_node(parser, node.right);
+            if (parser->failed)
+                return;
+
+            machine->program[split].x = split + 1;
+            machine->program[split].y = right;
+            machine->program[jump].x = (uint32_t)machine->size;
+        } break;
+        case AST_REPEAT: {
+            for (uint32_t i = 0; i < node.min; i++)
+                compile_node(parser, node.left);
+
+            if (node.max == UNBOUNDED) {
+                const uint32_t split = emit(parser, OP_SPLIT, 0, 0);
+                compile_node(parser, node.left);
+                emit(parser, OP_JUMP, split, 0);
+                if (parser->failed)
+                    return;
+
+                machine->program[split].x = node.lazy ? (uint32_t)machine->size : split + 1;
+                machine->program[split].y = node.lazy ? split + 1 : (uint32_t)machine->size;
+                break;
+            }
+
+            // The optional copies all skip to the end, x{1,3} is x(x(x)?)?
+            const uint32_t optional = node.max - node.min;
+            uint32_t* splits = mem_alloc((optional ? optional : 1) * sizeof(uint32_t));
+            for (uint32_t i = 0; i < optional && !parser->failed; i++) {
+                splits[i] = emit(parser, OP_SPLIT, 0, 0);
+                compile_node(parser, node.left);
+            }
+
+            for (uint32_t i = 0; i < optional && !parser->failed; i++) {
+                machine->program[splits[i]].x = node.lazy ? (uint32_t)machine->size : splits[i] + 1;
+                machine->program[splits[i]].y = node.lazy ? splits[i] + 1 : (uint32_t)machine->size;
+            }
+            mem_free(splits);
+        } break;
+    }
+}
+
+// Returns the most code units a node can match
+static uint64_t longest(const struct parser* parser, int32_t index) {
+    const struct ast* node = &parser->nodes[index];
+    switch (node->type) {
+        case AST_SET: return 1;
+        case AST_CONCAT: {
+            const uint64_t left = longest(parser, node->left), right = longest(parser, node->right);
+            return left == UNBOUNDED || right == UNBOUNDED ? UNBOUNDED : left + right;
+        }
+        case AST_ALTERNATE: {
+            const uint64_t left = longest(parser, node->left), right = longest(parser, node->right);
+            return left > right ? left : right;
+        }
+        case AST_REPEAT: {
+            const uint64_t child = longest(parser, node->left);
+            if (!child)
+                return 0;
+            if (node->max == UNBOUNDED || child == UNBOUNDED)
+                return UNBOUNDED;
+            const uint64_t total = child * node->max;
+            return total < UNBOUNDED ? total : UNBOUNDED;
+        }
+        default: return 0;
+    }
+}
+
+// Collects the nodes of the concatenation at the top of the pattern, in order
+static void flatten(const struct parser* parser, int32_t index, int32_t* items, size_t* count) {
+    const struct ast* node = &parser->nodes[index];
+    if (node->type == AST_CONCAT) {
+        flatten(parser, node->left, items, count);
+        flatten(parser, node->right, items, count);
+    } else {
+        items[(*count)++] = index;
+    }
+}
+
+// Picks the longest run of literal characters every match has to contain, where the part of the pattern before it
+// can't match more than a bounded number of code units, and compiles it for find.h
+static void choose_literal(struct parser* parser, int32_t root) {
+    int32_t* items = mem_alloc(parser->node_count * sizeof(int32_t));
+    size_t count = 0;
+    flatten(parser, root, items, &count);
+
+    size_t best = 0, best_length = 0, best_before = 0;
+    uint64_t before = 0;
+    for (size_t i = 0; i < count && before != UNBOUNDED;) {
+        size_t length = 0;
+        while (i + length < count && parser->nodes[items[i + length]].literal >= 0 && length < FIND_MAX_PATTERN)
+            length++;
+
+        if (length > best_length) {
+            best = i;
+            best_length = length;
+            best_before = (size_t)before;
+        }
+
+        // The literal characters are one code unit each
+        const size_t skip = length ? length : 1;
+        for (size_t k = 0; k < skip; k++) {
+            const uint64_t item = length ? 1 : longest(parser, items[i + k]);
+            before = item == UNBOUNDED || before + item >= UNBOUNDED ? UNBOUNDED : before + item;
+        }
+        i += skip;
+    }
+
+    if (best_length) {
+        uint16_t* literal = mem_alloc(best_length * sizeof(uint16_t));
+        for (size_t i = 0; i < best_length; i++)
+            literal[i] = (uint16_t)parser->nodes[items[best + i]].literal;
+        parser->regex->literal = find_create(literal, best_length, parser->ignore_case);
+        parser->regex->literal_before = best_before;
+        mem_free(literal);
+    }
+
+    mem_free(items);
+}
+
+// Splits the code units into classes that none of the sets (nor the line breaks) tell apart
+static void compile_classes(struct regex* regex) {
+    static const struct range breaks[] = { { '\n', '\n' }, { '\r', '\r' } };
+
+    // The classes are refined on the intervals between all of the ends of the ranges
+    uint32_t* points = mem_alloc((regex->range_count * 2 + 6) * sizeof(uint32_t));
+    size_t point_count = 0;
+    points[point_count++] = 0;
+    points[point_count++] = 65536;
+    for (size_t i = 0; i < 2; i++) {
+        points[point_count++] = breaks[i].lo;
+        points[point_count++] = breaks[i].hi + 1u;
+    }
+    for (size_t i = 0; i < regex->range_count; i++) {
+        points[point_count++] = regex->ranges[i].lo;
+        points[point_count++] = regex->ranges[i].hi + 1u;
+    }
+
+    // Sorted without duplicates
+    for (size_t i = 1; i < point_count; i++) {
+        const uint32_t point = points[i];
+        size_t j = i;
+        for (; j && points[j - 1] > point; j--)
+            points[j] = points[j - 1];
+        points[j] = point;
+    }
+    size_t unique = 1;
+    for (size_t i = 1; i < point_count; i++)
+        if (points[i] != points[unique - 1])
+            points[unique++] = points[i];
+    const size_t intervals = unique - 1;
+
+    uint16_t* of = mem_calloc(intervals, sizeof(uint16_t));
+    uint8_t* in = mem_calloc(intervals, 1);
+    uint32_t* remap = mem_alloc(intervals * 2 * sizeof(uint32_t));
+    size_t count = 1;
+
+    for (size_t s = 0; s < regex->set_count + 2; s++) {
+        const struct range* ranges = s < regex->set_count ? regex->ranges + regex->sets[s].first : &breaks[s - regex->set_count];
+        const size_t range_count = s < regex->set_count ? regex->sets[s].count : 1;
+
+        // The intervals inside the ranges, the first one of a range is found by bisection
+        memset(in, 0, intervals);
+        for (size_t r = 0; r < range_count; r++) {
+            size_t lo = 0, hi = intervals;
+            while (lo < hi) {
+                const size_t mid = (lo + hi) / 2;
+                if (points[mid] < ranges[r].lo)
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            for (size_t i = lo; i < intervals && points[i] <= ranges[r].hi; i++)
+                in[i] = 1;
+        }
+
+        for (size_t i = 0; i < count * 2; i++)
+            remap[i] = UINT32_MAX;
+        size_t next = 0;
+        for (size_t i = 0; i < intervals; i++) {
+            uint32_t* class = &remap[of[i] * 2 + in[i]];
+            if (*class == UINT32_MAX)
+                *class = (uint32_t)next++;
+            of[i] = (uint16_t)*class;
+        }
+        count = next;
+    }
+
+    regex->class_count = count;
+    regex->classes = mem_alloc(65536 * sizeof(uint16_t));
+    for (size_t i = 0; i < intervals; i++)
+        for (uint32_t u = points[i]; u < points[i + 1]; u++)
+            regex->classes[u] = of[i];
+
+    const size_t width = count + 1;
+    regex->class_breaks = mem_calloc(width, 1);
+    regex->class_breaks[regex->classes['\n']] = BREAK_LF;
+    regex->class_breaks[regex->classes['\r']] = BREAK_CR;
+    regex->class_breaks[count] = BREAK_ANY;
+
+    // Every unit of a class is in the same sets, so the first one tells
+    regex->member = mem_calloc(regex->set_count ? regex->set_count * width : 1, 1);
+    for (size_t s = 0; s < regex->set_count; s++) {
+        const struct set* set = &regex->sets[s];
+        for (size_t r = 0; r < set->count; r++) {
+            const struct range range = regex->ranges[set->first + r];
+            for (size_t i = 0; i < intervals; i++)
+                if (points[i] >= range.lo && points[i] <= range.hi)
+                    regex->member[s * width + of[i]] = 1;
+        }
+    }
+
+    mem_free(remap);
+    mem_free(in);
+    mem_free(of);
+    mem_free(points);
+}
+
+static void sparse_init(struct sparse* sparse, size_t size) {
+    sparse->dense = mem_alloc(size * sizeof(uint32_t));
+    sparse->index = mem_calloc(size, sizeof(uint32_t));
+    sparse->count = 0;
+}
+
+static void sparse_free(struct sparse* sparse) {
+    mem_free(sparse->dense);
+    mem_free(sparse->index);
+}
+
+static bool sparse_insert(struct sparse* sparse, uint32_t pc) {
+    const uint32_t i = sparse->index[pc];
+    if (i < sparse->count && sparse->dense[i] == pc)
+        return false;
+
+    sparse->index[pc] = sparse->count;
+    sparse->dense[sparse->count++] = pc;
+    return true;
+}
+
+// Adds an instruction to a list with everything the splits and the jumps from it lead to, in the order of their
+// priority, an instruction that's already in the list stays where it is. The assertions only get followed if they
+// hold for the line breaks 'previous' and 'next', building the next state they aren't known, so they're both 0
+static void closure(const struct machine* machine, struct sparse* list, uint32_t* stack, uint32_t pc, uint8_t previous, uint8_t next) {
+    size_t top = 0;
+    stack[top++] = pc;
+    while (top) {
+        pc = stack[--top];
+        if (!sparse_insert(list, pc))
+            continue;
+
+        const struct inst* inst = &machine->program[pc];
+        switch (inst->op) {
+            case OP_SPLIT:
+                stack[top++] = inst->y;
+                stack[top++] = inst->x;
+            break;
+            case OP_JUMP:
+                stack[top++] = inst->x;
+            break;
+            case OP_PREVIOUS:
+                if (previous & inst->x)
+                    stack[top++] = pc + 1;
+            break;
+            case OP_NEXT:
+                if (next & inst->x)
+                    stack[top++] = pc + 1;
+            break;
+            default:
+            break;
+        }
+    }
+}
+
+static size_t dfa_width(const struct regex* regex) {
+    return regex->class_count + 1;
+}
+
+// Forgets all of the states but the empty ones
+static void dfa_reset(const struct regex* regex, struct dfa* dfa) {
+    dfa->state_count = EMPTY_STATES;
+    dfa->pc_count = 0;
+    dfa->generation++;
+    memset(dfa->table, 0xFF, EMPTY_STATES * dfa_width(regex) * sizeof(uint32_t));
+    memset(dfa->hash, 0, dfa->hash_capacity * sizeof(uint32_t));
+    memset(dfa->anchored, 0xFF, sizeof(dfa->anchored));
+}
+
+static void dfa_init(const struct regex* regex, struct machine* machine) {
+    struct dfa* dfa = &machine->dfa;
+    dfa->state_capacity = 64;
+    dfa->states = mem_calloc(dfa->state_capacity, sizeof(struct dstate));
+    dfa->table = mem_alloc(dfa->state_capacity * dfa_width(regex) * sizeof(uint32_t));
+    dfa->hash_capacity = 128;
+    dfa->hash = mem_alloc(dfa->hash_capacity * sizeof(uint32_t));
+    for (uint8_t flags = 0; flags < EMPTY_STATES; flags++)
+        dfa->states[flags] = (struct dstate){ 0, 0, flags };
+
+    sparse_init(&dfa->current, machine->size);
+    sparse_init(&dfa->next, machine->size);
+    dfa->stack = mem_alloc((machine->size * 2 + 2) * sizeof(uint32_t));
+    dfa->key = mem_alloc(machine->size * sizeof(uint32_t));
+    dfa_reset(regex, dfa);
+}
+
+static void dfa_free(struct dfa* dfa) {
+    mem_free(dfa->states);
+    mem_free(dfa->pcs);
+    mem_free(dfa->table);
+    mem_free(dfa->hash);
+    sparse_free(&dfa->current);
+    sparse_free(&dfa->next);
+    mem_free(dfa->stack);
+    mem_free(dfa->key);
+}
+
+static uint32_t hash_state(const uint32_t* pcs, uint32_t count, uint8_t flags) {
+    uint32_t hash = 2166136261u ^ flags;
+    for (uint32_t i = 0; i < count; i++)
+        hash = (hash ^ pcs[i]) * 16777619u;
+    return hash;
+}
+
+// Returns the slot of the state in the hash table, or the empty slot where it would go
+static size_t dfa_slot(const struct dfa* dfa, const uint32_t* pcs, uint32_t count, uint8_t flags) {
+    const size_t mask = dfa->hash_capacity - 1;
+    for (size_t slot = hash_state(pcs, count, flags) & mask;; slot = (slot + 1) & mask) {
+        if (!dfa->hash[slot])
+            return slot;
+
+        const struct dstate* state = &dfa->states[dfa->hash[slot] - 1];
+        if (state->flags == flags && state->count == count && !memcmp(dfa->pcs + state->first, pcs, count * sizeof(uint32_t)))
+            return slot;
+    }
+}
+
+// Finds the state with the instructions and the flags, or adds it
+static uint32_t dfa_state(const struct regex* regex, struct dfa* dfa, const uint32_t* pcs, uint32_t count, uint8_t flags) {
+    if (!count)
+        return flags;
+
+    size_t slot = dfa_slot(dfa, pcs, count, flags);
+    if (dfa->hash[slot])
+        return dfa->hash[slot] - 1;
+
+    // A pattern that needs a lot of states gets them built again, the time per code unit stays bounded
+    const size_t width = dfa_width(regex);
+    const size_t bytes = (dfa->state_count + 1) * (width * sizeof(uint32_t) + sizeof(struct dstate)) + (dfa->pc_count + count) * sizeof(uint32_t);
+    if (bytes > REGEX_DFA_BUDGET && dfa->state_count > EMPTY_STATES) {
+        dfa_reset(regex, dfa);
+        slot = dfa_slot(dfa, pcs, count, flags);
+    }
+
+    if (dfa->state_count == dfa->state_capacity) {
+        dfa->state_capacity *= 2;
+        dfa->states = mem_realloc(dfa->states, dfa->state_capacity * sizeof(struct dstate));
+        dfa->table = mem_realloc(dfa->table, dfa->state_capacity * width * sizeof(uint32_t));
+    }
+    if (dfa->pc_count + count > dfa->pc_capacity) {
+        while (dfa->pc_count + count > dfa->pc_capacity)
+            dfa->pc_capacity = dfa->pc_capacity ? dfa->pc_capacity * 2 : 256;
+        dfa->pcs = mem_realloc(dfa->pcs, dfa->pc_capacity * sizeof(uint32_t));
+    }
+
+    const uint32_t index = (uint32_t)dfa->state_count++;
+    dfa->states[index] = (struct dstate){ dfa->pc_count, count, flags };
+    memcpy(dfa->pcs + dfa->pc_count, pcs, count * sizeof(uint32_t));
+    dfa->pc_count += count;
+    memset(dfa->table + index * width, 0xFF, width * sizeof(uint32_t));
+    dfa->hash[slot] = index + 1;
+
+    // The hash table stays at most half full
+    if (dfa->state_count * 2 > dfa->hash_capacity) {
+        mem_free(dfa->hash);
+        dfa->hash_capacity *= 2;
+        dfa->hash = mem_calloc(dfa->hash_capacity, sizeof(uint32_t));
+        for (uint32_t i = EMPTY_STATES; i < dfa->state_count; i++) {
+            const struct dstate* state = &dfa->states[i];
+            dfa->hash[dfa_slot(dfa, dfa->pcs + state->first, state->count, state->flags)] = i + 1;
+        }
+    }
+
+    return index;
+}
+
+// Finds the state for a list of instructions, without the splits and the jumps, which only lead to the others
+static uint32_t dfa_state_of(const struct regex* regex, struct machine* machine, const struct sparse* list, uint8_t flags) {
+    struct dfa* dfa = &machine->dfa;
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < list->count; i++) {
+        const enum op op = machine->program[list->dense[i]].op;
+        if (op != OP_SPLIT && op != OP_JUMP)
+            dfa->key[count++] = list->dense[i];
+    }
+    return dfa_state(regex, dfa, dfa->key, count, flags);
+}
+
+// Returns the state a match starts in
+static uint32_t dfa_anchored(const struct regex* regex, struct machine* machine, uint8_t previous) {
+    struct dfa* dfa = &machine->dfa;
+    if (dfa->anchored[previous] == UINT32_MAX) {
+        dfa->next.count = 0;
+        closure(machine, &dfa->next, dfa->stack, 0, 0, 0);
+        const uint32_t state = dfa_state_of(regex, machine, &dfa->next, previous);
+        dfa->anchored[previous] = state;
+    }
+    return dfa->anchored[previous];
+}
+
+// Builds the transition of a state on a class, returns it and stores it in the table
+static uint32_t dfa_step(const struct regex* regex, struct machine* machine, uint32_t index, uint32_t class) {
+    struct dfa* dfa = &machine->dfa;
+    const struct dstate state = dfa->states[index];
+    const size_t generation = dfa->generation;
+    const size_t width = dfa_width(regex);
+    const uint8_t previous = state.flags & BREAK_ANY, next = regex->class_breaks[class];
+
+    // The threads in the order of their priority, a new one that starts here has the lowest, now that
+    // the code unit is known, the assertions can be checked
+    struct sparse* current = &dfa->current;
+    current->count = 0;
+    for (uint32_t i = 0; i < state.count; i++)
+        closure(machine, current, dfa->stack, dfa->pcs[state.first + i], previous, next);
+    if (state.flags & STATE_STARTING)
+        closure(machine, current, dfa->stack, 0, previous, next);
+
+    // The leftmost-first match cuts off the threads after it, whatever they'd match has a lower priority,
+    // and the ones that start later don't matter anymore either
+    bool matched = false;
+    uint32_t count = current->count;
+    for (uint32_t i = 0; i < count && !matched; i++) {
+        if (machine->program[current->dense[i]].op == OP_MATCH) {
+            matched = true;
+            if (!machine->longest)
+                count = i;
+        }
+    }
+
+    struct sparse* following = &dfa->next;
+    following->count = 0;
+    if (class != regex->class_count) {
+        for (uint32_t i = 0; i < count; i++) {
+            const uint32_t pc = current->dense[i];
+            const struct inst* inst = &machine->program[pc];
+            if (inst->op == OP_SET && regex->member[inst->x * width + class])
+                closure(machine, following, dfa->stack, pc + 1, 0, 0);
+        }
+    }
+
+    const uint8_t flags = (next & BREAK_ANY) | ((state.flags & STATE_STARTING) && !matched ? STATE_STARTING : 0);
+    const uint32_t transition = (uint32_t)(dfa_state_of(regex, machine, following, flags) * width) | (matched ? TRANSITION_MATCH : 0);
+    if (dfa->generation == generation)
+        dfa->table[index * width + class] = transition;
+    return transition;
+}
+
+// Returns the same state, but without starting any more threads
+static uint32_t dfa_stop_starting(const struct regex* regex, struct machine* machine, uint32_t index) {
+    struct dfa* dfa = &machine->dfa;
+    const struct dstate state = dfa->states[index];
+    if (index < EMPTY_STATES)
+        return index & ~STATE_STARTING;
+
+    memcpy(dfa->key, dfa->pcs + state.first, state.count * sizeof(uint32_t));
+    return dfa_state(regex, dfa, dfa->key, state.count, state.flags & ~STATE_STARTING);
+}
+
+// Reads the document a block at a time, and remembers how the literal prefilter is doing
+struct reader {
+    const struct document* document;
+    size_t total;
+    uint16_t* text;
+    size_t base, length;
+
+    bool prefilter;
+    size_t tries, skipped;
+};
+
+static void reader_init(struct reader* reader, const struct regex* regex, const struct document* document) {
+    *reader = (struct reader){
+        .document = document,
+        .total = document_length(document),
+        .text = mem_alloc(REGEX_BLOCK * sizeof(uint16_t)),
+        .prefilter = regex->literal != NULL
+    };
+}
+
+// Reads the block that starts at 'pos'
+static void reader_load(struct reader* reader, size_t pos) {
+    const size_t remaining = reader->total - pos;
+    reader->base = pos;
+    reader->length = document_read(reader->document, pos, reader->text, remaining < REGEX_BLOCK ? remaining : REGEX_BLOCK);
+}
+
+// Makes the block contain the code unit at 'pos', returns false if it's the end of the document
+static bool reader_at(struct reader* reader, size_t pos) {
+    if (pos - reader->base < reader->length)
+        return true;
+    if (pos >= reader->total)
+        return false;
+
+    reader_load(reader, pos);
+    return true;
+}
+
+// Returns the code unit before 'pos', for scanning backwards the block gets read up to it
+static uint16_t reader_before(struct reader* reader, size_t pos) {
+    if (pos - 1 - reader->base >= reader->length) {
+        reader->base = pos > REGEX_BLOCK ? pos - REGEX_BLOCK : 0;
+        reader->length = document_read(reader->document, reader->base, reader->text, pos - reader->base);
+    }
+    return reader->text[pos - 1 - reader->base];
+}
+
+// Returns the line breaks the code unit at 'pos' is, the block stays as it is
+static uint8_t breaks_at(const struct regex* regex, const struct reader* reader, size_t pos) {
+    if (pos >= reader->total)
+        return BREAK_ANY;
+    if (pos - reader->base < reader->length)
+        return regex->class_breaks[regex->classes[reader->text[pos - reader->base]]];
+
+    uint16_t unit;
+    document_read(reader->document, pos, &unit, 1);
+    return regex->class_breaks[regex->classes[unit]];
+}
+
+static uint8_t breaks_before(const struct regex* regex, const struct reader* reader, size_t pos) {
+    return pos ? breaks_at(regex, reader, pos - 1) : BREAK_ANY;
+}
+
+// Where the forward DFA is in the text
+struct scan {
+    size_t pos;
+    uint32_t state;
+    // The last position where no match was in progress, and after which the prefilter may look for the literal again
+    size_t last, check;
+    // Whether matches may still start, i.e. 'to' hasn't been reached yet
+    bool starting;
+};
+
+static void scan_restart(const struct regex* regex, const struct reader* reader, struct scan* scan, size_t pos) {
+    scan->pos = scan->last = pos;
+    scan->state = STATE_STARTING | breaks_before(regex, reader, pos);
+}
+
+// Finds the next occurrence of the literal from 'pos' on, searching the blocks the scan reads anyway rather than
+// the document, which would have to find its way to 'pos' through the pieces every time
+// Returns false if there is none that starts before 'limit'
+static bool find_literal(const struct regex* regex, struct reader* reader, size_t pos, size_t limit, size_t* found) {
+    const size_t overlap = find_length(regex->literal) - 1;
+    while (pos < limit && reader_at(reader, pos)) {
+        const size_t at = find_in(regex->literal, reader->text, reader->length, pos - reader->base);
+        if (at != SIZE_MAX) {
+            *found = reader->base + at;
+            return *found < limit;
+        }
+
+        // An occurrence may start in the last code units of the block and go on in the next one
+        const size_t end = reader->base + reader->length;
+        if (end == reader->total)
+            return false;
+        pos = end - overlap > pos ? end - overlap : pos + 1;
+        reader_load(reader, pos);
+    }
+
+    return false;
+}
+
+// Jumps to the first place a match containing the next occurrence of the literal could start
+// Returns false if there is no such place before 'to'
+static bool prefilter(const struct regex* regex, struct reader* reader, struct scan* scan, size_t to) {
+    const size_t before = regex->literal_before;
+    const size_t limit = to > SIZE_MAX - before ? SIZE_MAX : to + before;
+
+    size_t literal;
+    if (!find_literal(regex, reader, scan->pos, limit, &literal))
+        return false;
+
+    const size_t target = literal - scan->pos > before ? literal - before : scan->pos;
+    if (target >= to)
+        return false;
+
+    reader->tries++;
+    reader->skipped += target - scan->pos;
+    if (reader->tries >= REGEX_PREFILTER_TRIES && reader->skipped < reader->tries * REGEX_PREFILTER_SKIP)
+        reader->prefilter = false;
+
+    scan->check = literal + 1;
+    if (target > scan->pos)
+        scan_restart(regex, reader, scan, target);
+    return true;
+}
+
+// Runs the forward DFA from 'from' until it can't match anymore, returns false if no match starts before 'to'
+// Otherwise 'match->end' gets where the leftmost-first match ends, and 'match->start' the last position before it
+// where no match was in progress, the match starts there or later
+static bool scan_forward(struct regex* regex, struct reader* reader, size_t from, size_t to, struct regex_match* match) {
+    struct machine* machine = &regex->forward;
+    const size_t width = dfa_width(regex);
+    const uint16_t* classes = regex->classes;
+    struct scan scan = { .check = from, .starting = true };
+    scan_restart(regex, reader, &scan, from);
+    bool found = false;
+
+    // The rows of the empty states come first, the ones that don't start any threads are dead
+    const uint32_t empty = (uint32_t)(EMPTY_STATES * width), dead = (uint32_t)(STATE_STARTING * width);
+
+    for (;;) {
+        if (scan.state < EMPTY_STATES && reader->prefilter && scan.pos >= scan.check && !prefilter(regex, reader, &scan, to))
+            return false;
+
+        if (!reader_at(reader, scan.pos)) {
+            uint32_t transition = machine->dfa.table[scan.state * width + regex->class_count];
+            if (transition == TRANSITION_UNKNOWN)
+                transition = dfa_step(regex, machine, scan.state, (uint32_t)regex->class_count);
+            if (transition & TRANSITION_MATCH) {
+                match->end = scan.pos;
+                found = true;
+            }
+            break;
+        }
+
+        // The block ends early at 'to', where no more matches may start
+        const uint16_t* text = reader->text + (scan.pos - reader->base);
+        size_t count = reader->base + reader->length - scan.pos;
+        if (scan.starting && to - scan.pos < count)
+            count = to - scan.pos;
+
+        const uint32_t* table = machine->dfa.table;
+        uint32_t row = (uint32_t)(scan.state * width);
+        size_t i = 0;
+        while (i < count) {
+            const uint32_t class = classes[text[i]];
+            uint32_t transition = table[row + class];
+            if (transition >= TRANSITION_MATCH) {
+                if (transition == TRANSITION_UNKNOWN) {
+                    transition = dfa_step(regex, machine, (uint32_t)(row / width), class);
+                    table = machine->dfa.table;
+                }
+                if (transition & TRANSITION_MATCH) {
+                    match->end = scan.pos + i;
+                    found = true;
+                    transition &= ~TRANSITION_MATCH;
+                }
+            }
+
+            row = transition;
+            i++;
+            if (row < empty) {
+                if (row < dead)
+                    break;
+                scan.last = scan.pos + i;
+                if (reader->prefilter && scan.last >= scan.check)
+                    break;
+            }
+        }
+        scan.pos += i;
+        scan.state = (uint32_t)(row / width);
+        if (scan.state < STATE_STARTING)
+            break;
+
+        if (scan.pos == to && scan.starting) {
+            scan.starting = false;
+            scan.state = dfa_stop_starting(regex, machine, scan.state);
+            if (scan.state < STATE_STARTING)
+                break;
+        }
+    }
+
+    match->start = scan.last;
+    return found;
+}
+
+// Runs the reverse DFA back from the end of a match to 'since' at the furthest, returns where the match starts
+static size_t scan_reverse(struct regex* regex, struct reader* reader, size_t since, size_t end) {
+    struct machine* machine = &regex->reverse;
+    const size_t width = dfa_width(regex);
+    const uint32_t empty = (uint32_t)(EMPTY_STATES * width);
+    uint32_t row = (uint32_t)(dfa_anchored(regex, machine, breaks_at(regex, reader, end)) * width);
+    size_t start = end;
+
+    for (size_t pos = end;; pos--) {
+        const uint32_t class = pos ? regex->classes[reader_before(reader, pos)] : (uint32_t)regex->class_count;
+        uint32_t transition = machine->dfa.table[row + class];
+        if (transition == TRANSITION_UNKNOWN)
+            transition = dfa_step(regex, machine, (uint32_t)(row / width), class);
+        if (transition & TRANSITION_MATCH)
+            start = pos;
+
+        row = transition & ~TRANSITION_MATCH;
+        if (pos == since || row < empty)
+            return start;
+    }
+}
+
+// Finds the leftmost match that starts in the range from 'from' up to 'to'
+static bool search(struct regex* regex, struct reader* reader, size_t from, size_t to, struct regex_match* match) {
+    if (!scan_forward(regex, reader, from, to, match))
+        return false;
+
+    match->start = scan_reverse(regex, reader, match->start, match->end);
+    return true;
+}
+
+struct regex* regex_create(const uint16_t* pattern, size_t length, bool ignore_case, size_t* error_at) {
+    *error_at = 0;
+    if (length > REGEX_MAX_PATTERN) {
+        *error_at = REGEX_MAX_PATTERN;
+        return NULL;
+    }
+
+    struct regex* regex = mem_calloc(1, sizeof(*regex));
+    regex->reverse.longest = true;
+    struct parser parser = {
+        .pattern = pattern,
+        .length = length,
+        .ignore_case = ignore_case,
+        .regex = regex,
+        .machine = &regex->forward
+    };
+
+    const int32_t root = parse_alternate(&parser);
+    // Only an unmatched ')' stops the parsing early
+    if (parser.pos < length)
+        fail(&parser, parser.pos);
+
+    compile_node(&parser, root);
+    emit(&parser, OP_MATCH, 0, 0);
+    parser.machine = &regex->reverse;
+    parser.reversed = true;
+    compile_node(&parser, root);
+    emit(&parser, OP_MATCH, 0, 0);
+    if (!parser.failed)
+        choose_literal(&parser, root);
+
+    mem_free(parser.nodes);
+    mem_free(parser.scratch);
+    mem_free(parser.bits);
+    mem_free(parser.by_fold);
+    mem_free(parser.fold_start);
+
+    if (parser.failed) {
+        *error_at = parser.error_at;
+        regex_free(regex);
+        return NULL;
+    }
+
+    compile_classes(regex);
+    dfa_init(regex, &regex->forward);
+    dfa_init(regex, &regex->reverse);
+    return regex;
+}
+
+void regex_free(struct regex* regex) {
+    if (!regex)
+        return;
+
+    if (regex->classes) {
+        dfa_free(&regex->forward.dfa);
+        dfa_free(&regex->reverse.dfa);
+    }
+    find_free(regex->literal);
+    mem_free(regex->forward.program);
+    mem_free(regex->reverse.program);
+    mem_free(regex->ranges);
+    mem_free(regex->sets);
+    mem_free(regex->classes);
+    mem_free(regex->class_breaks);
+    mem_free(regex->member);
+    mem_free(regex);
+}
+
+bool regex_next(struct regex* regex, const struct document* document, size_t from, size_t to, struct regex_match* match) {
+    if (to <= from || from > document_length(document))
+        return false;
+
+    struct reader reader;
+    reader_init(&reader, regex, document);
+    const bool found = search(regex, &reader, from, to, match);
+    mem_free(reader.text);
+    return found;
+}
+
+size_t regex_all(struct regex* regex, const struct document* document, struct regex_match** matches) {
+    struct reader reader;
+    reader_init(&reader, regex, document);
+
+    size_t count = 0, capacity = 0, pos = 0;
+    struct regex_match match;
+    *matches = NULL;
+    while (pos <= reader.total && search(regex, &reader, pos, SIZE_MAX, &match)) {
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            *matches = mem_realloc(*matches, capacity * sizeof(struct regex_match));
+        }
+        (*matches)[count++] = match;
+        pos = match.end > match.start ? match.end : match.end + 1;
+    }
+
+    mem_free(reader.text);
+    return count;
+}
@@ -0,0 +1,47 @@
+#pragma once
+// Regular expressions
+//
+// A pattern compiles to the programs of Thompson NFAs, which are never backtracked through, so matching takes linear
+// time whatever the pattern and the text are. The text is scanned by DFAs that are built lazily out of the programs,
+// a state and a transition at a time as the text needs them. The states keep the threads in the order of their
+// priority, so the forward DFA finds where the leftmost-first match ends (the usual priorities of the alternatives
+// and the greedy and lazy repeats), then a DFA of the pattern reversed runs back from there to find where it starts.
+//
+// If every match has to contain a string of literal characters and the part of the pattern before it can only match
+// a bounded amount of text, the vectorized literal search of find.h skips all of the text where the string isn't.
+// The text is read from the document a block at a time, a document is never turned into one contiguous string.
+//
+// The syntax: literal characters, '.' (anything but a line break), classes like [a-z_] and [^,], \d \w \s \D \W \S,
+// the escapes \t \n \r \f \v \xHH \uHHHH and any escaped punctuation, groups (...) and (?:...), alternatives |,
+// the repeats * + ? {n} {n,} {n,m} and their lazy forms (e.g. *?), and ^ $ for the start and the end of a line.
+// Ignoring the case compares the characters folded the same way find.h does.
+
+#include "document.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// The longest pattern that can be compiled, in code units
+#define REGEX_MAX_PATTERN 4096
+
+// A match, from 'start' up to 'end' (which is the same for an empty match)
+struct regex_match {
+    size_t start, end;
+};
+
+// A compiled pattern, it keeps the part of the DFA it has built so far, so it may only be used by one thread at a time
+struct regex;
+
+// Compiles a pattern, returns NULL if it isn't valid (or too long or too big), '*error_at' then gets the offset
+// in the pattern where the problem is
+struct regex* regex_create(const uint16_t* pattern, size_t length, bool ignore_case, size_t* error_at);
+void regex_free(struct regex* regex);
+
+// Finds the leftmost match that starts in the range from 'from' up to 'to', it may end after 'to'
+// Returns true and the match in '*match', or false if there is none
+bool regex_next(struct regex* regex, const struct document* document, size_t from, size_t to, struct regex_match* match);
+
+// Finds all of the matches that don't overlap, after an empty one the search goes on from the next code unit
+// Returns the number of matches, '*matches' gets them in order (allocated with mem_alloc, NULL if there are none)
+size_t regex_all(struct regex* regex, const struct document* document, struct regex_match** matches);
@@ -0,0 +1,357 @@
+#ifndef _WIN32
+    #define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "save.h"
+#include "arena.h"
+#include "convert.h"
+#include "thread.h"
+#include "trace.h"
+
+#include <string.h>
+
+#ifdef _WIN32
+    #include <windows.h>
+    typedef HANDLE file_handle;
+    typedef DWORD error_code;
+    #define TEMP_SUFFIX L".jittey~"
+    #define INVALID_INPUT ERROR_NO_UNICODE_TRANSLATION
+#else
+    #include <errno.h>
+    #include <stdio.h>
+    #include <fcntl.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+    typedef int file_handle;
+    typedef int error_code;
+    #define TEMP_SUFFIX ".jittey~"
+    #define INVALID_INPUT EILSEQ
+#endif
+
+// The state shared by the converting thread (the caller) and the writer thread
+struct saver {
+    file_handle file;
+
+    struct mutex* mutex;
+    // Signalled whenever a buffer gets full or empty, or when saving stops
+    struct condition* changed;
+
+    uint8_t* buffers[2];
+    size_t sizes[2];
+    // A full buffer belongs to the writer until it's written and empty again
+    bool full[2];
+    // The buffer being filled and how much of it is used
+    int current;
+    size_t used;
+
+    // Started by the first full buffer
+    struct thread* thread;
+
+    // Set once there is nothing more to write, or when writing has failed
+    bool done, failed;
+    error_code error;
+};
+
+static error_code last_error(void) {
+#ifdef _WIN32
+    return GetLastError();
+#else
+    return errno;
+#endif
+}
+
+static void set_last_error(error_code error) {
+#ifdef _WIN32
+    SetLastError(error);
+#else
+    errno = error;
+#endif
+}
+
+// Builds the path of the temporary file, it is in the same directory so that it can be renamed over the target
+static path_char* temp_path(struct arena* arena, const path_char* path) {
+#ifdef _WIN32
+    const size_t length = wcslen(path), suffix = wcslen(TEMP_SUFFIX);
+#else
+    const size_t length = strlen(path), suffix = strlen(TEMP_SUFFIX);
+#endif
+
+    path_char* temp = arena_alloc(arena, (length + suffix + 1) * sizeof(path_char));
+    memcpy(temp, path, length * sizeof(path_char));
+    memcpy(temp + length, TEMP_SUFFIX, (suffix + 1) * sizeof(path_char));
+    return temp;
+}
+
+static bool file_create(file_handle* file, const path_char* path, const path_char* original) {
+#ifdef _WIN32
+    (void)original;
+    *file = CreateFileW(path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    return *file != INVALID_HANDLE_VALUE;
+#else
+    // The new file keeps the permissions of the one it replaces
+    struct stat st;
+    const mode_t mode = stat(original, &st) ? 0666 : st.st_mode & 07777;
+    *file = open(path, O_WRONLY | O_CREAT | O_TRUNC, mode);
+    return *file >= 0;
+#endif
+}
+
+static bool file_write(file_handle file, const uint8_t* data, size_t size) {
+#ifdef _WIN32
+    DWORD written;
+    // The buffers are much smaller than what a DWORD can hold
+    return WriteFile(file, data, (DWORD)size, &written, NULL) && written == size;
+#else
+    while (size) {
+        const ssize_t written = write(file, data, size);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += written;
+        size -= written;
+    }
+    return true;
+#endif
+}
+
+// Makes sure the data is on the disk before the file replaces the original, then closes it
+static bool file_close(file_handle file) {
+#ifdef _WIN32
+    const bool flushed = FlushFileBuffers(file);
+    return CloseHandle(file) && flushed;
+#else
+    const bool flushed = !fsync(file);
+    return !close(file) && flushed;
+#endif
+}
+
+static bool file_replace(const path_char* from, const path_char* to) {
+#ifdef _WIN32
+    return MoveFileExW(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+#else
+    return !rename(from, to);
+#endif
+}
+
+static void file_delete(const path_char* path) {
+#ifdef _WIN32
+    DeleteFileW(path);
+#else
+    unlink(path);
+#endif
+}
+
+// The writer thread, writes the full buffers in order until there are no more of them
+static void writer(void* ctx) {
+    struct saver* saver = ctx;
+
+    for (int i = 0; ; i ^= 1) {
+        mutex_lock(saver->mutex);
+        while (!saver->full[i] && !saver->done)
+            condition_wait(saver->changed, saver->mutex);
+        const bool stop = !saver->full[i];
+        mutex_unlock(saver->mutex);
+
+        if (stop)
+            break;
+
+        const uint64_t span = trace_begin();
+        const bool written = file_write(saver->file, saver->buffers[i], saver->sizes[i]);
+        trace_end(span, "save: write");
+        const error_code error = written ? 0 : last_error();
+
+        mutex_lock(saver->mutex);
+        saver->full[i] = false;
+        if (!written) {
+            saver->failed = saver->done = true;
+            saver->error = error;
+        }
+        condition_broadcast(saver->changed);
+        mutex_unlock(saver->mutex);
+
+        if (!written)
+            break;
+    }
+}
+
+// Hands the current buffer over to the writer and waits until the other one is free, the writer thread is started
+// only once there is more than a buffer to write, so small files are written without one
+// Returns false if writing has failed
+static bool submit(struct saver* saver) {
+    if (!saver->thread && !(saver->thread = thread_start(writer, saver))) {
+        saver->failed = true;
+        saver->error = last_error();
+        return false;
+    }
+
+    mutex_lock(saver->mutex);
+    saver->sizes[saver->current] = saver->used;
+    saver->full[saver->current] = true;
+    condition_broadcast(saver->changed);
+
+    saver->current ^= 1;
+    saver->used = 0;
+    while (saver->full[saver->current] && !saver->failed)
+        condition_wait(saver->changed, saver->mutex);
+
+    const bool failed = saver->failed;
+    mutex_unlock(saver->mutex);
+    return !failed;
+}
+
+// Writes whatever is left in the current buffer and waits for the writer thread (if any) to finish
+static void flush(struct saver* saver) {
+    if (!saver->thread) {
+        const uint64_t span = trace_begin();
+        if (saver->used && !saver->failed && !file_write(saver->file, saver->buffers[saver->current], saver->used)) {
+            saver->failed = true;
+            saver->error = last_error();
+        }
+        trace_end(span, "save: write");
+        return;
+    }
+
+    if (saver->used && !saver->failed)
+        submit(saver);
+
+    mutex_lock(saver->mutex);
+    saver->done = true;
+    condition_broadcast(saver->changed);
+    mutex_unlock(saver->mutex);
+    thread_join(saver->thread);
+}
+
+// The converter sink, fills the buffers
+static bool save_sink(void* ctx, const void* data, size_t size) {
+    struct saver* saver = ctx;
+    const uint8_t* bytes = data;
+
+    while (size) {
+        size_t chunk = SAVE_BUFFER - saver->used;
+        if (chunk > size)
+            chunk = size;
+
+        memcpy(saver->buffers[saver->current] + saver->used, bytes, chunk);
+        saver->used += chunk;
+        bytes += chunk;
+        size -= chunk;
+
+        if (saver->used == SAVE_BUFFER && !submit(saver))
+            return false;
+    }
+
+    return true;
+}
+
+// Feeds all of the text to the converter (but doesn't finish it), returns how that went
+typedef enum convert_status (*feed_fn)(void* ctx, struct converter* converter);
+
+// Converts the text from 'feed' into a temporary file, which then replaces the target
+// 'release' (which may be NULL) gets called once the text isn't needed anymore, before the target is replaced
+static bool save(const path_char* path, struct format from, struct format format, feed_fn feed, void* ctx,
+    buffer_release_fn release, const void* data, size_t size, void* release_ctx) {
+
+    // The path, the buffers and the converter all come from one block, which the next save gets to use again
+    struct arena arena;
+    arena_init(&arena);
+    path_char* temp = temp_path(&arena, path);
+
+    struct saver saver = {0};
+    if (!file_create(&saver.file, temp, path)) {
+        const error_code error = last_error();
+        if (release)
+            release(release_ctx, data, size);
+        arena_reset(&arena);
+        set_last_error(error);
+        return false;
+    }
+
+    saver.mutex = mutex_create();
+    saver.changed = condition_create();
+    saver.buffers[0] = arena_alloc(&arena, SAVE_BUFFER);
+    saver.buffers[1] = arena_alloc(&arena, SAVE_BUFFER);
+
+    struct converter* converter = arena_alloc(&arena, sizeof(*converter));
+    converter_init(converter, from, format, save_sink, &saver);
+
+    // The converter stops when the writer has failed, or when the input isn't valid
+    const uint64_t span = trace_begin();
+    enum convert_status status = feed(ctx, converter);
+    if (status == CONVERT_OK)
+        status = converter_finish(converter);
+    trace_end(span, "save: convert");
+    if (status == CONVERT_INVALID && !saver.failed) {
+        saver.failed = true;
+        saver.error = INVALID_INPUT;
+    }
+
+    flush(&saver);
+    if (release)
+        release(release_ctx, data, size);
+    bool success = !saver.failed;
+
+    const uint64_t replace_span = trace_begin();
+    if (!file_close(saver.file) && success) {
+        success = false;
+        saver.error = last_error();
+    }
+
+    if (success && !file_replace(temp, path)) {
+        success = false;
+        saver.error = last_error();
+    }
+
+    if (!success)
+        file_delete(temp);
+    trace_end(replace_span, "save: replace");
+
+    condition_free(saver.changed);
+    mutex_free(saver.mutex);
+    arena_reset(&arena);
+
+    // The clean up may have changed the error
+    if (!success)
+        set_last_error(saver.error);
+    return success;
+}
+
+// The document_walk_pieces callback, feeds the pieces to the converter the way they are stored, so UTF-8 text
+// saved as UTF-8 is neither decoded nor validated again, only its line breaks are translated
+static bool save_piece(void* ctx, size_t pos, const void* data, size_t size, size_t length, enum encoding encoding) {
+    (void)pos;
+    (void)length;
+    converter_set_source(ctx, encoding, true);
+    return converter_feed(ctx, data, encoding == ENCODING_UTF8 ? size : size * sizeof(uint16_t)) == CONVERT_OK;
+}
+
+// The UTF-8 pieces were validated when they were loaded, so the walk stops only when the writer has failed
+static enum convert_status feed_document(void* ctx, struct converter* converter) {
+    const struct document* document = ctx;
+    return document_walk_pieces(document, 0, document_length(document), save_piece, converter) ? CONVERT_OK : CONVERT_STOPPED;
+}
+
+bool save_document(const struct document* document, const path_char* path, struct format format) {
+    // The encoding changes with the pieces, the line breaks of the source don't matter to the converter
+    const struct format from = { .encoding = ENCODING_UTF16, .linebreak = LINEBREAK_WIN, .bom = false };
+    return save(path, from, format, feed_document, (void*)document, NULL, NULL, 0, NULL);
+}
+
+// The input of save_converted
+struct input {
+    const void* data;
+    size_t size;
+};
+
+static enum convert_status feed_input(void* ctx, struct converter* converter) {
+    const struct input* input = ctx;
+    return converter_feed(converter, input->data, input->size);
+}
+
+bool save_converted(const void* data, size_t size, struct format from, const path_char* path, struct format format,
+    buffer_release_fn release, void* release_ctx) {
+
+    struct input input = { data, size };
+    return save(path, from, format, feed_input, &input, release, data, size, release_ctx);
+}
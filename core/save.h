@@ -0,0 +1,29 @@
+#pragma once
+// Saving a document to a file without ever having the whole converted text in memory
+//
+// The document is converted a block at a time into one of two buffers, while the other one is being written
+// by a writer thread, so encoding and writing overlap and the memory used doesn't depend on the size of the text.
+// (A text that fits in one buffer is written right away, without starting the thread.)
+// Everything goes to a temporary file next to the target, which replaces the target only once it's complete,
+// so a crash (or a full disk) in the middle of saving leaves the original file as it was.
+
+#include "document.h"
+#include "format.h"
+#include "platform.h"
+
+#include <stdbool.h>
+
+// The size of each of the two buffers, in bytes
+#define SAVE_BUFFER (1024 * 1024)
+
+// Writes the whole document to 'path' in the specified format, a snapshot is fine (and safe to use from any thread)
+// Returns false on failure, GetLastError (or errno) describes the reason, the file at 'path' is not touched then
+bool save_document(const struct document* document, const path_char* path, struct format format);
+
+// Writes the text in 'data' (BOM included, if 'from' has one) to 'path' in the specified format, the same way
+// 'release' (which may be NULL) gets called once the text isn't needed anymore, always before the target gets replaced,
+// so the text may be a mapping of the target itself
+// Returns false on failure, GetLastError (or errno) describes the reason, ERROR_NO_UNICODE_TRANSLATION (or EILSEQ)
+// if the text isn't valid in its encoding
+bool save_converted(const void* data, size_t size, struct format from, const path_char* path, struct format format,
+    buffer_release_fn release, void* release_ctx);
@@ -0,0 +1,51 @@
+#include "simd.h"
+
+#include <stdatomic.h>
+
+#if defined(SIMD_X86) && defined(_MSC_VER) && !defined(__clang__)
+    #include <intrin.h>
+#endif
+
+// -1 until the CPU has been asked
+static atomic_int Detected = -1;
+static atomic_int Limit = SIMD_AVX2;
+
+static enum simd_level detect(void) {
+#ifdef SIMD_X86
+    // SSE2 is a part of x86-64, only AVX2 has to be checked (including the OS support for the wide registers)
+    #if defined(_MSC_VER) && !defined(__clang__)
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7)
+            return SIMD_SSE2;
+
+        __cpuid(info, 1);
+        const int osxsave = info[2] & (1 << 27), avx = info[2] & (1 << 28);
+        if (!osxsave || !avx || (_xgetbv(0) & 6) != 6)
+            return SIMD_SSE2;
+
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) ? SIMD_AVX2 : SIMD_SSE2;
+    #else
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") ? SIMD_AVX2 : SIMD_SSE2;
+    #endif
+#else
+    return SIMD_NONE;
+#endif
+}
+
+enum simd_level simd_level(void) {
+    int level = atomic_load_explicit(&Detected, memory_order_relaxed);
+    if (level < 0) {
+        level = detect();
+        atomic_store_explicit(&Detected, level, memory_order_relaxed);
+    }
+
+    const int limit = atomic_load_explicit(&Limit, memory_order_relaxed);
+    return level < limit ? level : limit;
+}
+
+void simd_limit(enum simd_level level) {
+    atomic_store_explicit(&Limit, level, memory_order_relaxed);
+}
@@ -0,0 +1,52 @@
+#pragma once
+// Runtime selection of the vector instruction set
+// The hot loops of the core have an SSE2 and an AVX2 version next to the plain C one, the best one the CPU
+// supports is picked at runtime, so a single executable runs everywhere. Only x86-64 is vectorized, other
+// architectures always use the plain C versions.
+
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(_M_X64)
+    #define SIMD_X86 1
+    #include <immintrin.h>
+#endif
+
+// Functions using AVX2 have to be marked for GCC and Clang, MSVC allows the intrinsics anywhere
+#if defined(__GNUC__) || defined(__clang__)
+    #define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+    #define TARGET_AVX2
+#endif
+
+// The instruction sets, ordered from the worst to the best
+enum simd_level {
+    SIMD_NONE,
+    SIMD_SSE2,
+    SIMD_AVX2
+};
+
+// Returns the best instruction set that can be used (detected on the first call)
+enum simd_level simd_level(void);
+
+// Limits the instruction set the core uses, mainly for benchmarks comparing the versions against each other
+void simd_limit(enum simd_level level);
+
+// Returns the index of the lowest set bit, 'mask' must not be zero
+static inline unsigned simd_ctz(uint32_t mask) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+// Returns the number of set bits
+static inline unsigned simd_popcount(uint32_t mask) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    return __popcnt(mask);
+#else
+    return __builtin_popcount(mask);
+#endif
+}
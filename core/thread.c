@@ -0,0 +1,172 @@
+#ifndef _WIN32
+    #define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "thread.h"
+#include "memory.h"
+#include "trace.h"
+
+#ifdef _WIN32
+
+#include <windows.h>
+
+struct thread {
+    HANDLE handle;
+    thread_fn fn;
+    void* ctx;
+};
+
+struct mutex { SRWLOCK lock; };
+struct condition { CONDITION_VARIABLE variable; };
+
+static DWORD WINAPI thread_main(LPVOID param) {
+    struct thread* thread = param;
+    thread->fn(thread->ctx);
+    trace_thread_exit();
+    return 0;
+}
+
+struct thread* thread_start(thread_fn fn, void* ctx) {
+    struct thread* thread = mem_alloc(sizeof(*thread));
+    thread->fn = fn;
+    thread->ctx = ctx;
+
+    if (!(thread->handle = CreateThread(NULL, 0, thread_main, thread, 0, NULL))) {
+        mem_free(thread);
+        return NULL;
+    }
+
+    return thread;
+}
+
+void thread_join(struct thread* thread) {
+    WaitForSingleObject(thread->handle, INFINITE);
+    CloseHandle(thread->handle);
+    mem_free(thread);
+}
+
+size_t thread_count(void) {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors ? info.dwNumberOfProcessors : 1;
+}
+
+struct mutex* mutex_create(void) {
+    struct mutex* mutex = mem_alloc(sizeof(*mutex));
+    InitializeSRWLock(&mutex->lock);
+    return mutex;
+}
+
+void mutex_free(struct mutex* mutex) {
+    mem_free(mutex);
+}
+
+void mutex_lock(struct mutex* mutex) {
+    AcquireSRWLockExclusive(&mutex->lock);
+}
+
+void mutex_unlock(struct mutex* mutex) {
+    ReleaseSRWLockExclusive(&mutex->lock);
+}
+
+struct condition* condition_create(void) {
+    struct condition* condition = mem_alloc(sizeof(*condition));
+    InitializeConditionVariable(&condition->variable);
+    return condition;
+}
+
+void condition_free(struct condition* condition) {
+    mem_free(condition);
+}
+
+void condition_wait(struct condition* condition, struct mutex* mutex) {
+    SleepConditionVariableSRW(&condition->variable, &mutex->lock, INFINITE, 0);
+}
+
+void condition_broadcast(struct condition* condition) {
+    WakeAllConditionVariable(&condition->variable);
+}
+
+#else
+
+#include <pthread.h>
+#include <unistd.h>
+
+struct thread {
+    pthread_t handle;
+    thread_fn fn;
+    void* ctx;
+};
+
+struct mutex { pthread_mutex_t lock; };
+struct condition { pthread_cond_t variable; };
+
+static void* thread_main(void* param) {
+    struct thread* thread = param;
+    thread->fn(thread->ctx);
+    trace_thread_exit();
+    return NULL;
+}
+
+struct thread* thread_start(thread_fn fn, void* ctx) {
+    struct thread* thread = mem_alloc(sizeof(*thread));
+    thread->fn = fn;
+    thread->ctx = ctx;
+
+    if (pthread_create(&thread->handle, NULL, thread_main, thread)) {
+        mem_free(thread);
+        return NULL;
+    }
+
+    return thread;
+}
+
+void thread_join(struct thread* thread) {
+    pthread_join(thread->handle, NULL);
+    mem_free(thread);
+}
+
+size_t thread_count(void) {
+    const long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (size_t)count : 1;
+}
+
+struct mutex* mutex_create(void) {
+    struct mutex* mutex = mem_alloc(sizeof(*mutex));
+    pthread_mutex_init(&mutex->lock, NULL);
+    return mutex;
+}
+
+void mutex_free(struct mutex* mutex) {
+    pthread_mutex_destroy(&mutex->lock);
+    mem_free(mutex);
+}
+
+void mutex_lock(struct mutex* mutex) {
+    pthread_mutex_lock(&mutex->lock);
+}
+
+void mutex_unlock(struct mutex* mutex) {
+    pthread_mutex_unlock(&mutex->lock);
+}
+
+struct condition* condition_create(void) {
+    struct condition* condition = mem_alloc(sizeof(*condition));
+    pthread_cond_init(&condition->variable, NULL);
+    return condition;
+}
+
+void condition_free(struct condition* condition) {
+    pthread_cond_destroy(&condition->variable);
+    mem_free(condition);
+}
+
+void condition_wait(struct condition* condition, struct mutex* mutex) {
+    pthread_cond_wait(&condition->variable, &mutex->lock);
+}
+
+void condition_broadcast(struct condition* condition) {
+    pthread_cond_broadcast(&condition->variable);
+}
+
+#endif
@@ -0,0 +1,30 @@
+#pragma once
+// Threads and the bare minimum to synchronize them
+// All of the objects are allocated (with mem_alloc) so that the platform headers stay out of the core headers
+
+#include <stddef.h>
+#include <stdbool.h>
+
+struct thread;
+struct mutex;
+struct condition;
+
+typedef void (*thread_fn)(void* ctx);
+
+// Runs 'fn' on a new thread, returns NULL if the thread couldn't be created
+struct thread* thread_start(thread_fn fn, void* ctx);
+// Waits for the thread to finish and frees it
+void thread_join(struct thread* thread);
+// Returns the number of processors the threads can run on
+size_t thread_count(void);
+
+struct mutex* mutex_create(void);
+void mutex_free(struct mutex* mutex);
+void mutex_lock(struct mutex* mutex);
+void mutex_unlock(struct mutex* mutex);
+
+struct condition* condition_create(void);
+void condition_free(struct condition* condition);
+// Unlocks the mutex while waiting, it may also wake up for no reason, so the waited for state has to be checked in a loop
+void condition_wait(struct condition* condition, struct mutex* mutex);
+void condition_broadcast(struct condition* condition);
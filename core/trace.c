@@ -0,0 +1,161 @@
+#ifndef _WIN32
+    #define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "trace.h"
+#include "memory.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <time.h>
+#endif
+
+struct span {
+    const char* name;
+    uint64_t start, end;
+    uint32_t thread;
+};
+
+struct ring {
+    // The next one of all of the rings ever made
+    struct ring* next;
+    // Whether a thread records into this ring right now
+    atomic_bool taken;
+    // The number of spans recorded so far, the last TRACE_RING of them are kept
+    atomic_size_t count;
+    struct span spans[TRACE_RING];
+};
+
+static atomic_bool Enabled = false;
+static _Atomic(struct ring*) Rings = NULL;
+static atomic_uint_fast32_t Threads = 0;
+// When tracing was first turned on, the export starts at it
+static _Atomic uint64_t Origin = 0;
+
+static _Thread_local struct ring* Ring = NULL;
+static _Thread_local uint32_t Thread = 0;
+
+uint64_t trace_now(void) {
+#ifdef _WIN32
+    static LARGE_INTEGER frequency;
+    if (!frequency.QuadPart)
+        QueryPerformanceFrequency(&frequency);
+
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    const uint64_t f = (uint64_t)frequency.QuadPart, c = (uint64_t)counter.QuadPart;
+    return c / f * 1000000000 + c % f * 1000000000 / f;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+void trace_enable(bool enabled) {
+    uint64_t unset = 0;
+    if (enabled)
+        atomic_compare_exchange_strong(&Origin, &unset, trace_now());
+    atomic_store_explicit(&Enabled, enabled, memory_order_relaxed);
+}
+
+bool trace_enabled(void) {
+    return atomic_load_explicit(&Enabled, memory_order_relaxed);
+}
+
+uint64_t trace_begin(void) {
+    return atomic_load_explicit(&Enabled, memory_order_relaxed) ? trace_now() : 0;
+}
+
+// Takes a ring no thread is using, or makes a new one
+static struct ring* claim(void) {
+    for (struct ring* ring = atomic_load_explicit(&Rings, memory_order_acquire); ring; ring = ring->next) {
+        bool taken = false;
+        if (!atomic_load_explicit(&ring->taken, memory_order_relaxed) &&
+            atomic_compare_exchange_strong_explicit(&ring->taken, &taken, true, memory_order_acquire, memory_order_relaxed))
+            return ring;
+    }
+
+    struct ring* ring = mem_alloc(sizeof(*ring));
+    atomic_init(&ring->taken, true);
+    atomic_init(&ring->count, 0);
+    ring->next = atomic_load_explicit(&Rings, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&Rings, &ring->next, ring, memory_order_release, memory_order_relaxed));
+    return ring;
+}
+
+uint64_t trace_end(uint64_t start, const char* name) {
+    if (!start)
+        return 0;
+
+    const uint64_t end = trace_now();
+    if (!Ring) {
+        Ring = claim();
+        Thread = (uint32_t)atomic_fetch_add_explicit(&Threads, 1, memory_order_relaxed) + 1;
+    }
+
+    // Only this thread ever writes to the ring, the count tells the exporter how far the spans are complete
+    const size_t count = atomic_load_explicit(&Ring->count, memory_order_relaxed);
+    Ring->spans[count % TRACE_RING] = (struct span){ name, start, end, Thread };
+    atomic_store_explicit(&Ring->count, count + 1, memory_order_release);
+    return end - start;
+}
+
+void trace_thread_exit(void) {
+    if (!Ring)
+        return;
+
+    atomic_store_explicit(&Ring->taken, false, memory_order_release);
+    Ring = NULL;
+}
+
+// Writes a string as a JSON one, the names are meant to be plain ASCII, but quotes and control characters are escaped
+static void write_string(FILE* f, const char* text) {
+    fputc('"', f);
+    for (; *text; text++) {
+        if (*text == '"' || *text == '\\')
+            fprintf(f, "\\%c", *text);
+        else if ((unsigned char)*text < 0x20)
+            fprintf(f, "\\u%04x", *text);
+        else
+            fputc(*text, f);
+    }
+    fputc('"', f);
+}
+
+bool trace_export(const path_char* path) {
+#ifdef _WIN32
+    FILE* f = _wfopen(path, L"wb");
+#else
+    FILE* f = fopen(path, "wb");
+#endif
+    if (!f)
+        return false;
+
+    const uint64_t origin = atomic_load_explicit(&Origin, memory_order_relaxed);
+    bool first = true;
+    fputs("{\"traceEvents\":[\n", f);
+
+    for (struct ring* ring = atomic_load_explicit(&Rings, memory_order_acquire); ring; ring = ring->next) {
+        const size_t count = atomic_load_explicit(&ring->count, memory_order_acquire);
+        for (size_t i = count > TRACE_RING ? count - TRACE_RING : 0; i < count; i++) {
+            const struct span* span = &ring->spans[i % TRACE_RING];
+            // The times are in microseconds since tracing was first turned on
+            const uint64_t start = span->start > origin ? span->start - origin : 0;
+            fputs(first ? "" : ",\n", f);
+            fputs("{\"name\":", f);
+            write_string(f, span->name);
+            fprintf(f, ",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}", (unsigned)span->thread,
+                start / 1e3, (span->end - span->start) / 1e3);
+            first = false;
+        }
+    }
+
+    fputs("\n],\"displayTimeUnit\":\"ms\"}\n", f);
+    const bool success = !ferror(f);
+    return !fclose(f) && success;
+}
@@ -0,0 +1,38 @@
+#pragma once
+// Lightweight tracing of where the time goes, e.g. when opening a file seems to hang
+//
+// A span is a named interval on one thread. Every thread records its spans into a ring of its own, so recording never
+// takes a lock, only the first span of a thread allocates (and the threads started by thread_start hand their rings
+// over to the ones after them). Once a ring is full, its oldest spans get overwritten. Tracing is off until
+// trace_enable, until then a span costs a check of a flag. The spans can be exported as Chrome trace events,
+// which chrome://tracing and https://ui.perfetto.dev open.
+
+#include "platform.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// The number of spans every ring keeps
+#define TRACE_RING 16384
+
+// Turns recording on or off, the spans recorded so far are kept
+void trace_enable(bool enabled);
+bool trace_enabled(void);
+
+// Returns a monotonic timestamp in nanoseconds, tracing or not
+uint64_t trace_now(void);
+
+// Returns the start of a span, or 0 if tracing is off
+uint64_t trace_begin(void);
+// Records the span that started at 'start' (nothing if it's 0), returns how long it took in nanoseconds
+// The name isn't copied, so it has to stay valid until the spans are exported, a string literal is the way to go
+uint64_t trace_end(uint64_t start, const char* name);
+
+// Lets the next thread have the ring of the current one, the spans in it are kept
+// The threads started by thread_start call this when they finish
+void trace_thread_exit(void);
+
+// Writes all of the spans kept in the rings to 'path' as Chrome trace event JSON
+// Meant for when the other threads are done recording, a span recorded while exporting may come out garbled
+// Returns false on failure, GetLastError (or errno) describes the reason
+bool trace_export(const path_char* path);
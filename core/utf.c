@@ -0,0 +1,555 @@
+#include "utf.h"
+#include "simd.h"
+
+#include <string.h>
+
+// Decodes a single character that doesn't start with an ASCII byte
+// Returns the length of the sequence, or 0 if it is invalid (overlong, a surrogate, out of range or cut off)
+static size_t decode_sequence(const uint8_t* src, const uint8_t* end, uint32_t* cp) {
+    const uint8_t lead = src[0];
+    const size_t available = end - src;
+
+    if (lead >= 0xC2 && lead <= 0xDF) {
+        if (available < 2 || (src[1] & 0xC0) != 0x80)
+            return 0;
+        *cp = ((uint32_t)(lead & 0x1F) << 6) | (src[1] & 0x3F);
+        return 2;
+    }
+
+    if (lead >= 0xE0 && lead <= 0xEF) {
+        if (available < 3 || (src[1] & 0xC0) != 0x80 || (src[2] & 0xC0) != 0x80)
+            return 0;
+        // Overlong forms and UTF-16 surrogates are not allowed
+        if ((lead == 0xE0 && src[1] < 0xA0) || (lead == 0xED && src[1] > 0x9F))
+            return 0;
+        *cp = ((uint32_t)(lead & 0x0F) << 12) | ((uint32_t)(src[1] & 0x3F) << 6) | (src[2] & 0x3F);
+        return 3;
+    }
+
+    if (lead >= 0xF0 && lead <= 0xF4) {
+        if (available < 4 || (src[1] & 0xC0) != 0x80 || (src[2] & 0xC0) != 0x80 || (src[3] & 0xC0) != 0x80)
+            return 0;
+        // Overlong forms and characters above U+10FFFF are not allowed
+        if ((lead == 0xF0 && src[1] < 0x90) || (lead == 0xF4 && src[1] > 0x8F))
+            return 0;
+        *cp = ((uint32_t)(lead & 0x07) << 18) | ((uint32_t)(src[1] & 0x3F) << 12) | ((uint32_t)(src[2] & 0x3F) << 6) | (src[3] & 0x3F);
+        return 4;
+    }
+
+    return 0;
+}
+
+// Decodes a single character that doesn't start with an ASCII byte into 'dst'
+// Returns the length of the sequence (0 if invalid) and sets '*written' to the number of code units written
+static inline size_t decode_char(const uint8_t* src, const uint8_t* end, uint16_t* dst, size_t* written) {
+    uint32_t cp;
+    const size_t length = decode_sequence(src, end, &cp);
+
+    // An invalid sequence leaves 'cp' unset, nothing gets written
+    if (!length) {
+        *written = 0;
+        return 0;
+    }
+
+    if (cp >= 0x10000) {
+        cp -= 0x10000;
+        dst[0] = 0xD800 | (cp >> 10);
+        dst[1] = 0xDC00 | (cp & 0x3FF);
+        *written = 2;
+    } else {
+        dst[0] = cp;
+        *written = 1;
+    }
+
+    return length;
+}
+
+// The plain C conversion, the vectorized versions use it for the remainder of the input
+// 's' and 'd' are the current positions in 'src' and 'dst'
+static size_t to_utf16_scalar(const uint8_t* src, const uint8_t* s, const uint8_t* end, uint16_t* dst, uint16_t* d, size_t* error) {
+    while (s < end) {
+        if (*s < 0x80) {
+            *d++ = *s++;
+            continue;
+        }
+
+        size_t written;
+        const size_t length = decode_char(s, end, d, &written);
+        if (!length) {
+            if (error) *error = s - src;
+            return UTF_INVALID;
+        }
+
+        s += length;
+        d += written;
+    }
+
+    return d - dst;
+}
+
+// Counts the code units from 's' on, see to_utf16_scalar
+static size_t length_utf16_scalar(const uint8_t* src, const uint8_t* s, const uint8_t* end, size_t units, size_t* error) {
+    while (s < end) {
+        if (*s < 0x80) {
+            units++;
+            s++;
+            continue;
+        }
+
+        uint32_t cp;
+        const size_t length = decode_sequence(s, end, &cp);
+        if (!length) {
+            if (error) *error = s - src;
+            return UTF_INVALID;
+        }
+
+        // Four byte sequences are the only ones that need a surrogate pair
+        units += (length == 4) ? 2 : 1;
+        s += length;
+    }
+
+    return units;
+}
+
+#ifdef SIMD_X86
+
+// The vectorized versions process the input in blocks: a block of pure ASCII is widened at once,
+// any other block is widened as well, but from the first non-ASCII byte on, the characters are decoded one by one
+// until the end of the block. Writing the whole widened block is fine even if only a part of it is used,
+// because the output never gets ahead of the input and the output buffer is at least as long as the input.
+
+static size_t to_utf16_sse2(const uint8_t* src, size_t size, uint16_t* dst, size_t* error) {
+    const uint8_t* s = src;
+    const uint8_t* end = src + size;
+    uint16_t* d = dst;
+    const __m128i zero = _mm_setzero_si128();
+
+    while (end - s >= 16) {
+        const __m128i block = _mm_loadu_si128((const __m128i*)s);
+        const uint32_t mask = _mm_movemask_epi8(block);
+
+        _mm_storeu_si128((__m128i*)d, _mm_unpacklo_epi8(block, zero));
+        _mm_storeu_si128((__m128i*)(d + 8), _mm_unpackhi_epi8(block, zero));
+
+        if (!mask) {
+            s += 16;
+            d += 16;
+            continue;
+        }
+
+        const uint8_t* block_end = s + 16;
+        const unsigned ascii = simd_ctz(mask);
+        s += ascii;
+        d += ascii;
+
+        while (s < block_end) {
+            if (*s < 0x80) {
+                *d++ = *s++;
+                continue;
+            }
+
+            size_t written;
+            const size_t length = decode_char(s, end, d, &written);
+            if (!length) {
+                if (error) *error = s - src;
+                return UTF_INVALID;
+            }
+
+            s += length;
+            d += written;
+        }
+    }
+
+    return to_utf16_scalar(src, s, end, dst, d, error);
+}
+
+TARGET_AVX2 static size_t to_utf16_avx2(const uint8_t* src, size_t size, uint16_t* dst, size_t* error) {
+    const uint8_t* s = src;
+    const uint8_t* end = src + size;
+    uint16_t* d = dst;
+
+    while (end - s >= 32) {
+        const __m256i block = _mm256_loadu_si256((const __m256i*)s);
+        const uint32_t mask = _mm256_movemask_epi8(block);
+
+        _mm256_storeu_si256((__m256i*)d, _mm256_cvtepu8_epi16(_mm256_castsi256_si128(block)));
+        _mm256_storeu_si256((__m256i*)(d + 16), _mm256_cvtepu8_epi16(_mm256_extracti128_si256(block, 1)));
+
+        if (!mask) {
+            s += 32;
+            d += 32;
+            continue;
+        }
+
+        const uint8_t* block_end = s + 32;
+        const unsigned ascii = simd_ctz(mask);
+        s += ascii;
+        d += ascii;
+
+        while (s < block_end) {
+            if (*s < 0x80) {
+                *d++ = *s++;
+                continue;
+            }
+
+            size_t written;
+            const size_t length = decode_char(s, end, d, &written);
+            if (!length) {
+                if (error) *error = s - src;
+                return UTF_INVALID;
+            }
+
+            s += length;
+            d += written;
+        }
+    }
+
+    return to_utf16_scalar(src, s, end, dst, d, error);
+}
+
+static size_t length_utf16_sse2(const uint8_t* src, size_t size, size_t* error) {
+    const uint8_t* s = src;
+    const uint8_t* end = src + size;
+    size_t units = 0;
+
+    while (end - s >= 16) {
+        const uint32_t mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)s));
+        if (!mask) {
+            s += 16;
+            units += 16;
+            continue;
+        }
+
+        const uint8_t* block_end = s + 16;
+        const unsigned ascii = simd_ctz(mask);
+        s += ascii;
+        units += ascii;
+
+        while (s < block_end) {
+            if (*s < 0x80) {
+                units++;
+                s++;
+                continue;
+            }
+
+            uint32_t cp;
+            const size_t length = decode_sequence(s, end, &cp);
+            if (!length) {
+                if (error) *error = s - src;
+                return UTF_INVALID;
+            }
+
+            units += (length == 4) ? 2 : 1;
+            s += length;
+        }
+    }
+
+    return length_utf16_scalar(src, s, end, units, error);
+}
+
+TARGET_AVX2 static size_t length_utf16_avx2(const uint8_t* src, size_t size, size_t* error) {
+    const uint8_t* s = src;
+    const uint8_t* end = src + size;
+    size_t units = 0;
+
+    while (end - s >= 32) {
+        const uint32_t mask = _mm256_movemask_epi8(_mm256_loadu_si256((const __m256i*)s));
+        if (!mask) {
+            s += 32;
+            units += 32;
+            continue;
+        }
+
+        const uint8_t* block_end = s + 32;
+        const unsigned ascii = simd_ctz(mask);
+        s += ascii;
+        units += ascii;
+
+        while (s < block_end) {
+            if (*s < 0x80) {
+                units++;
+                s++;
+                continue;
+            }
+
+            uint32_t cp;
+            const size_t length = decode_sequence(s, end, &cp);
+            if (!length) {
+                if (error) *error = s - src;
+                return UTF_INVALID;
+            }
+
+            units += (length == 4) ? 2 : 1;
+            s += length;
+        }
+    }
+
+    return length_utf16_scalar(src, s, end, units, error);
+}
+
+#endif
+
+size_t utf8_to_utf16(const uint8_t* src, size_t size, uint16_t* dst, size_t* error) {
+    switch (simd_level()) {
+#ifdef SIMD_X86
+        case SIMD_AVX2: return to_utf16_avx2(src, size, dst, error);
+        case SIMD_SSE2: return to_utf16_sse2(src, size, dst, error);
+#endif
+        default: return to_utf16_scalar(src, src, src + size, dst, dst, error);
+    }
+}
+
+size_t utf8_length_utf16(const uint8_t* src, size_t size, size_t* error) {
+    switch (simd_level()) {
+#ifdef SIMD_X86
+        case SIMD_AVX2: return length_utf16_avx2(src, size, error);
+        case SIMD_SSE2: return length_utf16_sse2(src, size, error);
+#endif
+        default: return length_utf16_scalar(src, src, src + size, 0, error);
+    }
+}
+
+size_t utf8_to_utf16_lossy(const uint8_t* src, size_t size, uint16_t* dst) {
+    size_t written = 0, error;
+    for (;;) {
+        const size_t length = utf8_to_utf16(src, size, dst + written, &error);
+        if (length != UTF_INVALID)
+            return written + length;
+
+        // Whatever got written after the invalid byte is overwritten, the text before it is converted again
+        written += utf8_to_utf16(src, error, dst + written, NULL);
+        dst[written++] = 0xFFFD;
+        src += error + 1;
+        size -= error + 1;
+    }
+}
+
+size_t utf8_length_utf16_lossy(const uint8_t* src, size_t size) {
+    size_t units = 0, error;
+    for (;;) {
+        const size_t length = utf8_length_utf16(src, size, &error);
+        if (length != UTF_INVALID)
+            return units + length;
+
+        units += utf8_length_utf16(src, error, NULL) + 1;
+        src += error + 1;
+        size -= error + 1;
+    }
+}
+
+size_t utf8_offset_of(const uint8_t* src, size_t size, size_t units, bool* inside_pair) {
+    size_t offset = 0;
+    *inside_pair = false;
+
+    while (units && offset < size) {
+        // Runs of ASCII are skipped eight bytes at a time, one byte is one code unit there
+        uint64_t block;
+        if (units >= 8 && size - offset >= 8 && (memcpy(&block, src + offset, 8), !(block & 0x8080808080808080ull))) {
+            units -= 8;
+            offset += 8;
+            continue;
+        }
+
+        const uint8_t lead = src[offset];
+        const size_t length = lead < 0x80 ? 1 : lead < 0xE0 ? 2 : lead < 0xF0 ? 3 : 4;
+        const size_t width = length == 4 ? 2 : 1;
+
+        if (units < width) {
+            *inside_pair = true;
+            break;
+        }
+
+        units -= width;
+        offset += length;
+    }
+
+    return offset < size ? offset : size;
+}
+
+size_t utf8_complete(const uint8_t* src, size_t size) {
+    // Find the start of the last character, it is at most three bytes back
+    size_t start = size;
+    while (start > 0 && size - start < 4) {
+        start--;
+        if ((src[start] & 0xC0) != 0x80)
+            break;
+    }
+
+    if (start == size)
+        return size;
+
+    const uint8_t lead = src[start];
+    const size_t length = lead < 0x80 ? 1 : lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : lead >= 0xC0 ? 2 : 1;
+
+    // If the last character is cut off, the prefix ends right before it
+    return (size - start < length) ? start : size;
+}
+
+// Encodes the character starting at 'src' (which is not ASCII), returns the number of bytes written
+// '*consumed' is set to the number of code units used, unpaired surrogates are replaced with U+FFFD
+static inline size_t encode_char(const uint16_t* src, const uint16_t* end, uint8_t* dst, size_t* consumed) {
+    uint32_t cp = src[0];
+    *consumed = 1;
+
+    if (cp < 0x800) {
+        dst[0] = 0xC0 | (cp >> 6);
+        dst[1] = 0x80 | (cp & 0x3F);
+        return 2;
+    }
+
+    if (cp >= 0xD800 && cp <= 0xDFFF) {
+        if (cp <= 0xDBFF && end - src >= 2 && src[1] >= 0xDC00 && src[1] <= 0xDFFF) {
+            cp = 0x10000 + ((cp - 0xD800) << 10) + (src[1] - 0xDC00);
+            dst[0] = 0xF0 | (cp >> 18);
+            dst[1] = 0x80 | ((cp >> 12) & 0x3F);
+            dst[2] = 0x80 | ((cp >> 6) & 0x3F);
+            dst[3] = 0x80 | (cp & 0x3F);
+            *consumed = 2;
+            return 4;
+        }
+
+        cp = 0xFFFD;
+    }
+
+    dst[0] = 0xE0 | (cp >> 12);
+    dst[1] = 0x80 | ((cp >> 6) & 0x3F);
+    dst[2] = 0x80 | (cp & 0x3F);
+    return 3;
+}
+
+static size_t to_utf8_scalar(const uint16_t* s, const uint16_t* end, uint8_t* dst, uint8_t* d) {
+    while (s < end) {
+        if (*s < 0x80) {
+            *d++ = (uint8_t)*s++;
+            continue;
+        }
+
+        size_t consumed;
+        d += encode_char(s, end, d, &consumed);
+        s += consumed;
+    }
+
+    return d - dst;
+}
+
+#ifdef SIMD_X86
+
+// Same idea as with decoding: ASCII blocks are narrowed at once, the rest of a mixed block is encoded one by one
+// The narrowed block may be written even if it isn't used, the output is at least three times the input
+
+static size_t to_utf8_sse2(const uint16_t* src, size_t length, uint8_t* dst) {
+    const uint16_t* s = src;
+    const uint16_t* end = src + length;
+    uint8_t* d = dst;
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i high = _mm_set1_epi16((short)0xFF80);
+
+    while (end - s >= 16) {
+        const __m128i a = _mm_loadu_si128((const __m128i*)s);
+        const __m128i b = _mm_loadu_si128((const __m128i*)(s + 8));
+        const __m128i ascii = _mm_packs_epi16(
+            _mm_cmpeq_epi16(_mm_and_si128(a, high), zero),
+            _mm_cmpeq_epi16(_mm_and_si128(b, high), zero));
+        const uint32_t mask = ~(uint32_t)_mm_movemask_epi8(ascii) & 0xFFFF;
+
+        _mm_storeu_si128((__m128i*)d, _mm_packus_epi16(a, b));
+
+        if (!mask) {
+            s += 16;
+            d += 16;
+            continue;
+        }
+
+        const uint16_t* block_end = s + 16;
+        const unsigned prefix = simd_ctz(mask);
+        s += prefix;
+        d += prefix;
+
+        while (s < block_end) {
+            if (*s < 0x80) {
+                *d++ = (uint8_t)*s++;
+                continue;
+            }
+
+            size_t consumed;
+            d += encode_char(s, end, d, &consumed);
+            s += consumed;
+        }
+    }
+
+    return to_utf8_scalar(s, end, dst, d);
+}
+
+TARGET_AVX2 static size_t to_utf8_avx2(const uint16_t* src, size_t length, uint8_t* dst) {
+    const uint16_t* s = src;
+    const uint16_t* end = src + length;
+    uint8_t* d = dst;
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i high = _mm256_set1_epi16((short)0xFF80);
+
+    while (end - s >= 32) {
+        const __m256i a = _mm256_loadu_si256((const __m256i*)s);
+        const __m256i b = _mm256_loadu_si256((const __m256i*)(s + 16));
+        // Packing works within the 128-bit lanes, the permutation puts the quarters back in order
+        const __m256i ascii = _mm256_permute4x64_epi64(_mm256_packs_epi16(
+            _mm256_cmpeq_epi16(_mm256_and_si256(a, high), zero),
+            _mm256_cmpeq_epi16(_mm256_and_si256(b, high), zero)), 0xD8);
+        const uint32_t mask = ~(uint32_t)_mm256_movemask_epi8(ascii);
+
+        _mm256_storeu_si256((__m256i*)d, _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8));
+
+        if (!mask) {
+            s += 32;
+            d += 32;
+            continue;
+        }
+
+        const uint16_t* block_end = s + 32;
+        const unsigned prefix = simd_ctz(mask);
+        s += prefix;
+        d += prefix;
+
+        while (s < block_end) {
+            if (*s < 0x80) {
+                *d++ = (uint8_t)*s++;
+                continue;
+            }
+
+            size_t consumed;
+            d += encode_char(s, end, d, &consumed);
+            s += consumed;
+        }
+    }
+
+    return to_utf8_scalar(s, end, dst, d);
+}
+
+#endif
+
+size_t utf16_to_utf8(const uint16_t* src, size_t length, uint8_t* dst) {
+    switch (simd_level()) {
+#ifdef SIMD_X86
+        case SIMD_AVX2: return to_utf8_avx2(src, length, dst);
+        case SIMD_SSE2: return to_utf8_sse2(src, length, dst);
+#endif
+        default: return to_utf8_scalar(src, src + length, dst, dst);
+    }
+}
+
+size_t utf16_length_utf8(const uint16_t* src, size_t length) {
+    size_t size = 0;
+    for (size_t i = 0; i < length; i++) {
+        const uint16_t c = src[i];
+        if (c < 0x80)
+            size += 1;
+        else if (c < 0x800)
+            size += 2;
+        else if (c <= 0xDBFF && c >= 0xD800 && i + 1 < length && src[i+1] >= 0xDC00 && src[i+1] <= 0xDFFF) {
+            size += 4;
+            i++;
+        } else
+            size += 3;
+    }
+
+    return size;
+}
@@ -0,0 +1,40 @@
+#pragma once
+// Conversions between UTF-8 and UTF-16
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Returned instead of a length when the input is not valid
+#define UTF_INVALID SIZE_MAX
+
+// Converts UTF-8 to UTF-16, validating it along the way
+// 'dst' must have room for at least 'size' code units, which is the worst case
+// Returns the number of code units written, or UTF_INVALID if the input isn't valid UTF-8, in which case
+// '*error' (if not NULL) is set to the offset of the first invalid byte
+size_t utf8_to_utf16(const uint8_t* src, size_t size, uint16_t* dst, size_t* error);
+
+// Counts the UTF-16 code units the UTF-8 input decodes to, validating it the same way utf8_to_utf16 does
+size_t utf8_length_utf16(const uint8_t* src, size_t size, size_t* error);
+
+// The same as utf8_to_utf16 and utf8_length_utf16, but every invalid byte becomes a U+FFFD, so they never fail
+// For text that was valid once but may not be anymore, like a file indexed by earlier checkpoints (see checkpoint.h)
+size_t utf8_to_utf16_lossy(const uint8_t* src, size_t size, uint16_t* dst);
+size_t utf8_length_utf16_lossy(const uint8_t* src, size_t size);
+
+// Returns the byte offset of the 'units'-th UTF-16 code unit of valid UTF-8 input
+// If the offset falls in the middle of a surrogate pair, the offset of the character the pair comes from
+// is returned and '*inside_pair' is set to true (false otherwise)
+size_t utf8_offset_of(const uint8_t* src, size_t size, size_t units, bool* inside_pair);
+
+// Returns the length of the longest prefix that doesn't end in the middle of a character,
+// this is where a big input can be cut into pieces that can be converted separately
+size_t utf8_complete(const uint8_t* src, size_t size);
+
+// Converts UTF-16 to UTF-8, unpaired surrogates (including a high surrogate at the very end) become U+FFFD
+// 'dst' must have room for at least 3 * 'length' bytes, which is the worst case
+// Returns the number of bytes written
+size_t utf16_to_utf8(const uint16_t* src, size_t length, uint8_t* dst);
+
+// Returns the number of bytes utf16_to_utf8 would write
+size_t utf16_length_utf8(const uint16_t* src, size_t length);
@@ -0,0 +1,1076 @@
+#include "view.h"
+#include "journal.h"
+#include "memory.h"
+#include "wrap.h"
+
+#include <stdint.h>
+#include <string.h>
+
+// The number of code units read and measured at once
+#define VIEW_BLOCK 256
+// How far apart the x checkpoints of a long line are, in code units
+#define VIEW_X_STEP 4096
+
+// A row on the screen, a line has more than one only when it's wrapped
+// A wrapped line is wrapped in chunks (see wrap.h), a row is the row of a chunk, which is always 0 without wrapping
+struct row {
+    size_t line, chunk, row;
+};
+
+struct view {
+    struct document* document;
+    struct view_metrics metrics;
+    int width, height;
+    int tab_width, space_width;
+
+    // The first visible row, the horizontal scroll offset and the widest line seen so far
+    struct row top;
+    int scroll_x;
+    int text_width;
+
+    // The rows of the lines around the visible ones when wrapping, and room for the breaks of a chunk being wrapped
+    bool wrap;
+    struct wrap_cache* wraps;
+    size_t* breaks;
+    size_t breaks_capacity;
+
+    // Where the edits get recorded for undoing them, NULL if nowhere
+    struct journal* journal;
+
+    // The selection goes from the anchor to the caret, nothing is selected if they are the same
+    size_t caret, anchor;
+    // Where the caret wants to be when moving up and down, so that it doesn't drift on short lines, -1 if nowhere
+    int preferred_x;
+
+    // The x of every VIEW_X_STEP code units of the last long line (or row) the caret was measured on, so that the
+    // caret at the end of a huge line doesn't get measured all the way from its start on every key, SIZE_MAX if none
+    size_t xs_start;
+    int* xs;
+    size_t xs_count, xs_capacity;
+
+    // A block of text being measured and the extents of its code units
+    uint16_t text[VIEW_BLOCK];
+    int extents[VIEW_BLOCK];
+};
+
+static bool is_high_surrogate(uint16_t c) { return c >= 0xD800 && c <= 0xDBFF; }
+static bool is_low_surrogate(uint16_t c) { return c >= 0xDC00 && c <= 0xDFFF; }
+
+// The characters that separate words, for moving (and erasing) by words
+static bool is_space(uint16_t c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == 0x00A0 || c == 0x3000;
+}
+
+// Returns the code unit at 'pos', or 0 if there is none
+static uint16_t char_at(const struct view* view, size_t pos) {
+    uint16_t c = 0;
+    document_read(view->document, pos, &c, 1);
+    return c;
+}
+
+static size_t line_count(const struct view* view) {
+    return document_line_count(view->document);
+}
+
+// Gets the range of a line without its line break
+static void line_bounds(const struct view* view, size_t line, size_t* start, size_t* end) {
+    *start = document_line_start(view->document, line);
+    *end = line + 1 < line_count(view) ? document_line_start(view->document, line + 1) : document_length(view->document);
+
+    if (*end > *start && char_at(view, *end - 1) == '\n')
+        (*end)--;
+    if (*end > *start && char_at(view, *end - 1) == '\r')
+        (*end)--;
+}
+
+// Moves a position out of the middle of a CRLF or a surrogate pair
+static size_t clamp_position(const struct view* view, size_t pos) {
+    const size_t length = document_length(view->document);
+    if (pos >= length)
+        return length;
+    if (!pos)
+        return 0;
+
+    const uint16_t before = char_at(view, pos - 1), after = char_at(view, pos);
+    if ((before == '\r' && after == '\n') || (is_high_surrogate(before) && is_low_surrogate(after)))
+        return pos - 1;
+    return pos;
+}
+
+static size_t next_position(const struct view* view, size_t pos) {
+    const size_t length = document_length(view->document);
+    if (pos >= length)
+        return length;
+
+    const uint16_t c = char_at(view, pos), next = pos + 1 < length ? char_at(view, pos + 1) : 0;
+    if ((c == '\r' && next == '\n') || (is_high_surrogate(c) && is_low_surrogate(next)))
+        return pos + 2;
+    return pos + 1;
+}
+
+static size_t previous_position(const struct view* view, size_t pos) {
+    if (!pos)
+        return 0;
+
+    const uint16_t c = char_at(view, pos - 1), before = pos >= 2 ? char_at(view, pos - 2) : 0;
+    if ((c == '\n' && before == '\r') || (is_low_surrogate(c) && is_high_surrogate(before)))
+        return pos - 2;
+    return pos - 1;
+}
+
+// Measures a block of text starting at 'x', tabs go to the next tab stop
+// Returns the x where the block ends
+static int measure(struct view* view, size_t length, int x) {
+    size_t i = 0;
+    while (i < length) {
+        if (view->text[i] == '\t') {
+            x = (x / view->tab_width + 1) * view->tab_width;
+            view->extents[i++] = x;
+            continue;
+        }
+
+        size_t end = i;
+        while (end < length && view->text[end] != '\t')
+            end++;
+
+        view->metrics.extents(view->metrics.ctx, view->text + i, end - i, view->extents + i);
+        for (size_t j = i; j < end; j++)
+            view->extents[j] += x;
+        x = view->extents[end - 1];
+        i = end;
+    }
+
+    return x;
+}
+
+// Reads the next block of a line into the view's buffer, never cutting a surrogate pair in half
+// Returns the number of code units read
+static size_t read_block(struct view* view, size_t pos, size_t end) {
+    size_t length = end - pos < VIEW_BLOCK ? end - pos : VIEW_BLOCK;
+    length = document_read(view->document, pos, view->text, length);
+    if (length > 1 && pos + length < end && is_high_surrogate(view->text[length - 1]))
+        length--;
+    return length;
+}
+
+// Measures the text from 'start' to 'end', returns the x where it ends
+static int measure_range(struct view* view, size_t start, size_t end, int x) {
+    while (start < end) {
+        const size_t length = read_block(view, start, end);
+        x = measure(view, length, x);
+        start += length;
+    }
+    return x;
+}
+
+// Returns where the x checkpoint 'i' of a line that starts at 'start' is, never inside of a surrogate pair
+static size_t x_checkpoint(const struct view* view, size_t start, size_t i) {
+    return clamp_position(view, start + (i + 1) * VIEW_X_STEP);
+}
+
+// Drops the x checkpoints, when the text before them or the way it's measured has changed
+static void drop_xs(struct view* view) {
+    view->xs_start = SIZE_MAX;
+    view->xs_count = 0;
+}
+
+// Returns the x of a position on a line that starts at 'start'
+// Far from the start, the measuring starts at the last checkpoint before the position, the ones missing get made on the way
+static int x_of(struct view* view, size_t start, size_t pos) {
+    const size_t checkpoints = (pos - start) / VIEW_X_STEP;
+    if (!checkpoints)
+        return measure_range(view, start, pos, 0);
+
+    if (view->xs_start != start) {
+        drop_xs(view);
+        view->xs_start = start;
+    }
+
+    size_t known = view->xs_count < checkpoints ? view->xs_count : checkpoints;
+    size_t from = known ? x_checkpoint(view, start, known - 1) : start;
+    int x = known ? view->xs[known - 1] : 0;
+
+    for (; known < checkpoints; known++) {
+        const size_t to = x_checkpoint(view, start, known);
+        x = measure_range(view, from, to, x);
+        from = to;
+
+        if (known >= view->xs_capacity) {
+            view->xs_capacity = view->xs_capacity ? view->xs_capacity * 2 : 64;
+            view->xs = mem_realloc(view->xs, view->xs_capacity * sizeof(int));
+        }
+        view->xs[known] = x;
+        view->xs_count = known + 1;
+    }
+
+    return measure_range(view, from, pos, x);
+}
+
+static size_t page_lines(const struct view* view) {
+    const int lines = view->height / view->metrics.line_height;
+    return lines > 1 ? (size_t)lines : 1;
+}
+
+// The width the lines get wrapped to, a bit of room is left for the caret at the end of a row
+static int wrap_width(const struct view* view) {
+    return view->width > 2 * view->space_width ? view->width - view->space_width : view->space_width;
+}
+
+// Returns where a chunk of a line starts, right after a surrogate pair instead of inside of it
+static size_t chunk_start(const struct view* view, size_t line_start, size_t chunk) {
+    const size_t pos = line_start + chunk * WRAP_CHUNK;
+    return chunk && is_high_surrogate(char_at(view, pos - 1)) && is_low_surrogate(char_at(view, pos)) ? pos + 1 : pos;
+}
+
+// Returns the number of chunks of a line that goes from 'start' to 'end' (without its line break), there is one at least
+static size_t count_chunks(const struct view* view, size_t start, size_t end) {
+    size_t chunks = (end - start + WRAP_CHUNK - 1) / WRAP_CHUNK;
+    if (chunks > 1 && chunk_start(view, start, chunks - 1) >= end)
+        chunks--;
+    return chunks ? chunks : 1;
+}
+
+static size_t chunks_of(const struct view* view, size_t line) {
+    if (!view->wrap)
+        return 1;
+
+    size_t start, end;
+    line_bounds(view, line, &start, &end);
+    return count_chunks(view, start, end);
+}
+
+// Returns the rows of a chunk of a line, wrapping it if it isn't in the cache yet
+// A row breaks after the last space that fits, or wherever it has to if there is none, every row gets some text
+static const struct wrap_entry* wrap_of(struct view* view, size_t line, size_t chunk) {
+    const int width = wrap_width(view);
+    const struct wrap_entry* entry = wrap_find(view->wraps, line, chunk, width);
+    if (entry)
+        return entry;
+
+    size_t line_start, line_end;
+    line_bounds(view, line, &line_start, &line_end);
+    const size_t chunks = count_chunks(view, line_start, line_end);
+    const size_t start = chunk_start(view, line_start, chunk);
+    const size_t end = chunk + 1 < chunks ? chunk_start(view, line_start, chunk + 1) : line_end;
+
+    size_t rows = 1, row = start;
+    for (;;) {
+        // Measure from the start of the row until something doesn't fit
+        size_t pos = row, space = row, wrap = end;
+        int x = 0;
+        while (pos < end && wrap == end) {
+            const size_t length = read_block(view, pos, end);
+            measure(view, length, x);
+
+            for (size_t i = 0; i < length; i++) {
+                if (view->extents[i] > width && pos + i > row) {
+                    wrap = space > row ? space : pos + i;
+                    break;
+                }
+                if (is_space(view->text[i]))
+                    space = pos + i + 1;
+            }
+
+            x = view->extents[length - 1];
+            pos += length;
+        }
+
+        if (wrap == end)
+            break;
+
+        // A surrogate pair stays in one piece, on this row if it's the only thing on it
+        const size_t clamped = clamp_position(view, wrap);
+        if (clamped != wrap)
+            wrap = clamped > row ? clamped : next_position(view, clamped);
+
+        if (rows > view->breaks_capacity) {
+            view->breaks_capacity = view->breaks_capacity ? view->breaks_capacity * 2 : 64;
+            view->breaks = mem_realloc(view->breaks, view->breaks_capacity * sizeof(size_t));
+        }
+        view->breaks[rows - 1] = wrap - start;
+        rows++;
+        row = wrap;
+    }
+
+    return wrap_store(view->wraps, line, chunk, chunks, width, view->breaks, rows);
+}
+
+static size_t rows_of(struct view* view, size_t line, size_t chunk) {
+    return view->wrap ? wrap_of(view, line, chunk)->rows : 1;
+}
+
+// Returns true if a row isn't the last one of its line
+static bool wraps_after(struct view* view, struct row row) {
+    if (!view->wrap)
+        return false;
+
+    const struct wrap_entry* entry = wrap_of(view, row.line, row.chunk);
+    return row.row + 1 < entry->rows || row.chunk + 1 < entry->chunks;
+}
+
+// Gets the range of a row without the line break
+static void row_bounds(struct view* view, struct row row, size_t* start, size_t* end) {
+    line_bounds(view, row.line, start, end);
+    if (!view->wrap)
+        return;
+
+    const struct wrap_entry* entry = wrap_of(view, row.line, row.chunk);
+    const size_t line_start = *start, from = chunk_start(view, line_start, row.chunk);
+    *start = row.row ? from + entry->breaks[row.row - 1] : from;
+    if (row.row + 1 < entry->rows)
+        *end = from + entry->breaks[row.row];
+    else if (row.chunk + 1 < entry->chunks)
+        *end = chunk_start(view, line_start, row.chunk + 1);
+}
+
+// Returns the row of a position, the position where a line wraps belongs to the row after it
+static struct row row_of(struct view* view, size_t pos) {
+    struct row row = { document_line_of(view->document, pos), 0, 0 };
+    if (!view->wrap)
+        return row;
+
+    // Only the chunk of the position gets wrapped
+    size_t line_start, line_end;
+    line_bounds(view, row.line, &line_start, &line_end);
+    const size_t chunks = count_chunks(view, line_start, line_end);
+    row.chunk = (pos - line_start) / WRAP_CHUNK;
+    if (row.chunk && pos < chunk_start(view, line_start, row.chunk))
+        row.chunk--;
+    if (row.chunk >= chunks)
+        row.chunk = chunks - 1;
+
+    const struct wrap_entry* entry = wrap_of(view, row.line, row.chunk);
+    const size_t offset = pos - chunk_start(view, line_start, row.chunk);
+
+    // The number of breaks up to the position
+    size_t low = 0, high = entry->rows - 1;
+    while (low < high) {
+        const size_t middle = low + (high - low) / 2;
+        if (entry->breaks[middle] <= offset)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    row.row = low;
+    return row;
+}
+
+static bool is_before(struct row a, struct row b) {
+    if (a.line != b.line)
+        return a.line < b.line;
+    return a.chunk < b.chunk || (a.chunk == b.chunk && a.row < b.row);
+}
+
+// Moves by a number of rows (up if negative), stopping at the start and the end of the document
+static struct row step(struct view* view, struct row row, ptrdiff_t count) {
+    if (!view->wrap) {
+        const size_t last = line_count(view) - 1;
+        if (count < 0)
+            row.line = (size_t)-count < row.line ? row.line + count : 0;
+        else
+            row.line = last - row.line > (size_t)count ? row.line + count : last;
+        return row;
+    }
+
+    for (; count < 0; count++) {
+        if (row.row) {
+            row.row--;
+        } else if (row.chunk) {
+            row.chunk--;
+            row.row = rows_of(view, row.line, row.chunk) - 1;
+        } else if (row.line) {
+            row.line--;
+            row.chunk = chunks_of(view, row.line) - 1;
+            row.row = rows_of(view, row.line, row.chunk) - 1;
+        } else {
+            break;
+        }
+    }
+
+    for (; count > 0; count--) {
+        const struct wrap_entry* entry = wrap_of(view, row.line, row.chunk);
+        if (row.row + 1 < entry->rows) {
+            row.row++;
+        } else if (row.chunk + 1 < entry->chunks) {
+            row.chunk++;
+            row.row = 0;
+        } else if (row.line + 1 < line_count(view)) {
+            row.line++;
+            row.chunk = row.row = 0;
+        } else {
+            break;
+        }
+    }
+
+    return row;
+}
+
+// Returns how many rows 'to' is below 'from', but at most 'limit' (and 0 if it isn't below at all)
+static size_t distance(struct view* view, struct row from, struct row to, size_t limit) {
+    if (!is_before(from, to))
+        return 0;
+    if (!view->wrap)
+        return to.line - from.line < limit ? to.line - from.line : limit;
+
+    // Chunk by chunk, every one of them has a row at least
+    size_t rows = 0;
+    while (from.line < to.line || from.chunk < to.chunk) {
+        const struct wrap_entry* entry = wrap_of(view, from.line, from.chunk);
+        rows += entry->rows - from.row;
+        if (rows >= limit)
+            return limit;
+        if (from.chunk + 1 < entry->chunks) {
+            from.chunk++;
+        } else {
+            from.line++;
+            from.chunk = 0;
+        }
+        from.row = 0;
+    }
+
+    rows += to.row - from.row;
+    return rows < limit ? rows : limit;
+}
+
+// Returns the position in a row that is the closest to 'x'
+static size_t position_at(struct view* view, struct row row, int x) {
+    size_t start, end;
+    row_bounds(view, row, &start, &end);
+
+    // The end of a wrapped row is where the next one starts, the caret can get only right in front of it
+    const size_t last = wraps_after(view, row) ? previous_position(view, end) : end;
+
+    int left = 0;
+    while (start < end) {
+        const size_t length = read_block(view, start, end);
+        measure(view, length, left);
+
+        for (size_t i = 0; i < length; i++) {
+            const int right = view->extents[i];
+            if (x < right) {
+                const size_t pos = clamp_position(view, x - left < right - x ? start + i : start + i + 1);
+                return pos < last ? pos : last;
+            }
+            left = right;
+        }
+
+        start += length;
+    }
+
+    return last;
+}
+
+// Returns the x of the caret in its row
+static int caret_x(struct view* view, struct row row) {
+    size_t start, end;
+    row_bounds(view, row, &start, &end);
+    return x_of(view, start, view->caret);
+}
+
+// Keeps the top row within the document, an edit or another document may have taken it away
+static void clamp_top(struct view* view) {
+    if (view->top.line >= line_count(view))
+        view->top = (struct row){ line_count(view) - 1, 0, 0 };
+    if (!view->wrap)
+        return;
+
+    // The last row of the line if its chunk is gone
+    const size_t chunks = chunks_of(view, view->top.line);
+    if (view->top.chunk >= chunks)
+        view->top = (struct row){ view->top.line, chunks - 1, SIZE_MAX };
+    if (view->top.row >= rows_of(view, view->top.line, view->top.chunk))
+        view->top.row = rows_of(view, view->top.line, view->top.chunk) - 1;
+}
+
+// Returns where the top row starts in its line, so that the view can stay put when the lines wrap differently
+static size_t top_offset(struct view* view) {
+    size_t start, end;
+    row_bounds(view, view->top, &start, &end);
+    return start - document_line_start(view->document, view->top.line);
+}
+
+static void set_top_offset(struct view* view, size_t offset) {
+    view->top = row_of(view, document_line_start(view->document, view->top.line) + offset);
+}
+
+// Scrolls so that the caret is visible
+static void show_caret(struct view* view) {
+    clamp_top(view);
+
+    const struct row caret = row_of(view, view->caret);
+    const size_t page = page_lines(view);
+
+    if (is_before(caret, view->top))
+        view->top = caret;
+    else if (distance(view, view->top, caret, page) >= page)
+        view->top = step(view, caret, -(ptrdiff_t)(page - 1));
+
+    const int x = caret_x(view, caret);
+    if (x > view->text_width)
+        view->text_width = x;
+
+    // Jumping by a part of the width, so that typing at the edge doesn't scroll on every character
+    if (view->wrap)
+        view->scroll_x = 0;
+    else if (x < view->scroll_x)
+        view->scroll_x = x > view->width / 4 ? x - view->width / 4 : 0;
+    else if (x >= view->scroll_x + view->width - view->space_width)
+        view->scroll_x = x - view->width * 3 / 4;
+}
+
+// Tells the wrap cache about an edit, the line before it goes too, a CR at its end may have become a part of a CRLF
+static void edited(struct view* view, size_t line, size_t removed, size_t added) {
+    if (line)
+        wrap_edited(view->wraps, line - 1, removed + 1, added + 1);
+    else
+        wrap_edited(view->wraps, line, removed, added);
+}
+
+// Moving the caret ends a typing run, the next edit is a new undo step
+static void break_run(struct view* view) {
+    if (view->journal)
+        journal_break(view->journal);
+}
+
+// Returns where the caret would end up after a move (without the selection being taken into account)
+static size_t target_of(struct view* view, enum view_move move) {
+    const size_t length = document_length(view->document);
+    size_t pos = view->caret;
+
+    switch (move) {
+        case VIEW_LEFT:
+            return previous_position(view, pos);
+        case VIEW_RIGHT:
+            return next_position(view, pos);
+        case VIEW_WORD_LEFT:
+            while (pos > 0 && is_space(char_at(view, pos - 1))) pos--;
+            while (pos > 0 && !is_space(char_at(view, pos - 1))) pos--;
+            return clamp_position(view, pos);
+        case VIEW_WORD_RIGHT:
+            while (pos < length && !is_space(char_at(view, pos))) pos++;
+            while (pos < length && is_space(char_at(view, pos))) pos++;
+            return clamp_position(view, pos);
+        case VIEW_UP:
+        case VIEW_DOWN:
+        case VIEW_PAGE_UP:
+        case VIEW_PAGE_DOWN: {
+            const struct row row = row_of(view, pos);
+            const ptrdiff_t count = (move == VIEW_UP || move == VIEW_DOWN) ? 1 : (ptrdiff_t)page_lines(view);
+
+            if (view->preferred_x < 0)
+                view->preferred_x = caret_x(view, row);
+            return position_at(view, step(view, row, (move == VIEW_UP || move == VIEW_PAGE_UP) ? -count : count), view->preferred_x);
+        }
+        case VIEW_LINE_START:
+            return document_line_start(view->document, document_line_of(view->document, pos));
+        case VIEW_LINE_END: {
+            size_t start, end;
+            line_bounds(view, document_line_of(view->document, pos), &start, &end);
+            return end;
+        }
+        case VIEW_DOCUMENT_START:
+            return 0;
+        case VIEW_DOCUMENT_END:
+            return length;
+    }
+
+    return pos;
+}
+
+struct view* view_create(struct document* document, const struct view_metrics* metrics) {
+    struct view* view = mem_calloc(1, sizeof(*view));
+    view->document = document;
+    view->wraps = wrap_create();
+    view->preferred_x = -1;
+    view->xs_start = SIZE_MAX;
+    view_set_metrics(view, metrics);
+    return view;
+}
+
+void view_free(struct view* view) {
+    if (!view)
+        return;
+
+    wrap_free(view->wraps);
+    mem_free(view->breaks);
+    mem_free(view->xs);
+    mem_free(view);
+}
+
+void view_set_document(struct view* view, struct document* document) {
+    view->document = document;
+    wrap_clear(view->wraps);
+    drop_xs(view);
+
+    const size_t length = document_length(document);
+    view->caret = clamp_position(view, view->caret < length ? view->caret : length);
+    view->anchor = clamp_position(view, view->anchor < length ? view->anchor : length);
+    clamp_top(view);
+}
+
+void view_set_metrics(struct view* view, const struct view_metrics* metrics) {
+    view->metrics = *metrics;
+    if (view->metrics.line_height < 1)
+        view->metrics.line_height = 1;
+
+    const uint16_t space = ' ';
+    int width;
+    view->metrics.extents(view->metrics.ctx, &space, 1, &width);
+    view->space_width = width > 0 ? width : 1;
+    view->tab_width = view->space_width * VIEW_TAB_SIZE;
+    view->text_width = 0;
+    wrap_clear(view->wraps);
+    drop_xs(view);
+}
+
+void view_resize(struct view* view, int width, int height) {
+    // The top row keeps its text when the lines wrap differently
+    const size_t offset = view->wrap ? top_offset(view) : 0;
+
+    view->width = width > 0 ? width : 0;
+    view->height = height > 0 ? height : 0;
+
+    if (view->wrap)
+        set_top_offset(view, offset);
+}
+
+void view_set_wrap(struct view* view, bool wrap) {
+    if (view->wrap == wrap)
+        return;
+
+    const size_t offset = top_offset(view);
+    view->wrap = wrap;
+    view->scroll_x = 0;
+    view->text_width = 0;
+    set_top_offset(view, offset);
+}
+
+bool view_wrap(const struct view* view) {
+    return view->wrap;
+}
+
+size_t view_top_line(const struct view* view) {
+    return view->top.line;
+}
+
+size_t view_page_lines(const struct view* view) {
+    return page_lines(view);
+}
+
+int view_scroll_x(const struct view* view) {
+    return view->scroll_x;
+}
+
+int view_text_width(const struct view* view) {
+    return view->text_width;
+}
+
+void view_scroll_to(struct view* view, size_t line) {
+    view->top = (struct row){ line < line_count(view) ? line : line_count(view) - 1, 0, 0 };
+}
+
+void view_scroll_lines(struct view* view, ptrdiff_t lines) {
+    clamp_top(view);
+    view->top = step(view, view->top, lines);
+}
+
+void view_scroll_to_x(struct view* view, int x) {
+    view->scroll_x = x > 0 && !view->wrap ? x : 0;
+}
+
+size_t view_caret(const struct view* view) {
+    return view->caret;
+}
+
+void view_selection(const struct view* view, size_t* start, size_t* end) {
+    *start = view->anchor < view->caret ? view->anchor : view->caret;
+    *end = view->anchor < view->caret ? view->caret : view->anchor;
+}
+
+void view_select(struct view* view, size_t anchor, size_t caret) {
+    break_run(view);
+    const size_t length = document_length(view->document);
+    view->anchor = clamp_position(view, anchor < length ? anchor : length);
+    view->caret = clamp_position(view, caret < length ? caret : length);
+    view->preferred_x = -1;
+    show_caret(view);
+}
+
+void view_move(struct view* view, enum view_move move, bool select) {
+    break_run(view);
+    const bool vertical = move == VIEW_UP || move == VIEW_DOWN || move == VIEW_PAGE_UP || move == VIEW_PAGE_DOWN;
+    if (!vertical)
+        view->preferred_x = -1;
+
+    // Moving left or right without shift only collapses the selection
+    size_t start, end;
+    view_selection(view, &start, &end);
+    if (!select && start != end && (move == VIEW_LEFT || move == VIEW_RIGHT)) {
+        view->caret = view->anchor = move == VIEW_LEFT ? start : end;
+        show_caret(view);
+        return;
+    }
+
+    clamp_top(view);
+    view->caret = target_of(view, move);
+    if (!select)
+        view->anchor = view->caret;
+
+    // Paging moves the view along with the caret
+    if (move == VIEW_PAGE_UP || move == VIEW_PAGE_DOWN) {
+        const ptrdiff_t page = (ptrdiff_t)page_lines(view);
+        view->top = step(view, view->top, move == VIEW_PAGE_UP ? -page : page);
+    }
+
+    show_caret(view);
+}
+
+void view_click(struct view* view, int x, int y, bool select) {
+    break_run(view);
+    const ptrdiff_t row = y >= 0 ? y / view->metrics.line_height : -1 - (-1 - y) / view->metrics.line_height;
+
+    clamp_top(view);
+    view->caret = position_at(view, step(view, view->top, row), x + view->scroll_x);
+    if (!select)
+        view->anchor = view->caret;
+    view->preferred_x = -1;
+    show_caret(view);
+}
+
+// Replaces 'removed' code units at 'pos' with the text, the caret ends up right after it
+static void replace(struct view* view, size_t pos, size_t removed, const uint16_t* text, size_t length) {
+    const size_t line = document_line_of(view->document, pos);
+    const size_t lines = document_line_of(view->document, pos + removed) - line;
+
+    document_erase(view->document, pos, removed);
+    document_insert(view->document, pos, text, length);
+    edited(view, line, lines, document_line_of(view->document, pos + length) - line);
+
+    // The x checkpoints before the edit still hold, typing at the end of a huge line measures only the end of it
+    if (pos <= view->xs_start) {
+        drop_xs(view);
+    } else {
+        const size_t kept = (pos - view->xs_start - 1) / VIEW_X_STEP;
+        if (view->xs_count > kept)
+            view->xs_count = kept;
+    }
+
+    // The text may complete a CRLF or a surrogate pair with what comes after it, the caret goes after the whole thing
+    const size_t caret = clamp_position(view, pos + length);
+    view->caret = view->anchor = caret == pos + length || !length ? caret : next_position(view, caret);
+    view->preferred_x = -1;
+}
+
+// Makes an edit and records it in the journal
+static void edit(struct view* view, size_t pos, size_t removed, const uint16_t* text, size_t length) {
+    if (view->journal)
+        journal_record(view->journal, view->document, pos, removed, text, length);
+    replace(view, pos, removed, text, length);
+    show_caret(view);
+}
+
+void view_replace_all(struct view* view, const size_t* positions, const size_t* lengths, size_t count, size_t removed, const uint16_t* text, size_t length) {
+    if (!count)
+        return;
+
+    if (view->journal)
+        journal_record_all(view->journal, view->document, positions, lengths, count, removed, text, length);
+    document_replace_all(view->document, positions, lengths, count, removed, text, length);
+
+    // The replacements may be on any of the lines, none of the wrapped ones can be trusted
+    wrap_clear(view->wraps);
+    drop_xs(view);
+    size_t gone = (count - 1) * removed;
+    if (lengths) {
+        gone = 0;
+        for (size_t i = 0; i + 1 < count; i++)
+            gone += lengths[i];
+    }
+    const size_t last = positions[count - 1] - gone + (count - 1) * length;
+    view->caret = view->anchor = clamp_position(view, last + length);
+    view->preferred_x = -1;
+    clamp_top(view);
+    show_caret(view);
+}
+
+// Called by the journal to undo or redo an edit
+static void apply(void* ctx, size_t pos, size_t removed, const uint16_t* text, size_t length) {
+    replace(ctx, pos, removed, text, length);
+}
+
+void view_insert(struct view* view, const uint16_t* text, size_t length) {
+    size_t start, end;
+    view_selection(view, &start, &end);
+    edit(view, start, end - start, text, length);
+}
+
+void view_erase(struct view* view, enum view_move move) {
+    size_t start, end;
+    view_selection(view, &start, &end);
+
+    if (start == end) {
+        const size_t target = target_of(view, move);
+        start = target < view->caret ? target : view->caret;
+        end = target < view->caret ? view->caret : target;
+    }
+
+    edit(view, start, end - start, NULL, 0);
+}
+
+void view_set_journal(struct view* view, struct journal* journal) {
+    view->journal = journal;
+}
+
+bool view_undo(struct view* view) {
+    if (!view->journal || !journal_undo(view->journal, apply, view))
+        return false;
+
+    show_caret(view);
+    return true;
+}
+
+bool view_redo(struct view* view) {
+    if (!view->journal || !journal_redo(view->journal, apply, view))
+        return false;
+
+    show_caret(view);
+    return true;
+}
+
+void view_caret_point(struct view* view, int* x, int* y) {
+    clamp_top(view);
+
+    // A caret far away from the view only needs to be out of it
+    const struct row caret = row_of(view, view->caret);
+    const size_t limit = page_lines(view) + 1;
+    const ptrdiff_t rows = is_before(caret, view->top) ? -(ptrdiff_t)distance(view, caret, view->top, limit) : (ptrdiff_t)distance(view, view->top, caret, limit);
+
+    *x = caret_x(view, caret) - view->scroll_x;
+    *y = (int)rows * view->metrics.line_height;
+}
+
+// What view_paint keeps track of while it walks through the visible text
+struct painter {
+    struct view* view;
+    view_draw_fn draw;
+    void* ctx;
+
+    size_t selection_start, selection_end;
+    size_t row, rows;
+    int y, right_edge;
+
+    // The position of the next code unit, where the buffered text starts and how much of it there is
+    size_t pos, start, buffered;
+    // The end of the current row so far, the rest of a row that goes past the right edge isn't read at all
+    int x;
+    bool skipping;
+
+    // The current line, the rows of its current chunk if it's wrapped, where that chunk starts, the next of its
+    // rows and where the current row wraps (SIZE_MAX if it ends at the line break)
+    const struct wrap_entry* wrap;
+    size_t line, line_start, chunk, chunk_start, next_row, wrap_at;
+};
+
+// Measures and draws the buffered text, except for the last 'keep' code units, which stay in the buffer
+static void flush(struct painter* painter, size_t keep) {
+    struct view* view = painter->view;
+    const size_t length = painter->buffered - keep;
+    if (!length)
+        return;
+
+    measure(view, length, painter->x);
+
+    // A run ends at a tab and where the selection starts or ends
+    for (size_t i = 0; i < length; ) {
+        const size_t pos = painter->start + i;
+        const bool selected = pos >= painter->selection_start && pos < painter->selection_end;
+
+        size_t end = i + 1;
+        if (view->text[i] != '\t')
+            while (end < length && view->text[end] != '\t' && (painter->start + end >= painter->selection_start && painter->start + end < painter->selection_end) == selected)
+                end++;
+
+        const int left = i ? view->extents[i - 1] : painter->x;
+        const int right = view->extents[end - 1];
+        if (left >= painter->right_edge)
+            break;
+        if (right > view->scroll_x)
+            painter->draw(painter->ctx, left - view->scroll_x, painter->y, right - left, view->text + i, view->text[i] == '\t' ? 0 : end - i, selected);
+        i = end;
+    }
+
+    painter->x = view->extents[length - 1];
+    painter->skipping = painter->x >= painter->right_edge;
+
+    memmove(view->text, view->text + length, keep * sizeof(uint16_t));
+    painter->start += length;
+    painter->buffered = keep;
+}
+
+// Finishes a line, 'end' is where its line break starts
+static void finish_line(struct painter* painter, size_t end, bool linebreak) {
+    struct view* view = painter->view;
+    flush(painter, 0);
+
+    if (!painter->skipping && painter->x > view->text_width)
+        view->text_width = painter->x;
+
+    // A selected line break is shown as a space
+    if (linebreak && !painter->skipping && painter->selection_start <= end && painter->selection_end > end)
+        painter->draw(painter->ctx, painter->x - view->scroll_x, painter->y, view->space_width, NULL, 0, true);
+
+    painter->row++;
+    painter->y += view->metrics.line_height;
+    painter->x = 0;
+    painter->skipping = false;
+}
+
+// Finds where the current row wraps, at the next break of its chunk or at the end of the chunk if there is another one
+static void find_wrap(struct painter* painter) {
+    painter->wrap_at = SIZE_MAX;
+    if (!painter->wrap)
+        return;
+
+    if (painter->next_row < painter->wrap->rows)
+        painter->wrap_at = painter->chunk_start + painter->wrap->breaks[painter->next_row - 1];
+    else if (painter->chunk + 1 < painter->wrap->chunks)
+        painter->wrap_at = chunk_start(painter->view, painter->line_start, painter->chunk + 1);
+}
+
+// Goes on with a row of a chunk of the current line, the chunk starts at 'start'
+// Wrapping measures the chunk with the buffer, which has to be empty by now
+static void start_chunk(struct painter* painter, size_t chunk, size_t start, size_t row) {
+    painter->chunk = chunk;
+    painter->chunk_start = start;
+    painter->next_row = row + 1;
+    if (painter->view->wrap)
+        painter->wrap = wrap_of(painter->view, painter->line, chunk);
+    find_wrap(painter);
+}
+
+// Goes on with the next line, which starts at 'start'
+static void next_line(struct painter* painter, size_t start) {
+    painter->line++;
+    painter->line_start = start;
+    start_chunk(painter, 0, start, 0);
+}
+
+// Goes on with the row after the one that has wrapped, in the same chunk or at the start of the next one
+static void next_row(struct painter* painter) {
+    if (painter->next_row < painter->wrap->rows) {
+        painter->next_row++;
+        find_wrap(painter);
+    } else {
+        start_chunk(painter, painter->chunk + 1, painter->wrap_at, 0);
+    }
+}
+
+// Skips the rest of a row that has gone past the right edge, returns where the next row starts
+static size_t skip_row(struct painter* painter) {
+    struct view* view = painter->view;
+    painter->buffered = 0;
+
+    if (painter->wrap_at != SIZE_MAX) {
+        painter->start = painter->pos = painter->wrap_at;
+        finish_line(painter, painter->pos, false);
+        if (painter->row < painter->rows)
+            next_row(painter);
+        return painter->pos;
+    }
+
+    // The last line has nothing after it, the walk starting at the end finds nothing to read
+    if (painter->line + 1 >= line_count(view))
+        return painter->pos = document_length(view->document);
+
+    // Nothing past the right edge gets drawn, not even a selected line break
+    painter->start = painter->pos = document_line_start(view->document, painter->line + 1);
+    finish_line(painter, painter->pos, false);
+    if (painter->row < painter->rows)
+        next_line(painter, painter->pos);
+    return painter->pos;
+}
+
+// The document_walk callback of view_paint, stops at the end of the last row and where a row goes past the right edge
+static bool paint_span(void* ctx, const uint16_t* text, size_t length) {
+    struct painter* painter = ctx;
+    struct view* view = painter->view;
+
+    for (size_t i = 0; i < length; i++, painter->pos++) {
+        const uint16_t c = text[i];
+
+        if (c == '\n') {
+            // The CR of a CRLF is still in the buffer
+            const bool cr = painter->buffered && view->text[painter->buffered - 1] == '\r';
+            if (cr)
+                painter->buffered--;
+            finish_line(painter, cr ? painter->pos - 1 : painter->pos, true);
+
+            painter->start = painter->pos + 1;
+            painter->buffered = 0;
+            if (painter->row >= painter->rows)
+                return false;
+
+            next_line(painter, painter->pos + 1);
+            continue;
+        }
+
+        // The end of a wrapped row
+        if (painter->pos == painter->wrap_at) {
+            finish_line(painter, painter->pos, false);
+            painter->start = painter->pos;
+            painter->buffered = 0;
+            if (painter->row >= painter->rows)
+                return false;
+            next_row(painter);
+        }
+
+        if (!painter->buffered)
+            painter->start = painter->pos;
+        view->text[painter->buffered++] = c;
+
+        // A CR or a high surrogate at the end waits for what comes after it
+        if (painter->buffered == VIEW_BLOCK) {
+            const uint16_t last = view->text[VIEW_BLOCK - 1];
+            flush(painter, last == '\r' || is_high_surrogate(last) ? 1 : 0);
+            if (painter->skipping)
+                return false;
+        }
+    }
+
+    return true;
+}
+
+size_t view_paint(struct view* view, view_draw_fn draw, void* ctx) {
+    clamp_top(view);
+
+    size_t start, end;
+    row_bounds(view, view->top, &start, &end);
+
+    struct painter painter = {
+        .view = view,
+        .draw = draw,
+        .ctx = ctx,
+        // The last row may be visible only partly
+        .rows = page_lines(view) + 1,
+        .right_edge = view->scroll_x + view->width,
+        .pos = start,
+        .line = view->top.line,
+        .line_start = document_line_start(view->document, view->top.line)
+    };
+    start_chunk(&painter, view->top.chunk, chunk_start(view, painter.line_start, view->top.chunk), view->top.row);
+    view_selection(view, &painter.selection_start, &painter.selection_end);
+
+    // The visible rows are read in one go, finding where every one of them starts would cost more than reading them,
+    // except for a row that goes past the right edge, the walk starts over where the next one starts instead
+    size_t pos = painter.pos;
+    while (!document_walk(view->document, pos, document_length(view->document) - pos, paint_span, &painter) && painter.skipping) {
+        pos = skip_row(&painter);
+        if (painter.row >= painter.rows)
+            return painter.row;
+    }
+    if (painter.row < painter.rows)
+        finish_line(&painter, painter.pos, false);
+
+    return painter.row;
+}
@@ -0,0 +1,123 @@
+#pragma once
+// The text view: scrolling, the caret, the selection and the layout of the visible part of a document
+//
+// Only the lines on the screen are ever read or measured, the view finds them through the line index of the
+// document, so painting and scrolling cost the same no matter how big the document is. The view doesn't draw
+// anything itself, it measures the text through a metrics interface and hands positioned runs of text to
+// whoever paints them, so it runs headless just as well (with fake metrics) as with a real font.
+//
+// All of the coordinates are in pixels (or whatever the metrics use) relative to the top left corner of the view.
+// Lines are logical lines, see document_line_of, rows are what is on the screen, which is the same unless the
+// lines are wrapped. Positions are in code units, the view never puts the caret between a CR and an LF or inside
+// of a surrogate pair.
+//
+// Wrapped lines are wrapped only when they are shown, and huge ones only a chunk at a time (see wrap.h), so
+// wrapping, resizing and scrolling cost as much as the visible part of the document.
+
+#include "document.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// The number of spaces a tab is as wide as
+#define VIEW_TAB_SIZE 4
+
+// Measures a run of text without any tabs or line breaks:
+// 'extents[i]' must be set to the width of the first i + 1 code units
+typedef void (*view_extents_fn)(void* ctx, const uint16_t* text, size_t length, int* extents);
+
+struct view_metrics {
+    view_extents_fn extents;
+    void* ctx;
+    // The height of every line
+    int line_height;
+};
+
+// Called for every run of text when painting, 'width' covers the whole run (a tab is a run without any text)
+typedef void (*view_draw_fn)(void* ctx, int x, int y, int width, const uint16_t* text, size_t length, bool selected);
+
+// The ways the caret can move
+enum view_move {
+    VIEW_LEFT,
+    VIEW_RIGHT,
+    VIEW_WORD_LEFT,
+    VIEW_WORD_RIGHT,
+    VIEW_UP,
+    VIEW_DOWN,
+    VIEW_PAGE_UP,
+    VIEW_PAGE_DOWN,
+    VIEW_LINE_START,
+    VIEW_LINE_END,
+    VIEW_DOCUMENT_START,
+    VIEW_DOCUMENT_END
+};
+
+struct view;
+struct journal;
+
+// Creates a view of a document, the view doesn't own the document
+struct view* view_create(struct document* document, const struct view_metrics* metrics);
+void view_free(struct view* view);
+
+// Switches to another document (or another version of the same one, e.g. a newer snapshot of a file that is loading)
+// The view keeps its scroll position and caret as far as the new document allows
+void view_set_document(struct view* view, struct document* document);
+
+// Sets the metrics after the font has changed
+void view_set_metrics(struct view* view, const struct view_metrics* metrics);
+
+// Sets the size of the view, the first visible row keeps its text when the lines wrap differently
+void view_resize(struct view* view, int width, int height);
+
+// Turns wrapping the lines to the width of the view on or off, there is no horizontal scrolling when it's on
+void view_set_wrap(struct view* view, bool wrap);
+bool view_wrap(const struct view* view);
+
+// Returns the line of the first visible row and the number of rows that fit into the view completely
+size_t view_top_line(const struct view* view);
+size_t view_page_lines(const struct view* view);
+// Returns the horizontal scroll offset and a guess of how wide the text is (the widest line seen so far)
+int view_scroll_x(const struct view* view);
+int view_text_width(const struct view* view);
+
+// Scrolls so that the first row of 'line' is at the top, the caret doesn't move
+void view_scroll_to(struct view* view, size_t line);
+// Scrolls by a number of rows (up if negative)
+void view_scroll_lines(struct view* view, ptrdiff_t lines);
+// Scrolls horizontally to 'x'
+void view_scroll_to_x(struct view* view, int x);
+
+// Returns the position of the caret and the selection, 'start' <= 'end', both are the caret if nothing is selected
+size_t view_caret(const struct view* view);
+void view_selection(const struct view* view, size_t* start, size_t* end);
+// Selects a range, the caret ends up at 'caret' and the other end at 'anchor'
+void view_select(struct view* view, size_t anchor, size_t caret);
+
+// Moves the caret, extending the selection if 'select' is true, otherwise dropping it
+void view_move(struct view* view, enum view_move move, bool select);
+// Moves the caret to the position closest to a point, as a mouse click does
+void view_click(struct view* view, int x, int y, bool select);
+
+// Replaces the selection with the text (inserts it at the caret if nothing is selected)
+void view_insert(struct view* view, const uint16_t* text, size_t length);
+// Erases the selection, or if there is none, the text between the caret and where 'move' would take it
+void view_erase(struct view* view, enum view_move move);
+// Replaces 'removed' code units (or 'lengths[i]' of them) at each of the sorted positions with the text
+// (see document_replace_all) as one undo step, the caret ends up after the last replacement
+void view_replace_all(struct view* view, const size_t* positions, const size_t* lengths, size_t count, size_t removed, const uint16_t* text, size_t length);
+
+// Gives the view a journal to record its edits into (NULL for none), the view doesn't own it
+// Moving the caret ends a typing run, so that it gets undone separately from what is typed somewhere else
+void view_set_journal(struct view* view, struct journal* journal);
+// Undoes or redoes the last step recorded in the journal, the caret ends up after the last edit it has made
+// Returns false if there was nothing to undo or redo
+bool view_undo(struct view* view);
+bool view_redo(struct view* view);
+
+// Gets the position of the caret in the view, it may be outside of the view
+void view_caret_point(struct view* view, int* x, int* y);
+
+// Calls 'draw' for every run of text that is visible, in order, the runs never overlap
+// Returns the number of rows that were laid out
+size_t view_paint(struct view* view, view_draw_fn draw, void* ctx);
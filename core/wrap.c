@@ -0,0 +1,136 @@
+#include "wrap.h"
+#include "memory.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// The table is kept at most half full, when it fills up only the chunks this close to the new one (in lines and
+// in chunks) are kept
+#define WRAP_CACHE_MAX (WRAP_CACHE_LINES / 2)
+#define WRAP_KEEP_DISTANCE (WRAP_CACHE_LINES / 8)
+
+// An open addressing hash table of chunks, an entry without any rows is empty
+struct wrap_cache {
+    struct wrap_entry entries[WRAP_CACHE_LINES];
+    size_t count;
+};
+
+static size_t slot_of(size_t line, size_t chunk) {
+    return (size_t)(((uint64_t)line * 0x9E3779B97F4A7C15ull + (uint64_t)chunk * 0xC2B2AE3D27D4EB4Full) >> 32) & (WRAP_CACHE_LINES - 1);
+}
+
+// Returns the slot of a chunk, or the empty slot where it would go
+static struct wrap_entry* lookup(const struct wrap_cache* cache, size_t line, size_t chunk) {
+    size_t slot = slot_of(line, chunk);
+    while (cache->entries[slot].rows && (cache->entries[slot].line != line || cache->entries[slot].chunk != chunk))
+        slot = (slot + 1) & (WRAP_CACHE_LINES - 1);
+    return (struct wrap_entry*)&cache->entries[slot];
+}
+
+static bool is_near(size_t a, size_t b) {
+    return a + WRAP_KEEP_DISTANCE >= b && a <= b + WRAP_KEEP_DISTANCE;
+}
+
+struct wrap_cache* wrap_create(void) {
+    return mem_calloc(1, sizeof(struct wrap_cache));
+}
+
+void wrap_free(struct wrap_cache* cache) {
+    if (!cache)
+        return;
+
+    wrap_clear(cache);
+    mem_free(cache);
+}
+
+const struct wrap_entry* wrap_find(const struct wrap_cache* cache, size_t line, size_t chunk, int width) {
+    const struct wrap_entry* entry = lookup(cache, line, chunk);
+    return entry->rows && entry->width == width ? entry : NULL;
+}
+
+// Takes all of the entries out of the table, so that the ones that stay can be put back
+// The table is small, rebuilding it is simpler than keeping track of removed slots
+static struct wrap_entry* take_entries(struct wrap_cache* cache) {
+    struct wrap_entry* entries = mem_alloc(sizeof(cache->entries));
+    memcpy(entries, cache->entries, sizeof(cache->entries));
+    memset(cache->entries, 0, sizeof(cache->entries));
+    cache->count = 0;
+    return entries;
+}
+
+static void put_entry(struct wrap_cache* cache, const struct wrap_entry* entry) {
+    *lookup(cache, entry->line, entry->chunk) = *entry;
+    cache->count++;
+}
+
+const struct wrap_entry* wrap_store(struct wrap_cache* cache, size_t line, size_t chunk, size_t chunks, int width, const size_t* breaks, size_t rows) {
+    struct wrap_entry* entry = lookup(cache, line, chunk);
+
+    if (entry->rows) {
+        mem_free(entry->breaks);
+    } else {
+        // Only the chunks near the new one are worth keeping once the table is full
+        if (cache->count >= WRAP_CACHE_MAX) {
+            struct wrap_entry* entries = take_entries(cache);
+            for (size_t i = 0; i < WRAP_CACHE_LINES; i++) {
+                if (!entries[i].rows)
+                    continue;
+                if (is_near(entries[i].line, line) && is_near(entries[i].chunk, chunk))
+                    put_entry(cache, &entries[i]);
+                else
+                    mem_free(entries[i].breaks);
+            }
+            mem_free(entries);
+
+            // Which may still be too many with a lot of long lines on the screen
+            if (cache->count >= WRAP_CACHE_MAX)
+                wrap_clear(cache);
+            entry = lookup(cache, line, chunk);
+        }
+        cache->count++;
+    }
+
+    *entry = (struct wrap_entry){ .line = line, .chunk = chunk, .chunks = chunks, .width = width, .rows = rows ? rows : 1 };
+    if (rows > 1) {
+        entry->breaks = mem_alloc((rows - 1) * sizeof(size_t));
+        memcpy(entry->breaks, breaks, (rows - 1) * sizeof(size_t));
+    }
+
+    return entry;
+}
+
+void wrap_edited(struct wrap_cache* cache, size_t line, size_t removed, size_t added) {
+    if (!cache->count)
+        return;
+
+    // The lines before the edit stay, the edited ones go (all of their chunks) and the ones after it move
+    struct wrap_entry* entries = take_entries(cache);
+    for (size_t i = 0; i < WRAP_CACHE_LINES; i++) {
+        struct wrap_entry* entry = &entries[i];
+        if (!entry->rows)
+            continue;
+
+        if (entry->line >= line && entry->line <= line + removed) {
+            mem_free(entry->breaks);
+            continue;
+        }
+
+        if (entry->line > line)
+            entry->line = entry->line - removed + added;
+        put_entry(cache, entry);
+    }
+    mem_free(entries);
+}
+
+void wrap_clear(struct wrap_cache* cache) {
+    for (size_t i = 0; i < WRAP_CACHE_LINES; i++)
+        mem_free(cache->entries[i].breaks);
+
+    memset(cache->entries, 0, sizeof(cache->entries));
+    cache->count = 0;
+}
+
+size_t wrap_count(const struct wrap_cache* cache) {
+    return cache->count;
+}
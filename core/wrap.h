@@ -0,0 +1,51 @@
+#pragma once
+// A cache of where wrapped lines break into rows
+//
+// Wrapping a line means measuring all of it, so the view wraps only the lines it shows and keeps the results here.
+// A line longer than WRAP_CHUNK code units gets wrapped in chunks of that many, each of them on its own (a chunk
+// always starts a row), so that showing a bit of a huge line wraps only the chunks around that bit.
+// The cache holds a bounded number of chunks around the ones asked for last, a chunk is found by the number of its
+// line and its own number in it, and is only good for the width it was wrapped to, so a resize makes the visible
+// chunks wrap again as they are needed and leaves the rest of the document alone. Edits drop the lines they touch
+// and renumber the ones after them.
+
+#include <stddef.h>
+
+// The most chunks the cache keeps (a power of two), far more than fit on any screen
+#define WRAP_CACHE_LINES 1024
+
+// The code units in a chunk of a line, the last one of a line may have fewer (and a chunk that would start inside
+// of a surrogate pair starts right after it instead)
+#define WRAP_CHUNK 16384
+
+// The rows of one chunk of a line: row 0 starts where the chunk starts and row i + 1 'breaks[i]' code units after it
+struct wrap_entry {
+    size_t line, chunk;
+    // The number of chunks of the line
+    size_t chunks;
+    int width;
+    size_t rows;
+    // NULL if the chunk fits on one row
+    size_t* breaks;
+};
+
+struct wrap_cache;
+
+struct wrap_cache* wrap_create(void);
+void wrap_free(struct wrap_cache* cache);
+
+// Returns the rows of a chunk of a line wrapped to 'width', or NULL if the chunk isn't cached for that width
+const struct wrap_entry* wrap_find(const struct wrap_cache* cache, size_t line, size_t chunk, int width);
+
+// Stores the rows of a chunk of a line (the breaks are copied), replacing what the cache had for it
+// Chunks far from it may be evicted, so the entries returned before are only good until the next call
+const struct wrap_entry* wrap_store(struct wrap_cache* cache, size_t line, size_t chunk, size_t chunks, int width, const size_t* breaks, size_t rows);
+
+// Tells the cache about an edit that has replaced 'removed' line breaks after the start of 'line' with 'added' ones
+void wrap_edited(struct wrap_cache* cache, size_t line, size_t removed, size_t added);
+
+// Drops every chunk, e.g. after the text has been replaced or measures differently
+void wrap_clear(struct wrap_cache* cache);
+
+// Returns the number of chunks cached
+size_t wrap_count(const struct wrap_cache* cache);
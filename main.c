@@ -1,1194 +1,1859 @@
-// All the base windows functions
-#include <windows.h>
-// The StringCb* functions, sort of replacement for string.h
-#include <strsafe.h>
-// Some functions regarding the common controls
-#include <commctrl.h>
-
-// We need this for the error_box_format function
-#include <stdarg.h>
-
-// The name to be displayed while creating a new file
-#define NEW_FILE_NAME L"Empty file"
-// A custom window message to signify that the caret of a text-box has moved
-#define WM_USER_CARETMOVE (WM_USER+0)
-// An edit control accelerator code to delete the word behind the cursor (Ctrl+Backspace)
-#define ACC_EDIT_DELETEWORD 0
-
-// Minwindef.h (a part of windows.h) apparently already has a max macro, so let's use that
-//#define max(a, b) ((a) > (b) ? (a) : (b))
-
-// Describes if the string loaded uses '\n' or '\r\n' to signify line breaks
-enum linebreak {
-    LINEBREAK_UNIX,
-    LINEBREAK_WIN
-};
-
-// Describes the encoding of a string
-enum encoding {
-    ENCODING_UTF8,
-    ENCODING_UTF16
-};
-
-// A so-called format specifies the encoding, linebreak type and the BOM
-struct format {
-    enum encoding encoding;
-    enum linebreak linebreak;
-    BOOL bom;
-};
-
-// The format used by the internal text-box
-CONST struct format Internal_format = {
-    .encoding = ENCODING_UTF16,
-    .linebreak = LINEBREAK_WIN,
-    .bom = FALSE
-};
-
-CONST struct format Default_format = {
-    .encoding = ENCODING_UTF8,
-    .bom = FALSE,
-    .linebreak = LINEBREAK_WIN
-};
-
-// The byte-order-mark structure, size is in bytes
-struct bom { UINT32 data; SIZE_T size; };
-
-// The main and only window
-static HWND Window = NULL;
-// The size, in pixels, of the window's client area
-static INT Width = 640, Height = 480;
-
-// The preferred fonts to use for the window elements
-// The add_* functions use these fonts for new controls
-static struct {
-    HFONT editor, filename;
-} Fonts;
-
-// These values are used as ID's to the GUI elements
-enum Gui_Enums {
-    GUI_TEXT_BOX, GUI_STATIC_TEXT,
-    GUI_MENU_NEW, GUI_MENU_LOAD, GUI_MENU_SAVE, GUI_MENU_ABOUT, GUI_MENU_WWRAP
-};
-
-// A singleton structure that holds all needed handles to the GUI elements 
-static struct {
-    HWND text_box, filename, status;
-    HMENU menu, menu_file, menu_edit, menu_help;
-    HACCEL edit_accels;
-} Gui;
-
-// Hold information about layout and spacing of the GUI
-static struct {
-    INT filename_height, margin, reduced_margin;
-} Layout;
-
-// Hold information about the settings of the current file
-// This is used when saving the file, to save it in the original format
-static struct {
-    struct format format;
-    BOOL is_new;
-} Settings;
-
-// Show a formatted MessageBox with the latest error obtained by GetLastError()
-static void error_box_winerror(PCWSTR caption) {
-
-    CONST DWORD err = GetLastError();
-
-    WCHAR buf[128];
-    if (FAILED(StringCbPrintfW(buf, sizeof(buf), L"%ls\n%d (0x%X)", caption, err, err)))
-        StringCbCopyW(buf, sizeof(buf), L"Failed to format the error message");
-    
-    MessageBoxW(Window, 
-                buf,
-                L"Unexpected error",
-                MB_OK | MB_ICONERROR | MB_DEFBUTTON1 | MB_APPLMODAL);
-
-}
-
-// Same as error_box_winerror but terminates the process, returning the last error code
-static void fatal(PCWSTR caption) {
-    error_box_winerror(caption);
-    ExitProcess(GetLastError());
-}
-
-// A MessageBox wrapper, displays an error box
-static void error_box(PCWSTR caption, PCWSTR msg) {
-    MessageBoxW(Window, 
-               msg,
-               caption,
-               MB_OK | MB_ICONERROR | MB_DEFBUTTON1 | MB_APPLMODAL);
-}
-
-// Same as error_box, formats the 'msg' argument (like printf)
-static void error_box_format(PCWSTR caption, PCWSTR msg, ...) {
-
-    va_list args;
-    va_start(args, msg);
-
-    WCHAR buf[256];
-    if (FAILED(StringCbVPrintfW(buf, sizeof(buf), msg, args)))
-        StringCbCopyW(buf, sizeof(buf), L"Failed to format the error message");
-
-    MessageBoxW(Window, 
-               buf,
-               caption,
-               MB_OK | MB_ICONERROR | MB_DEFBUTTON1 | MB_APPLMODAL);
-
-    va_end(args);    
-}
-
-// Updates the status bar's proportions according to the width of the window
-static void resize_status_bar() {
-
-    // Observations have shown that the part size has to be greater than 0, otherwise everything breakes
-    INT sizes[4] = {
-        max(Width-330, 1), 
-        max(Width-230, 1), 
-        max(Width-130, 1), 
-        -1
-    };
-
-    SendMessageW(Gui.status, SB_SETPARTS, (WPARAM)4, (LPARAM)sizes);
-    SendMessageW(Gui.status, WM_SIZE, 0, 0);
-}
-
-// Adds an already set-up status bar to the window (resize_status_bar must be called to separate it though)
-static HWND add_status_bar() {
-    HWND sbar = CreateWindowW(
-            STATUSCLASSNAMEW,
-            L"",
-            WS_CHILD | WS_VISIBLE | SBARS_SIZEGRIP,
-            0, 0, 0, 0,
-            Window,
-            NULL,
-            (HINSTANCE)GetWindowLongPtr(Window, GWLP_HINSTANCE),
-            NULL
-        );
-    if (!sbar)
-        fatal(L"Failed to create the status bar");
-
-    return sbar;
-}
-
-// Change the format displayed on the status bar (and thus even the global current file settings)
-static void change_format(CONST struct format format) {
-
-    // Change the type variable itself
-    Settings.format = format;
-
-    static PCWSTR encodings[] = {
-        [ENCODING_UTF8 ] = L"UTF-8",
-        [ENCODING_UTF16] = L"UTF-16"
-    };
-
-    WCHAR buf[128];
-    // Format the encoding type
-    StringCbPrintfW(buf, sizeof(buf), L"%ls%ls", encodings[Settings.format.encoding], Settings.format.bom ? L" with BOM" : L"");
-    SendMessageW(Gui.status, SB_SETTEXTW, 3, (LPARAM)buf);
-
-    // Format the linebreak type
-    StringCbPrintfW(buf, sizeof(buf), L"%ls", Settings.format.linebreak == LINEBREAK_UNIX ? L"Unix (LF)" : L"Windows (CRLF)");
-    SendMessageW(Gui.status, SB_SETTEXTW, 2, (LPARAM)buf);
-}
-
-// Change the cursor position displayed on the status bar
-static void change_status_pos(CONST ULONGLONG row, CONST ULONGLONG col) {
-    WCHAR buf[128];
-
-    // Format the lines and columns
-    StringCbPrintfW(buf, sizeof(buf), L"Ln %llu, Col %llu", row, col);
-    SendMessageW(Gui.status, SB_SETTEXTW, 1, (LPARAM)buf);
-}
-
-// A custom edit control procedure used by all edit controls created by the add_text_box function,
-// it supports the ACC_EDIT_DELETEWORD accelerator and sends WM_USER_CARETMOVE to the main window
-static LRESULT CALLBACK EditProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam) {
-
-    switch (uMsg) {
-        // If the user presses a key or clicks the mouse, the caret position has likely changed
-        //TODO: react to changes while dragging the mouse in real time (WM_MOUSEMOVE would be possible
-        // but is unnecessarily frequent)
-        case WM_KEYDOWN:
-        case WM_LBUTTONDOWN:
-        case WM_LBUTTONUP:  
-        case EM_SETSEL:
-        case WM_CLEAR:
-            // Checking the return value is possible and recommended, but unnecessary
-            // If the message queue is full, there are other things to worry about than the caret moving
-            // PostMessage is necessary here (don't ask me why) // TODO: find out why PostMessage is necessary here
-            PostMessageW(Window, WM_USER_CARETMOVE, MAKEWPARAM(GetDlgCtrlID(hwnd), 0), (LPARAM)hwnd);
-        break;
-        case WM_COMMAND:
-            switch(HIWORD(wParam)) {
-                case 1:
-                    switch (LOWORD(wParam)) {
-                        // TODO: fails when trying to delete the first word with a BOM present, 
-                        // load files without the bom
-                        case ACC_EDIT_DELETEWORD: {                                
-                            HLOCAL textH = (HLOCAL)SendMessageW(hwnd, EM_GETHANDLE, 0, 0);
-                            PCWSTR text = LocalLock(textH);
-                            CONST ULONGLONG text_length = GetWindowTextLengthW(hwnd);
-
-                            // Find the last whitespace character
-                            DWORD sel_start, sel_end;
-                            SendMessageW(hwnd, EM_GETSEL, (WPARAM)&sel_start, (LPARAM)&sel_end);
-                            if (sel_start != sel_end) {
-                                SendMessageW(hwnd, WM_CLEAR, 0, 0);
-                                break;
-                            }
-
-                            ULONGLONG start = sel_start;
-                            for (; start > 0 && iswspace(text[start-1]); start--);
-                            for (; start > 0 && !iswspace(text[start-1]); start--);
-
-                            // Delete the last word
-                            // TODO: the edit control flickers when redrawn
-                            SendMessageW(hwnd, WM_SETREDRAW, FALSE, 0);
-                                SendMessageW(hwnd, EM_SETSEL, start, sel_start);
-                                SendMessageW(hwnd, WM_CLEAR, 0, 0);
-                            SendMessageW(hwnd, WM_SETREDRAW, TRUE, 0);
-
-                            LocalUnlock(textH);
-
-                            return 0;
-                        } break;
-                    }
-                break;
-            }
-        break;
-    }
-
-    return CallWindowProcW((WNDPROC)GetWindowLongPtrW(hwnd, GWLP_USERDATA), hwnd, uMsg, wParam, lParam);
-}
-
-// Adds an edit control to the main window (unscaled, unpositioned, check the resize() method)
-static HWND add_text_box(CONST UINT id, CONST BOOL wrap) {
-    HWND text_box = CreateWindowExW(
-        WS_EX_CLIENTEDGE,
-        WC_EDITW,
-        L"",
-        WS_CHILD | WS_VISIBLE | WS_BORDER | ES_MULTILINE | WS_VSCROLL | (wrap ? ES_AUTOHSCROLL | WS_HSCROLL : 0),
-        0,0,0,0,
-        Window,
-        (HMENU)(UINT_PTR)id,
-        (HINSTANCE)GetWindowLongPtr(Window, GWLP_HINSTANCE),
-        NULL
-    );
-    if (!text_box)
-        fatal(L"Failed to create the text box");
-
-    SendMessageW(text_box, WM_SETFONT, (WPARAM)Fonts.editor, TRUE);
-    SetWindowLongPtrW(text_box, GWLP_USERDATA, (LONG_PTR)SetWindowLongPtrW(text_box, GWLP_WNDPROC, (LONG_PTR)EditProc));
-
-    return text_box;
-}
-
-// Adds a static text to the main window (unscaled, unpositioned, check the resize() method)
-static HWND add_static_text(CONST UINT id) {
-
-    HWND static_text = CreateWindowW(
-        WC_STATICW,
-        L"",
-        WS_CHILD | WS_VISIBLE | SS_SIMPLE,
-        0, 0, 0, 0,
-        Window,
-        (HMENU)(UINT_PTR)id,
-        (HINSTANCE)GetWindowLongPtr(Window, GWLP_HINSTANCE),
-        NULL
-    );
-    if (!static_text)
-        fatal(L"Failed to create the static text");
-
-    SendMessageW(static_text, WM_SETFONT, (WPARAM)Fonts.filename, TRUE);
-
-    return static_text;
-
-}
-
-// Adds a button with a title with an ID to a menu
-static void add_menu_button(HMENU menu, CONST UINT id, PCWSTR title) {
-    MENUITEMINFOW info;
-    info.cbSize = sizeof(MENUITEMINFOW);
-    info.fMask = MIIM_STRING | MIIM_ID;
-    info.wID = id;
-    info.dwTypeData = (PWSTR)title;
-
-    if (!(InsertMenuItemW(menu, GetMenuItemCount(menu), TRUE, &info)))
-        fatal(L"Failed to insert the menu button");
-}
-
-// Inserts a button with a title, ID and a checkbox to the menu (the default state is unchecked)
-static void add_menu_checkbox(HMENU menu, CONST UINT id, PCWSTR title) {
-    MENUITEMINFOW info;
-    info.cbSize = sizeof(MENUITEMINFOW);
-    info.fMask = MIIM_STRING | MIIM_ID | MIIM_CHECKMARKS | MIIM_STATE;
-    // The checkmark info
-    info.hbmpChecked = NULL;
-    info.hbmpUnchecked = NULL;
-    info.fState = MFS_UNCHECKED;
-    // The common info
-    info.wID = id;
-    info.dwTypeData = (PWSTR)title;
-
-    if (!InsertMenuItemW(menu, GetMenuItemCount(menu), TRUE, &info))
-        fatal(L"Failed to insert a menu checkbox");
-}
-
-// Adds a submenu to a menu item
-static void add_menu_submenu(HMENU menu, CONST HMENU submenu, PCWSTR title) {
-    MENUITEMINFOW info;
-    info.cbSize = sizeof(MENUITEMINFOW);
-    info.fMask = MIIM_STRING | MIIM_SUBMENU;
-    info.hSubMenu = submenu;
-    info.dwTypeData = (PWSTR)title;
-
-    if (!(InsertMenuItemW(menu, GetMenuItemCount(menu), TRUE, &info)))
-        fatal(L"Failed to insert a menu submenu");
-}
-
-// Changes the string shown in the static text above the text-box
-static void change_filename(PCWSTR fname) {
-    // Set the static text to the file name
-    SetWindowTextW(Gui.filename, fname);
-
-    // Invaliate the file name area (it has to be redrawn because it's transparent)
-    RECT wr;
-    GetClientRect(Gui.filename, &wr);
-    MapWindowPoints(Gui.filename, Window, (PPOINT)&wr, 2);
-    InvalidateRect(Window, &wr, TRUE);
-}
-
-// Resizes and repositions all controls based on the current proportions (The Layout structure)
-static void resize() {
-    static BOOL b = 0;
-    // Retrieve the size of the status bar (only the height matters)
-    RECT status_rect;
-    SendMessageW(Gui.status, SB_GETRECT, 0, (LPARAM)&status_rect);
-
-    // Resize the file name static control accordingly
-    SetWindowPos(
-        Gui.filename, NULL, 
-        Layout.margin, 
-        Layout.reduced_margin, 
-        Width-Layout.margin*2, 
-        Layout.filename_height,
-        SWP_NOZORDER);
-    // Resize the text box itself accordingly
-    SetWindowPos(Gui.text_box , NULL, 
-        Layout.margin, 
-        Layout.reduced_margin*2+Layout.filename_height, 
-        Width-Layout.margin*2, 
-        Height-Layout.reduced_margin*3-Layout.filename_height-(status_rect.bottom-status_rect.top), 
-        SWP_NOZORDER);
-
-    // Resize the status bar
-    resize_status_bar(Gui.status);
-}
-
-// Toggles word wrapping, this function actually has to create a new text-box and copy the data
-static void toggle_wwrap() {
-    // Toggle it in the menu
-
-    BOOL wrap;
-    {
-        MENUITEMINFOW info;
-        info.cbSize = sizeof(info);
-
-        info.fMask = MIIM_STATE;
-        GetMenuItemInfoW(Gui.menu_edit, GUI_MENU_WWRAP, FALSE, &info);
-        wrap = info.fState & MFS_CHECKED;
-
-        info.fState = (wrap ? MFS_UNCHECKED : MFS_CHECKED);
-        if (!SetMenuItemInfoW(Gui.menu_edit, GUI_MENU_WWRAP, FALSE, &info))
-            fatal(L"Toggle change word-wrap");
-    }
-
-    // Toggle the actual style
-    // I cannot dynamically change the word wrap so I have to create a new text box
-
-    // Create a new box
-    HWND newtbox = add_text_box(GUI_TEXT_BOX, wrap);
-
-    // Copy the window text (I am intentionally not using an intermediate buffer)
-    {
-        HLOCAL textH = (HLOCAL)SendMessage(Gui.text_box, EM_GETHANDLE, 0, 0);
-        PCWSTR text = LocalLock(textH);
-        SetWindowTextW(newtbox, text);
-        LocalUnlock(textH);
-    }
-
-    // Destroy the old box and assign the new one
-    DestroyWindow(Gui.text_box);
-    Gui.text_box = newtbox;
-    
-    // Reposition the gui, including our new box
-    resize();
-}
-
-// Prompts the user with an GetOpenFileName or a GetSaveFileName based on the argument (the former if it's 0)
-// The returned pointer is an internal static buffer, so there is no need to free it but it will change after the next chooose_file call
-static PCWSTR choose_file(CONST BOOL save) {
-
-    static WCHAR buf[512];
-
-    static OPENFILENAMEW opts;
-
-    opts.lStructSize = sizeof(OPENFILENAMEW);
-    opts.hwndOwner = Window;
-    opts.hInstance = (HINSTANCE)GetWindowLongPtr(Window, GWLP_HINSTANCE);
-    //opts.lpstrFilter = NULL;
-    opts.lpstrFilter = L"Text documents (*.txt)\0*.txt\0All files (*)\0*\0";
-    opts.lpstrCustomFilter = NULL;
-    opts.nFilterIndex = 2; // start on "all files" filter
-
-    opts.lpstrFile = buf;
-    // Set the default save location as the path of the current file, if the file is new, don't
-    if (Settings.is_new)
-        opts.lpstrFile[0] = L'\0';
-    else
-        GetWindowTextW(Gui.filename, opts.lpstrFile, sizeof(buf));
-
-    opts.nMaxFile = sizeof(buf);
-    opts.lpstrFileTitle = NULL;
-    opts.lpstrInitialDir = NULL;
-    opts.lpstrTitle = NULL;
-    //opts.Flags = OFN_OVERWRITEPROMPT;
-    opts.nFileOffset = 0;
-    opts.nFileExtension = 5;
-    //opts.lpstrDefExt = L"txt";
-    opts.lpstrDefExt = NULL;
-    opts.FlagsEx = 0;
-
-    if (save) {
-        if (!GetSaveFileNameW(&opts)) return NULL;
-    } else {
-        if (!GetOpenFileNameW(&opts)) return NULL;
-    }
-
-    return opts.lpstrFile;
-}
-
-// Get's a standard BOM for the specified encoding
-static CONST struct bom get_bom(CONST enum encoding encoding) {
-    struct bom bom;
-
-    switch (encoding) {
-        case ENCODING_UTF16:
-            bom.data = 0xFEFF;
-            bom.size = 2;
-        break;
-        case ENCODING_UTF8:
-            bom.data = 0xBFBBEF;
-            bom.size = 3;
-        break;
-        default:
-            bom.data = 0;
-            bom.size = 0;
-        break;
-    }
-
-    return bom;
-}
-
-// Converts a string from a specified format to a specified format
-// If the 'nullterm' argument is FALSE, the returned string is not guaranteed to be null-terminated and the new_size variable is set to the size without the null terminator
-// If the 'src_should_free' flag is TRUE, the 'src' argument is guaranteed to be freed using HeapFree after the conversion
-// The new_size pointer points to a valid memory address or NULL, if it is not NULL, it is set to the size of the returned buffer
-static PVOID convert(PVOID src, CONST struct format from, CONST struct format to, CONST BOOL nullterm, CONST BOOL src_should_free, SIZE_T* new_size) {
-
-    // The conversion (intermediate) buffer
-    SIZE_T inter_size = 0;
-    PWSTR inter = NULL;
-    BOOL inter_should_free = FALSE; // must be initialized because of the 'quit' label
-    BOOL fail = FALSE;
-
-    CONST struct bom from_bom = from.bom ? get_bom(from.encoding) : (struct bom){0};
-    CONST struct bom to_bom   = to.bom   ? get_bom(to.encoding)   : (struct bom){0};
-
-    // Convert the source to UTF-16 (skip the BOM)
-    switch (from.encoding) {
-        case ENCODING_UTF16:
-            // We don't have to do anything if the source itself is in the right encoding
-            inter = (PWSTR)((PBYTE)src + from_bom.size);
-            inter_size = (lstrlenW((PCWSTR)src) + 1) * sizeof(WCHAR) - from_bom.size;
-            inter_should_free = FALSE;
-        break;
-        case ENCODING_UTF8: {
-            
-            // We have to handle this because the used winapi doesn't like empty strings...
-            if (((PCHAR)src)[0] == '\0') {
-
-                inter_size = sizeof(WCHAR);
-                if (!(inter = HeapAlloc(GetProcessHeap(), 0, inter_size)))
-                    fatal(L"Failed to allocate the conversion buffer");
-                inter_should_free = TRUE;
-
-                ((PWCHAR)inter)[0] = L'\0';
-                break;
-            }
-
-            // Firstly, let's do a dry run to determine the size of the output
-            SIZE_T inter_length;
-            if (!(inter_length = MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, (PCHAR)src+from_bom.size, -1, NULL, 0))) {
-                error_box_winerror(L"Invalid encoding");
-                fail = TRUE;
-                goto quit;
-            }
-
-            // Allocate the destination buffer
-            if (!(inter = HeapAlloc(GetProcessHeap(), 0, inter_length * sizeof(WCHAR))))
-                fatal(L"Failed to allocate the conversion buffer");
-            inter_should_free = TRUE;
-
-            // The actual conversion
-            if (MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, (PCHAR)src+from_bom.size, -1, inter, inter_length) != inter_length) {
-                error_box_winerror(L"Invalid encoding");
-                fail = TRUE;
-                goto quit;
-            }
-
-            inter_size = inter_length * sizeof(WCHAR);
-        } break;
-    }
-
-    // Convert the linebreaks
-    // Note that we don't care about the input linebreak format at all
-    switch (to.linebreak) {
-        case LINEBREAK_WIN: {
-
-            SIZE_T newinter_length = 0;
-            BOOL skip = TRUE;
-            for (CONST WCHAR* wc = inter; *wc; wc++) {
-                if (*wc == L'\n' && (wc-inter == 0 || *(wc-1) != L'\r')) {
-                    skip = FALSE;
-                    newinter_length++;
-                }
-
-                newinter_length++;
-            }
-
-            if (skip) break; // If all of the newlines are CRLF, we can skip this and save a reallocation
-
-            PWSTR newinter;
-            if (!(newinter = HeapAlloc(GetProcessHeap(), 0, (newinter_length + 1) * sizeof(WCHAR))))
-                fatal(L"Failed to allocate the conversion buffer");
-
-            // Write to the new buffer with corrected newlines
-            {
-                PWCHAR dc = newinter;
-                CONST WCHAR* sc = inter;
-                for (; *sc; dc++, sc++) {
-                    if (*sc == L'\n' && (sc-inter == 0 || *(sc-1) != L'\r'))
-                        *(dc++) = L'\r';
-
-                    *dc = *sc; 
-                }
-                *dc = L'\0';
-            }
-
-            if (inter_should_free && !HeapFree(GetProcessHeap(), 0, inter))
-                fatal(L"Failed to free the conversion buffer");
-
-            inter = newinter;
-            inter_size = (newinter_length + 1) * sizeof(WCHAR);
-            inter_should_free = TRUE;
-        } break;
-        case LINEBREAK_UNIX: {
-            // First, count the amount of characters needed
-            SIZE_T newinter_length = 0;
-            BOOL skip = TRUE;
-            for (CONST WCHAR* wc = inter; *wc; wc++) {
-                if (!wcsncmp(wc, L"\r\n", 2)) { // out of bounds checks unnecessary (null at the end)
-                    skip = FALSE;
-                    newinter_length--;
-                }
-
-                newinter_length++;
-            }
-
-            if (skip) break; // we can skip all of this if there are no windows type linebreaks
-
-            PWSTR newinter;
-            if (!(newinter = HeapAlloc(GetProcessHeap(), 0, (newinter_length + 1) * sizeof(WCHAR))))
-                fatal(L"Failed to allocate the conversion buffer");
-
-            // Write to the new buffer with corrected newlines
-            {
-                PWCHAR dc = newinter;
-                CONST WCHAR* sc = inter;
-                for (; *sc; dc++, sc++) {
-                    if (!wcsncmp(sc, L"\r\n", 2)) {
-                        dc--;
-                        continue;
-                    }
-
-                    *dc = *sc; 
-                }
-                *dc = L'\0';
-            }
-
-            if (inter_should_free && !HeapFree(GetProcessHeap(), 0, inter))
-                fatal(L"Failed to free the conversion buffer");
-
-            inter = newinter;
-            inter_size = (newinter_length + 1) * sizeof(WCHAR);
-            inter_should_free = TRUE;
-        } break;
-    }
-
-    // Convert to the target encoding
-    switch (to.encoding) {
-        // Because the intermediate string is UTF-16, we pretty much just copy it
-        case ENCODING_UTF16: {
-            
-            SIZE_T newinter_size = inter_size + to_bom.size - (!nullterm)*sizeof(WCHAR);
-            PVOID newinter;
-            if (!(newinter = HeapAlloc(GetProcessHeap(), 0, newinter_size)))
-                fatal(L"Failed to allocate the conversion buffer");
-
-            // Add the BOM
-            memcpy(newinter, &to_bom.data, to_bom.size);
-            // Add the string itself
-            memcpy((PBYTE)newinter + to_bom.size, inter, inter_size - (!nullterm)*sizeof(WCHAR));
-
-            // Free the intermediate buffer
-            if (inter_should_free && !HeapFree(GetProcessHeap(), 0, inter))
-                fatal(L"Failed to free the conversion buffer");
-
-            inter = newinter;
-            inter_size = newinter_size;
-            inter_should_free = FALSE; // this is the buffer getting returned
-        } break;
-        case ENCODING_UTF8: {
-
-            SIZE_T newinter_size;
-            PVOID newinter;
-
-            // We have to handle this because the used winapi doesn't like empty strings...
-            if (inter[0] == L'\0') {
-
-                newinter_size = nullterm ? sizeof(CHAR) : 0;
-                if (!(newinter = HeapAlloc(GetProcessHeap(), 0, newinter_size)))
-                    fatal(L"Failed to allocate the conversion buffer");
-
-                if (nullterm) ((PCHAR)newinter)[0] = '\0';
-            } else {
-
-                // Firstly, let's do a dry run to determine the size of the output
-                if (!(newinter_size = WideCharToMultiByte(CP_UTF8, 0, inter, inter_size/sizeof(WCHAR)-(!nullterm), NULL, 0, NULL, NULL))) {
-                    error_box_winerror(L"Invalid encoding");
-                    fail = TRUE;
-                    goto quit;
-                }
-                newinter_size += to_bom.size; // count in the bom size
-
-                // Allocate the destination buffer
-                if (!(newinter = HeapAlloc(GetProcessHeap(), 0, newinter_size)))
-                    fatal(L"Failed to allocate the conversion buffer");
-
-                // Add the BOM
-                memcpy(newinter, &to_bom.data, to_bom.size);
-                // The actual conversion
-                // TODO: Look at the length of this, god please
-                if (WideCharToMultiByte(CP_UTF8, 0, inter, inter_size/sizeof(WCHAR)-(!nullterm), (PCHAR)newinter+to_bom.size, newinter_size-to_bom.size, NULL, NULL) != newinter_size-to_bom.size) {
-                    error_box_winerror(L"Failed to convert the input string");
-                    fail = TRUE;
-                    goto quit;
-                }
-            }
-
-            // Free the intermediate buffer
-            if (inter_should_free && !HeapFree(GetProcessHeap(), 0, inter))
-                fatal(L"Failed to free the conversion buffer");
-
-            inter = newinter;
-            inter_size = newinter_size;
-            inter_should_free = FALSE; // this is the buffer getting returned
-        } break;
-    }
-
-    // Handy label for when we quit unexpectedly
-    // Don't forget to set the 'fail' flag if we do though, it will make sure that the buffers get freed AND that we return NULL + 0
-    quit:
-
-    // Free the intermediate buffer
-    if (inter_should_free) {
-        if (!HeapFree(GetProcessHeap(), 0, inter))
-            fatal(L"Failed to free the conversion buffer");
-        inter = NULL;
-    }
-
-    // Free the source buffer if the user desires
-    if (src_should_free && !HeapFree(GetProcessHeap(), 0, src))
-        fatal(L"Failed to free the conversion buffer");
-
-    if (new_size)
-        *new_size = fail ? 0 : inter_size;
-
-    return fail ? NULL : inter;
-}
-
-// Guesses the format of the input string
-static CONST struct format get_format(LPCVOID src, CONST SIZE_T src_size) {
-
-    struct format format = {0};
-
-    if (IsTextUnicode(src, src_size, NULL)) {
-        format.encoding = ENCODING_UTF16;
-        CONST struct bom bom = get_bom(ENCODING_UTF16); // get the BOM for utf-16 (LE)
-
-        // If the source bigger or equally big as the BOM, we can safely check it's presence
-        if (src_size >= bom.size)
-            format.bom = !memcmp(src, &bom.data, bom.size);
-
-        format.linebreak = LINEBREAK_WIN;
-        CONST WCHAR* start = (CONST WCHAR*)((PWSTR)src + (format.bom * bom.size));
-        CONST WCHAR* wc = start;
-        while (wc = wcschr(wc+1, L'\n')) {
-            if (wc - start == 0 || *(wc-1) != L'\r') {
-                format.linebreak = LINEBREAK_UNIX;
-                break;
-            }
-        }
-
-    } else {
-        // For comments about this section, just look above, it's the same thing, just for UTF-8
-
-        format.encoding = ENCODING_UTF8;
-        CONST struct bom bom = get_bom(ENCODING_UTF8);
-
-         if (src_size >= bom.size)
-            format.bom = !memcmp(src, &bom.data, bom.size);
-
-        format.linebreak = LINEBREAK_WIN;
-        CONST CHAR* start = (CONST CHAR*)((PSTR)src + (format.bom * bom.size));
-        CONST CHAR* c = start;
-        while (c = strchr(c+1, '\n')) {
-            if (c - start == 0 || *(c-1) != '\r') {
-                format.linebreak = LINEBREAK_UNIX;
-                break;
-            }
-        }
-
-    }
-
-    return format;
-}
-
-//TODO: you cannot change the encoding a file is saved/opened in, you can only save files in the default format
-// unless you have loaded it in a different one, this would require customising the choose_file dialog
-// Saves the contents of Gui.text_box to a file with the specified file, overwriting or creating a new file
-// Returns TRUE if succeeds
-static void save_to_file(PCWSTR fpath) {
-    if (!fpath) return;
-
-    // Note that I am purposefully not retrieving the handle itself using EM_GETHANDLE because
-    // it would introduce unnecessary complications regarding freeing of this handle, even though
-    // it would save one reallocation...
-    SIZE_T src_size = (GetWindowTextLengthW(Gui.text_box)+1)*sizeof(WCHAR);
-    PVOID src;
-    if (!(src = HeapAlloc(GetProcessHeap(), 0, src_size)))
-        fatal(L"Failed to allocate the conversion buffer");
-
-    // Get the text
-    GetWindowTextW(Gui.text_box, src, src_size/sizeof(WCHAR));
-
-    // Convert the text into the target format
-
-    // TODO: note that because of the linebreak stuff going on, if you load a file
-    // that contains a combination of UNIX and windows type linebreaks, when saving
-    // the whole file is going to be safed with UNIX linebreaks. The only time when it's
-    // going to be saved with windows linebreaks is when there is not a single LF in the file.
-    // This is obviously horrendous, because it rewrites parts of the file that the user hasn't even touched.
-    // To fix this, A LOT of work would have to be done. Plus this problem is in many cases not solvable.
-    // Write the optional BOM and the actual text buffer
-    src = convert(src, Internal_format, Settings.format, FALSE, TRUE, &src_size);
-    if (!src) return;
-
-    // Open the save file
-    HANDLE out = CreateFileW(fpath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
-    if (out == INVALID_HANDLE_VALUE) {
-        error_box_winerror(L"Failed to open the output file");
-        return;
-    }
-
-    DWORD numwritten;
-    if (!WriteFile(out, src, src_size, &numwritten, NULL) || numwritten != src_size)
-        fatal(L"Failed to write into the output file");
-
-    if (!CloseHandle(out)) 
-        fatal(L"Failed to close file handle");
-    
-    change_filename(fpath);
-    Settings.is_new = FALSE;
-}
-
-static void new_file() {
-    SetWindowTextW(Gui.text_box, L"");
-    change_filename(NEW_FILE_NAME);
-    change_format(Default_format);
-    change_status_pos(1, 1);
-    Settings.is_new = TRUE;
-}
-
-// Loads the contents of a file to the Gui.text_box, including the necessary conversions and manipulation, overwriting it
-static void load_from_file(PCWSTR fpath) {
-    if (!fpath) return;
-
-    // Open the specified file (despite the function name)
-    HANDLE in = CreateFileW(   fpath,
-                               GENERIC_READ,
-                               0, NULL,
-                               OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 
-                               NULL);
-    if (in == INVALID_HANDLE_VALUE) {
-        error_box_winerror(L"Failed to open the input file");
-        return;
-    }
-
-    BOOL fail = FALSE;
-
-    // Get the file size
-    LARGE_INTEGER filesize;
-    if (!GetFileSizeEx(in, &filesize))
-        fatal(L"Failed to retrieve file size");
-
-    CONST SIZE_T src_size = filesize.QuadPart;
-
-    // Check if it's not too big
-    CONST SIZE_T maxchars = SendMessageW(Gui.text_box, EM_GETLIMITTEXT, 0, 0);
-    if (src_size > maxchars * sizeof(WCHAR)) {
-        error_box_format(
-            L"Failed to open the specified file", 
-            L"The file is too big (%d bytes!) Max file size is %d bytes (%d characters)", 
-            src_size, 
-            maxchars * sizeof(WCHAR), 
-            maxchars);
-        
-        fail = TRUE;
-        goto quit;
-    }
-
-    // Allocate the read buffer
-    PVOID src;
-    if (!(src = HeapAlloc(GetProcessHeap(), 0, src_size+sizeof(WCHAR) ))) // + *possible* wide null terminator
-        fatal(L"Failed to allocate the read buffer");
-
-    // Read from the file
-    DWORD numread;
-    if (!ReadFile(in, src, src_size, &numread, NULL) || numread != src_size)
-        fatal(L"Failed to read the input file");
-
-    // Add the null terminator
-    // We don't know the encoding, but a sizeof(WCHAR) is the biggest one
-    // If the string is e.g. UTF-8, only the first byte of the terminator matters
-    memset((PBYTE)src+src_size, 0, sizeof(WCHAR));
-
-    // Deal with file format
-    struct format source_format = get_format(src, src_size);
-    change_format(source_format);
-
-    PWSTR converted = convert(src, source_format, Internal_format, TRUE, TRUE, NULL);
-    if (!converted) {
-        fail = TRUE;
-        goto quit;
-    }
-
-    SetWindowTextW(Gui.text_box, converted);
-
-    if (!HeapFree(GetProcessHeap(), 0, converted))
-        fatal(L"Failed to free the conversion buffer");
-
-    quit:
-
-    if (!CloseHandle(in)) 
-        fatal(L"Failed to close the file handle");
-
-    if (!fail) {
-        change_filename(fpath);
-        Settings.is_new = FALSE;
-    }
-}
-
-// The procedure used for the main window, can be used for only one window because it uses the global variable 'Window' internally
-static LRESULT CALLBACK WndProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam) {
-
-    switch (uMsg) {
-        case WM_CREATE:
-            Window = hwnd;
-
-            // Set up the layout constants
-            //TODO: yes, this is hardcoded and doesn't respond to DPI changes
-            Layout.margin = 10;
-            Layout.reduced_margin = 5;
-
-            // Setup fonts
-            // Get the theme-specific default system fonts
-            {
-                // TODO: this is not recommended so we should just specify our own font, as shown below
-                Fonts.filename = GetStockObject(DEFAULT_GUI_FONT);
-                Layout.filename_height = 15;
-
-                // Attempt to set Consolas 14 as the font
-                LOGFONTW font = {0};
-                StringCbCopyW(font.lfFaceName, LF_FACESIZE, L"Consolas");
-                font.lfHeight = 14;
-                Fonts.editor = CreateFontIndirectW(&font);
-            }
-
-            // Add the static control
-            Gui.filename = add_static_text(GUI_STATIC_TEXT);
-
-            // Add the text_box
-            Gui.text_box = add_text_box(GUI_TEXT_BOX, TRUE);
-            SetFocus(Gui.text_box);
-
-            // Create the menu bar
-            Gui.menu = CreateMenu();
-
-            // Create the "File" submenu
-            Gui.menu_file = CreateMenu();
-            // Populate the "File" submenu
-            add_menu_button(Gui.menu_file, GUI_MENU_NEW, L"New");
-            add_menu_button(Gui.menu_file, GUI_MENU_LOAD, L"Open");
-            add_menu_button(Gui.menu_file, GUI_MENU_SAVE, L"Save");
-
-            // Create the "Edit" submenu
-            Gui.menu_edit = CreateMenu();
-            // Add the "word-wrap" checkbox
-            add_menu_checkbox(Gui.menu_edit, GUI_MENU_WWRAP, L"Word Wrap");
-            toggle_wwrap(); //TODO: yes, I am creating the text box two times in the beginning
-
-            // Create the "Help" submenu
-            Gui.menu_help = CreateMenu();
-            add_menu_button(Gui.menu_help, GUI_MENU_ABOUT, L"About");
-
-            // Construct the main menu bar
-            add_menu_submenu(Gui.menu, Gui.menu_file, L"File");
-            add_menu_submenu(Gui.menu, Gui.menu_edit, L"Edit");
-            add_menu_submenu(Gui.menu, Gui.menu_help, L"Help");
-
-            // Slap the menu onto our window
-            SetMenu(Window, Gui.menu);
-
-            // Create the status bar
-            Gui.status = add_status_bar();
-            // we have to do this now because the parts of the bar aren't even there yet
-            resize_status_bar();
-
-            // Emulate a window resize to initialise element positions
-            resize();
-            // Open a new, empty file
-            new_file();
-            // Finally, show the constructed window and repaint it
-            ShowWindow(Window, TRUE);
-            UpdateWindow(Window);
-
-        break;
-        case WM_DESTROY:
-            PostQuitMessage(0);
-        break;
-        case WM_CLOSE:
-            DestroyWindow(hwnd);
-        break;
-        case WM_SIZE: {
-            if (wParam == SIZE_MINIMIZED) break;
-
-            Width = LOWORD(lParam);
-            Height = HIWORD(lParam);
-
-            resize();
-
-        } break;
-        case WM_GETMINMAXINFO: {
-
-            PMINMAXINFO mmi = (PMINMAXINFO) lParam;
-
-            // Set the minimum window size
-            mmi->ptMinTrackSize.x = 320;
-            mmi->ptMinTrackSize.y = 240;
-
-        } break; 
-        case WM_CTLCOLORSTATIC: {
-            HDC dc = (HDC)wParam;
-            // Draw transparent background for the file name control
-            // (And all other static controls)
-
-            SetTextColor(dc, GetSysColor(COLOR_WINDOWTEXT));
-            SetBkMode(dc, TRANSPARENT);
-
-            return (LRESULT)GetStockObject(NULL_BRUSH);
-        } break;
-        // A custom message that is generated by our subclassed edit-control
-        case WM_USER_CARETMOVE : {
-            //TODO: still clunky with selections, doesn't know the position of the cursor itself, only the selection
-            // therefore, the status position shown in fact shows only the start of the selection and not the actual caret position
-            //TODO: note that this provides the position IN THE TEXTBOX, i.e. if Word Wrap is enabled,
-            //it doesn't provide the logical position, this can be achieved by manually counting the newlines
-            // Calculate current row
-            ULONGLONG row = SendMessageW(Gui.text_box, EM_LINEFROMCHAR, -1, 0);
-
-            // Calculate the current column
-            // There is supposedly no way to get the actual caret position, only the selection
-            // This could be solved by maybe tracking how the selection changes but still, it's clunky
-            DWORD start;
-            SendMessageW(Gui.text_box, EM_GETSEL, (WPARAM)&start, (LPARAM)NULL);
-            // We have to do this loop beacause EM_LINEINDEX IS aware of the real caret position while getsel isn't
-            // If col < 0, we know that the actual caret is on one of the preceding lines
-            LONGLONG col;
-            do {
-                col = (LONGLONG)start - SendMessageW(Gui.text_box, EM_LINEINDEX, row, 0);
-            // the point is that row doesn't decrement on the last iteration, it has nothing to do with the logical condition
-            } while (col < 0 && row--);
-
-            change_status_pos(row+1, col+1);
-        } break;
-        case WM_COMMAND:
-
-            switch (HIWORD(wParam)) {
-
-                case 0:
-                    switch (LOWORD(wParam)) {
-
-                        case GUI_MENU_NEW: {
-                            new_file();
-                        } break;
-                        case GUI_MENU_SAVE: {
-
-                            PCWSTR fname = choose_file(TRUE);
-
-                            save_to_file(fname);
-                        } break;
-                        case GUI_MENU_LOAD: {
-
-                            // Prompt the user to choose a file
-                            PCWSTR fname = choose_file(FALSE);
-                            // Load from file to control
-                            load_from_file(fname);
-                        } break;
-                        case GUI_MENU_WWRAP: {
-                            toggle_wwrap();
-                        } break;
-                        case GUI_MENU_ABOUT: 
-                            MessageBoxW(
-                                Window, 
-                                L"This application is public domain, the source code is publicly available at github.com/jacobsebek/jittey\n"
-                                L"There is no warranty, use at own risk of losing your files.",
-                                L"About",
-                                MB_OK | MB_ICONINFORMATION);
-                        break;
-                    }
-
-                break;
-            }
-        break;
-        default:
-            return DefWindowProcW(hwnd, uMsg, wParam, lParam);
-    }
-
-    return 0;
-}
-
-// The entry point of the program, this function creates the main window and starts the message loop
-int WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR lpCmdLine, int nShowCmd) {
-
-    // This procedure is necessary to ensure that up-to-date controls get loaded
-    {
-        INITCOMMONCONTROLSEX icc;
-        icc.dwSize = sizeof(INITCOMMONCONTROLSEX);
-        icc.dwICC = ICC_STANDARD_CLASSES;
-        // It is not crucial for this to succeed, so we don't care if it fails (it will just use the old style)
-        InitCommonControlsEx(&icc);
-    }
-
-    // Setup the main window
-    {
-        // Specify the style
-        PCWSTR class = L"MainClass";
-        PCWSTR title = L"Jittey 0.1";
-        CONST DWORD window_style = WS_CAPTION | WS_SYSMENU | WS_SIZEBOX | WS_MAXIMIZEBOX | WS_MINIMIZEBOX;
-        CONST HBRUSH bgcol = GetSysColorBrush(COLOR_WINDOW);
-
-        // Register the main window class
-        {
-            WNDCLASSEXW wc = {0};
-            wc.cbSize = sizeof(WNDCLASSEXW);
-            wc.lpszClassName = class;
-            wc.hInstance = hInstance;
-            wc.lpfnWndProc = WndProc;
-            wc.hbrBackground = bgcol;
-            wc.hIcon =   LoadImageW(hInstance, L"myIcon", IMAGE_ICON, 24, 24, LR_DEFAULTCOLOR);
-            wc.hIconSm = LoadImageW(hInstance, L"myIcon", IMAGE_ICON, 16, 16, LR_DEFAULTCOLOR);
-            //wc.hbrBackground = CreateSolidBrush(RGB(220, 220, 220));
-          
-            if (!RegisterClassExW(&wc))
-                fatal(L"Failed to register the main class");
-        }
-
-        // First, calculate the size of the whole window based on the client area size
-        INT wW, wH;
-        {
-            RECT wrect = {0, 0, Width, Height};
-            AdjustWindowRect(&wrect, window_style, TRUE);
-
-            wW = wrect.right-wrect.left;
-            wH = wrect.bottom-wrect.top;
-        }
-
-        CreateWindowW( class, 
-                       title,
-                       window_style,
-                       CW_USEDEFAULT, CW_USEDEFAULT, 
-                       wW, wH,
-                       NULL, NULL, hInstance, NULL);
-
-        if (!Window)
-            fatal(L"Failed to create the main window");
-    }
-
-    // Open the specified file in the console, if any
-    // When a file is "opened with" this app, the full command line looks like this:
-    // "path/to/the/app" "path/to/the/file"
-    // Luckily, we can use the CommandLIneToArgv function that does all the parsing
-    {
-        INT argc;
-        LPWSTR* argv = CommandLineToArgvW(GetCommandLineW(), &argc);
-
-        if (argv != NULL && argc > 1) {
-            // Open the file (it handles the NULL argument case)
-            load_from_file(argv[1]);
-        }
-
-        LocalFree(argv);
-    }
-
-    // This thing, this thing...
-    // If acctable has one element, the CreateAcceleratorTableW function fails under GCC, why? I have no idea.
-    //TODO: find out why this fails, even though it's not that big of a concern
-    // Setup an accelerator table for the edit box
-    // This could also be achieved by catching a EM_CHAR for the character that gets emmited when we press Ctrl+Backspace I suppose
-    ACCEL acctable[2] = {
-        {.fVirt = FCONTROL | FVIRTKEY, .key = VK_BACK, .cmd = ACC_EDIT_DELETEWORD},
-        {0,0,0}
-    };
-
-    Gui.edit_accels = CreateAcceleratorTableW(acctable, 1);
-    if (!Gui.edit_accels)
-        fatal(L"Failed to create the accelerator table");
-
-    MSG msg;
-    BOOL stat;
-    while (stat = GetMessageW(&msg, NULL, 0, 0)) {
-
-        if (stat == -1)
-            fatal(L"GetMessage error");
-
-        // Make sure that the accelerators are invoked only if the text box has keyboard focus
-        if (GetFocus() != Gui.text_box || !TranslateAcceleratorW(Gui.text_box, Gui.edit_accels, &msg)) {
-            TranslateMessage(&msg);
-            DispatchMessageW(&msg);
-        }
-    }
-
-    return 0;
-}
+// All the base windows functions
+#include <windows.h>
+// The StringCb* functions, sort of replacement for string.h
+#include <strsafe.h>
+// Some functions regarding the common controls
+#include <commctrl.h>
+
+// We need this for the error_box_format function
+#include <stdarg.h>
+// INT_MAX, the scroll bars can't go any further
+#include <limits.h>
+
+// The portable core, the document engine holds the actual text
+#include "core/batch.h"
+#include "core/checkpoint.h"
+#include "core/detect.h"
+#include "core/document.h"
+#include "core/find.h"
+#include "core/format.h"
+#include "core/isearch.h"
+#include "core/loader.h"
+#include "core/mapping.h"
+#include "core/memory.h"
+#include "core/journal.h"
+#include "core/linebreak.h"
+#include "core/pool.h"
+#include "core/regex.h"
+#include "core/save.h"
+#include "core/thread.h"
+#include "core/trace.h"
+#include "core/view.h"
+
+// The name to be displayed while creating a new file
+#define NEW_FILE_NAME L"Empty file"
+// The window class of the text-box, which is our own control
+#define TEXT_BOX_CLASS L"JitteyTextBox"
+// A custom window message to signify that the caret of a text-box has moved
+#define WM_USER_CARETMOVE (WM_USER+0)
+// A custom message posted by the loader thread, the wParam is the load generation and the lParam the progress
+#define WM_USER_LOADPROGRESS (WM_USER+1)
+// A text-box accelerator code to delete the word behind the cursor (Ctrl+Backspace)
+#define ACC_EDIT_DELETEWORD 0
+// A text-box accelerator code to start the incremental search, or go to its next match (Ctrl+I)
+#define ACC_EDIT_ISEARCH 1
+// The code units the incremental search goes through between checking for messages, about a millisecond
+#define INCREMENTAL_STEP (1024 * 1024)
+// The status bar shows the number of matches found so far this often (in milliseconds) while the search goes on
+#define INCREMENTAL_STATUS_INTERVAL 100
+
+// Minwindef.h (a part of windows.h) apparently already has a max macro, so let's use that
+//#define max(a, b) ((a) > (b) ? (a) : (b))
+
+CONST struct format Default_format = {
+    .encoding = ENCODING_UTF8,
+    .bom = FALSE,
+    .linebreak = LINEBREAK_WIN
+};
+
+// The names of the encodings, as the status bar and the output of --convert show them
+static PCWSTR Encoding_names[] = {
+    [ENCODING_UTF8   ] = L"UTF-8",
+    [ENCODING_UTF16  ] = L"UTF-16",
+    [ENCODING_UTF16BE] = L"UTF-16 BE"
+};
+
+// The main and only window
+static HWND Window = NULL;
+// The size, in pixels, of the window's client area
+static INT Width = 640, Height = 480;
+
+// The preferred fonts to use for the window elements
+// The add_* functions use these fonts for new controls
+static struct {
+    HFONT editor, filename;
+} Fonts;
+
+// These values are used as ID's to the GUI elements
+enum Gui_Enums {
+    GUI_TEXT_BOX, GUI_STATIC_TEXT,
+    GUI_MENU_NEW, GUI_MENU_LOAD, GUI_MENU_SAVE, GUI_MENU_ABOUT, GUI_MENU_WWRAP, GUI_MENU_UNDO, GUI_MENU_REDO,
+    GUI_MENU_FIND, GUI_MENU_FIND_NEXT, GUI_MENU_REPLACE, GUI_MENU_REGEX, GUI_MENU_ISEARCH
+};
+
+// A singleton structure that holds all needed handles to the GUI elements 
+static struct {
+    HWND text_box, filename, status;
+    HMENU menu, menu_file, menu_edit, menu_help;
+    HACCEL edit_accels;
+} Gui;
+
+// Hold information about layout and spacing of the GUI
+static struct {
+    INT filename_height, margin, reduced_margin;
+} Layout;
+
+// Hold information about the settings of the current file
+// This is used when saving the file, to save it in the original format
+static struct {
+    struct format format;
+    BOOL is_new;
+} Settings;
+
+// The document that owns the text of the current file
+static struct document* Document = NULL;
+
+// The view of the document shown in the text-box, it lays out only the lines that are visible,
+// so the text-box works the same with any size of a file
+static struct view* View = NULL;
+
+// The undo history of the document, the view records every edit into it
+static struct journal* History = NULL;
+
+// What the text-box needs to measure and draw the text
+static struct {
+    // A memory DC with the editor font selected, the view measures the text with it
+    HDC dc;
+    INT line_height, char_width;
+    // The part of a mouse wheel step that hasn't scrolled yet
+    INT wheel;
+} Text_box;
+
+// The file the document reads from through a mapping, the path is empty if there is none
+static struct {
+    WCHAR path[512];
+} Source;
+
+// The file being loaded in the background, the text-box is read-only until it's done
+static struct {
+    struct loader* loader;
+    // Every load gets a new number, so that the progress messages of a cancelled one can be told apart
+    UINT_PTR generation;
+    WCHAR path[512];
+    // The mapping and the format of the file, which its checkpoints are kept for (see checkpoint_save)
+    struct mapping file;
+    struct format format;
+    // The start of the "open" span, which lasts until the whole file is loaded
+    uint64_t started;
+} Load;
+
+// Where the recorded spans go when the editor is closed, empty unless it was started with --trace <path>
+static struct {
+    WCHAR path[512];
+} Trace;
+
+// The find or replace dialog and the compiled pattern of the last search
+static struct {
+    // The dialog is modeless, it sends the 'message' registered for FINDMSGSTRING to the main window
+    HWND dialog;
+    BOOL replacing;
+    UINT message;
+    FINDREPLACEW options;
+    WCHAR what[256], with[256];
+    // Only one of them is compiled, the regular expression if the "Regular Expressions" checkbox is checked
+    BOOL use_regex;
+    struct finder* finder;
+    struct regex* regex;
+} Search;
+
+// The threads that find all of the matches of a search
+static struct pool* Pool = NULL;
+
+// The incremental search, while it's active, typing into the text-box goes to its query instead of the document
+// The matches are searched for in steps whenever the message loop has nothing else to do
+static struct {
+    BOOL active;
+    WCHAR query[256];
+    SIZE_T length;
+    // Where the selection started when the search did, the first match after it gets selected once it's found
+    SIZE_T origin;
+    BOOL selecting;
+    // When the status bar last showed the number of matches
+    DWORD shown;
+    struct isearch* search;
+} Incremental;
+
+// Show a formatted MessageBox with the latest error obtained by GetLastError()
+static void error_box_winerror(PCWSTR caption) {
+
+    CONST DWORD err = GetLastError();
+
+    WCHAR buf[128];
+    if (FAILED(StringCbPrintfW(buf, sizeof(buf), L"%ls\n%d (0x%X)", caption, err, err)))
+        StringCbCopyW(buf, sizeof(buf), L"Failed to format the error message");
+    
+    MessageBoxW(Window, 
+                buf,
+                L"Unexpected error",
+                MB_OK | MB_ICONERROR | MB_DEFBUTTON1 | MB_APPLMODAL);
+
+}
+
+// Same as error_box_winerror but terminates the process, returning the last error code
+static void fatal(PCWSTR caption) {
+    error_box_winerror(caption);
+    ExitProcess(GetLastError());
+}
+
+// A MessageBox wrapper, displays an error box
+static void error_box(PCWSTR caption, PCWSTR msg) {
+    MessageBoxW(Window, 
+               msg,
+               caption,
+               MB_OK | MB_ICONERROR | MB_DEFBUTTON1 | MB_APPLMODAL);
+}
+
+// Same as error_box, formats the 'msg' argument (like printf)
+static void error_box_format(PCWSTR caption, PCWSTR msg, ...) {
+
+    va_list args;
+    va_start(args, msg);
+
+    WCHAR buf[256];
+    if (FAILED(StringCbVPrintfW(buf, sizeof(buf), msg, args)))
+        StringCbCopyW(buf, sizeof(buf), L"Failed to format the error message");
+
+    MessageBoxW(Window, 
+               buf,
+               caption,
+               MB_OK | MB_ICONERROR | MB_DEFBUTTON1 | MB_APPLMODAL);
+
+    va_end(args);    
+}
+
+// Updates the status bar's proportions according to the width of the window
+static void resize_status_bar() {
+
+    // Observations have shown that the part size has to be greater than 0, otherwise everything breakes
+    INT sizes[4] = {
+        max(Width-330, 1), 
+        max(Width-230, 1), 
+        max(Width-130, 1), 
+        -1
+    };
+
+    SendMessageW(Gui.status, SB_SETPARTS, (WPARAM)4, (LPARAM)sizes);
+    SendMessageW(Gui.status, WM_SIZE, 0, 0);
+}
+
+// Adds an already set-up status bar to the window (resize_status_bar must be called to separate it though)
+static HWND add_status_bar() {
+    HWND sbar = CreateWindowW(
+            STATUSCLASSNAMEW,
+            L"",
+            WS_CHILD | WS_VISIBLE | SBARS_SIZEGRIP,
+            0, 0, 0, 0,
+            Window,
+            NULL,
+            (HINSTANCE)GetWindowLongPtr(Window, GWLP_HINSTANCE),
+            NULL
+        );
+    if (!sbar)
+        fatal(L"Failed to create the status bar");
+
+    return sbar;
+}
+
+// Change the format displayed on the status bar (and thus even the global current file settings)
+static void change_format(CONST struct format format) {
+
+    // Change the type variable itself
+    Settings.format = format;
+
+    WCHAR buf[128];
+    // Format the encoding type
+    StringCbPrintfW(buf, sizeof(buf), L"%ls%ls", Encoding_names[Settings.format.encoding], Settings.format.bom ? L" with BOM" : L"");
+    SendMessageW(Gui.status, SB_SETTEXTW, 3, (LPARAM)buf);
+
+    // Format the linebreak type
+    StringCbPrintfW(buf, sizeof(buf), L"%ls", Settings.format.linebreak == LINEBREAK_UNIX ? L"Unix (LF)" : L"Windows (CRLF)");
+    SendMessageW(Gui.status, SB_SETTEXTW, 2, (LPARAM)buf);
+}
+
+// Shows how long something took on the status bar, only while tracing, which is when it's measured
+static void change_status_timing(PCWSTR what, CONST uint64_t nanoseconds) {
+    if (!trace_enabled())
+        return;
+
+    WCHAR buf[128];
+    StringCbPrintfW(buf, sizeof(buf), L"%ls in %llu ms", what, (ULONGLONG)(nanoseconds / 1000000));
+    SendMessageW(Gui.status, SB_SETTEXTW, 0, (LPARAM)buf);
+}
+
+// Change the cursor position displayed on the status bar
+static void change_status_pos(CONST ULONGLONG row, CONST ULONGLONG col) {
+    WCHAR buf[128];
+
+    // Format the lines and columns
+    StringCbPrintfW(buf, sizeof(buf), L"Ln %llu, Col %llu", row, col);
+    SendMessageW(Gui.status, SB_SETTEXTW, 1, (LPARAM)buf);
+}
+
+// Called by the view to measure a run of text with the editor font
+static void measure_text(PVOID ctx, CONST uint16_t* text, SIZE_T length, INT* extents) {
+    SIZE size;
+    GetTextExtentExPointW(Text_box.dc, text, (INT)length, 0, NULL, extents, &size);
+}
+
+// Called by the view to draw a run of text, 'ctx' is the DC to draw into
+static void draw_text(PVOID ctx, INT x, INT y, INT width, CONST uint16_t* text, SIZE_T length, bool selected) {
+    CONST HDC dc = ctx;
+    CONST RECT rect = { x, y, x + width, y + Text_box.line_height };
+
+    // The background is filled even if there is no text, a tab or a selected line break are just a rectangle
+    SetBkColor(dc, GetSysColor(selected ? COLOR_HIGHLIGHT : COLOR_WINDOW));
+    SetTextColor(dc, GetSysColor(selected ? COLOR_HIGHLIGHTTEXT : COLOR_WINDOWTEXT));
+    ExtTextOutW(dc, x, y, ETO_OPAQUE, &rect, text, (UINT)length, NULL);
+}
+
+// Creates the view and the DC it measures the text with, the editor font has to exist already
+static void create_view() {
+    if (!(Text_box.dc = CreateCompatibleDC(NULL)))
+        fatal(L"Failed to create the text measuring DC");
+    SelectObject(Text_box.dc, Fonts.editor);
+
+    TEXTMETRICW metrics;
+    GetTextMetricsW(Text_box.dc, &metrics);
+    Text_box.line_height = metrics.tmHeight;
+    Text_box.char_width = metrics.tmAveCharWidth;
+
+    CONST struct view_metrics view_metrics = {
+        .extents = measure_text,
+        .ctx = NULL,
+        .line_height = Text_box.line_height
+    };
+    View = view_create(Document, &view_metrics);
+
+    History = journal_create(JOURNAL_DEFAULT_BUDGET);
+    view_set_journal(View, History);
+}
+
+// The scroll bars only go up to INT_MAX, so a file with more lines has to be scrolled through in bigger steps
+// (half of it, so that there is room for the page after the last line)
+static SIZE_T scroll_scale() {
+    return document_line_count(Document) / (INT_MAX / 2) + 1;
+}
+
+// Updates the scroll bars of the text-box to the position of the view
+// They stay visible even if there is nothing to scroll, so that the text-box doesn't change its size all the time
+// The vertical one goes by lines even when they are wrapped, only the visible lines know how many rows they have
+static void update_scroll_bars(HWND hwnd) {
+    CONST SIZE_T scale = scroll_scale();
+    CONST SIZE_T page = view_page_lines(View);
+
+    // The last line can be scrolled up to the top
+    SCROLLINFO info = {
+        .cbSize = sizeof(info),
+        .fMask = SIF_RANGE | SIF_PAGE | SIF_POS | SIF_DISABLENOSCROLL,
+        .nMin = 0,
+        .nMax = (INT)((document_line_count(Document) - 1) / scale + page - 1),
+        .nPage = (UINT)page,
+        .nPos = (INT)(view_top_line(View) / scale)
+    };
+    SetScrollInfo(hwnd, SB_VERT, &info, TRUE);
+
+    RECT client;
+    GetClientRect(hwnd, &client);
+    info.nMax = max(view_text_width(View), view_scroll_x(View) + client.right) + Text_box.char_width;
+    info.nPage = client.right;
+    info.nPos = view_scroll_x(View);
+    SetScrollInfo(hwnd, SB_HORZ, &info, TRUE);
+}
+
+// Moves the caret of the text-box to where the caret of the view is
+static void update_caret(HWND hwnd) {
+    if (GetFocus() != hwnd)
+        return;
+
+    INT x, y;
+    view_caret_point(View, &x, &y);
+    SetCaretPos(x, y);
+}
+
+// Repaints the text-box after the view has changed and lets the main window know that the caret may have moved
+static void update_text_box(HWND hwnd) {
+    update_scroll_bars(hwnd);
+    update_caret(hwnd);
+    InvalidateRect(hwnd, NULL, FALSE);
+
+    // Checking the return value is possible and recommended, but unnecessary
+    // If the message queue is full, there are other things to worry about than the caret moving
+    PostMessageW(Window, WM_USER_CARETMOVE, MAKEWPARAM(GetDlgCtrlID(hwnd), 0), (LPARAM)hwnd);
+}
+
+// Makes the view show the current document, e.g. after it has been replaced
+static void show_document(struct document* old) {
+    view_set_document(View, Document);
+    document_free(old);
+    update_text_box(Gui.text_box);
+}
+
+// Replaces the current document with a new one and shows it in the text-box
+static void replace_document(struct document* document) {
+    struct document* old = Document;
+    Document = document;
+    Source.path[0] = L'\0';
+    journal_clear(History);
+    view_select(View, 0, 0);
+    show_document(old);
+}
+
+// Unmaps a file once the document doesn't need it anymore
+static void close_mapping(PVOID ctx, LPCVOID data, SIZE_T size) {
+    mapping_close(ctx);
+    mem_free(ctx);
+}
+
+// Called by the core when it runs out of memory
+static void out_of_memory() {
+    SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+    fatal(L"Out of memory");
+}
+
+// Where copy_span puts the text for the clipboard
+struct clip {
+    PWSTR text;
+    SIZE_T length;
+    bool cr;
+};
+
+// The document_walk callback of copying, the clipboard wants CRLF line breaks whatever the document has
+static bool copy_span(PVOID ctx, CONST uint16_t* text, SIZE_T length) {
+    struct clip* clip = ctx;
+    clip->length += linebreak_to_win_utf16(text, length, clip->text + clip->length, &clip->cr);
+    return true;
+}
+
+// Copies the selected text to the clipboard
+static void copy_selection(HWND hwnd) {
+    SIZE_T start, end;
+    view_selection(View, &start, &end);
+    if (start == end)
+        return;
+
+    // The clipboard wants a null-terminated copy of the text, which it takes over, every LF may gain a CR
+    CONST SIZE_T lfs = document_line_of(Document, end) - document_line_of(Document, start);
+    HGLOBAL memory;
+    if (!(memory = GlobalAlloc(GMEM_MOVEABLE, (end - start + lfs + 1) * sizeof(WCHAR)))) {
+        error_box_winerror(L"Failed to copy the text, it's too big");
+        return;
+    }
+
+    struct clip clip = { GlobalLock(memory), 0, false };
+    document_walk(Document, start, end - start, copy_span, &clip);
+    clip.text[clip.length] = L'\0';
+    GlobalUnlock(memory);
+
+    if (!OpenClipboard(hwnd)) {
+        error_box_winerror(L"Failed to open the clipboard");
+        GlobalFree(memory);
+        return;
+    }
+
+    EmptyClipboard();
+    if (!SetClipboardData(CF_UNICODETEXT, memory))
+        GlobalFree(memory);
+    CloseClipboard();
+}
+
+// Replaces the selection with the text on the clipboard
+static void paste_clipboard(HWND hwnd) {
+    if (!OpenClipboard(hwnd))
+        return;
+
+    CONST HANDLE memory = GetClipboardData(CF_UNICODETEXT);
+    PCWSTR text = memory ? GlobalLock(memory) : NULL;
+    if (text) {
+        CONST SIZE_T length = lstrlenW(text);
+        // The clipboard has CRLF line breaks, a document with LF ones gets them as LFs (a lone CR stays the way it is)
+        if (Settings.format.linebreak == LINEBREAK_UNIX) {
+            PWSTR lf = mem_alloc((length + 1) * sizeof(WCHAR));
+            bool cr = false;
+            SIZE_T lf_length = linebreak_to_unix_utf16(text, length, lf, &cr);
+            if (cr)
+                lf[lf_length++] = L'\r';
+            view_insert(View, lf, lf_length);
+            mem_free(lf);
+        } else {
+            view_insert(View, text, length);
+        }
+        GlobalUnlock(memory);
+    }
+
+    CloseClipboard();
+}
+
+// Paints the visible part of the view, everything is drawn into a bitmap first so that the text doesn't flicker
+static void paint_text_box(HWND hwnd) {
+    PAINTSTRUCT ps;
+    CONST HDC dc = BeginPaint(hwnd, &ps);
+
+    RECT client;
+    GetClientRect(hwnd, &client);
+
+    CONST HDC buffer = CreateCompatibleDC(dc);
+    CONST HBITMAP bitmap = CreateCompatibleBitmap(dc, client.right, client.bottom);
+    CONST HGDIOBJ old_bitmap = SelectObject(buffer, bitmap);
+    CONST HGDIOBJ old_font = SelectObject(buffer, Fonts.editor);
+
+    FillRect(buffer, &client, GetSysColorBrush(COLOR_WINDOW));
+    view_paint(View, draw_text, buffer);
+    BitBlt(dc, 0, 0, client.right, client.bottom, buffer, 0, 0, SRCCOPY);
+
+    SelectObject(buffer, old_font);
+    SelectObject(buffer, old_bitmap);
+    DeleteObject(bitmap);
+    DeleteDC(buffer);
+
+    EndPaint(hwnd, &ps);
+}
+
+// Scrolls the text-box according to a WM_VSCROLL or WM_HSCROLL message
+static void scroll_text_box(HWND hwnd, CONST INT bar, CONST WORD request) {
+    SCROLLINFO info = { .cbSize = sizeof(info), .fMask = SIF_TRACKPOS };
+    GetScrollInfo(hwnd, bar, &info);
+
+    if (bar == SB_VERT) {
+        CONST ptrdiff_t page = view_page_lines(View);
+        switch (request) {
+            case SB_LINEUP:        view_scroll_lines(View, -1); break;
+            case SB_LINEDOWN:      view_scroll_lines(View, 1); break;
+            case SB_PAGEUP:        view_scroll_lines(View, -page); break;
+            case SB_PAGEDOWN:      view_scroll_lines(View, page); break;
+            case SB_TOP:           view_scroll_to(View, 0); break;
+            case SB_BOTTOM:        view_scroll_to(View, document_line_count(Document) - 1); break;
+            case SB_THUMBTRACK:
+            case SB_THUMBPOSITION: view_scroll_to(View, (SIZE_T)info.nTrackPos * scroll_scale()); break;
+        }
+    } else {
+        RECT client;
+        GetClientRect(hwnd, &client);
+        CONST INT x = view_scroll_x(View);
+        switch (request) {
+            case SB_LINELEFT:      view_scroll_to_x(View, x - Text_box.char_width * 4); break;
+            case SB_LINERIGHT:     view_scroll_to_x(View, x + Text_box.char_width * 4); break;
+            case SB_PAGELEFT:      view_scroll_to_x(View, x - client.right); break;
+            case SB_PAGERIGHT:     view_scroll_to_x(View, x + client.right); break;
+            case SB_LEFT:          view_scroll_to_x(View, 0); break;
+            case SB_THUMBTRACK:
+            case SB_THUMBPOSITION: view_scroll_to_x(View, info.nTrackPos); break;
+        }
+    }
+
+    update_scroll_bars(hwnd);
+    update_caret(hwnd);
+    InvalidateRect(hwnd, NULL, FALSE);
+}
+
+// Shows the find or the replace dialog, or brings it up if it's already open
+// The other one gets closed, they share the text and the options
+static void show_find_dialog(BOOL replace) {
+    if (Search.dialog) {
+        if (Search.replacing == replace) {
+            SetFocus(Search.dialog);
+            return;
+        }
+        DestroyWindow(Search.dialog);
+        Search.dialog = NULL;
+    }
+
+    // The text has to outlive the dialog, the search always goes down and wraps around at the end
+    Search.options = (FINDREPLACEW){
+        .lStructSize = sizeof(Search.options),
+        .hwndOwner = Window,
+        .Flags = FR_DOWN | FR_HIDEUPDOWN | FR_HIDEWHOLEWORD | (Search.options.Flags & FR_MATCHCASE),
+        .lpstrFindWhat = Search.what,
+        .wFindWhatLen = sizeof(Search.what),
+        .lpstrReplaceWith = Search.with,
+        .wReplaceWithLen = sizeof(Search.with)
+    };
+
+    Search.replacing = replace;
+    Search.dialog = replace ? ReplaceTextW(&Search.options) : FindTextW(&Search.options);
+    if (!Search.dialog)
+        error_box_winerror(replace ? L"Failed to open the replace dialog" : L"Failed to open the find dialog");
+}
+
+// Compiles the pattern of the dialog, as a regular expression if the checkbox says so, returns FALSE if it isn't valid
+static BOOL compile_search(BOOL ignore_case) {
+    find_free(Search.finder);
+    regex_free(Search.regex);
+    Search.finder = NULL;
+    Search.regex = NULL;
+
+    CONST SIZE_T length = wcslen(Search.what);
+    if (!Search.use_regex) {
+        Search.finder = find_create(Search.what, length, ignore_case);
+        return Search.finder != NULL;
+    }
+
+    SIZE_T error_at;
+    Search.regex = regex_create(Search.what, length, ignore_case, &error_at);
+    if (!Search.regex) {
+        error_box_format(L"Invalid regular expression", L"The pattern isn't valid, the problem is at character %llu", (ULONGLONG)error_at + 1);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// Finds the first match that starts in the range from 'from' up to 'to' with whichever pattern is compiled
+static BOOL search_next(SIZE_T from, SIZE_T to, SIZE_T* start, SIZE_T* end) {
+    if (Search.regex) {
+        struct regex_match match;
+        if (!regex_next(Search.regex, Document, from, to, &match))
+            return FALSE;
+        *start = match.start;
+        *end = match.end;
+        return TRUE;
+    }
+
+    if (!find_next(Search.finder, Document, from, to, start))
+        return FALSE;
+    *end = *start + find_length(Search.finder);
+    return TRUE;
+}
+
+// Selects the next match after the selection, wrapping around to the start of the document
+// Opens the find dialog if nothing has been searched for yet
+static void find_next_match() {
+    if (!Search.finder && !Search.regex) {
+        show_find_dialog(FALSE);
+        return;
+    }
+
+    // Searching from the start of the selection + 1 finds the next match even if the selection is one already
+    // An empty match of a regular expression is where the caret already is, the one after it is the next one
+    SIZE_T start, end, match, match_end;
+    view_selection(View, &start, &end);
+    SIZE_T from = start == end ? start : start + 1;
+    if (Search.regex && start == end && search_next(from, from + 1, &match, &match_end) && match == match_end)
+        from++;
+
+    if (!search_next(from, SIZE_MAX, &match, &match_end) && !search_next(0, from, &match, &match_end)) {
+        // Not finding anything isn't an error
+        WCHAR buf[320];
+        StringCbPrintfW(buf, sizeof(buf), L"Cannot find \"%ls\"", Search.what);
+        MessageBoxW(Search.dialog ? Search.dialog : Window, buf, L"Find", MB_OK | MB_ICONINFORMATION);
+        return;
+    }
+
+    view_select(View, match, match_end);
+    update_text_box(Gui.text_box);
+}
+
+// Replaces the selection if it's a match and selects the next one
+static void replace_match() {
+    if (Load.loader) {
+        error_box(L"Failed to replace the text", L"The file is still loading, wait for it or cancel it first");
+        return;
+    }
+
+    SIZE_T start, end, match, match_end;
+    view_selection(View, &start, &end);
+    if (search_next(start, start + 1, &match, &match_end) && match == start && match_end == end)
+        view_insert(View, Search.with, wcslen(Search.with));
+
+    find_next_match();
+}
+
+// Replaces all of the matches at once, as a single step to undo
+static void replace_all_matches() {
+    if (Load.loader) {
+        error_box(L"Failed to replace the text", L"The file is still loading, wait for it or cancel it first");
+        return;
+    }
+
+    // The matches of a regular expression aren't all as long, the view gets the length of each one
+    SIZE_T count;
+    SIZE_T* matches;
+    SIZE_T* lengths = NULL;
+    if (Search.regex) {
+        struct regex_match* found;
+        count = regex_all(Search.regex, Document, &found);
+        matches = count ? mem_alloc(count * sizeof(SIZE_T)) : NULL;
+        lengths = count ? mem_alloc(count * sizeof(SIZE_T)) : NULL;
+        for (SIZE_T i = 0; i < count; i++) {
+            matches[i] = found[i].start;
+            lengths[i] = found[i].end - found[i].start;
+        }
+        mem_free(found);
+    } else {
+        count = find_all(Search.finder, Document, Pool, &matches);
+    }
+
+    if (count) {
+        view_replace_all(View, matches, lengths, count, Search.finder ? find_length(Search.finder) : 0, Search.with, wcslen(Search.with));
+        update_text_box(Gui.text_box);
+    }
+    mem_free(matches);
+    mem_free(lengths);
+
+    WCHAR buf[320];
+    if (count)
+        StringCbPrintfW(buf, sizeof(buf), L"Replaced %llu occurrences", (ULONGLONG)count);
+    else
+        StringCbPrintfW(buf, sizeof(buf), L"Cannot find \"%ls\"", Search.what);
+    MessageBoxW(Search.dialog ? Search.dialog : Window, buf, L"Replace", MB_OK | MB_ICONINFORMATION);
+}
+
+// Shows the query and the number of matches of the incremental search on the status bar, or nothing if it isn't active
+static void show_incremental_status() {
+    WCHAR buf[320] = L"";
+
+    if (Incremental.active)
+        StringCbPrintfW(buf, sizeof(buf), L"Search: %ls (%llu%ls matches)", Incremental.query, (ULONGLONG)isearch_count(Incremental.search),
+            isearch_done(Incremental.search, Document) ? L"" : L"+");
+    SendMessageW(Gui.status, SB_SETTEXTW, 0, (LPARAM)buf);
+    Incremental.shown = GetTickCount();
+}
+
+// Selects the first match of the incremental search at or after 'pos', returns FALSE if it hasn't been found yet
+static BOOL select_incremental_match(SIZE_T pos) {
+    SIZE_T match;
+    if (!isearch_next(Incremental.search, Document, pos, &match))
+        return FALSE;
+
+    view_select(View, match, match + isearch_length(Incremental.search));
+    update_text_box(Gui.text_box);
+    return TRUE;
+}
+
+// Searches a bit more, the message loop calls this whenever there are no messages waiting
+static void step_incremental_search() {
+    CONST BOOL done = isearch_step(Incremental.search, Document, INCREMENTAL_STEP);
+
+    if (Incremental.selecting && select_incremental_match(Incremental.origin))
+        Incremental.selecting = FALSE;
+    if (done || GetTickCount() - Incremental.shown >= INCREMENTAL_STATUS_INTERVAL)
+        show_incremental_status();
+}
+
+// Searches for the changed query, a longer one only has to check the matches of the shorter one
+static void change_incremental_query() {
+    Incremental.query[Incremental.length] = L'\0';
+    Incremental.selecting = isearch_query(Incremental.search, Incremental.query, Incremental.length, !(Search.options.Flags & FR_MATCHCASE));
+
+    // Nothing to search for, the caret goes back to where the search started
+    if (!Incremental.selecting) {
+        view_select(View, Incremental.origin, Incremental.origin);
+        update_text_box(Gui.text_box);
+    }
+    step_incremental_search();
+}
+
+// Selects the match after the selection, if the search has found it yet
+static void next_incremental_match() {
+    SIZE_T start, end;
+    view_selection(View, &start, &end);
+    Incremental.selecting = FALSE;
+    select_incremental_match(start + 1);
+}
+
+// Starts the incremental search with an empty query, or goes to the next match if it's already active
+static void start_incremental_search() {
+    if (Incremental.active) {
+        next_incremental_match();
+        return;
+    }
+
+    SIZE_T end;
+    view_selection(View, &Incremental.origin, &end);
+    Incremental.active = TRUE;
+    Incremental.length = 0;
+    change_incremental_query();
+    show_incremental_status();
+}
+
+// Ends the incremental search, the last match stays selected
+static void end_incremental_search() {
+    Incremental.active = FALSE;
+    Incremental.selecting = FALSE;
+    show_incremental_status();
+}
+
+// The procedure of the text-box, it shows the View and turns the input into its moves and edits
+// It supports the ACC_EDIT_DELETEWORD and ACC_EDIT_ISEARCH accelerators and sends WM_USER_CARETMOVE to the main window
+// The text can't be changed while a file is loading
+static LRESULT CALLBACK TextBoxProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam) {
+
+    CONST BOOL read_only = Load.loader != NULL;
+
+    switch (uMsg) {
+        case WM_PAINT:
+            paint_text_box(hwnd);
+            // Painting may have come across a line wider than any before
+            update_scroll_bars(hwnd);
+        return 0;
+        // The whole text-box gets painted over anyway
+        case WM_ERASEBKGND:
+        return 1;
+        case WM_SIZE:
+            view_resize(View, LOWORD(lParam), HIWORD(lParam));
+            update_scroll_bars(hwnd);
+            InvalidateRect(hwnd, NULL, FALSE);
+        return 0;
+        case WM_SETFOCUS:
+            CreateCaret(hwnd, NULL, 1, Text_box.line_height);
+            update_caret(hwnd);
+            ShowCaret(hwnd);
+        return 0;
+        case WM_KILLFOCUS:
+            DestroyCaret();
+        return 0;
+        case WM_VSCROLL:
+        case WM_HSCROLL:
+            scroll_text_box(hwnd, uMsg == WM_VSCROLL ? SB_VERT : SB_HORZ, LOWORD(wParam));
+        return 0;
+        case WM_MOUSEWHEEL: {
+            // Three lines per notch, the rest of a step of a high resolution wheel is kept for the next one
+            Text_box.wheel += GET_WHEEL_DELTA_WPARAM(wParam);
+            CONST INT lines = Text_box.wheel * 3 / WHEEL_DELTA;
+            Text_box.wheel -= lines * WHEEL_DELTA / 3;
+
+            view_scroll_lines(View, -lines);
+            update_scroll_bars(hwnd);
+            update_caret(hwnd);
+            InvalidateRect(hwnd, NULL, FALSE);
+        } return 0;
+        case WM_LBUTTONDOWN:
+            if (Incremental.active)
+                end_incremental_search();
+            SetFocus(hwnd);
+            SetCapture(hwnd);
+            view_click(View, (SHORT)LOWORD(lParam), (SHORT)HIWORD(lParam), wParam & MK_SHIFT);
+            update_text_box(hwnd);
+        return 0;
+        // Dragging selects, the view scrolls if the mouse leaves it
+        case WM_MOUSEMOVE:
+            if (GetCapture() == hwnd && (wParam & MK_LBUTTON)) {
+                view_click(View, (SHORT)LOWORD(lParam), (SHORT)HIWORD(lParam), TRUE);
+                update_text_box(hwnd);
+            }
+        return 0;
+        case WM_LBUTTONUP:
+            ReleaseCapture();
+        return 0;
+        case WM_KEYDOWN: {
+            CONST BOOL control = GetKeyState(VK_CONTROL) < 0;
+            CONST BOOL shift = GetKeyState(VK_SHIFT) < 0;
+
+            // Escape ends the incremental search, F3 goes to its next match and moving the caret ends it too
+            if (Incremental.active) {
+                switch (wParam) {
+                    case VK_ESCAPE:
+                        end_incremental_search();
+                    return 0;
+                    case VK_F3:
+                        next_incremental_match();
+                    return 0;
+                    case VK_LEFT: case VK_RIGHT: case VK_UP: case VK_DOWN:
+                    case VK_PRIOR: case VK_NEXT: case VK_HOME: case VK_END: case VK_DELETE:
+                        end_incremental_search();
+                    break;
+                }
+            }
+
+            switch (wParam) {
+                case VK_LEFT:   view_move(View, control ? VIEW_WORD_LEFT : VIEW_LEFT, shift); break;
+                case VK_RIGHT:  view_move(View, control ? VIEW_WORD_RIGHT : VIEW_RIGHT, shift); break;
+                case VK_UP:     view_move(View, VIEW_UP, shift); break;
+                case VK_DOWN:   view_move(View, VIEW_DOWN, shift); break;
+                case VK_PRIOR:  view_move(View, VIEW_PAGE_UP, shift); break;
+                case VK_NEXT:   view_move(View, VIEW_PAGE_DOWN, shift); break;
+                case VK_HOME:   view_move(View, control ? VIEW_DOCUMENT_START : VIEW_LINE_START, shift); break;
+                case VK_END:    view_move(View, control ? VIEW_DOCUMENT_END : VIEW_LINE_END, shift); break;
+                case VK_DELETE:
+                    if (read_only) return 0;
+                    view_erase(View, control ? VIEW_WORD_RIGHT : VIEW_RIGHT);
+                break;
+                // Escape cancels loading, the load then finishes with LOADER_CANCELLED
+                case VK_ESCAPE:
+                    if (Load.loader)
+                        loader_cancel(Load.loader);
+                return 0;
+                // Find next, the selection is updated by find_next_match itself
+                case VK_F3:
+                    find_next_match();
+                return 0;
+                default:
+                return 0;
+            }
+
+            update_text_box(hwnd);
+        } return 0;
+        case WM_CHAR: {
+            CONST WCHAR c = (WCHAR)wParam;
+
+            // The incremental search takes the characters and backspace into its query, Enter goes to the next match
+            // Anything else ends it and does what it does otherwise
+            if (Incremental.active) {
+                if (c == L'\b' && GetKeyState(VK_CONTROL) >= 0) {
+                    if (Incremental.length) {
+                        Incremental.length--;
+                        change_incremental_query();
+                    }
+                    return 0;
+                } else if (c == L'\r') {
+                    next_incremental_match();
+                    return 0;
+                } else if (c >= 0x20 && c != 0x7F) {
+                    if (Incremental.length + 1 < sizeof(Incremental.query) / sizeof(WCHAR)) {
+                        Incremental.query[Incremental.length++] = c;
+                        change_incremental_query();
+                    }
+                    return 0;
+                }
+                end_incremental_search();
+            }
+
+            // Ctrl+A, Ctrl+C, Ctrl+F, Ctrl+H, Ctrl+X, Ctrl+V, Ctrl+Z and Ctrl+Y come as control characters
+            // Ctrl+H is the same one as backspace, only the control key tells them apart
+            if (c == 0x01) {
+                view_select(View, 0, document_length(Document));
+            } else if (c == 0x06) {
+                show_find_dialog(FALSE);
+                return 0;
+            } else if (c == 0x08 && GetKeyState(VK_CONTROL) < 0) {
+                show_find_dialog(TRUE);
+                return 0;
+            } else if (c == 0x03 || (c == 0x18 && read_only)) {
+                copy_selection(hwnd);
+                return 0;
+            } else if (read_only) {
+                return 0;
+            } else if (c == 0x18) {
+                copy_selection(hwnd);
+                view_erase(View, VIEW_RIGHT);
+            } else if (c == 0x16) {
+                paste_clipboard(hwnd);
+            } else if (c == 0x1A) {
+                view_undo(View);
+            } else if (c == 0x19) {
+                view_redo(View);
+            } else if (c == L'\b') {
+                view_erase(View, VIEW_LEFT);
+            } else if (c == L'\r') {
+                // The document keeps the line breaks of the file
+                if (Settings.format.linebreak == LINEBREAK_UNIX)
+                    view_insert(View, L"\n", 1);
+                else
+                    view_insert(View, L"\r\n", 2);
+            } else if ((c >= 0x20 && c != 0x7F) || c == L'\t') {
+                view_insert(View, &c, 1);
+            } else {
+                return 0;
+            }
+
+            update_text_box(hwnd);
+        } return 0;
+        case WM_COMMAND:
+            switch (HIWORD(wParam)) {
+                case 1:
+                    switch (LOWORD(wParam)) {
+                        case ACC_EDIT_ISEARCH:
+                            start_incremental_search();
+                        break;
+                        case ACC_EDIT_DELETEWORD:
+                            if (Incremental.active)
+                                end_incremental_search();
+                            if (read_only) break;
+                            view_erase(View, VIEW_WORD_LEFT);
+                            update_text_box(hwnd);
+                        break;
+                    }
+                break;
+            }
+        return 0;
+    }
+
+    return DefWindowProcW(hwnd, uMsg, wParam, lParam);
+}
+
+// Adds a text-box to the main window (unscaled, unpositioned, check the resize() method)
+static HWND add_text_box(CONST UINT id) {
+    HWND text_box = CreateWindowExW(
+        WS_EX_CLIENTEDGE,
+        TEXT_BOX_CLASS,
+        L"",
+        WS_CHILD | WS_VISIBLE | WS_VSCROLL | WS_HSCROLL,
+        0,0,0,0,
+        Window,
+        (HMENU)(UINT_PTR)id,
+        (HINSTANCE)GetWindowLongPtr(Window, GWLP_HINSTANCE),
+        NULL
+    );
+    if (!text_box)
+        fatal(L"Failed to create the text box");
+
+    return text_box;
+}
+
+// Adds a static text to the main window (unscaled, unpositioned, check the resize() method)
+static HWND add_static_text(CONST UINT id) {
+
+    HWND static_text = CreateWindowW(
+        WC_STATICW,
+        L"",
+        WS_CHILD | WS_VISIBLE | SS_SIMPLE,
+        0, 0, 0, 0,
+        Window,
+        (HMENU)(UINT_PTR)id,
+        (HINSTANCE)GetWindowLongPtr(Window, GWLP_HINSTANCE),
+        NULL
+    );
+    if (!static_text)
+        fatal(L"Failed to create the static text");
+
+    SendMessageW(static_text, WM_SETFONT, (WPARAM)Fonts.filename, TRUE);
+
+    return static_text;
+
+}
+
+// Adds a button with a title with an ID to a menu
+static void add_menu_button(HMENU menu, CONST UINT id, PCWSTR title) {
+    MENUITEMINFOW info;
+    info.cbSize = sizeof(MENUITEMINFOW);
+    info.fMask = MIIM_STRING | MIIM_ID;
+    info.wID = id;
+    info.dwTypeData = (PWSTR)title;
+
+    if (!(InsertMenuItemW(menu, GetMenuItemCount(menu), TRUE, &info)))
+        fatal(L"Failed to insert the menu button");
+}
+
+// Inserts a button with a title, ID and a checkbox to the menu (the default state is unchecked)
+static void add_menu_checkbox(HMENU menu, CONST UINT id, PCWSTR title) {
+    MENUITEMINFOW info;
+    info.cbSize = sizeof(MENUITEMINFOW);
+    info.fMask = MIIM_STRING | MIIM_ID | MIIM_CHECKMARKS | MIIM_STATE;
+    // The checkmark info
+    info.hbmpChecked = NULL;
+    info.hbmpUnchecked = NULL;
+    info.fState = MFS_UNCHECKED;
+    // The common info
+    info.wID = id;
+    info.dwTypeData = (PWSTR)title;
+
+    if (!InsertMenuItemW(menu, GetMenuItemCount(menu), TRUE, &info))
+        fatal(L"Failed to insert a menu checkbox");
+}
+
+// Adds a submenu to a menu item
+static void add_menu_submenu(HMENU menu, CONST HMENU submenu, PCWSTR title) {
+    MENUITEMINFOW info;
+    info.cbSize = sizeof(MENUITEMINFOW);
+    info.fMask = MIIM_STRING | MIIM_SUBMENU;
+    info.hSubMenu = submenu;
+    info.dwTypeData = (PWSTR)title;
+
+    if (!(InsertMenuItemW(menu, GetMenuItemCount(menu), TRUE, &info)))
+        fatal(L"Failed to insert a menu submenu");
+}
+
+// Changes the string shown in the static text above the text-box
+static void change_filename(PCWSTR fname) {
+    // Set the static text to the file name
+    SetWindowTextW(Gui.filename, fname);
+
+    // Invaliate the file name area (it has to be redrawn because it's transparent)
+    RECT wr;
+    GetClientRect(Gui.filename, &wr);
+    MapWindowPoints(Gui.filename, Window, (PPOINT)&wr, 2);
+    InvalidateRect(Window, &wr, TRUE);
+}
+
+// Resizes and repositions all controls based on the current proportions (The Layout structure)
+static void resize() {
+    static BOOL b = 0;
+    // Retrieve the size of the status bar (only the height matters)
+    RECT status_rect;
+    SendMessageW(Gui.status, SB_GETRECT, 0, (LPARAM)&status_rect);
+
+    // Resize the file name static control accordingly
+    SetWindowPos(
+        Gui.filename, NULL, 
+        Layout.margin, 
+        Layout.reduced_margin, 
+        Width-Layout.margin*2, 
+        Layout.filename_height,
+        SWP_NOZORDER);
+    // Resize the text box itself accordingly
+    SetWindowPos(Gui.text_box , NULL, 
+        Layout.margin, 
+        Layout.reduced_margin*2+Layout.filename_height, 
+        Width-Layout.margin*2, 
+        Height-Layout.reduced_margin*3-Layout.filename_height-(status_rect.bottom-status_rect.top), 
+        SWP_NOZORDER);
+
+    // Resize the status bar
+    resize_status_bar(Gui.status);
+}
+
+// Toggles word wrapping, the view wraps only the lines it shows, so this is as cheap as a repaint
+static void toggle_wwrap() {
+    MENUITEMINFOW info;
+    info.cbSize = sizeof(info);
+
+    info.fMask = MIIM_STATE;
+    GetMenuItemInfoW(Gui.menu_edit, GUI_MENU_WWRAP, FALSE, &info);
+    CONST BOOL wrap = info.fState & MFS_CHECKED;
+
+    info.fState = (wrap ? MFS_UNCHECKED : MFS_CHECKED);
+    if (!SetMenuItemInfoW(Gui.menu_edit, GUI_MENU_WWRAP, FALSE, &info))
+        fatal(L"Toggle change word-wrap");
+
+    CONST uint64_t span = trace_begin();
+    view_set_wrap(View, !wrap);
+    update_text_box(Gui.text_box);
+    trace_end(span, "toggle word wrap");
+}
+
+// Toggles whether the search pattern is a regular expression, the last pattern gets compiled again so that
+// Find Next goes on with it the new way
+static void toggle_regex() {
+    MENUITEMINFOW info;
+    info.cbSize = sizeof(info);
+
+    info.fMask = MIIM_STATE;
+    Search.use_regex = !Search.use_regex;
+    info.fState = (Search.use_regex ? MFS_CHECKED : MFS_UNCHECKED);
+    if (!SetMenuItemInfoW(Gui.menu_edit, GUI_MENU_REGEX, FALSE, &info))
+        fatal(L"Toggle change regular expressions");
+
+    if (Search.finder || Search.regex)
+        compile_search(!(Search.options.Flags & FR_MATCHCASE));
+}
+
+// Prompts the user with an GetOpenFileName or a GetSaveFileName based on the argument (the former if it's 0)
+// The returned pointer is an internal static buffer, so there is no need to free it but it will change after the next chooose_file call
+static PCWSTR choose_file(CONST BOOL save) {
+
+    static WCHAR buf[512];
+
+    static OPENFILENAMEW opts;
+
+    opts.lStructSize = sizeof(OPENFILENAMEW);
+    opts.hwndOwner = Window;
+    opts.hInstance = (HINSTANCE)GetWindowLongPtr(Window, GWLP_HINSTANCE);
+    //opts.lpstrFilter = NULL;
+    opts.lpstrFilter = L"Text documents (*.txt)\0*.txt\0All files (*)\0*\0";
+    opts.lpstrCustomFilter = NULL;
+    opts.nFilterIndex = 2; // start on "all files" filter
+
+    opts.lpstrFile = buf;
+    // Set the default save location as the path of the current file, if the file is new, don't
+    if (Settings.is_new)
+        opts.lpstrFile[0] = L'\0';
+    else
+        GetWindowTextW(Gui.filename, opts.lpstrFile, sizeof(buf));
+
+    opts.nMaxFile = sizeof(buf);
+    opts.lpstrFileTitle = NULL;
+    opts.lpstrInitialDir = NULL;
+    opts.lpstrTitle = NULL;
+    //opts.Flags = OFN_OVERWRITEPROMPT;
+    opts.nFileOffset = 0;
+    opts.nFileExtension = 5;
+    //opts.lpstrDefExt = L"txt";
+    opts.lpstrDefExt = NULL;
+    opts.FlagsEx = 0;
+
+    if (save) {
+        if (!GetSaveFileNameW(&opts)) return NULL;
+    } else {
+        if (!GetOpenFileNameW(&opts)) return NULL;
+    }
+
+    return opts.lpstrFile;
+}
+
+// Shows the loading progress on the status bar, or nothing if 'total' is 0
+static void change_status_progress(CONST ULONGLONG done, CONST ULONGLONG total) {
+    WCHAR buf[128] = L"";
+
+    if (total)
+        StringCbPrintfW(buf, sizeof(buf), L"Loading %llu%% (Esc to cancel)", done * 100 / total);
+    SendMessageW(Gui.status, SB_SETTEXTW, 0, (LPARAM)buf);
+}
+
+// Called by the loader on its worker thread, hands the progress over to the main window
+static void post_load_progress(PVOID ctx, CONST struct loader_progress* progress) {
+    // A big file that had to be indexed keeps its checkpoints, so that opening it the next time doesn't read it again,
+    // this is still the loader's thread and the mapping is alive as long as the snapshot is
+    if (progress->status == LOADER_DONE && progress->mapped && !progress->indexed && Load.file.size >= CHECKPOINT_SMALLEST) {
+        CONST uint64_t span = trace_begin();
+        checkpoint_save(Load.path, &Load.file, Load.format, progress->snapshot);
+        trace_end(span, "open: save checkpoints");
+    }
+
+    struct loader_progress* copy = mem_alloc(sizeof(*copy));
+    *copy = *progress;
+
+    // Posting fails only when the queue is full, but the progress mustn't get lost, the last one finishes the load
+    while (!PostMessageW(Window, WM_USER_LOADPROGRESS, (WPARAM)ctx, (LPARAM)copy))
+        Sleep(10);
+}
+
+// Stops loading the current file (if any), the text-box can be edited again
+static void stop_loading() {
+    if (!Load.loader)
+        return;
+
+    loader_free(Load.loader);
+    Load.loader = NULL;
+    change_status_progress(0, 0);
+}
+
+// Makes a snapshot from the loader the document, the view keeps its caret and scroll position
+static void show_loaded(struct document* snapshot) {
+    struct document* old = Document;
+    Document = snapshot;
+    show_document(old);
+}
+
+// Guesses the format of the input string, it doesn't have to be null-terminated
+// Big files are only sampled, so a stray LF somewhere in the middle of a CRLF file may go unnoticed,
+// which is fine because the document doesn't mind mixed line breaks
+static CONST struct format get_format(LPCVOID src, CONST SIZE_T src_size) {
+    return detect_format(src, src_size, DETECT_SAMPLE).format;
+}
+
+//TODO: you cannot change the encoding a file is saved/opened in, you can only save files in the default format
+// unless you have loaded it in a different one, this would require customising the choose_file dialog
+// Saves the document to the specified file, overwriting or creating a new file
+// The text is converted and written in small blocks into a temporary file, which replaces the target only once it's
+// complete, so the converted text is never in memory as a whole and a failed save leaves the original file alone
+static void save_to_file(PCWSTR fpath) {
+    if (!fpath) return;
+
+    CONST uint64_t span = trace_begin();
+
+    // Windows doesn't let us replace a file while the document reads straight from its mapping,
+    // so in that case the document has to use a copy of the text from now on (as it is stored, UTF-8 stays UTF-8)
+    //TODO: this is the only case where saving still needs memory for the whole text
+    if (Source.path[0] && !lstrcmpiW(Source.path, fpath)) {
+        struct document* old = Document;
+        Document = document_copy(old);
+        Source.path[0] = L'\0';
+        show_document(old);
+    }
+
+    // The document has the line breaks of the file, plus the ones typed in the format's style, so they're saved
+    // the way they are, a file with both kinds keeps them and the lines nobody has touched stay byte for byte the same
+    struct format format = Settings.format;
+    format.linebreak = LINEBREAK_KEEP;
+    if (!save_document(Document, fpath, format)) {
+        trace_end(span, "save (failed)");
+        error_box_winerror(L"Failed to save the file, it was left as it was");
+        return;
+    }
+
+    change_filename(fpath);
+    Settings.is_new = FALSE;
+    change_status_timing(L"Saved", trace_end(span, "save"));
+}
+
+static void new_file() {
+    stop_loading();
+    replace_document(document_create());
+    change_filename(NEW_FILE_NAME);
+    change_format(Default_format);
+    change_status_pos(1, 1);
+    Settings.is_new = TRUE;
+}
+
+// Loads the contents of a file into the document, replacing the current one
+// The file is memory mapped and loaded on a worker thread, which posts WM_USER_LOADPROGRESS after every step,
+// so the window keeps responding and the beginning of the file can be read while the rest is still loading.
+// The document keeps the line breaks of the file, so UTF-8 and UTF-16 files are read straight from the mapping
+// and only ever decoded where they're shown, big endian UTF-16 is converted right out of it
+static void load_from_file(PCWSTR fpath) {
+    if (!fpath) return;
+
+    CONST uint64_t started = trace_begin();
+    uint64_t span = started;
+
+    // Map the specified file (the mapping has to outlive this function, the loader or the document takes it over)
+    struct mapping* in = mem_alloc(sizeof(*in));
+    if (!mapping_open(in, fpath)) {
+        error_box_winerror(L"Failed to open the input file");
+        mem_free(in);
+        return;
+    }
+    trace_end(span, "open: map");
+
+    CONST SIZE_T src_size = in->size;
+    // Empty files have no mapping, but the functions below don't like NULL
+    LPCVOID src = in->data ? in->data : "";
+
+    // Deal with file format
+    span = trace_begin();
+    struct format source_format = get_format(src, src_size);
+    trace_end(span, "open: detect");
+
+    // Start over with an empty document, which gets filled as the file loads
+    new_file();
+    change_format(source_format);
+    change_filename(fpath);
+
+    Load.generation++;
+    Load.started = started;
+    Load.file = *in;
+    Load.format = source_format;
+    StringCbCopyW(Load.path, sizeof(Load.path), fpath);
+
+    // A big file opened before (and not changed since) is built out of its checkpoints without reading it
+    SIZE_T checkpoint_count = 0;
+    struct document_checkpoint* checkpoints = NULL;
+    if (src_size >= CHECKPOINT_SMALLEST) {
+        span = trace_begin();
+        checkpoints = checkpoint_load(fpath, in, source_format, &checkpoint_count);
+        trace_end(span, "open: load checkpoints");
+    }
+
+    Load.loader = loader_start_indexed(src, src_size, source_format, source_format.linebreak, checkpoints, checkpoint_count,
+        close_mapping, in, post_load_progress, (PVOID)Load.generation);
+    if (!Load.loader) {
+        error_box_winerror(L"Failed to start loading the file");
+        mem_free(checkpoints);
+        mapping_close(in);
+        mem_free(in);
+        new_file();
+        return;
+    }
+
+    change_status_progress(0, src_size);
+}
+
+// Writes the spans recorded since the start to the file given with --trace, if any
+static void export_trace() {
+    if (Trace.path[0] && !trace_export(Trace.path))
+        error_box(L"Failed to write the trace", Trace.path);
+}
+
+// Writes to the console jittey was started from, or to wherever the output is redirected to (as UTF-8)
+static void console_print(PCWSTR format, ...) {
+    va_list args;
+    va_start(args, format);
+    WCHAR buf[1024];
+    // A path too long to fit is cut off, that's all
+    StringCbVPrintfW(buf, sizeof(buf), format, args);
+    va_end(args);
+
+    CONST HANDLE out = GetStdHandle(STD_OUTPUT_HANDLE);
+    if (out == NULL || out == INVALID_HANDLE_VALUE)
+        return;
+
+    DWORD mode, written;
+    CONST INT length = lstrlenW(buf);
+    if (GetConsoleMode(out, &mode)) {
+        WriteConsoleW(out, buf, length, &written, NULL);
+    } else {
+        CHAR utf8[sizeof(buf) / sizeof(WCHAR) * 3];
+        CONST INT size = WideCharToMultiByte(CP_UTF8, 0, buf, length, utf8, sizeof(utf8), NULL, NULL);
+        WriteFile(out, utf8, size, &written, NULL);
+    }
+}
+
+// Converts the files and directories given after "--convert format" without ever showing a window, returns the exit code
+// It's for normalizing many files at once, see core/batch.h
+static INT convert_files(CONST INT argc, LPWSTR* argv) {
+    // A GUI program has no console of its own, the output goes to the one it was started from
+    AttachConsole(ATTACH_PARENT_PROCESS);
+
+    struct format format;
+    if (argc < 4 || !batch_parse_format(argv[2], &format)) {
+        console_print(L"\nUsage: jittey --convert format paths...\n"
+                      L"  format: utf-8, utf-16 or utf-16be, then optionally bom and lf, crlf or keep, e.g. utf-16,bom,crlf\n");
+        return 2;
+    }
+
+    static PCWSTR statuses[] = {
+        [BATCH_PENDING  ] = L"pending",
+        [BATCH_CONVERTED] = L"converted",
+        [BATCH_UNCHANGED] = L"unchanged",
+        [BATCH_SKIPPED  ] = L"skipped",
+        [BATCH_INVALID  ] = L"invalid",
+        [BATCH_FAILED   ] = L"failed"
+    };
+
+    console_print(L"\n");
+    CONST uint64_t start = trace_now();
+    struct batch* batch = batch_create(format);
+    INT result = 0;
+    for (INT i = 3; i < argc; i++)
+        if (!batch_add(batch, argv[i])) {
+            console_print(L"Failed to read %ls (error %lu)\n", argv[i], GetLastError());
+            result = 1;
+        }
+
+    // The threads mostly wait for the disk, so there are more of them than processors
+    struct pool* pool = pool_create(BATCH_THREADS * thread_count());
+    if (batch_run(batch, pool))
+        result = 1;
+    pool_free(pool);
+    CONST double seconds = (trace_now() - start) / 1e9;
+
+    size_t counts[sizeof(statuses) / sizeof(statuses[0])] = {0};
+    ULONGLONG bytes = 0;
+    for (size_t i = 0; i < batch_count(batch); i++) {
+        CONST struct batch_file* file = batch_file(batch, i);
+        counts[file->status]++;
+        bytes += file->size;
+
+        // The format is the one the file was detected in, so the one it was converted from
+        console_print(L"%-9ls  %-9ls %-3ls %10.1f MB/s  %ls", statuses[file->status], Encoding_names[file->from.encoding],
+            file->from.bom ? L"BOM" : L"", file->time ? file->size / (file->time / 1e9) / 1e6 : 0.0, file->path);
+        if (file->status == BATCH_FAILED)
+            console_print(L" (error %lu)", file->error);
+        console_print(L"\n");
+    }
+
+    console_print(L"%llu files, %.1f MB in %.0f ms, %.1f MB/s on %llu threads:", (ULONGLONG)batch_count(batch), bytes / 1e6,
+        seconds * 1e3, seconds > 0 ? bytes / seconds / 1e6 : 0.0, (ULONGLONG)(BATCH_THREADS * thread_count()));
+    for (size_t i = BATCH_CONVERTED; i < sizeof(statuses) / sizeof(statuses[0]); i++)
+        console_print(L" %llu %ls%ls", (ULONGLONG)counts[i], statuses[i], i + 1 < sizeof(statuses) / sizeof(statuses[0]) ? L"," : L"\n");
+
+    batch_free(batch);
+    return result;
+}
+
+// The procedure used for the main window, can be used for only one window because it uses the global variable 'Window' internally
+static LRESULT CALLBACK WndProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam) {
+
+    switch (uMsg) {
+        case WM_CREATE:
+            Window = hwnd;
+
+            // Set up the layout constants
+            //TODO: yes, this is hardcoded and doesn't respond to DPI changes
+            Layout.margin = 10;
+            Layout.reduced_margin = 5;
+
+            // Setup fonts
+            // Get the theme-specific default system fonts
+            {
+                // TODO: this is not recommended so we should just specify our own font, as shown below
+                Fonts.filename = GetStockObject(DEFAULT_GUI_FONT);
+                Layout.filename_height = 15;
+
+                // Attempt to set Consolas 14 as the font
+                LOGFONTW font = {0};
+                StringCbCopyW(font.lfFaceName, LF_FACESIZE, L"Consolas");
+                font.lfHeight = 14;
+                Fonts.editor = CreateFontIndirectW(&font);
+            }
+
+            // Start with an empty document, the text-box created below shows it
+            Document = document_create();
+            create_view();
+
+            // Add the static control
+            Gui.filename = add_static_text(GUI_STATIC_TEXT);
+
+            // Add the text_box
+            Gui.text_box = add_text_box(GUI_TEXT_BOX);
+            SetFocus(Gui.text_box);
+
+            // Create the menu bar
+            Gui.menu = CreateMenu();
+
+            // Create the "File" submenu
+            Gui.menu_file = CreateMenu();
+            // Populate the "File" submenu
+            add_menu_button(Gui.menu_file, GUI_MENU_NEW, L"New");
+            add_menu_button(Gui.menu_file, GUI_MENU_LOAD, L"Open");
+            add_menu_button(Gui.menu_file, GUI_MENU_SAVE, L"Save");
+
+            // Create the "Edit" submenu
+            Gui.menu_edit = CreateMenu();
+            // Add the "word-wrap" checkbox
+            add_menu_button(Gui.menu_edit, GUI_MENU_UNDO, L"Undo\tCtrl+Z");
+            add_menu_button(Gui.menu_edit, GUI_MENU_REDO, L"Redo\tCtrl+Y");
+            add_menu_button(Gui.menu_edit, GUI_MENU_FIND, L"Find...\tCtrl+F");
+            add_menu_button(Gui.menu_edit, GUI_MENU_FIND_NEXT, L"Find Next\tF3");
+            add_menu_button(Gui.menu_edit, GUI_MENU_REPLACE, L"Replace...\tCtrl+H");
+            add_menu_button(Gui.menu_edit, GUI_MENU_ISEARCH, L"Incremental Search\tCtrl+I");
+            add_menu_checkbox(Gui.menu_edit, GUI_MENU_REGEX, L"Regular Expressions");
+            add_menu_checkbox(Gui.menu_edit, GUI_MENU_WWRAP, L"Word Wrap");
+            toggle_wwrap();
+
+            // Create the "Help" submenu
+            Gui.menu_help = CreateMenu();
+            add_menu_button(Gui.menu_help, GUI_MENU_ABOUT, L"About");
+
+            // Construct the main menu bar
+            add_menu_submenu(Gui.menu, Gui.menu_file, L"File");
+            add_menu_submenu(Gui.menu, Gui.menu_edit, L"Edit");
+            add_menu_submenu(Gui.menu, Gui.menu_help, L"Help");
+
+            // Slap the menu onto our window
+            SetMenu(Window, Gui.menu);
+
+            // Create the status bar
+            Gui.status = add_status_bar();
+            // we have to do this now because the parts of the bar aren't even there yet
+            resize_status_bar();
+
+            // Emulate a window resize to initialise element positions
+            resize();
+            // Open a new, empty file
+            new_file();
+            // Finally, show the constructed window and repaint it
+            ShowWindow(Window, TRUE);
+            UpdateWindow(Window);
+
+        break;
+        case WM_DESTROY:
+            stop_loading();
+            PostQuitMessage(0);
+        break;
+        case WM_CLOSE:
+            // The loader has to be done recording before the spans get exported
+            stop_loading();
+            export_trace();
+            DestroyWindow(hwnd);
+        break;
+        case WM_SIZE: {
+            if (wParam == SIZE_MINIMIZED) break;
+
+            Width = LOWORD(lParam);
+            Height = HIWORD(lParam);
+
+            resize();
+
+        } break;
+        case WM_GETMINMAXINFO: {
+
+            PMINMAXINFO mmi = (PMINMAXINFO) lParam;
+
+            // Set the minimum window size
+            mmi->ptMinTrackSize.x = 320;
+            mmi->ptMinTrackSize.y = 240;
+
+        } break; 
+        case WM_CTLCOLORSTATIC: {
+            HDC dc = (HDC)wParam;
+            // Draw transparent background for the file name control
+            // (And all other static controls)
+
+            SetTextColor(dc, GetSysColor(COLOR_WINDOWTEXT));
+            SetBkMode(dc, TRANSPARENT);
+
+            return (LRESULT)GetStockObject(NULL_BRUSH);
+        } break;
+        // A custom message posted by the loader thread
+        case WM_USER_LOADPROGRESS : {
+            struct loader_progress* progress = (struct loader_progress*)lParam;
+
+            // The progress of a load that has been stopped since
+            if (wParam != Load.generation || !Load.loader) {
+                document_free(progress->snapshot);
+                mem_free(progress);
+                break;
+            }
+
+            if (progress->snapshot) {
+                CONST uint64_t span = trace_begin();
+                show_loaded(progress->snapshot);
+                trace_end(span, "open: show");
+            }
+
+            switch (progress->status) {
+                case LOADER_LOADING:
+                    change_status_progress(progress->done, progress->total);
+                break;
+                case LOADER_DONE:
+                    stop_loading();
+                    if (progress->mapped)
+                        StringCbCopyW(Source.path, sizeof(Source.path), Load.path);
+                    Settings.is_new = FALSE;
+                    change_status_timing(L"Opened", trace_end(Load.started, "open"));
+                break;
+                case LOADER_INVALID:
+                    error_box_format(
+                        L"Failed to open the specified file",
+                        L"Invalid encoding, the file is not valid UTF-8 (byte %llu)",
+                        (ULONGLONG)progress->error);
+                    new_file();
+                break;
+                case LOADER_CANCELLED:
+                    new_file();
+                break;
+            }
+
+            mem_free(progress);
+        } break;
+        // A custom message that is generated by the text-box
+        case WM_USER_CARETMOVE : {
+            CONST uint64_t span = trace_begin();
+
+            // The document knows where its lines start, so this is O(log n) and gives
+            // the logical position, no matter how the text-box shows the lines
+            CONST SIZE_T caret = view_caret(View);
+            CONST ULONGLONG row = document_line_of(Document, caret);
+            CONST ULONGLONG col = caret - document_line_start(Document, row);
+
+            change_status_pos(row+1, col+1);
+            trace_end(span, "caret move");
+        } break;
+        case WM_COMMAND:
+
+            switch (HIWORD(wParam)) {
+
+                case 0:
+                    switch (LOWORD(wParam)) {
+
+                        case GUI_MENU_NEW: {
+                            new_file();
+                        } break;
+                        case GUI_MENU_SAVE: {
+
+                            // Saving a part of the file would be a disaster
+                            if (Load.loader) {
+                                error_box(L"Failed to save the file", L"The file is still loading, wait for it or cancel it first");
+                                break;
+                            }
+
+                            PCWSTR fname = choose_file(TRUE);
+
+                            save_to_file(fname);
+                        } break;
+                        case GUI_MENU_LOAD: {
+
+                            // Prompt the user to choose a file
+                            PCWSTR fname = choose_file(FALSE);
+                            // Load from file to control
+                            load_from_file(fname);
+                        } break;
+                        case GUI_MENU_WWRAP: {
+                            toggle_wwrap();
+                        } break;
+                        case GUI_MENU_UNDO:
+                        case GUI_MENU_REDO: {
+                            if (Load.loader) break;
+
+                            if (LOWORD(wParam) == GUI_MENU_UNDO)
+                                view_undo(View);
+                            else
+                                view_redo(View);
+                            update_text_box(Gui.text_box);
+                        } break;
+                        case GUI_MENU_FIND: {
+                            show_find_dialog(FALSE);
+                        } break;
+                        case GUI_MENU_REPLACE: {
+                            show_find_dialog(TRUE);
+                        } break;
+                        case GUI_MENU_FIND_NEXT: {
+                            find_next_match();
+                        } break;
+                        case GUI_MENU_ISEARCH: {
+                            SetFocus(Gui.text_box);
+                            start_incremental_search();
+                        } break;
+                        case GUI_MENU_REGEX: {
+                            toggle_regex();
+                        } break;
+                        case GUI_MENU_ABOUT: 
+                            MessageBoxW(
+                                Window, 
+                                L"This application is public domain, the source code is publicly available at github.com/jacobsebek/jittey\n"
+                                L"There is no warranty, use at own risk of losing your files.",
+                                L"About",
+                                MB_OK | MB_ICONINFORMATION);
+                        break;
+                    }
+
+                break;
+            }
+        break;
+        default:
+            // The find and replace dialogs send a registered message, it can't be a case of the switch
+            if (uMsg == Search.message && Search.message) {
+                CONST LPFINDREPLACEW options = (LPFINDREPLACEW)lParam;
+
+                if (options->Flags & FR_DIALOGTERM) {
+                    Search.dialog = NULL;
+                    SetFocus(Gui.text_box);
+                } else if (options->Flags & (FR_FINDNEXT | FR_REPLACE | FR_REPLACEALL)) {
+                    // The pattern is compiled again every time, the text or the case may have changed
+                    if (!compile_search(!(options->Flags & FR_MATCHCASE)))
+                        return 0;
+
+                    if (options->Flags & FR_REPLACEALL)
+                        replace_all_matches();
+                    else if (options->Flags & FR_REPLACE)
+                        replace_match();
+                    else
+                        find_next_match();
+                }
+                return 0;
+            }
+            return DefWindowProcW(hwnd, uMsg, wParam, lParam);
+    }
+
+    return 0;
+}
+
+// The entry point of the program, this function creates the main window and starts the message loop
+int WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR lpCmdLine, int nShowCmd) {
+
+    // The core has no idea about message boxes, let it fail the same way we do
+    mem_set_oom_handler(out_of_memory);
+
+    // "--convert format paths..." converts the files without any window, see convert_files
+    {
+        INT argc;
+        LPWSTR* argv = CommandLineToArgvW(GetCommandLineW(), &argc);
+        if (argv != NULL && argc > 1 && !lstrcmpW(argv[1], L"--convert")) {
+            CONST INT result = convert_files(argc, argv);
+            LocalFree(argv);
+            return result;
+        }
+        LocalFree(argv);
+    }
+
+    // This procedure is necessary to ensure that up-to-date controls get loaded
+    {
+        INITCOMMONCONTROLSEX icc;
+        icc.dwSize = sizeof(INITCOMMONCONTROLSEX);
+        icc.dwICC = ICC_STANDARD_CLASSES;
+        // It is not crucial for this to succeed, so we don't care if it fails (it will just use the old style)
+        InitCommonControlsEx(&icc);
+    }
+
+    // The find dialog talks to the main window through this message
+    Search.message = RegisterWindowMessageW(FINDMSGSTRINGW);
+    if (!Search.message)
+        fatal(L"Failed to register the find message");
+
+    // Finding all of the matches uses every processor
+    Pool = pool_create(0);
+    Incremental.search = isearch_create();
+
+    // Setup the main window
+    {
+        // Specify the style
+        PCWSTR class = L"MainClass";
+        PCWSTR title = L"Jittey 0.1";
+        CONST DWORD window_style = WS_CAPTION | WS_SYSMENU | WS_SIZEBOX | WS_MAXIMIZEBOX | WS_MINIMIZEBOX;
+        CONST HBRUSH bgcol = GetSysColorBrush(COLOR_WINDOW);
+
+        // Register the main window class
+        {
+            WNDCLASSEXW wc = {0};
+            wc.cbSize = sizeof(WNDCLASSEXW);
+            wc.lpszClassName = class;
+            wc.hInstance = hInstance;
+            wc.lpfnWndProc = WndProc;
+            wc.hbrBackground = bgcol;
+            wc.hIcon =   LoadImageW(hInstance, L"myIcon", IMAGE_ICON, 24, 24, LR_DEFAULTCOLOR);
+            wc.hIconSm = LoadImageW(hInstance, L"myIcon", IMAGE_ICON, 16, 16, LR_DEFAULTCOLOR);
+            //wc.hbrBackground = CreateSolidBrush(RGB(220, 220, 220));
+          
+            if (!RegisterClassExW(&wc))
+                fatal(L"Failed to register the main class");
+
+            // The text-box class, it paints everything itself
+            WNDCLASSEXW text_box_wc = {0};
+            text_box_wc.cbSize = sizeof(WNDCLASSEXW);
+            text_box_wc.lpszClassName = TEXT_BOX_CLASS;
+            text_box_wc.hInstance = hInstance;
+            text_box_wc.lpfnWndProc = TextBoxProc;
+            text_box_wc.hCursor = LoadCursorW(NULL, IDC_IBEAM);
+
+            if (!RegisterClassExW(&text_box_wc))
+                fatal(L"Failed to register the text box class");
+        }
+
+        // First, calculate the size of the whole window based on the client area size
+        INT wW, wH;
+        {
+            RECT wrect = {0, 0, Width, Height};
+            AdjustWindowRect(&wrect, window_style, TRUE);
+
+            wW = wrect.right-wrect.left;
+            wH = wrect.bottom-wrect.top;
+        }
+
+        CreateWindowW( class, 
+                       title,
+                       window_style,
+                       CW_USEDEFAULT, CW_USEDEFAULT, 
+                       wW, wH,
+                       NULL, NULL, hInstance, NULL);
+
+        if (!Window)
+            fatal(L"Failed to create the main window");
+    }
+
+    // Open the specified file in the console, if any
+    // When a file is "opened with" this app, the full command line looks like this:
+    // "path/to/the/app" "path/to/the/file"
+    // Luckily, we can use the CommandLIneToArgv function that does all the parsing
+    // It may also start with "--trace path/to/trace.json", which records where the time goes and writes it
+    // to that file (as Chrome trace events) when the editor is closed
+    {
+        INT argc;
+        LPWSTR* argv = CommandLineToArgvW(GetCommandLineW(), &argc);
+        INT file = 1;
+
+        if (argv != NULL && argc > 2 && !lstrcmpW(argv[1], L"--trace")) {
+            StringCbCopyW(Trace.path, sizeof(Trace.path), argv[2]);
+            trace_enable(TRUE);
+            file = 3;
+        }
+
+        if (argv != NULL && argc > file) {
+            // Open the file (it handles the NULL argument case)
+            load_from_file(argv[file]);
+        }
+
+        LocalFree(argv);
+    }
+
+    // This thing, this thing...
+    // If acctable has one element, the CreateAcceleratorTableW function fails under GCC, why? I have no idea.
+    //TODO: find out why this fails, even though it's not that big of a concern
+    // Setup an accelerator table for the edit box
+    // This could also be achieved by catching a EM_CHAR for the character that gets emmited when we press Ctrl+Backspace I suppose
+    ACCEL acctable[3] = {
+        {.fVirt = FCONTROL | FVIRTKEY, .key = VK_BACK, .cmd = ACC_EDIT_DELETEWORD},
+        {.fVirt = FCONTROL | FVIRTKEY, .key = 'I', .cmd = ACC_EDIT_ISEARCH},
+        {0,0,0}
+    };
+
+    Gui.edit_accels = CreateAcceleratorTableW(acctable, 2);
+    if (!Gui.edit_accels)
+        fatal(L"Failed to create the accelerator table");
+
+    MSG msg;
+    BOOL stat;
+    while (TRUE) {
+        // The incremental search goes on only while there are no messages waiting, so typing never waits for it
+        if (Incremental.active && !isearch_done(Incremental.search, Document) && !PeekMessageW(&msg, NULL, 0, 0, PM_NOREMOVE)) {
+            step_incremental_search();
+            continue;
+        }
+
+        if (!(stat = GetMessageW(&msg, NULL, 0, 0)))
+            break;
+
+        if (stat == -1)
+            fatal(L"GetMessage error");
+
+        // The find dialog handles its own keyboard navigation
+        if (Search.dialog && IsDialogMessageW(Search.dialog, &msg))
+            continue;
+
+        // Make sure that the accelerators are invoked only if the text box has keyboard focus
+        if (GetFocus() != Gui.text_box || !TranslateAcceleratorW(Gui.text_box, Gui.edit_accels, &msg)) {
+            TranslateMessage(&msg);
+            DispatchMessageW(&msg);
+        }
+    }
+
+    return 0;
+}
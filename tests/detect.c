@@ -0,0 +1,124 @@
+// Tests the format detection on the edge cases: empty and tiny texts, odd sizes, BOMs and samples
+
+#include "test.h"
+#include "../core/detect.h"
+#include "../core/memory.h"
+
+#include <stdalign.h>
+#include <string.h>
+
+// Detects the format of a text copied to a buffer aligned the way detect_format wants it
+static struct detection detect(const char* text, size_t size, size_t sample) {
+    alignas(uint16_t) uint8_t buffer[64] = {0};
+    memcpy(buffer, text, size);
+    return detect_format(buffer, size, sample);
+}
+
+static bool confident(const struct detection* detection) {
+    return detection->confidence >= 0 && detection->confidence <= 100;
+}
+
+static void test_tiny(void) {
+    struct detection detection = detect("", 0, 0);
+    CHECK(detection.format.encoding == ENCODING_UTF8 && !detection.format.bom && detection.scanned == 0);
+
+    // A single byte is never UTF-16, not even a NUL
+    detection = detect("\0", 1, 0);
+    CHECK(detection.format.encoding == ENCODING_UTF8 && confident(&detection));
+    CHECK(detection.confidence == 20);
+    detection = detect("a", 1, DETECT_SAMPLE);
+    CHECK(detection.format.encoding == ENCODING_UTF8 && detection.confidence == 90);
+    detection = detect("\xE9", 1, 0);
+    CHECK(detection.format.encoding == ENCODING_UTF8 && detection.confidence == 0);
+
+    // A whole code unit is enough
+    detection = detect("a\0", 2, 0);
+    CHECK(detection.format.encoding == ENCODING_UTF16 && confident(&detection));
+    detection = detect("\0a", 2, 0);
+    CHECK(detection.format.encoding == ENCODING_UTF16BE && confident(&detection));
+}
+
+static void test_odd_sizes(void) {
+    // The byte left over isn't a part of any code unit
+    struct detection detection = detect("\0a\0", 3, 0);
+    CHECK(detection.format.encoding == ENCODING_UTF16BE && confident(&detection));
+    detection = detect("a\0b\0c", 5, 0);
+    CHECK(detection.format.encoding == ENCODING_UTF16 && confident(&detection));
+    detection = detect("\0\0\0\0\0", 5, 0);
+    CHECK(confident(&detection));
+
+    // Odd sized text without NULs that isn't UTF-8 can't be UTF-16 either
+    detection = detect("\xFF\xFF\xFF", 3, 0);
+    CHECK(detection.format.encoding == ENCODING_UTF8 && detection.confidence == 0);
+    detection = detect("ab\n", 3, 0);
+    CHECK(detection.format.encoding == ENCODING_UTF8 && detection.format.linebreak == LINEBREAK_UNIX);
+}
+
+static void test_boms(void) {
+    struct detection detection = detect("\xEF\xBB\xBF", 3, 0);
+    CHECK(detection.format.encoding == ENCODING_UTF8 && detection.format.bom && detection.confidence == 100);
+    CHECK(detection.scanned == 3);
+
+    detection = detect("\xFF\xFEx\0\r\0\n\0", 8, 0);
+    CHECK(detection.format.encoding == ENCODING_UTF16 && detection.format.bom && detection.confidence == 100);
+    CHECK(detection.format.linebreak == LINEBREAK_WIN && detection.linebreaks.crlf == 1);
+
+    detection = detect("\xFE\xFF\0x\0\n", 6, 0);
+    CHECK(detection.format.encoding == ENCODING_UTF16BE && detection.format.bom);
+    CHECK(detection.format.linebreak == LINEBREAK_UNIX && detection.linebreaks.lf == 1);
+
+    // A BOM followed by half a code unit is still a BOM
+    detection = detect("\xFF\xFEx", 3, 0);
+    CHECK(detection.format.encoding == ENCODING_UTF16 && detection.format.bom && confident(&detection));
+
+    // Too short to be a BOM
+    detection = detect("\xEF\xBB", 2, 0);
+    CHECK(!detection.format.bom && confident(&detection));
+}
+
+// The size of the texts sampled, a few times the sample
+#define SAMPLED (4 * DETECT_SAMPLE + 2)
+
+static void test_sampled(void) {
+    uint8_t* text = mem_alloc(SAMPLED);
+    for (size_t i = 0; i < SAMPLED; i++)
+        text[i] = i % 50 == 49 ? '\n' : 'a' + i % 26;
+
+    struct detection whole = detect_format(text, SAMPLED, 0);
+    struct detection sampled = detect_format(text, SAMPLED, DETECT_SAMPLE);
+    CHECK(!whole.sampled && whole.scanned == SAMPLED);
+    CHECK(sampled.sampled && sampled.scanned <= DETECT_SAMPLE && sampled.scanned > DETECT_SAMPLE / 2);
+    CHECK(sampled.format.encoding == ENCODING_UTF8 && sampled.format.linebreak == LINEBREAK_UNIX);
+    CHECK(sampled.confidence == whole.confidence);
+
+    // A text no bigger than the sample is looked at as a whole
+    sampled = detect_format(text, DETECT_SAMPLE, DETECT_SAMPLE);
+    CHECK(!sampled.sampled && sampled.scanned == DETECT_SAMPLE);
+
+    // The same as UTF-16, both byte orders
+    for (size_t i = 0; i < SAMPLED; i += 2) {
+        text[i] = i % 100 == 98 ? '\n' : 'a' + i / 2 % 26;
+        text[i + 1] = 0;
+    }
+    sampled = detect_format(text, SAMPLED, DETECT_SAMPLE);
+    CHECK(sampled.format.encoding == ENCODING_UTF16 && sampled.format.linebreak == LINEBREAK_UNIX && confident(&sampled));
+    CHECK(sampled.confidence == detect_format(text, SAMPLED, 0).confidence);
+
+    memmove(text + 1, text, SAMPLED - 1);
+    text[0] = 0;
+    sampled = detect_format(text, SAMPLED, DETECT_SAMPLE);
+    CHECK(sampled.format.encoding == ENCODING_UTF16BE && confident(&sampled));
+
+    // A sample too small for a single code unit per span looks at nothing, and doesn't guess UTF-16 out of nothing
+    sampled = detect_format(text, SAMPLED, 8);
+    CHECK(sampled.sampled && sampled.scanned == 0 && sampled.format.encoding == ENCODING_UTF8);
+
+    mem_free(text);
+}
+
+void test_detect(void) {
+    test_tiny();
+    test_odd_sizes();
+    test_boms();
+    test_sampled();
+}
@@ -0,0 +1,384 @@
+// Tests the piece table: editing, snapshots, the line index, lazy loading and building out of checkpoints
+// The random edits are checked against a plain array of the same text
+
+#include "test.h"
+#include "../core/memory.h"
+#include "../core/utf.h"
+
+#include <string.h>
+
+// The text the random edits are checked against, with its lines counted the slow way
+struct model {
+    uint16_t* text;
+    size_t length, capacity;
+};
+
+static void model_insert(struct model* model, size_t pos, const uint16_t* text, size_t length) {
+    if (model->length + length > model->capacity) {
+        model->capacity = (model->length + length) * 2;
+        model->text = mem_realloc(model->text, model->capacity * sizeof(uint16_t));
+    }
+    memmove(model->text + pos + length, model->text + pos, (model->length - pos) * sizeof(uint16_t));
+    memcpy(model->text + pos, text, length * sizeof(uint16_t));
+    model->length += length;
+}
+
+static void model_erase(struct model* model, size_t pos, size_t length) {
+    memmove(model->text + pos, model->text + pos + length, (model->length - pos - length) * sizeof(uint16_t));
+    model->length -= length;
+}
+
+// Returns true if the document has the text of the model and the same lines
+static bool same_as(const struct document* document, const struct model* model) {
+    if (document_length(document) != model->length)
+        return false;
+
+    uint16_t* text = mem_alloc((model->length + 1) * sizeof(uint16_t));
+    bool same = document_read(document, 0, text, model->length) == model->length && !memcmp(text, model->text, model->length * sizeof(uint16_t));
+    mem_free(text);
+
+    size_t line = 0;
+    same &= document_line_start(document, 0) == 0;
+    for (size_t i = 0; i < model->length && same; i++)
+        if (model->text[i] == '\n') {
+            same &= document_line_of(document, i) == line;
+            same &= document_line_start(document, ++line) == i + 1;
+        }
+    return same && document_line_count(document) == line + 1;
+}
+
+static void test_insert_erase(void) {
+    struct document* document = document_create();
+    CHECK(document_length(document) == 0);
+    CHECK(document_line_count(document) == 1);
+
+    const uint16_t hello[] = { 'h', 'e', 'l', 'l', 'o' };
+    const uint16_t world[] = { ' ', 'w', 'o', 'r', 'l', 'd' };
+    document_insert(document, 0, hello, 5);
+    document_insert(document, 5, world, 6);
+    CHECK(test_document_is(document, "hello world"));
+
+    document_insert(document, 5, (const uint16_t[]){ ',' }, 1);
+    document_insert(document, 0, (const uint16_t[]){ '>' }, 1);
+    CHECK(test_document_is(document, ">hello, world"));
+
+    document_erase(document, 0, 1);
+    document_erase(document, 5, 1);
+    CHECK(test_document_is(document, "hello world"));
+    document_erase(document, 3, 5);
+    CHECK(test_document_is(document, "helrld"));
+    // Erasing past the end erases up to the end
+    document_erase(document, 4, 10);
+    CHECK(test_document_is(document, "helr"));
+    document_erase(document, 0, 4);
+    CHECK(document_length(document) == 0);
+
+    // Reading past the end gives only what there is
+    document_insert(document, 0, hello, 5);
+    uint16_t out[16];
+    CHECK(document_read(document, 3, out, 16) == 2 && out[0] == 'l' && out[1] == 'o');
+    document_free(document);
+}
+
+static void test_random_edits(void) {
+    struct document* document = document_create();
+    struct model model = { 0 };
+    uint64_t rng = 1;
+
+    // Big insertions (over half a chunk) get buffers of their own, the small ones go to the append block
+    uint16_t* text = mem_alloc(DOCUMENT_CHUNK * sizeof(uint16_t));
+    bool same = true;
+    for (int i = 0; i < 2000 && same; i++) {
+        const uint64_t r = test_random(&rng);
+        const size_t pos = model.length ? r % (model.length + 1) : 0;
+
+        if (r % 3 || !model.length) {
+            const size_t length = r % 100 == 0 ? DOCUMENT_CHUNK / 2 + r % 1000 : 1 + r % 40;
+            for (size_t j = 0; j < length; j++)
+                text[j] = test_random(&rng) % 8 == 0 ? '\n' : 'a' + j % 26;
+            document_insert(document, pos, text, length);
+            model_insert(&model, pos, text, length);
+        } else {
+            const size_t length = (r >> 20) % (model.length - pos + 1) % 3000;
+            document_erase(document, pos, length);
+            model_erase(&model, pos, length);
+        }
+
+        if (i % 100 == 0)
+            same = same_as(document, &model);
+    }
+    CHECK(same && same_as(document, &model));
+
+    mem_free(text);
+    mem_free(model.text);
+    document_free(document);
+}
+
+static void test_snapshots(void) {
+    struct document* document = test_document_from("one\ntwo\n");
+    const uint64_t revision = document_revision(document);
+    struct document* snapshot = document_snapshot(document);
+    CHECK(document_revision(snapshot) == revision);
+
+    // Neither sees the edits of the other
+    document_insert(document, 4, (const uint16_t[]){ '2', '\n' }, 2);
+    CHECK(test_document_is(document, "one\n2\ntwo\n"));
+    CHECK(test_document_is(snapshot, "one\ntwo\n"));
+    CHECK(document_revision(document) != revision);
+    CHECK(document_line_count(document) == 4 && document_line_count(snapshot) == 3);
+
+    document_erase(snapshot, 0, 4);
+    CHECK(test_document_is(snapshot, "two\n"));
+    CHECK(test_document_is(document, "one\n2\ntwo\n"));
+
+    // A snapshot outlives the original, and a copy shares nothing with it
+    struct document* copy = document_copy(document);
+    document_free(document);
+    CHECK(test_document_is(snapshot, "two\n"));
+    CHECK(test_document_is(copy, "one\n2\ntwo\n"));
+    document_free(snapshot);
+    document_free(copy);
+}
+
+static void test_lines(void) {
+    // A CRLF line ends with its CR, the lines are only about the LFs
+    struct document* document = test_document_from("a\nbb\r\nccc\n");
+    CHECK(document_line_count(document) == 4);
+    CHECK(document_line_start(document, 0) == 0);
+    CHECK(document_line_start(document, 1) == 2);
+    CHECK(document_line_start(document, 2) == 6);
+    CHECK(document_line_start(document, 3) == 10);
+    // Lines past the end start where the last one does
+    CHECK(document_line_start(document, 100) == 10);
+
+    CHECK(document_line_of(document, 0) == 0);
+    CHECK(document_line_of(document, 1) == 0);
+    CHECK(document_line_of(document, 4) == 1);
+    CHECK(document_line_of(document, 5) == 1);
+    CHECK(document_line_of(document, 9) == 2);
+    CHECK(document_line_of(document, 10) == 3);
+    CHECK(document_line_of(document, 100) == 3);
+
+    // Erasing a line break joins the lines
+    document_erase(document, 1, 1);
+    CHECK(document_line_count(document) == 3);
+    CHECK(document_line_start(document, 1) == 5);
+    document_free(document);
+
+    struct document* empty = document_create();
+    CHECK(document_line_count(empty) == 1 && document_line_start(empty, 0) == 0 && document_line_of(empty, 0) == 0);
+    document_free(empty);
+}
+
+static void test_replace_all(void) {
+    struct document* document = test_document_from("one two one three one");
+    const size_t positions[] = { 0, 8, 18 };
+    document_replace_all(document, positions, NULL, 3, 3, (const uint16_t[]){ '1' }, 1);
+    CHECK(test_document_is(document, "1 two 1 three 1"));
+
+    // Matches of different lengths, replaced with nothing
+    const size_t at[] = { 0, 6 }, lengths[] = { 2, 8 };
+    document_replace_all(document, at, lengths, 2, 0, NULL, 0);
+    CHECK(test_document_is(document, "two 1"));
+
+    // Nothing to replace changes nothing
+    document_replace_all(document, NULL, NULL, 0, 0, NULL, 0);
+    CHECK(test_document_is(document, "two 1"));
+    CHECK(document_line_count(document) == 1);
+    document_free(document);
+}
+
+// The UTF-8 text the lazy documents are made of, over a few chunks, with characters of every length
+// cut by the chunk boundaries
+static char* lazy_text(size_t* size) {
+    static const char* words[] = { "ascii ", "h\xC3\xA9llo ", "\xE4\xB8\xAD\xE6\x96\x87 ", "\xF0\x9F\x98\x80 ", "line\n", "crlf\r\n" };
+    const size_t capacity = 3 * DOCUMENT_CHUNK + 100;
+    char* text = mem_alloc(capacity);
+    uint64_t rng = 2;
+    *size = 0;
+    for (;;) {
+        const char* word = words[test_random(&rng) % 6];
+        const size_t length = strlen(word);
+        if (*size + length > capacity)
+            return text;
+        memcpy(text + *size, word, length);
+        *size += length;
+    }
+}
+
+// Counts the calls of the release callback
+static void count_release(void* ctx, const void* data, size_t size) {
+    (void)data;
+    (void)size;
+    (*(int*)ctx)++;
+}
+
+static struct model decoded(const char* text, size_t size) {
+    struct model model = { mem_alloc(size * sizeof(uint16_t)), 0, size };
+    model.length = utf8_to_utf16((const uint8_t*)text, size, model.text, NULL);
+    return model;
+}
+
+static void test_lazy(void) {
+    size_t size;
+    char* text = lazy_text(&size);
+    struct model model = decoded(text, size);
+
+    int released = 0;
+    struct document* document = document_create_lazy(text, size, ENCODING_UTF8, count_release, &released);
+    CHECK(document_state(document) == DOCUMENT_LOADING);
+    CHECK(document_length(document) == 0 && document_pending_bytes(document) == size);
+
+    // Only what has been loaded is in a snapshot
+    CHECK(document_load_more(document, 1000) == DOCUMENT_LOADING);
+    struct document* partial = document_snapshot(document);
+    CHECK(document_length(partial) > 0 && document_length(partial) < model.length);
+
+    while (document_load_more(document, 1000) == DOCUMENT_LOADING);
+    CHECK(document_state(document) == DOCUMENT_LOADED && document_pending_bytes(document) == 0);
+    CHECK(same_as(document, &model));
+    CHECK(document_checkpoints(partial, &(size_t){ 0 }) == NULL);
+
+    // Reading inside of the UTF-8 pieces decodes them, editing them splits them
+    document_insert(document, 5, (const uint16_t[]){ 'X' }, 1);
+    model_insert(&model, 5, (const uint16_t[]){ 'X' }, 1);
+    document_erase(document, DOCUMENT_CHUNK - 3, 10);
+    model_erase(&model, DOCUMENT_CHUNK - 3, 10);
+    CHECK(same_as(document, &model));
+
+    document_free(document);
+    CHECK(released == 0);
+    document_free(partial);
+    CHECK(released == 1);
+
+    // Broken text stops loading at the first invalid byte
+    text[size / 2] = (char)0xFF;
+    document = document_create_lazy(text, size, ENCODING_UTF8, NULL, NULL);
+    while (document_load_more(document, 4096) == DOCUMENT_LOADING);
+    CHECK(document_state(document) == DOCUMENT_INVALID);
+    CHECK(size - document_pending_bytes(document) == size / 2);
+    document_free(document);
+
+    // UTF-16 is only indexed, a stray odd byte is ignored
+    const uint16_t units[] = { 'a', '\n', 0xD83D, 0xDE00, '\n', 'b' };
+    document = document_create_lazy(units, sizeof(units) + 1, ENCODING_UTF16, NULL, NULL);
+    while (document_load_more(document, 2) == DOCUMENT_LOADING);
+    uint16_t out[8];
+    CHECK(document_read(document, 0, out, 8) == 6 && !memcmp(out, units, sizeof(units)));
+    CHECK(document_line_count(document) == 3 && document_line_start(document, 2) == 5);
+    document_free(document);
+
+    mem_free(model.text);
+    mem_free(text);
+}
+
+static void test_indexed(void) {
+    size_t size;
+    char* text = lazy_text(&size);
+    struct model model = decoded(text, size);
+
+    struct document* lazy = document_create_lazy(text, size, ENCODING_UTF8, NULL, NULL);
+    CHECK(document_checkpoints(lazy, &(size_t){ 0 }) == NULL);
+    while (document_load_more(lazy, 10000) == DOCUMENT_LOADING);
+
+    size_t count = 0;
+    struct document_checkpoint* checkpoints = document_checkpoints(lazy, &count);
+    if (!CHECK(checkpoints && count > 3)) {
+        document_free(lazy);
+        mem_free(checkpoints);
+        return;
+    }
+    CHECK(checkpoints[0].offset == 0 && checkpoints[count - 1].offset == size);
+    CHECK(checkpoints[count - 1].position == model.length && checkpoints[count - 1].line == document_line_count(lazy) - 1);
+
+    // Built out of the checkpoints without reading anything, it's the same document
+    int released = 0;
+    struct document* indexed = document_create_indexed(text, size, ENCODING_UTF8, checkpoints, count, count_release, &released);
+    CHECK(indexed && document_state(indexed) == DOCUMENT_LOADED);
+    CHECK(indexed && same_as(indexed, &model));
+
+    // It has the same checkpoints, until it's edited
+    size_t again_count = 0;
+    struct document_checkpoint* again = indexed ? document_checkpoints(indexed, &again_count) : NULL;
+    CHECK(again && again_count == count && !memcmp(again, checkpoints, count * sizeof(*checkpoints)));
+    mem_free(again);
+    if (indexed) {
+        document_insert(indexed, 1, (const uint16_t[]){ 'X' }, 1);
+        CHECK(document_checkpoints(indexed, &again_count) == NULL);
+        document_erase(indexed, 1, 1);
+        CHECK(same_as(indexed, &model));
+    }
+    document_free(indexed);
+    CHECK(released == 1);
+
+    // Checkpoints that don't fit the buffer are refused and the buffer isn't released
+    released = 0;
+    CHECK(!document_create_indexed(text, size - 1, ENCODING_UTF8, checkpoints, count, count_release, &released));
+    checkpoints[1].offset = checkpoints[2].offset;
+    CHECK(!document_create_indexed(text, size, ENCODING_UTF8, checkpoints, count, count_release, &released));
+    checkpoints[1].offset = checkpoints[0].offset + DOCUMENT_CHUNK + 1;
+    CHECK(!document_create_indexed(text, size, ENCODING_UTF8, checkpoints, count, count_release, &released));
+    CHECK(!document_create_indexed(text, size, ENCODING_UTF8, checkpoints, 0, count_release, &released));
+    CHECK(released == 0);
+
+    // A document that isn't all of one buffer has none
+    struct document* typed = test_document_from("typed");
+    CHECK(document_checkpoints(typed, &count) == NULL);
+    document_free(typed);
+
+    mem_free(checkpoints);
+    document_free(lazy);
+    mem_free(model.text);
+    mem_free(text);
+}
+
+// Checkpoints of a file that has changed since in a way the cache can't tell, which must not hang or read out of bounds
+static void test_stale_checkpoints(void) {
+    // Two 4 byte characters said to be 5 code units, the one they don't have reads as U+FFFD
+    const char pairs[] = "\xF0\x9F\x98\x80\xF0\x9F\x98\x80";
+    const struct document_checkpoint short_of[] = { { 0, 0, 0 }, { 8, 5, 0 } };
+    struct document* document = document_create_indexed(pairs, 8, ENCODING_UTF8, short_of, 2, NULL, NULL);
+    uint16_t out[8];
+    CHECK(document && document_read(document, 0, out, 8) == 5);
+    CHECK(out[0] == 0xD83D && out[1] == 0xDE00 && out[2] == 0xD83D && out[3] == 0xDE00 && out[4] == 0xFFFD);
+    if (document) {
+        document_erase(document, 1, 1);
+        CHECK(document_length(document) == 4 && document_read(document, 0, out, 8) == 4 && out[0] == 0xD83D && out[3] == 0xFFFD);
+    }
+    document_free(document);
+
+    // A piece with an invalid byte and fewer LFs than it's said to have, bigger than what a walk decodes at once
+    const size_t size = 5000;
+    char* text = mem_alloc(size);
+    for (size_t i = 0; i < size; i++)
+        text[i] = 'a' + i % 26;
+    memcpy(text + 10, "\xC3\xA9", 2);
+    text[3000] = (char)0xFF;
+    const struct document_checkpoint stale[] = { { 0, 0, 0 }, { size, size - 1, 3 } };
+    document = document_create_indexed(text, size, ENCODING_UTF8, stale, 2, NULL, NULL);
+    uint16_t* units = mem_alloc(size * sizeof(uint16_t));
+    CHECK(document && document_read(document, 0, units, size) == size - 1);
+    CHECK(units[10] == 0xE9 && units[2999] == 0xFFFD && units[3000] == 'a' + 3001 % 26);
+    CHECK(document && document_line_count(document) == 4 && document_line_start(document, 2) <= size - 1);
+
+    // Replacing inside of it decodes it too
+    if (document) {
+        const size_t positions[] = { 2998 };
+        document_replace_all(document, positions, NULL, 1, 1, (const uint16_t[]){ 'x' }, 1);
+        CHECK(document_length(document) == size - 1 && document_read(document, 2998, out, 2) == 2 && out[0] == 'x' && out[1] == 0xFFFD);
+    }
+    document_free(document);
+    mem_free(units);
+    mem_free(text);
+}
+
+void test_document(void) {
+    test_insert_erase();
+    test_random_edits();
+    test_snapshots();
+    test_lines();
+    test_replace_all();
+    test_lazy();
+    test_indexed();
+    test_stale_checkpoints();
+}
@@ -0,0 +1,203 @@
+// Tests the undo history: coalescing typing runs, groups, keeping to the budget and edits that don't fit at all
+// Every edit is recorded before it's made, the way the editor does
+
+#include "test.h"
+#include "../core/journal.h"
+#include "../core/memory.h"
+
+#include <string.h>
+
+// Makes an edit the journal asks for
+static void apply(void* ctx, size_t pos, size_t removed, const uint16_t* text, size_t length) {
+    struct document* document = ctx;
+    document_erase(document, pos, removed);
+    document_insert(document, pos, text, length);
+}
+
+// Records and makes an edit
+static void edit(struct journal* journal, struct document* document, size_t pos, size_t removed, const char* text) {
+    uint16_t units[64];
+    const size_t length = strlen(text);
+    for (size_t i = 0; i < length; i++)
+        units[i] = (uint8_t)text[i];
+    journal_record(journal, document, pos, removed, units, length);
+    apply(document, pos, removed, units, length);
+}
+
+// Types the text one character at a time after 'pos'
+static void type(struct journal* journal, struct document* document, size_t pos, const char* text) {
+    for (size_t i = 0; text[i]; i++)
+        edit(journal, document, pos + i, 0, (const char[]){ text[i], 0 });
+}
+
+static void test_typing(void) {
+    struct journal* journal = journal_create(JOURNAL_DEFAULT_BUDGET);
+    struct document* document = document_create();
+    CHECK(!journal_can_undo(journal) && !journal_can_redo(journal));
+    CHECK(!journal_undo(journal, apply, document));
+
+    type(journal, document, 0, "abc");
+    CHECK(journal_steps(journal) == 1);
+    CHECK(journal_undo(journal, apply, document) && document_length(document) == 0);
+    CHECK(!journal_can_undo(journal) && journal_can_redo(journal));
+    CHECK(journal_redo(journal, apply, document) && test_document_is(document, "abc"));
+    CHECK(!journal_can_redo(journal));
+
+    // Typing after a redo starts a new run, a line break goes with the run it's typed into and the next one starts after it
+    type(journal, document, 3, "d\nef");
+    CHECK(journal_steps(journal) == 3);
+    CHECK(journal_undo(journal, apply, document) && test_document_is(document, "abcd\n"));
+    CHECK(journal_undo(journal, apply, document) && test_document_is(document, "abc"));
+    CHECK(journal_redo(journal, apply, document) && test_document_is(document, "abcd\n"));
+
+    // Typing after an undo forgets what could be redone
+    type(journal, document, 5, "x");
+    CHECK(!journal_can_redo(journal) && test_document_is(document, "abcd\nx"));
+
+    // Typing somewhere else, or after a break, is a new step
+    const size_t steps = journal_steps(journal);
+    type(journal, document, 0, "1");
+    CHECK(journal_steps(journal) == steps + 1);
+    journal_break(journal);
+    type(journal, document, 1, "2");
+    CHECK(journal_steps(journal) == steps + 2);
+
+    // Backspace and delete make runs of their own, a pasted text doesn't
+    edit(journal, document, 5, 1, "");
+    edit(journal, document, 4, 1, "");
+    edit(journal, document, 4, 1, "");
+    edit(journal, document, 4, 1, "");
+    CHECK(journal_steps(journal) == steps + 3 && test_document_is(document, "12ab"));
+    edit(journal, document, 4, 0, "pasted");
+    edit(journal, document, 10, 0, "!");
+    CHECK(journal_steps(journal) == steps + 5);
+
+    CHECK(journal_undo(journal, apply, document) && journal_undo(journal, apply, document));
+    CHECK(journal_undo(journal, apply, document) && test_document_is(document, "12abcd\nx"));
+    CHECK(journal_redo(journal, apply, document) && test_document_is(document, "12ab"));
+
+    journal_clear(journal);
+    CHECK(!journal_can_undo(journal) && !journal_can_redo(journal) && journal_steps(journal) == 0);
+    document_free(document);
+    journal_free(journal);
+}
+
+static void test_groups(void) {
+    struct journal* journal = journal_create(JOURNAL_DEFAULT_BUDGET);
+    struct document* document = test_document_from("one two one");
+
+    // Nested groups are a single step, and typing in them makes no run with what came before
+    type(journal, document, 11, "!");
+    journal_begin_group(journal);
+    edit(journal, document, 12, 0, "?");
+    journal_begin_group(journal);
+    edit(journal, document, 0, 3, "1");
+    edit(journal, document, 6, 3, "1");
+    journal_end_group(journal);
+    type(journal, document, 0, ">>");
+    journal_end_group(journal);
+    CHECK(test_document_is(document, ">>1 two 1!?"));
+    CHECK(journal_steps(journal) == 2);
+
+    CHECK(journal_undo(journal, apply, document) && test_document_is(document, "one two one!"));
+    CHECK(journal_redo(journal, apply, document) && test_document_is(document, ">>1 two 1!?"));
+
+    // Replacing all of the matches is one step too
+    const size_t positions[] = { 2, 8 };
+    const uint16_t three[] = { '3', '3' };
+    journal_record_all(journal, document, positions, NULL, 2, 1, three, 2);
+    document_replace_all(document, positions, NULL, 2, 1, three, 2);
+    CHECK(test_document_is(document, ">>33 two 33!?"));
+    CHECK(journal_undo(journal, apply, document) && test_document_is(document, ">>1 two 1!?"));
+    CHECK(journal_redo(journal, apply, document) && test_document_is(document, ">>33 two 33!?"));
+
+    // An empty group is nothing to undo
+    const size_t steps = journal_steps(journal);
+    journal_begin_group(journal);
+    journal_end_group(journal);
+    CHECK(journal_steps(journal) == steps);
+
+    document_free(document);
+    journal_free(journal);
+}
+
+// The units each big step inserts, a few fit into a small budget
+#define STEP_UNITS 40000
+#define STEPS 20
+
+static void test_budget(void) {
+    const size_t budget = 600 * 1024;
+    struct journal* journal = journal_create(budget);
+    struct document* document = document_create();
+
+    uint16_t* text = mem_alloc(STEP_UNITS * sizeof(uint16_t));
+    bool within = true;
+    for (int i = 0; i < STEPS; i++) {
+        for (size_t j = 0; j < STEP_UNITS; j++)
+            text[j] = 'a' + i;
+        journal_record(journal, document, document_length(document), 0, text, STEP_UNITS);
+        document_insert(document, document_length(document), text, STEP_UNITS);
+        within &= journal_bytes(journal) <= budget;
+    }
+    CHECK(within);
+
+    // The oldest steps are gone, the newest ones can still be undone
+    const size_t steps = journal_steps(journal);
+    CHECK(steps > 1 && steps < STEPS);
+    while (journal_undo(journal, apply, document));
+    CHECK(document_length(document) == (STEPS - steps) * STEP_UNITS);
+    uint16_t last = 0;
+    CHECK(document_read(document, document_length(document) - 1, &last, 1) == 1 && last == 'a' + STEPS - steps - 1);
+
+    // And all of them can be redone
+    while (journal_redo(journal, apply, document));
+    CHECK(document_length(document) == STEPS * STEP_UNITS);
+
+    mem_free(text);
+    document_free(document);
+    journal_free(journal);
+}
+
+static void test_oversized(void) {
+    const size_t budget = 256 * 1024;
+    struct journal* journal = journal_create(budget);
+    struct document* document = test_document_from("text");
+    type(journal, document, 4, "!");
+    CHECK(journal_can_undo(journal));
+
+    // An edit bigger than the budget takes the history with it, and the rest of its group too
+    const size_t length = budget / sizeof(uint16_t) + 1;
+    uint16_t* big = mem_alloc(length * sizeof(uint16_t));
+    for (size_t i = 0; i < length; i++)
+        big[i] = 'b';
+    journal_begin_group(journal);
+    edit(journal, document, 0, 0, "<");
+    journal_record(journal, document, 1, 0, big, length);
+    document_insert(document, 1, big, length);
+    edit(journal, document, 0, 0, "<");
+    journal_end_group(journal);
+    CHECK(!journal_can_undo(journal) && !journal_can_redo(journal));
+    CHECK(journal_steps(journal) == 0);
+
+    // Out of the group, the edits are recorded again
+    edit(journal, document, 0, 1, "");
+    CHECK(journal_steps(journal) == 1);
+    CHECK(journal_undo(journal, apply, document) && !journal_can_undo(journal));
+    CHECK(document_length(document) == length + 7);
+
+    // Erasing all of it doesn't fit either
+    journal_record(journal, document, 0, document_length(document), NULL, 0);
+    document_erase(document, 0, document_length(document));
+    CHECK(!journal_can_undo(journal) && !journal_can_redo(journal));
+
+    mem_free(big);
+    document_free(document);
+    journal_free(journal);
+}
+
+void test_journal(void) {
+    test_typing();
+    test_groups();
+    test_budget();
+    test_oversized();
+}
@@ -0,0 +1,91 @@
+// The unit test driver for the portable core
+// Usage: jittey-test [test...], runs all of the tests if none is specified, fails if any check does
+
+#include "test.h"
+#include "../core/memory.h"
+
+#include <string.h>
+
+static const struct {
+    const char* name;
+    test_fn fn;
+} Tests[] = {
+    { "detect", test_detect },
+    { "document", test_document },
+    { "journal", test_journal },
+    { "memory", test_memory },
+    { "view", test_view },
+};
+
+#define TEST_COUNT (sizeof(Tests) / sizeof(Tests[0]))
+
+static size_t Checks = 0, Failures = 0;
+
+bool test_check(bool passed, const char* condition, const char* file, int line) {
+    Checks++;
+    if (!passed) {
+        Failures++;
+        fprintf(stderr, "  %s:%d: %s\n", file, line, condition);
+    }
+    return passed;
+}
+
+struct document* test_document_from(const char* text) {
+    struct document* document = document_create();
+    const size_t length = strlen(text);
+    uint16_t* units = mem_alloc((length + 1) * sizeof(uint16_t));
+    for (size_t i = 0; i < length; i++)
+        units[i] = (uint8_t)text[i];
+    document_insert(document, 0, units, length);
+    mem_free(units);
+    return document;
+}
+
+bool test_document_is(const struct document* document, const char* text) {
+    const size_t length = strlen(text);
+    if (document_length(document) != length)
+        return false;
+
+    uint16_t* units = mem_alloc((length + 1) * sizeof(uint16_t));
+    bool same = document_read(document, 0, units, length) == length;
+    for (size_t i = 0; i < length && same; i++)
+        same = units[i] == (uint8_t)text[i];
+    mem_free(units);
+    return same;
+}
+
+uint64_t test_random(uint64_t* state) {
+    // splitmix64
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static void run(size_t index) {
+    const size_t failures = Failures;
+    Tests[index].fn();
+    printf("%-12s %s\n", Tests[index].name, Failures == failures ? "ok" : "FAILED");
+}
+
+int main(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        size_t index = 0;
+        while (index < TEST_COUNT && strcmp(argv[i], Tests[index].name))
+            index++;
+        if (index == TEST_COUNT) {
+            fprintf(stderr, "Unknown test '%s', the available ones are:\n", argv[i]);
+            for (size_t j = 0; j < TEST_COUNT; j++)
+                fprintf(stderr, "  %s\n", Tests[j].name);
+            return 1;
+        }
+        run(index);
+    }
+
+    if (argc < 2)
+        for (size_t i = 0; i < TEST_COUNT; i++)
+            run(i);
+
+    printf("%zu checks, %zu failed\n", Checks, Failures);
+    return Failures ? 1 : 0;
+}
@@ -0,0 +1,117 @@
+// Tests the counters of the allocator, and the arenas with the pool of blocks they share
+// The counters are global, so every check is about the difference a known sequence makes to them
+
+#include "test.h"
+#include "../core/arena.h"
+#include "../core/memory.h"
+
+#include <stdalign.h>
+#include <string.h>
+
+static void test_counters(void) {
+    struct mem_stats before, after;
+    mem_get_stats(&before);
+
+    uint8_t* block = mem_alloc(100);
+    mem_get_stats(&after);
+    CHECK(after.allocations == before.allocations + 1 && after.frees == before.frees);
+    CHECK(after.bytes == before.bytes + 100);
+
+    // Resizing is a free and an allocation
+    block = mem_realloc(block, 300);
+    mem_get_stats(&after);
+    CHECK(after.allocations == before.allocations + 2 && after.frees == before.frees + 1);
+    CHECK(after.bytes == before.bytes + 300);
+
+    mem_free(block);
+    mem_free(NULL);
+    mem_get_stats(&after);
+    CHECK(after.frees == before.frees + 2 && after.bytes == before.bytes);
+
+    // Zeroed memory counts the same
+    uint8_t* zeroed = mem_calloc(10, 20);
+    bool zero = true;
+    for (size_t i = 0; i < 200; i++)
+        zero &= !zeroed[i];
+    CHECK(zero);
+    mem_get_stats(&after);
+    CHECK(after.allocations == before.allocations + 3 && after.bytes == before.bytes + 200);
+    mem_free(zeroed);
+
+    // The peak is the most there has been at once since it was reset, not the sum
+    mem_reset_peak();
+    mem_get_stats(&before);
+    CHECK(before.peak == before.bytes);
+    mem_free(mem_alloc(1000));
+    void* small = mem_alloc(10);
+    mem_get_stats(&after);
+    CHECK(after.peak == before.bytes + 1000 && after.bytes == before.bytes + 10);
+    mem_free(small);
+}
+
+static void test_arena(void) {
+    arena_trim();
+    struct arena_stats before, after;
+    arena_get_stats(&before);
+    CHECK(before.pooled == 0);
+
+    // The first allocation takes a block, the next ones come out of it
+    struct arena arena;
+    arena_init(&arena);
+    uint8_t* a = arena_alloc(&arena, 1);
+    uint8_t* b = arena_alloc(&arena, 100);
+    uint8_t* c = arena_alloc(&arena, 1000);
+    arena_get_stats(&after);
+    CHECK(after.allocated == before.allocated + 1 && after.reused == before.reused);
+    CHECK(a < b && b < c && c + 1000 <= a + ARENA_BLOCK);
+    CHECK((uintptr_t)b % alignof(max_align_t) == 0 && (uintptr_t)c % alignof(max_align_t) == 0);
+    memset(c, 0xAB, 1000);
+
+    // Resetting gives the block back to the pool, and the arena starts over
+    struct arena_block* block = arena.blocks;
+    arena_reset(&arena);
+    arena_get_stats(&after);
+    CHECK(!arena.blocks && arena.used == 0);
+    CHECK(after.pooled == 1);
+
+    // Which the next arena takes instead of allocating one
+    struct arena other;
+    arena_init(&other);
+    CHECK(arena_alloc(&other, 10) == a);
+    arena_get_stats(&after);
+    CHECK(other.blocks == block && after.reused == before.reused + 1 && after.allocated == before.allocated + 1);
+    CHECK(after.pooled == 0);
+    arena_reset(&other);
+
+    // A buffer too big for a block gets one of its own, which isn't kept
+    uint8_t* big = arena_alloc(&arena, ARENA_BLOCK + 1);
+    big[ARENA_BLOCK] = 1;
+    arena_get_stats(&after);
+    CHECK(after.allocated == before.allocated + 2 && after.pooled == 1);
+    arena_reset(&arena);
+    arena_get_stats(&after);
+    CHECK(after.pooled == 1);
+
+    // The pool keeps only so many blocks, the rest are freed
+    struct mem_stats memory;
+    mem_get_stats(&memory);
+    for (int i = 0; i < ARENA_POOL + 2; i++)
+        arena_alloc(&arena, ARENA_BLOCK / 2 + 1);
+    arena_reset(&arena);
+    arena_get_stats(&after);
+    CHECK(after.pooled == ARENA_POOL);
+    CHECK(after.reused == before.reused + 2 && after.allocated == before.allocated + 2 + ARENA_POOL + 1);
+
+    // Trimming frees them all
+    arena_trim();
+    struct mem_stats trimmed;
+    mem_get_stats(&trimmed);
+    arena_get_stats(&after);
+    CHECK(after.pooled == 0 && trimmed.bytes < memory.bytes);
+    CHECK(trimmed.frees == memory.frees + 2 + ARENA_POOL);
+}
+
+void test_memory(void) {
+    test_counters();
+    test_arena();
+}
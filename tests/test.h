@@ -0,0 +1,34 @@
+#pragma once
+// Shared helpers for the unit tests of the portable core (Linux only)
+// Unlike the benchmarks, the tests are small and deterministic, they only check what the modules do, not how fast
+
+#include "../core/document.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+// Every test module gets run as a whole, the checks that fail are printed and counted
+typedef void (*test_fn)(void);
+
+// Checks a condition, a failed one is reported with where it is, the test goes on either way
+#define CHECK(condition) test_check((condition), #condition, __FILE__, __LINE__)
+
+// Returns 'passed', counting and printing the check if it failed
+bool test_check(bool passed, const char* condition, const char* file, int line);
+
+// Creates a document with ASCII (or Latin-1) text, as if it had been typed in
+struct document* test_document_from(const char* text);
+// Returns true if the document has exactly this ASCII (or Latin-1) text
+bool test_document_is(const struct document* document, const char* text);
+
+// A small deterministic random generator, so that every run makes the same edits
+uint64_t test_random(uint64_t* state);
+
+// The tests themselves, one per module
+void test_detect(void);
+void test_document(void);
+void test_journal(void);
+void test_memory(void);
+void test_view(void);
@@ -0,0 +1,383 @@
+// Tests the text view with fake metrics: moving the caret, clicking, scrolling and the runs painted
+// Every code unit is 10 wide and every line 20 high, so all of the positions can be worked out by hand
+
+#include "test.h"
+#include "../core/memory.h"
+#include "../core/view.h"
+#include "../core/wrap.h"
+
+#include <string.h>
+
+#define CHAR_WIDTH 10
+#define LINE_HEIGHT 20
+
+// Counts the code units measured, to check what a view reads
+static void fake_extents(void* ctx, const uint16_t* text, size_t length, int* extents) {
+    (void)text;
+    *(size_t*)ctx += length;
+    for (size_t i = 0; i < length; i++)
+        extents[i] = (int)(i + 1) * CHAR_WIDTH;
+}
+
+static size_t Measured;
+
+static struct view* view_of(struct document* document, int width, int height) {
+    const struct view_metrics metrics = { fake_extents, &Measured, LINE_HEIGHT };
+    struct view* view = view_create(document, &metrics);
+    view_resize(view, width, height);
+    return view;
+}
+
+static struct document* document_of(const uint16_t* text) {
+    size_t length = 0;
+    while (text[length])
+        length++;
+    struct document* document = document_create();
+    document_insert(document, 0, text, length);
+    return document;
+}
+
+// What got painted, every run with the first of its code units
+struct run {
+    int x, y, width;
+    size_t length;
+    uint16_t first;
+    bool selected;
+};
+
+struct canvas {
+    struct run runs[64];
+    size_t count;
+};
+
+static void fake_draw(void* ctx, int x, int y, int width, const uint16_t* text, size_t length, bool selected) {
+    struct canvas* canvas = ctx;
+    if (canvas->count < sizeof(canvas->runs) / sizeof(canvas->runs[0]))
+        canvas->runs[canvas->count] = (struct run){ x, y, width, length, length ? text[0] : 0, selected };
+    canvas->count++;
+}
+
+static bool run_is(const struct run* run, int x, int y, int width, size_t length, uint16_t first, bool selected) {
+    return run->x == x && run->y == y && run->width == width && run->length == length && run->first == first && run->selected == selected;
+}
+
+static void test_moving(void) {
+    // a b CR LF and a surrogate pair before the c
+    struct document* document = document_of(u"ab\r\n\U0001F600c");
+    struct view* view = view_of(document, 200, 100);
+
+    // Right and left go over a CRLF and a surrogate pair in one step, and stop at the ends
+    const size_t right[] = { 1, 2, 4, 6, 7, 7 }, left[] = { 6, 4, 2, 1, 0, 0 };
+    bool moved = true;
+    for (size_t i = 0; i < 6; i++) {
+        view_move(view, VIEW_RIGHT, false);
+        moved &= view_caret(view) == right[i];
+    }
+    for (size_t i = 0; i < 6; i++) {
+        view_move(view, VIEW_LEFT, false);
+        moved &= view_caret(view) == left[i];
+    }
+    CHECK(moved);
+
+    // Nothing gets between a CR and an LF or the halves of a pair
+    size_t start, end;
+    view_select(view, 3, 5);
+    view_selection(view, &start, &end);
+    CHECK(start == 2 && end == 4 && view_caret(view) == 4);
+
+    // Moving without shift only collapses the selection
+    view_move(view, VIEW_LEFT, false);
+    CHECK(view_caret(view) == 2);
+
+    // Up and down keep to the x, the pair is two units wide
+    view_select(view, 6, 6);
+    view_move(view, VIEW_UP, false);
+    CHECK(view_caret(view) == 2);
+    view_move(view, VIEW_DOWN, false);
+    CHECK(view_caret(view) == 6);
+    view_move(view, VIEW_LINE_END, false);
+    CHECK(view_caret(view) == 7);
+    view_move(view, VIEW_LINE_START, true);
+    view_selection(view, &start, &end);
+    CHECK(start == 4 && end == 7);
+
+    // Backspace takes a whole pair, then a whole CRLF
+    view_select(view, 6, 6);
+    view_erase(view, VIEW_LEFT);
+    CHECK(view_caret(view) == 4 && test_document_is(document, "ab\r\nc"));
+    view_erase(view, VIEW_LEFT);
+    CHECK(view_caret(view) == 2 && test_document_is(document, "abc"));
+
+    // A CR typed before an LF makes a CRLF, the caret goes after all of it
+    view_select(view, 1, 1);
+    view_insert(view, u"\n", 1);
+    view_select(view, 1, 1);
+    view_insert(view, u"\r", 1);
+    CHECK(view_caret(view) == 3 && test_document_is(document, "a\r\nbc"));
+
+    view_free(view);
+    document_free(document);
+}
+
+static void test_click(void) {
+    // The tab goes from 30 to the tab stop at 40
+    struct document* document = test_document_from("one\ttwo\nthree\r\nfour");
+    struct view* view = view_of(document, 200, 60);
+
+    // A click goes to the closer side of the character
+    view_click(view, 12, 5, false);
+    CHECK(view_caret(view) == 1);
+    view_click(view, 18, 5, false);
+    CHECK(view_caret(view) == 2);
+    view_click(view, 33, 5, false);
+    CHECK(view_caret(view) == 3);
+    view_click(view, 37, 5, false);
+    CHECK(view_caret(view) == 4);
+
+    // Past the end of a line is its end, before its CRLF
+    view_click(view, 500, 25, false);
+    CHECK(view_caret(view) == 13);
+
+    // Below the last line and above the first one
+    view_click(view, 0, 1000, false);
+    CHECK(view_caret(view) == 15);
+    view_click(view, -5, -20, false);
+    CHECK(view_caret(view) == 0);
+
+    // Shift extends the selection
+    view_click(view, 500, 5, true);
+    size_t start, end;
+    view_selection(view, &start, &end);
+    CHECK(start == 0 && end == 7);
+
+    view_free(view);
+    document_free(document);
+}
+
+static void test_scrolling(void) {
+    // 100 lines and an empty one after them, 3 fit into the view
+    char text[600] = "";
+    for (int i = 0; i < 100; i++)
+        strcat(text, "line\n");
+    struct document* document = test_document_from(text);
+    struct view* view = view_of(document, 100, 60);
+    CHECK(view_page_lines(view) == 3);
+
+    view_scroll_lines(view, 5);
+    CHECK(view_top_line(view) == 5);
+    view_scroll_lines(view, -10);
+    CHECK(view_top_line(view) == 0);
+    view_scroll_to(view, 1000);
+    CHECK(view_top_line(view) == 100);
+
+    // Paging moves the view with the caret
+    view_select(view, 0, 0);
+    CHECK(view_top_line(view) == 0);
+    view_move(view, VIEW_PAGE_DOWN, false);
+    CHECK(view_caret(view) == 15 && view_top_line(view) == 3);
+
+    // The end of the document is on the last row of the view
+    int x, y;
+    view_move(view, VIEW_DOCUMENT_END, false);
+    view_caret_point(view, &x, &y);
+    CHECK(view_caret(view) == 500 && view_top_line(view) == 98);
+    CHECK(x == 0 && y == 2 * LINE_HEIGHT);
+
+    // A caret above the view is somewhere above it
+    view_scroll_to(view, 50);
+    view_select(view, 0, 0);
+    view_scroll_to(view, 50);
+    view_caret_point(view, &x, &y);
+    CHECK(y < 0);
+    view_free(view);
+    document_free(document);
+
+    // Going past the right edge scrolls by a part of the width, going back to the start scrolls all the way back
+    document = test_document_from("xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx\nshort");
+    view = view_of(document, 100, 60);
+    view_move(view, VIEW_LINE_END, false);
+    view_caret_point(view, &x, &y);
+    CHECK(view_scroll_x(view) == 425 && x == 75 && view_text_width(view) == 500);
+    view_move(view, VIEW_LINE_START, false);
+    CHECK(view_scroll_x(view) == 0);
+
+    view_free(view);
+    document_free(document);
+}
+
+static void test_paint(void) {
+    struct document* document = test_document_from("ab\tc\nxyz");
+    struct view* view = view_of(document, 200, 40);
+    view_select(view, 1, 6);
+
+    // The runs end at the tab and where the selection does, the selected line break is a space
+    struct canvas canvas = { 0 };
+    CHECK(view_paint(view, fake_draw, &canvas) == 2);
+    CHECK(canvas.count == 7);
+    CHECK(run_is(&canvas.runs[0], 0, 0, 10, 1, 'a', false));
+    CHECK(run_is(&canvas.runs[1], 10, 0, 10, 1, 'b', true));
+    CHECK(run_is(&canvas.runs[2], 20, 0, 20, 0, 0, true));
+    CHECK(run_is(&canvas.runs[3], 40, 0, 10, 1, 'c', true));
+    CHECK(run_is(&canvas.runs[4], 50, 0, CHAR_WIDTH, 0, 0, true));
+    CHECK(run_is(&canvas.runs[5], 0, 20, 10, 1, 'x', true));
+    CHECK(run_is(&canvas.runs[6], 10, 20, 20, 2, 'y', false));
+
+    // What is scrolled out to the left isn't drawn, a run that is only partly is
+    view_select(view, 0, 0);
+    view_scroll_to_x(view, 25);
+    canvas = (struct canvas){ 0 };
+    view_paint(view, fake_draw, &canvas);
+    CHECK(canvas.count == 3 && run_is(&canvas.runs[0], -5, 0, 20, 0, 0, false) && run_is(&canvas.runs[2], -25, 20, 30, 3, 'x', false));
+    view_free(view);
+    document_free(document);
+
+    // A CR of a CRLF is never drawn
+    document = test_document_from("ab\r\ncd\r\n");
+    view = view_of(document, 200, 40);
+    canvas = (struct canvas){ 0 };
+    CHECK(view_paint(view, fake_draw, &canvas) == 3);
+    CHECK(canvas.count == 2 && run_is(&canvas.runs[0], 0, 0, 20, 2, 'a', false) && run_is(&canvas.runs[1], 0, 20, 20, 2, 'c', false));
+
+    view_free(view);
+    document_free(document);
+}
+
+// A line far longer than the view, between two short ones
+#define LONG_LINE 100000
+
+static struct document* long_document(void) {
+    uint16_t* text = mem_alloc((LONG_LINE + 16) * sizeof(uint16_t));
+    memcpy(text, u"first\n", 6 * sizeof(uint16_t));
+    for (size_t i = 6; i < 6 + LONG_LINE; i++)
+        text[i] = 'a';
+    memcpy(text + 6 + LONG_LINE, u"\nlast", 6 * sizeof(uint16_t));
+    struct document* document = document_of(text);
+    mem_free(text);
+    return document;
+}
+
+static void test_long_line(void) {
+    struct document* document = long_document();
+    struct view* view = view_of(document, 100, 60);
+
+    // Painting reads only what fits, not the rest of the long line, a block at a time
+    struct canvas canvas = { 0 };
+    Measured = 0;
+    CHECK(view_paint(view, fake_draw, &canvas) == 3);
+    CHECK(Measured < 2000);
+    CHECK(canvas.count == 3 && run_is(&canvas.runs[1], 0, 20, 256 * CHAR_WIDTH, 256, 'a', false) && run_is(&canvas.runs[2], 0, 40, 40, 4, 'l', false));
+
+    // Which holds for the last line too
+    const size_t end = 6 + LONG_LINE;
+    view_select(view, end, end + 5);
+    view_erase(view, VIEW_RIGHT);
+    view_scroll_to(view, 0);
+    view_scroll_to_x(view, 0);
+    canvas = (struct canvas){ 0 };
+    Measured = 0;
+    CHECK(view_paint(view, fake_draw, &canvas) == 2);
+    CHECK(Measured < 2000 && canvas.count == 2);
+
+    // The caret at the end of the line gets measured all the way once, then only from the last checkpoint before it
+    int x, y;
+    view_select(view, end, end);
+    Measured = 0;
+    view_caret_point(view, &x, &y);
+    CHECK(Measured < 5000);
+    CHECK(x + view_scroll_x(view) == LONG_LINE * CHAR_WIDTH && y == LINE_HEIGHT);
+
+    // Also after typing there
+    Measured = 0;
+    view_insert(view, u"b", 1);
+    view_caret_point(view, &x, &y);
+    CHECK(Measured < 10000);
+    CHECK(x + view_scroll_x(view) == (LONG_LINE + 1) * CHAR_WIDTH);
+
+    // An edit before the checkpoints moves them all
+    view_select(view, 6, 6);
+    view_insert(view, u"\t", 1);
+    view_select(view, end + 2, end + 2);
+    view_caret_point(view, &x, &y);
+    CHECK(x + view_scroll_x(view) == (LONG_LINE + 1) * CHAR_WIDTH + 4 * CHAR_WIDTH);
+
+    view_free(view);
+    document_free(document);
+}
+
+static void test_wrapping(void) {
+    // 9 code units fit into a row of a view 100 wide, a bit of room is left for the caret
+    struct document* document = test_document_from("aaaa bbbb cccc\nx");
+    struct view* view = view_of(document, 100, 60);
+    view_set_wrap(view, true);
+
+    struct canvas canvas = { 0 };
+    CHECK(view_paint(view, fake_draw, &canvas) == 3);
+    CHECK(canvas.count == 3 && run_is(&canvas.runs[0], 0, 0, 50, 5, 'a', false) && run_is(&canvas.runs[1], 0, 20, 90, 9, 'b', false));
+
+    // The caret gets only right in front of where a row wraps, the wrap itself is the start of the next row
+    view_move(view, VIEW_DOWN, false);
+    CHECK(view_caret(view) == 5);
+    view_click(view, 95, 5, false);
+    CHECK(view_caret(view) == 4);
+    view_free(view);
+    document_free(document);
+
+    // A huge line gets wrapped only around what is shown, a chunk at a time, 99 code units to a row
+    document = long_document();
+    view = view_of(document, 1000, 60);
+    Measured = 0;
+    view_set_wrap(view, true);
+    canvas = (struct canvas){ 0 };
+    CHECK(view_paint(view, fake_draw, &canvas) == 4);
+    CHECK(Measured < LONG_LINE / 2);
+    CHECK(canvas.count == 4 && run_is(&canvas.runs[3], 0, 60, 990, 99, 'a', false));
+
+    // Every chunk starts a row, 16384 = 165 * 99 + 49
+    int x, y;
+    view_select(view, 6 + WRAP_CHUNK, 6 + WRAP_CHUNK);
+    view_caret_point(view, &x, &y);
+    CHECK(x == 0);
+    view_move(view, VIEW_LEFT, false);
+    view_caret_point(view, &x, &y);
+    CHECK(x == 48 * CHAR_WIDTH);
+    view_move(view, VIEW_DOWN, false);
+    CHECK(view_caret(view) == 6 + WRAP_CHUNK + 48);
+
+    // Resizing at the end of the line wraps only the last chunk again, the top row keeps its text
+    // (1485 code units into the chunk, on row 7 of 199 code units) and the caret is on the row after it
+    view_move(view, VIEW_LINE_END, false);
+    Measured = 0;
+    view_resize(view, 2000, 60);
+    view_paint(view, fake_draw, &canvas);
+    view_caret_point(view, &x, &y);
+    CHECK(Measured < LONG_LINE / 2 && view_top_line(view) == 1);
+    CHECK(y == LINE_HEIGHT);
+
+    // Scrolling up goes from the last row of a chunk (16384 = 82 * 199 + 66) into the first one of the next chunk
+    view_scroll_lines(view, -8);
+    canvas = (struct canvas){ 0 };
+    CHECK(view_paint(view, fake_draw, &canvas) == 4 && view_top_line(view) == 1);
+    CHECK(canvas.count == 4 && canvas.runs[0].length == 66 && canvas.runs[1].length == 199 && canvas.runs[1].y == LINE_HEIGHT);
+    view_scroll_lines(view, -(ptrdiff_t)(7 * 83 + 10));
+    CHECK(view_top_line(view) == 0);
+
+    // Turning wrapping off and back on wraps only the chunk at the top
+    view_scroll_to(view, 1);
+    view_set_wrap(view, false);
+    Measured = 0;
+    view_set_wrap(view, true);
+    view_paint(view, fake_draw, &canvas);
+    CHECK(Measured < LONG_LINE / 2 && view_top_line(view) == 1);
+
+    view_free(view);
+    document_free(document);
+}
+
+void test_view(void) {
+    test_moving();
+    test_click();
+    test_scrolling();
+    test_paint();
+    test_long_line();
+    test_wrapping();
+}